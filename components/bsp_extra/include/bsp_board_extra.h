@@ -25,10 +25,31 @@ extern "C" {
 #define CODEC_DEFAULT_CHANNEL               (2)
 #define CODEC_DEFAULT_VOLUME                (60)
 
+#define BSP_EXTRA_AUDIO_LAT_BUCKETS         (16)
+
 #define BSP_LCD_BACKLIGHT_BRIGHTNESS_MAX    (95)
 #define BSP_LCD_BACKLIGHT_BRIGHTNESS_MIN    (0)
 #define LCD_LEDC_CH                         (CONFIG_BSP_DISPLAY_BRIGHTNESS_LEDC_CH)
 
+/**
+ * @brief Audio output pipeline statistics
+ *
+ * Counters accumulate from codec init or the last bsp_extra_audio_stats_reset().
+ * Write latency bucket i counts bsp_extra_i2s_write() calls that took [2^i, 2^(i+1)) us,
+ * the last bucket also counts everything slower.
+ */
+typedef struct {
+    uint32_t underruns;                                  /*!< TX DMA ran out of data (I2S send queue overflow) */
+    uint32_t dma_buffers_sent;                           /*!< TX DMA buffers completed */
+    uint32_t write_calls;                                /*!< Calls to bsp_extra_i2s_write() */
+    uint32_t write_errors;                               /*!< Failed writes */
+    uint64_t bytes_written;                              /*!< Bytes handed to the codec */
+    uint32_t queued_bytes;                               /*!< Bytes written but not yet sent by DMA, at last write */
+    uint32_t queued_bytes_min;                           /*!< Lowest queue depth seen on entry of a write */
+    uint32_t write_us_max;                               /*!< Slowest write */
+    uint32_t write_us_hist[BSP_EXTRA_AUDIO_LAT_BUCKETS]; /*!< Write latency histogram, log2 us buckets */
+} bsp_extra_audio_stats_t;
+
 /**************************************************************************************************
  * BSP Extra interface
  * Mainly provided some I2S Codec interfaces.
@@ -36,6 +57,8 @@ extern "C" {
 /**
  * @brief Player set mute.
  *
+ * Mute ramps the software gain to zero, the volume is kept and restored on unmute.
+ *
  * @param enable: true or false
  *
  * @return
@@ -47,8 +70,11 @@ esp_err_t bsp_extra_codec_mute_set(bool enable);
 /**
  * @brief Player set volume.
  *
- * @param volume: volume set
- * @param volume_set: volume set response
+ * The volume is applied asynchronously by the volume control task, at most once every
+ * CONFIG_BSP_EXTRA_VOLUME_REFRESH_MS, with a click-free software ramp.
+ *
+ * @param volume: volume set, clamped to 0..100
+ * @param volume_set: volume set response, can be NULL if not needed
  *
  * @return
  *    - ESP_OK: Success
@@ -64,6 +90,34 @@ esp_err_t bsp_extra_codec_volume_set(int volume, int *volume_set);
  */
 int bsp_extra_codec_volume_get(void);
 
+/**
+ * @brief Mix a UI sound into the playback stream.
+ *
+ * The PCM data is added to the output after volume, so it is heard even while the stream is
+ * ramping or muted. It must match the current stream format (16 bits, same channel count) and
+ * stay valid until bsp_extra_ui_sound_is_playing() returns false. Mixing only happens while
+ * audio is being written. A new sound replaces the one still playing.
+ *
+ * @param pcm: Interleaved 16 bits PCM data
+ * @param samples: Sample count (frames * channels)
+ * @param volume: UI sound volume, 0..100
+ *
+ * @return
+ *    - ESP_OK: Success
+ *    - ESP_ERR_INVALID_STATE: Software volume not initialized
+ *    - Others: Fail
+ */
+esp_err_t bsp_extra_ui_sound_play(const int16_t *pcm, size_t samples, int volume);
+
+/**
+ * @brief Check if a UI sound is still being mixed.
+ *
+ * @return
+ *    - true: UI sound pending
+ *    - false: No UI sound pending
+ */
+bool bsp_extra_ui_sound_is_playing(void);
+
 /**
  * @brief Stop I2S function.
  *
@@ -124,6 +178,32 @@ esp_err_t bsp_extra_i2s_read(void *audio_buffer, size_t len, size_t *bytes_read,
 esp_err_t bsp_extra_i2s_write(void *audio_buffer, size_t len, size_t *bytes_written, uint32_t timeout_ms);
 
 
+/**
+ * @brief Get audio output pipeline statistics.
+ *
+ * @param stats: Filled with a snapshot of the counters
+ *
+ * @return
+ *    - ESP_OK: Success
+ *    - ESP_ERR_INVALID_ARG: stats is NULL
+ */
+esp_err_t bsp_extra_audio_get_stats(bsp_extra_audio_stats_t *stats);
+
+/**
+ * @brief Reset audio output pipeline statistics.
+ */
+void bsp_extra_audio_stats_reset(void);
+
+/**
+ * @brief Get the write latency below which a given fraction of writes completed.
+ *
+ * @param stats: Statistics snapshot
+ * @param percent: Percentile, 0..100
+ *
+ * @return Upper bound of the histogram bucket holding the percentile, in us. 0 if no writes.
+ */
+uint32_t bsp_extra_audio_stats_percentile(const bsp_extra_audio_stats_t *stats, int percent);
+
 /**
  * @brief Initialize codec play and record handle.
  *
@@ -156,6 +236,8 @@ esp_err_t bsp_extra_player_del(void);
 /**
  * @brief Initialize a file iterator instance
  *
+ * Lists the .mp3 and .wav files of the folder in natural order.
+ *
  * @param path The file path for the iterator.
  * @param ret_instance A pointer to the file iterator instance to be returned.
  * @return
@@ -10,6 +10,7 @@
 #include "esp_log.h"
 #include "esp_check.h"
 #include "esp_codec_dev_defaults.h"
+#include "esp_timer.h"
 #include "esp_err.h"
 #include "esp_log.h"
 #include "esp_vfs_fat.h"
@@ -17,6 +18,8 @@
 #include "driver/i2s_std.h"
 #include "driver/gpio.h"
 #include "driver/ledc.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 
 #include "bsp/esp-bsp.h"
 #include "bsp_board_extra.h"
@@ -29,6 +32,15 @@ static esp_codec_dev_handle_t record_dev_handle;
 static bool _is_audio_init = false;
 static bool _is_player_init = false;
 static int _vloume_intensity = CODEC_DEFAULT_VOLUME;
+static volatile bool _is_muted = false;
+
+static const audio_codec_vol_if_t *sw_vol_if = NULL;
+static TaskHandle_t vol_ctrl_task_handle = NULL;
+
+static bsp_extra_audio_stats_t audio_stats;
+static volatile uint32_t audio_bytes_sent; // Wraps, only differences with audio_bytes_queued are used
+static volatile uint32_t audio_bytes_queued;
+static portMUX_TYPE audio_stats_lock = portMUX_INITIALIZER_UNLOCKED;
 
 static audio_player_cb_t audio_idle_callback = NULL;
 static void *audio_idle_cb_user_data = NULL;
@@ -42,19 +54,50 @@ static char audio_file_path[128];
 
 static esp_err_t audio_mute_function(AUDIO_PLAYER_MUTE_SETTING setting)
 {
-    // Volume saved when muting and restored when unmuting. Restoring volume is necessary
-    // as es8311_set_voice_mute(true) results in voice volume (REG32) being set to zero.
-
-    bsp_extra_codec_mute_set(setting == AUDIO_PLAYER_MUTE ? true : false);
+    // Mute is a software gain ramp to zero, the saved volume is restored by the control task on unmute
+    return bsp_extra_codec_mute_set(setting == AUDIO_PLAYER_MUTE ? true : false);
+}
 
-    // restore the voice volume upon unmuting
-    if (setting == AUDIO_PLAYER_UNMUTE) {
-        ESP_RETURN_ON_ERROR(esp_codec_dev_set_out_vol(play_dev_handle, _vloume_intensity), TAG, "Set Codec volume failed");
+static float volume_to_db(int volume)
+{
+    // Same curve as the codec device default: 0 -> silence, 1..100 -> -50..0 dB
+    if (volume <= 0) {
+        return -96.0;
     }
+    return -50.0 + volume * 0.5;
+}
 
+static esp_err_t codec_apply_volume(void)
+{
+    int volume = _is_muted ? 0 : _vloume_intensity;
+    ESP_RETURN_ON_ERROR(esp_codec_dev_set_out_vol(play_dev_handle, volume), TAG, "Set Codec volume failed");
+    ESP_LOGD(TAG, "Volume applied: %d%s", _vloume_intensity, _is_muted ? " (muted)" : "");
     return ESP_OK;
 }
 
+/*
+ * Volume and mute requests only record the wanted state and wake this task, which applies the
+ * latest state at most once per refresh interval. A slider drag therefore costs one codec update
+ * per interval instead of one per LVGL event.
+ */
+static void vol_ctrl_task(void *arg)
+{
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        codec_apply_volume();
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_BSP_EXTRA_VOLUME_REFRESH_MS));
+    }
+}
+
+static esp_err_t codec_request_volume_update(void)
+{
+    if (vol_ctrl_task_handle) {
+        xTaskNotifyGive(vol_ctrl_task_handle);
+        return ESP_OK;
+    }
+    return codec_apply_volume();
+}
+
 static void audio_callback(audio_player_cb_ctx_t *ctx)
 {
     if (audio_idle_callback) {
@@ -63,19 +106,112 @@ static void audio_callback(audio_player_cb_ctx_t *ctx)
     }
 }
 
+static IRAM_ATTR bool i2s_tx_sent_cb(i2s_chan_handle_t handle, i2s_event_data_t *event, void *user_ctx)
+{
+    portENTER_CRITICAL_ISR(&audio_stats_lock);
+    audio_stats.dma_buffers_sent++;
+    audio_bytes_sent += event->size;
+    portEXIT_CRITICAL_ISR(&audio_stats_lock);
+    return false;
+}
+
+static IRAM_ATTR bool i2s_tx_underrun_cb(i2s_chan_handle_t handle, i2s_event_data_t *event, void *user_ctx)
+{
+    portENTER_CRITICAL_ISR(&audio_stats_lock);
+    audio_stats.underruns++;
+    // DMA is replaying cleared buffers, nothing written is left in the queue
+    audio_bytes_sent = audio_bytes_queued;
+    portEXIT_CRITICAL_ISR(&audio_stats_lock);
+    return false;
+}
+
+static uint32_t audio_queue_depth(void)
+{
+    int32_t depth = (int32_t)(audio_bytes_queued - audio_bytes_sent);
+    return depth > 0 ? depth : 0;
+}
+
+static void audio_stats_record_write(size_t len, uint32_t depth, uint32_t elapsed_us, bool ok)
+{
+    int bucket = 0;
+    while (bucket < BSP_EXTRA_AUDIO_LAT_BUCKETS - 1 && (elapsed_us >> (bucket + 1))) {
+        bucket++;
+    }
+
+    portENTER_CRITICAL(&audio_stats_lock);
+    audio_stats.write_calls++;
+    if (ok) {
+        audio_stats.bytes_written += len;
+        audio_bytes_queued += len;
+    } else {
+        audio_stats.write_errors++;
+    }
+    if (depth < audio_stats.queued_bytes_min) {
+        audio_stats.queued_bytes_min = depth;
+    }
+    audio_stats.queued_bytes = audio_queue_depth();
+    if (elapsed_us > audio_stats.write_us_max) {
+        audio_stats.write_us_max = elapsed_us;
+    }
+    audio_stats.write_us_hist[bucket]++;
+    portEXIT_CRITICAL(&audio_stats_lock);
+}
+
+esp_err_t bsp_extra_audio_get_stats(bsp_extra_audio_stats_t *stats)
+{
+    ESP_RETURN_ON_FALSE(stats, ESP_ERR_INVALID_ARG, TAG, "stats is NULL");
+
+    portENTER_CRITICAL(&audio_stats_lock);
+    *stats = audio_stats;
+    stats->queued_bytes = audio_queue_depth();
+    portEXIT_CRITICAL(&audio_stats_lock);
+    return ESP_OK;
+}
+
+void bsp_extra_audio_stats_reset(void)
+{
+    portENTER_CRITICAL(&audio_stats_lock);
+    memset(&audio_stats, 0, sizeof(audio_stats));
+    audio_stats.queued_bytes_min = UINT32_MAX;
+    portEXIT_CRITICAL(&audio_stats_lock);
+}
+
+uint32_t bsp_extra_audio_stats_percentile(const bsp_extra_audio_stats_t *stats, int percent)
+{
+    if (stats == NULL || stats->write_calls == 0) {
+        return 0;
+    }
+    uint64_t wanted = ((uint64_t)stats->write_calls * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (int i = 0; i < BSP_EXTRA_AUDIO_LAT_BUCKETS; i++) {
+        seen += stats->write_us_hist[i];
+        if (seen >= wanted) {
+            return i == BSP_EXTRA_AUDIO_LAT_BUCKETS - 1 ? stats->write_us_max : (2U << i);
+        }
+    }
+    return stats->write_us_max;
+}
+
 esp_err_t bsp_extra_i2s_read(void *audio_buffer, size_t len, size_t *bytes_read, uint32_t timeout_ms)
 {
     esp_err_t ret = ESP_OK;
     ret = esp_codec_dev_read(record_dev_handle, audio_buffer, len);
-    *bytes_read = len;
+    if (bytes_read) {
+        *bytes_read = (ret == ESP_OK) ? len : 0;
+    }
     return ret;
 }
 
 esp_err_t bsp_extra_i2s_write(void *audio_buffer, size_t len, size_t *bytes_written, uint32_t timeout_ms)
 {
     esp_err_t ret = ESP_OK;
+    uint32_t depth = audio_queue_depth();
+    int64_t start = esp_timer_get_time();
     ret = esp_codec_dev_write(play_dev_handle, audio_buffer, len);
-    *bytes_written = len;
+    audio_stats_record_write(len, depth, (uint32_t)(esp_timer_get_time() - start), ret == ESP_OK);
+    if (bytes_written) {
+        *bytes_written = (ret == ESP_OK) ? len : 0;
+    }
     return ret;
 }
 
@@ -108,12 +244,17 @@ esp_err_t bsp_extra_codec_set_fs(uint32_t rate, uint32_t bits_cfg, i2s_slot_mode
 
 esp_err_t bsp_extra_codec_volume_set(int volume, int *volume_set)
 {
-    ESP_RETURN_ON_ERROR(esp_codec_dev_set_out_vol(play_dev_handle, volume), TAG, "Set Codec volume failed");
+    if (volume < 0) {
+        volume = 0;
+    } else if (volume > 100) {
+        volume = 100;
+    }
     _vloume_intensity = volume;
+    if (volume_set) {
+        *volume_set = volume;
+    }
 
-    ESP_LOGI(TAG, "Setting volume: %d", volume);
-
-    return ESP_OK;
+    return codec_request_volume_update();
 }
 
 int bsp_extra_codec_volume_get(void)
@@ -123,9 +264,25 @@ int bsp_extra_codec_volume_get(void)
 
 esp_err_t bsp_extra_codec_mute_set(bool enable)
 {
-    esp_err_t ret = ESP_OK;
-    ret = esp_codec_dev_set_out_mute(play_dev_handle, enable);
-    return ret;
+    if (sw_vol_if == NULL) {
+        return esp_codec_dev_set_out_mute(play_dev_handle, enable);
+    }
+    _is_muted = enable;
+    return codec_request_volume_update();
+}
+
+esp_err_t bsp_extra_ui_sound_play(const int16_t *pcm, size_t samples, int volume)
+{
+    ESP_RETURN_ON_FALSE(sw_vol_if, ESP_ERR_INVALID_STATE, TAG, "Software volume not initialized");
+    ESP_RETURN_ON_FALSE(pcm || samples == 0, ESP_ERR_INVALID_ARG, TAG, "pcm is NULL");
+
+    int ret = audio_codec_sw_vol_mix(sw_vol_if, pcm, samples, volume_to_db(volume));
+    return ret == ESP_CODEC_DEV_OK ? ESP_OK : ESP_FAIL;
+}
+
+bool bsp_extra_ui_sound_is_playing(void)
+{
+    return sw_vol_if && audio_codec_sw_vol_mix_remain(sw_vol_if) > 0;
 }
 
 esp_err_t bsp_extra_codec_dev_stop(void)
@@ -159,8 +316,33 @@ esp_err_t bsp_extra_codec_init()
     record_dev_handle = bsp_audio_codec_microphone_init();
     assert((record_dev_handle) && "record_dev_handle not initialized");
 
+    // Volume in software keeps the ES8311 DAC register untouched, so volume changes cause no I2C traffic
+    sw_vol_if = audio_codec_new_sw_vol();
+    if (sw_vol_if == NULL || esp_codec_dev_set_vol_handler(play_dev_handle, sw_vol_if) != ESP_CODEC_DEV_OK) {
+        ESP_LOGW(TAG, "Software volume unavailable, using codec volume");
+        if (sw_vol_if) {
+            audio_codec_delete_vol_if(sw_vol_if);
+            sw_vol_if = NULL;
+        }
+    }
+
+    bsp_extra_audio_stats_reset();
+    const i2s_event_callbacks_t i2s_cbs = {
+        .on_sent = i2s_tx_sent_cb,
+        .on_send_q_ovf = i2s_tx_underrun_cb,
+    };
+    if (bsp_audio_register_tx_callbacks(&i2s_cbs, NULL) != ESP_OK) {
+        ESP_LOGW(TAG, "I2S TX callbacks not registered, underruns are not counted");
+    }
+
     bsp_extra_codec_set_fs(CODEC_DEFAULT_SAMPLE_RATE, CODEC_DEFAULT_BIT_WIDTH, CODEC_DEFAULT_CHANNEL);
 
+    BaseType_t res = xTaskCreate(vol_ctrl_task, "vol_ctrl", 3072, NULL, 4, &vol_ctrl_task_handle);
+    if (res != pdPASS) {
+        ESP_LOGW(TAG, "Volume control task not created, volume is applied synchronously");
+        vol_ctrl_task_handle = NULL;
+    }
+
     _is_audio_init = true;
 
     return ESP_OK;
@@ -199,7 +381,13 @@ esp_err_t bsp_extra_file_instance_init(const char *path, file_iterator_instance_
     ESP_RETURN_ON_FALSE(path, ESP_FAIL, TAG, "path is NULL");
     ESP_RETURN_ON_FALSE(ret_instance, ESP_FAIL, TAG, "ret_instance is NULL");
 
-    file_iterator_instance_t *file_iterator = file_iterator_new(path);
+    static const char *const audio_extensions[] = { ".mp3", ".wav", NULL };
+    const file_iterator_config_t scan_cfg = {
+        .extensions = audio_extensions,
+        .max_depth = 0,
+        .natural_sort = true,
+    };
+    file_iterator_instance_t *file_iterator = file_iterator_new_ex(path, &scan_cfg);
     ESP_RETURN_ON_FALSE(file_iterator, ESP_FAIL, TAG, "file_iterator_new failed, %s", path);
 
     *ret_instance = file_iterator;
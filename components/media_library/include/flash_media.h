@@ -0,0 +1,82 @@
+/*
+ * Flash media
+ *
+ * Clips packed into a data partition behind a small table of contents, played zero-copy from
+ * the memory mapped partition.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FLASH_MEDIA_DEFAULT_PARTITION   "storage"
+#define FLASH_MEDIA_NAME_MAX            (40)    // Including the terminator
+
+typedef struct flash_media_t *flash_media_handle_t;
+
+/**
+ * @brief Clip stored in the flash partition
+ */
+typedef struct {
+    const char *name;       /*!< Clip name from the partition table of contents */
+    const uint8_t *data;    /*!< Clip data, mapped into the address space */
+    size_t size;            /*!< Clip size in bytes */
+} flash_media_clip_t;
+
+/**
+ * @brief Map the clips of a data partition.
+ *
+ * The partition holds a table of contents followed by the clips, see scripts/pack_flash_media.py.
+ * Only the part of the partition used by clips is mapped, the data is read through the flash
+ * cache on access and never copied to RAM.
+ *
+ * @param partition_label: Partition label, e.g. FLASH_MEDIA_DEFAULT_PARTITION
+ * @param ret_media: Created handle
+ *
+ * @return
+ *    - ESP_OK: Success
+ *    - ESP_ERR_INVALID_ARG: NULL arguments
+ *    - ESP_ERR_NOT_FOUND: No such partition, or it holds no clips
+ *    - ESP_ERR_INVALID_SIZE: Table of contents points past the partition end
+ *    - ESP_ERR_NO_MEM: Out of memory or of mappable address space
+ */
+esp_err_t flash_media_open(const char *partition_label, flash_media_handle_t *ret_media);
+
+/**
+ * @brief Get the number of clips in the partition.
+ */
+size_t flash_media_count(flash_media_handle_t media);
+
+/**
+ * @brief Get a clip by position in the table of contents.
+ *
+ * @return
+ *    - ESP_OK: Success
+ *    - ESP_ERR_INVALID_ARG: NULL arguments or index out of range
+ */
+esp_err_t flash_media_get(flash_media_handle_t media, size_t index, flash_media_clip_t *clip);
+
+/**
+ * @brief Get a clip by name.
+ *
+ * @return
+ *    - ESP_OK: Success
+ *    - ESP_ERR_INVALID_ARG: NULL arguments
+ *    - ESP_ERR_NOT_FOUND: No clip with this name
+ */
+esp_err_t flash_media_find(flash_media_handle_t media, const char *name, flash_media_clip_t *clip);
+
+/**
+ * @brief Unmap the partition, clip data must not be used afterwards.
+ */
+void flash_media_close(flash_media_handle_t media);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,96 @@
+/*
+ * Media index
+ *
+ * Header info of the AVI files on the card, kept in one file keyed by path, size and mtime so
+ * a track start costs a stat() instead of a header parse.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "avi_player.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MEDIA_INDEX_DEFAULT_PATH    "/sdcard/.mediaindex"
+
+typedef struct media_index_t *media_index_handle_t;
+
+/**
+ * @brief Load the media index from the card.
+ *
+ * A missing, truncated or outdated index file gives an empty index, entries are then
+ * rebuilt on demand by media_index_get().
+ *
+ * @param index_path: Index file path, e.g. MEDIA_INDEX_DEFAULT_PATH
+ * @param ret_index: Created index handle
+ *
+ * @return
+ *    - ESP_OK: Success
+ *    - ESP_ERR_INVALID_ARG: NULL arguments
+ *    - ESP_ERR_NO_MEM: Out of memory
+ */
+esp_err_t media_index_load(const char *index_path, media_index_handle_t *ret_index);
+
+/**
+ * @brief Get the information of a media file.
+ *
+ * The cached entry is used when the file size and modification time still match,
+ * otherwise the file header is parsed again and the entry is updated.
+ *
+ * @param index: Index handle
+ * @param path: Media file path
+ * @param info: File information
+ *
+ * @return
+ *    - ESP_OK: Success
+ *    - ESP_ERR_NOT_FOUND: File does not exist
+ *    - Others: File header cannot be parsed, see avi_player_probe_file()
+ */
+esp_err_t media_index_get(media_index_handle_t index, const char *path, avi_player_file_info_t *info);
+
+/**
+ * @brief Mark a file as still part of the library, see media_index_prune().
+ *
+ * @param index: Index handle
+ * @param path: Media file path
+ */
+void media_index_keep(media_index_handle_t index, const char *path);
+
+/**
+ * @brief Drop the entries not marked with media_index_keep() since the last prune.
+ *
+ * @param index: Index handle
+ *
+ * @return Number of dropped entries
+ */
+size_t media_index_prune(media_index_handle_t index);
+
+/**
+ * @brief Get the number of entries in the index.
+ */
+size_t media_index_count(media_index_handle_t index);
+
+/**
+ * @brief Write the index back to the card if it changed since it was loaded or last saved.
+ *
+ * @param index: Index handle
+ *
+ * @return
+ *    - ESP_OK: Success or nothing to write
+ *    - ESP_FAIL: Index file cannot be written
+ */
+esp_err_t media_index_save(media_index_handle_t index);
+
+/**
+ * @brief Free the index, changes are not saved.
+ */
+void media_index_free(media_index_handle_t index);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,84 @@
+/*
+ * Thumbnail cache
+ *
+ * Poster frames of the videos on the card, decoded once and kept as RGB565 in a packed file
+ * with the most recently shown ones in PSRAM.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define THUMB_CACHE_DEFAULT_PATH    "/sdcard/.thumbs"
+
+typedef struct thumb_cache_t *thumb_cache_handle_t;
+
+/**
+ * @brief Thumbnail cache configuration
+ */
+typedef struct {
+    uint16_t width;         /*!< Thumbnail width, multiple of 8 */
+    uint16_t height;        /*!< Thumbnail height, multiple of 8 */
+    size_t lru_entries;     /*!< Thumbnails kept in PSRAM */
+} thumb_cache_config_t;
+
+/**
+ * @brief Open the thumbnail cache file.
+ *
+ * All thumbnails live in one packed file on the card, only its directory is loaded here.
+ * A missing or outdated file gives an empty cache, thumbnails are then made on demand.
+ *
+ * @param cache_path: Cache file path, e.g. THUMB_CACHE_DEFAULT_PATH
+ * @param config: Thumbnail size and PSRAM budget
+ * @param ret_cache: Created cache handle
+ *
+ * @return
+ *    - ESP_OK: Success
+ *    - ESP_ERR_INVALID_ARG: NULL arguments or size not a multiple of 8
+ *    - ESP_ERR_NO_MEM: Out of memory
+ */
+esp_err_t thumb_cache_open(const char *cache_path, const thumb_cache_config_t *config, thumb_cache_handle_t *ret_cache);
+
+/**
+ * @brief Get the thumbnail of a video as RGB565 pixels.
+ *
+ * Thumbnails come from PSRAM, else from the cache file. A video without a thumbnail, or
+ * changed since, gets one made: a frame about a tenth into the clip is located through the
+ * AVI index and decoded by the JPEG decoder straight to thumbnail size.
+ *
+ * @param cache: Cache handle
+ * @param path: Video file path
+ * @param pixels: Receives width * height RGB565 pixels
+ *
+ * @return
+ *    - ESP_OK: Success
+ *    - ESP_ERR_NOT_FOUND: Video does not exist
+ *    - ESP_ERR_NOT_SUPPORTED: No thumbnail can be made for this video, e.g. it is not MJPEG
+ */
+esp_err_t thumb_cache_get(thumb_cache_handle_t cache, const char *path, void *pixels);
+
+/**
+ * @brief Write the directory of new thumbnails to the cache file.
+ *
+ * The file is compacted when more than half of it is stale.
+ *
+ * @return
+ *    - ESP_OK: Success or nothing to write
+ *    - ESP_FAIL: Cache file cannot be written
+ */
+esp_err_t thumb_cache_save(thumb_cache_handle_t cache);
+
+/**
+ * @brief Free the cache, unsaved thumbnails are lost.
+ */
+void thumb_cache_close(thumb_cache_handle_t cache);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,131 @@
+/*
+ * Flash media
+ *
+ * The partition is mapped once up to the end of the last clip, clips are slices of that mapping.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_check.h"
+#include "esp_partition.h"
+#include "flash_media.h"
+
+static const char *TAG = "flash_media";
+
+#define FLASH_MEDIA_MAGIC       (0x50494C43) // "CLIP"
+#define FLASH_MEDIA_VERSION     (1)
+#define FLASH_MEDIA_MAX_CLIPS   (256)
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+} __attribute__((packed)) flash_media_head_t;
+
+/* Table of contents entry, offsets are from the partition start */
+typedef struct {
+    char name[FLASH_MEDIA_NAME_MAX];
+    uint32_t offset;
+    uint32_t size;
+} __attribute__((packed)) flash_media_entry_t;
+
+struct flash_media_t {
+    esp_partition_mmap_handle_t map_handle;
+    const uint8_t *base;
+    const flash_media_entry_t *entries;  // In the mapped table of contents
+    size_t count;
+};
+
+esp_err_t flash_media_open(const char *partition_label, flash_media_handle_t *ret_media)
+{
+    ESP_RETURN_ON_FALSE(partition_label && ret_media, ESP_ERR_INVALID_ARG, TAG, "NULL arguments");
+
+    const esp_partition_t *part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, partition_label);
+    ESP_RETURN_ON_FALSE(part, ESP_ERR_NOT_FOUND, TAG, "No partition %s", partition_label);
+
+    // Check the head with a plain read first, an erased partition is not worth mapping
+    flash_media_head_t head;
+    ESP_RETURN_ON_ERROR(esp_partition_read(part, 0, &head, sizeof(head)), TAG, "Read %s failed", partition_label);
+    if (head.magic != FLASH_MEDIA_MAGIC || head.version != FLASH_MEDIA_VERSION || head.count == 0) {
+        ESP_LOGI(TAG, "No clips in partition %s", partition_label);
+        return ESP_ERR_NOT_FOUND;
+    }
+    ESP_RETURN_ON_FALSE(head.count <= FLASH_MEDIA_MAX_CLIPS, ESP_ERR_INVALID_SIZE, TAG, "%u clips", head.count);
+
+    size_t toc_size = sizeof(head) + head.count * sizeof(flash_media_entry_t);
+    flash_media_entry_t *toc = malloc(head.count * sizeof(flash_media_entry_t));
+    ESP_RETURN_ON_FALSE(toc, ESP_ERR_NO_MEM, TAG, "no mem for table of contents");
+
+    esp_err_t ret = esp_partition_read(part, sizeof(head), toc, head.count * sizeof(flash_media_entry_t));
+    ESP_GOTO_ON_ERROR(ret, err, TAG, "Read table of contents failed");
+
+    size_t end = toc_size;
+    for (size_t i = 0; i < head.count; i++) {
+        const flash_media_entry_t *e = &toc[i];
+        ESP_GOTO_ON_FALSE(memchr(e->name, '\0', sizeof(e->name)) && e->offset >= toc_size &&
+                          e->offset <= part->size && e->size <= part->size - e->offset,
+                          ESP_ERR_INVALID_SIZE, err, TAG, "Invalid entry %u", i);
+        if (e->offset + e->size > end) {
+            end = e->offset + e->size;
+        }
+    }
+
+    struct flash_media_t *media = calloc(1, sizeof(struct flash_media_t));
+    ESP_GOTO_ON_FALSE(media, ESP_ERR_NO_MEM, err, TAG, "no mem for handle");
+
+    // Map only what the clips use, data address space is shared with PSRAM
+    const void *base = NULL;
+    ret = esp_partition_mmap(part, 0, end, ESP_PARTITION_MMAP_DATA, &base, &media->map_handle);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Map %u KB of %s failed: %s", end / 1024, partition_label, esp_err_to_name(ret));
+        free(media);
+        goto err;
+    }
+    media->base = base;
+    media->entries = (const flash_media_entry_t *)(media->base + sizeof(head));
+    media->count = head.count;
+    ESP_LOGI(TAG, "Mapped %u clips, %u KB of %s", media->count, end / 1024, partition_label);
+
+    *ret_media = media;
+err:
+    free(toc);
+    return ret;
+}
+
+size_t flash_media_count(flash_media_handle_t media)
+{
+    return media ? media->count : 0;
+}
+
+esp_err_t flash_media_get(flash_media_handle_t media, size_t index, flash_media_clip_t *clip)
+{
+    ESP_RETURN_ON_FALSE(media && clip, ESP_ERR_INVALID_ARG, TAG, "NULL arguments");
+    ESP_RETURN_ON_FALSE(index < media->count, ESP_ERR_INVALID_ARG, TAG, "index %u out of range", index);
+
+    const flash_media_entry_t *e = &media->entries[index];
+    clip->name = e->name;
+    clip->data = media->base + e->offset;
+    clip->size = e->size;
+    return ESP_OK;
+}
+
+esp_err_t flash_media_find(flash_media_handle_t media, const char *name, flash_media_clip_t *clip)
+{
+    ESP_RETURN_ON_FALSE(media && name && clip, ESP_ERR_INVALID_ARG, TAG, "NULL arguments");
+    for (size_t i = 0; i < media->count; i++) {
+        if (strcmp(media->entries[i].name, name) == 0) {
+            return flash_media_get(media, i, clip);
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+void flash_media_close(flash_media_handle_t media)
+{
+    if (!media) {
+        return;
+    }
+    esp_partition_munmap(media->map_handle);
+    free(media);
+}
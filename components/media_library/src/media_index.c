@@ -0,0 +1,323 @@
+/*
+ * Media index
+ *
+ * The index file is read in one go at load, and only rewritten by a save after entries changed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "esp_log.h"
+#include "esp_check.h"
+#include "esp_timer.h"
+#include "media_index.h"
+
+static const char *TAG = "media_index";
+
+#define MEDIA_INDEX_MAGIC       (0x5844494D) // "MIDX"
+#define MEDIA_INDEX_VERSION     (1)
+#define MEDIA_INDEX_PATH_MAX    (512)
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;   // sizeof(media_index_record_t), guards against layout changes
+    uint32_t count;
+} __attribute__((packed)) media_index_file_head_t;
+
+/* On card record, followed by path_len bytes of path without terminator */
+typedef struct {
+    uint32_t file_size;
+    int64_t mtime;
+    avi_player_file_info_t info;
+    uint16_t path_len;
+} __attribute__((packed)) media_index_record_t;
+
+typedef struct {
+    char *path;
+    uint32_t file_size;
+    int64_t mtime;
+    avi_player_file_info_t info;
+    bool keep;                      // Marked by media_index_keep()
+} media_index_entry_t;
+
+struct media_index_t {
+    char *index_path;
+    media_index_entry_t *entries;   // Sorted by path
+    size_t count;
+    size_t capacity;
+    bool dirty;
+};
+
+static int entry_cmp(const void *a, const void *b)
+{
+    return strcmp(((const media_index_entry_t *)a)->path, ((const media_index_entry_t *)b)->path);
+}
+
+/* Binary search, returns the entry position or where it has to be inserted */
+static size_t entry_find(const struct media_index_t *index, const char *path, bool *found)
+{
+    size_t lo = 0, hi = index->count;
+    *found = false;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        int c = strcmp(index->entries[mid].path, path);
+        if (c == 0) {
+            *found = true;
+            return mid;
+        }
+        if (c < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static esp_err_t entry_reserve(struct media_index_t *index, size_t count)
+{
+    if (count <= index->capacity) {
+        return ESP_OK;
+    }
+    size_t capacity = index->capacity ? index->capacity * 2 : 64;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    media_index_entry_t *entries = realloc(index->entries, capacity * sizeof(media_index_entry_t));
+    ESP_RETURN_ON_FALSE(entries, ESP_ERR_NO_MEM, TAG, "no mem for %u entries", capacity);
+    index->entries = entries;
+    index->capacity = capacity;
+    return ESP_OK;
+}
+
+static void index_parse(struct media_index_t *index, const uint8_t *data, size_t len)
+{
+    const media_index_file_head_t *head = (const media_index_file_head_t *)data;
+    if (len < sizeof(*head) || head->magic != MEDIA_INDEX_MAGIC || head->version != MEDIA_INDEX_VERSION ||
+            head->record_size != sizeof(media_index_record_t)) {
+        ESP_LOGW(TAG, "Index format changed, rebuilding");
+        return;
+    }
+    if (entry_reserve(index, head->count) != ESP_OK) {
+        return;
+    }
+
+    size_t pos = sizeof(*head);
+    for (uint32_t i = 0; i < head->count; i++) {
+        media_index_record_t rec;
+        if (len - pos < sizeof(rec)) {
+            break;
+        }
+        memcpy(&rec, data + pos, sizeof(rec));
+        pos += sizeof(rec);
+        if (rec.path_len == 0 || rec.path_len >= MEDIA_INDEX_PATH_MAX || len - pos < rec.path_len) {
+            break;
+        }
+        char *path = malloc(rec.path_len + 1);
+        if (!path) {
+            break;
+        }
+        memcpy(path, data + pos, rec.path_len);
+        path[rec.path_len] = '\0';
+        pos += rec.path_len;
+
+        media_index_entry_t *e = &index->entries[index->count++];
+        e->path = path;
+        e->file_size = rec.file_size;
+        e->mtime = rec.mtime;
+        e->info = rec.info;
+        e->keep = false;
+    }
+    if (index->count != head->count) {
+        ESP_LOGW(TAG, "Index truncated, %u of %u entries kept", index->count, head->count);
+        index->dirty = true;
+    }
+    // Saved sorted, sort anyway so a hand edited or foreign file cannot break lookups
+    qsort(index->entries, index->count, sizeof(media_index_entry_t), entry_cmp);
+}
+
+esp_err_t media_index_load(const char *index_path, media_index_handle_t *ret_index)
+{
+    ESP_RETURN_ON_FALSE(index_path && ret_index, ESP_ERR_INVALID_ARG, TAG, "NULL arguments");
+
+    struct media_index_t *index = calloc(1, sizeof(struct media_index_t));
+    ESP_RETURN_ON_FALSE(index, ESP_ERR_NO_MEM, TAG, "no mem for index");
+    index->index_path = strdup(index_path);
+    if (!index->index_path) {
+        free(index);
+        return ESP_ERR_NO_MEM;
+    }
+
+    int64_t start = esp_timer_get_time();
+    FILE *f = fopen(index_path, "rb");
+    if (f) {
+        struct stat st;
+        if (fstat(fileno(f), &st) == 0 && st.st_size > 0) {
+            uint8_t *data = malloc(st.st_size);
+            if (data && fread(data, 1, st.st_size, f) == (size_t)st.st_size) {
+                index_parse(index, data, st.st_size);
+            }
+            free(data);
+        }
+        fclose(f);
+    }
+    ESP_LOGI(TAG, "Loaded %u entries in %lld ms", index->count, (esp_timer_get_time() - start) / 1000);
+
+    *ret_index = index;
+    return ESP_OK;
+}
+
+esp_err_t media_index_get(media_index_handle_t index, const char *path, avi_player_file_info_t *info)
+{
+    ESP_RETURN_ON_FALSE(index && path && info, ESP_ERR_INVALID_ARG, TAG, "NULL arguments");
+    ESP_RETURN_ON_FALSE(strlen(path) < MEDIA_INDEX_PATH_MAX, ESP_ERR_INVALID_ARG, TAG, "path too long");
+
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    bool found;
+    size_t pos = entry_find(index, path, &found);
+    if (found) {
+        media_index_entry_t *e = &index->entries[pos];
+        if (e->file_size == (uint32_t)st.st_size && e->mtime == (int64_t)st.st_mtime) {
+            *info = e->info;
+            return ESP_OK;
+        }
+    }
+
+    int64_t start = esp_timer_get_time();
+    esp_err_t ret = avi_player_probe_file(path, info);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    ESP_LOGI(TAG, "Indexed %s in %lld ms", path, (esp_timer_get_time() - start) / 1000);
+
+    if (!found) {
+        char *dup = strdup(path);
+        if (!dup || entry_reserve(index, index->count + 1) != ESP_OK) {
+            free(dup);
+            return ESP_OK; // Info is valid, it is just not cached
+        }
+        memmove(&index->entries[pos + 1], &index->entries[pos], (index->count - pos) * sizeof(media_index_entry_t));
+        index->entries[pos].path = dup;
+        index->entries[pos].keep = false;
+        index->count++;
+    }
+    media_index_entry_t *e = &index->entries[pos];
+    e->file_size = st.st_size;
+    e->mtime = st.st_mtime;
+    e->info = *info;
+    index->dirty = true;
+    return ESP_OK;
+}
+
+void media_index_keep(media_index_handle_t index, const char *path)
+{
+    if (!index || !path) {
+        return;
+    }
+    bool found;
+    size_t pos = entry_find(index, path, &found);
+    if (found) {
+        index->entries[pos].keep = true;
+    }
+}
+
+size_t media_index_prune(media_index_handle_t index)
+{
+    if (!index) {
+        return 0;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < index->count; i++) {
+        if (index->entries[i].keep) {
+            index->entries[i].keep = false;
+            index->entries[n++] = index->entries[i];
+        } else {
+            free(index->entries[i].path);
+        }
+    }
+
+    size_t dropped = index->count - n;
+    index->count = n;
+    if (dropped) {
+        ESP_LOGI(TAG, "Dropped %u stale entries", dropped);
+        index->dirty = true;
+    }
+    return dropped;
+}
+
+size_t media_index_count(media_index_handle_t index)
+{
+    return index ? index->count : 0;
+}
+
+esp_err_t media_index_save(media_index_handle_t index)
+{
+    ESP_RETURN_ON_FALSE(index, ESP_ERR_INVALID_ARG, TAG, "NULL arguments");
+    if (!index->dirty) {
+        return ESP_OK;
+    }
+
+    // Write a temporary file first so a power loss never leaves a half written index
+    size_t len = strlen(index->index_path);
+    char *tmp_path = malloc(len + 5);
+    ESP_RETURN_ON_FALSE(tmp_path, ESP_ERR_NO_MEM, TAG, "no mem");
+    sprintf(tmp_path, "%s.tmp", index->index_path);
+
+    esp_err_t ret = ESP_OK;
+    FILE *f = fopen(tmp_path, "wb");
+    ESP_GOTO_ON_FALSE(f, ESP_FAIL, err, TAG, "Cannot create %s", tmp_path);
+
+    media_index_file_head_t head = {
+        .magic = MEDIA_INDEX_MAGIC,
+        .version = MEDIA_INDEX_VERSION,
+        .record_size = sizeof(media_index_record_t),
+        .count = index->count,
+    };
+    bool ok = fwrite(&head, sizeof(head), 1, f) == 1;
+    for (size_t i = 0; i < index->count && ok; i++) {
+        const media_index_entry_t *e = &index->entries[i];
+        media_index_record_t rec = {
+            .file_size = e->file_size,
+            .mtime = e->mtime,
+            .info = e->info,
+            .path_len = strlen(e->path),
+        };
+        ok = fwrite(&rec, sizeof(rec), 1, f) == 1 && fwrite(e->path, 1, rec.path_len, f) == rec.path_len;
+    }
+    ok = (fclose(f) == 0) && ok;
+    if (!ok) {
+        ESP_LOGE(TAG, "Write %s failed", tmp_path);
+        remove(tmp_path);
+        ret = ESP_FAIL;
+        goto err;
+    }
+
+    // FAT cannot rename over an existing file
+    remove(index->index_path);
+    ESP_GOTO_ON_FALSE(rename(tmp_path, index->index_path) == 0, ESP_FAIL, err, TAG, "Cannot rename %s", tmp_path);
+    index->dirty = false;
+    ESP_LOGI(TAG, "Saved %u entries", index->count);
+
+err:
+    free(tmp_path);
+    return ret;
+}
+
+void media_index_free(media_index_handle_t index)
+{
+    if (!index) {
+        return;
+    }
+    for (size_t i = 0; i < index->count; i++) {
+        free(index->entries[i].path);
+    }
+    free(index->entries);
+    free(index->index_path);
+    free(index);
+}
@@ -0,0 +1,607 @@
+/*
+ * Thumbnail cache
+ *
+ * A missing thumbnail is made from the keyframe nearest a tenth of the clip, found through idx1.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "esp_log.h"
+#include "esp_check.h"
+#include "esp_heap_caps.h"
+#include "esp_jpeg_dec.h"
+#include "avi_player.h"
+#include "avi_def.h"
+#include "thumb_cache.h"
+
+static const char *TAG = "thumb_cache";
+
+#define THUMB_CACHE_MAGIC       (0x424D4854) // "THMB"
+#define THUMB_CACHE_VERSION     (1)
+#define THUMB_CACHE_PATH_MAX    (512)
+#define THUMB_NONE              (0)          // Entry offset of a video no thumbnail can be made for
+#define THUMB_POSTER_DIV        (10)         // Poster frame at a tenth of the clip
+#define THUMB_IDX1_BATCH        (256)        // idx1 entries read at once
+#define THUMB_FRAME_MAX         (512 * 1024)
+#define THUMB_DC_ID             (0x63640000) // "##dc" in the upper half
+#define THUMB_AVIIF_KEYFRAME    (0x10)
+
+/*
+ * File layout: head, thumbnails of width * height RGB565 pixels, directory. New thumbnails are
+ * appended and the directory is written after them, the head is rewritten last so a power loss
+ * leaves the previous directory in place.
+ */
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t width;
+    uint16_t height;
+    uint16_t reserved;
+    uint32_t dir_offset;
+    uint32_t count;
+} __attribute__((packed)) thumb_file_head_t;
+
+/* Directory record, followed by path_len bytes of path without terminator */
+typedef struct {
+    uint32_t file_size;
+    int64_t mtime;
+    uint32_t offset;
+    uint16_t path_len;
+} __attribute__((packed)) thumb_record_t;
+
+typedef struct {
+    uint32_t ckid;
+    uint32_t flags;
+    uint32_t offset;
+    uint32_t size;
+} __attribute__((packed)) idx1_entry_t;
+
+typedef struct {
+    char *path;
+    uint32_t file_size;
+    int64_t mtime;
+    uint32_t offset;                // Thumbnail position in the cache file, THUMB_NONE if there is none
+} thumb_entry_t;
+
+typedef struct {
+    uint32_t offset;                // Thumbnail held, 0 if the slot is free
+    uint32_t used;
+    uint8_t *pixels;
+} thumb_slot_t;
+
+struct thumb_cache_t {
+    char *cache_path;
+    uint16_t width;
+    uint16_t height;
+    size_t thumb_size;
+    thumb_entry_t *entries;         // Sorted by path
+    size_t count;
+    size_t capacity;
+    bool dirty;
+    uint32_t file_end;              // Append position, 0 if the file has to be created
+    thumb_slot_t *slots;
+    size_t slot_count;
+    uint32_t tick;
+    uint8_t *decode_buf;            // Aligned for the JPEG decoder
+};
+
+static int entry_cmp(const void *a, const void *b)
+{
+    return strcmp(((const thumb_entry_t *)a)->path, ((const thumb_entry_t *)b)->path);
+}
+
+/* Binary search, returns the entry position or where it has to be inserted */
+static size_t entry_find(const struct thumb_cache_t *cache, const char *path, bool *found)
+{
+    size_t lo = 0, hi = cache->count;
+    *found = false;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        int c = strcmp(cache->entries[mid].path, path);
+        if (c == 0) {
+            *found = true;
+            return mid;
+        }
+        if (c < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static esp_err_t entry_reserve(struct thumb_cache_t *cache, size_t count)
+{
+    if (count <= cache->capacity) {
+        return ESP_OK;
+    }
+    size_t capacity = cache->capacity ? cache->capacity * 2 : 64;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    thumb_entry_t *entries = realloc(cache->entries, capacity * sizeof(thumb_entry_t));
+    ESP_RETURN_ON_FALSE(entries, ESP_ERR_NO_MEM, TAG, "no mem for %u entries", capacity);
+    cache->entries = entries;
+    cache->capacity = capacity;
+    return ESP_OK;
+}
+
+static bool slot_get(struct thumb_cache_t *cache, uint32_t offset, void *pixels)
+{
+    for (size_t i = 0; i < cache->slot_count; i++) {
+        thumb_slot_t *s = &cache->slots[i];
+        if (s->offset == offset) {
+            s->used = ++cache->tick;
+            memcpy(pixels, s->pixels, cache->thumb_size);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void slot_put(struct thumb_cache_t *cache, uint32_t offset, const void *pixels)
+{
+    thumb_slot_t *victim = NULL;
+    for (size_t i = 0; i < cache->slot_count; i++) {
+        thumb_slot_t *s = &cache->slots[i];
+        if (!victim || s->offset == 0 || s->used < victim->used) {
+            victim = s;
+            if (s->offset == 0) {
+                break;
+            }
+        }
+    }
+    if (!victim) {
+        return;
+    }
+    if (!victim->pixels) {
+        victim->pixels = heap_caps_malloc(cache->thumb_size, MALLOC_CAP_SPIRAM);
+        if (!victim->pixels) {
+            return;
+        }
+    }
+    memcpy(victim->pixels, pixels, cache->thumb_size);
+    victim->offset = offset;
+    victim->used = ++cache->tick;
+}
+
+static void slots_clear(struct thumb_cache_t *cache)
+{
+    for (size_t i = 0; i < cache->slot_count; i++) {
+        cache->slots[i].offset = 0;
+    }
+}
+
+static void dir_parse(struct thumb_cache_t *cache, const uint8_t *data, size_t len, uint32_t count)
+{
+    if (entry_reserve(cache, count) != ESP_OK) {
+        return;
+    }
+    size_t pos = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        thumb_record_t rec;
+        if (len - pos < sizeof(rec)) {
+            break;
+        }
+        memcpy(&rec, data + pos, sizeof(rec));
+        pos += sizeof(rec);
+        if (rec.path_len == 0 || rec.path_len >= THUMB_CACHE_PATH_MAX || len - pos < rec.path_len) {
+            break;
+        }
+        char *path = malloc(rec.path_len + 1);
+        if (!path) {
+            break;
+        }
+        memcpy(path, data + pos, rec.path_len);
+        path[rec.path_len] = '\0';
+        pos += rec.path_len;
+
+        thumb_entry_t *e = &cache->entries[cache->count++];
+        e->path = path;
+        e->file_size = rec.file_size;
+        e->mtime = rec.mtime;
+        e->offset = rec.offset;
+    }
+    if (cache->count != count) {
+        ESP_LOGW(TAG, "Directory truncated, %u of %u entries kept", cache->count, count);
+        cache->dirty = true;
+    }
+    qsort(cache->entries, cache->count, sizeof(thumb_entry_t), entry_cmp);
+}
+
+static void cache_load(struct thumb_cache_t *cache)
+{
+    FILE *f = fopen(cache->cache_path, "rb");
+    if (!f) {
+        return;
+    }
+    struct stat st;
+    thumb_file_head_t head;
+    if (fstat(fileno(f), &st) != 0 || fread(&head, sizeof(head), 1, f) != 1 || head.magic != THUMB_CACHE_MAGIC ||
+            head.version != THUMB_CACHE_VERSION || head.width != cache->width || head.height != cache->height ||
+            head.dir_offset > st.st_size) {
+        ESP_LOGW(TAG, "Cache format changed, rebuilding");
+        fclose(f);
+        return;
+    }
+
+    /*!< Anything after the directory is an unsaved thumbnail, it is overwritten */
+    size_t len = st.st_size - head.dir_offset;
+    cache->file_end = head.dir_offset ? st.st_size : sizeof(head);
+    if (head.count && len) {
+        uint8_t *data = malloc(len);
+        if (data && fseek(f, head.dir_offset, SEEK_SET) == 0 && fread(data, 1, len, f) == len) {
+            dir_parse(cache, data, len, head.count);
+        }
+        free(data);
+    }
+    fclose(f);
+}
+
+esp_err_t thumb_cache_open(const char *cache_path, const thumb_cache_config_t *config, thumb_cache_handle_t *ret_cache)
+{
+    ESP_RETURN_ON_FALSE(cache_path && config && ret_cache, ESP_ERR_INVALID_ARG, TAG, "NULL arguments");
+    ESP_RETURN_ON_FALSE(config->width && config->height && config->width % 8 == 0 && config->height % 8 == 0,
+                        ESP_ERR_INVALID_ARG, TAG, "thumbnail size must be a multiple of 8");
+
+    esp_err_t ret = ESP_OK;
+    struct thumb_cache_t *cache = calloc(1, sizeof(struct thumb_cache_t));
+    ESP_RETURN_ON_FALSE(cache, ESP_ERR_NO_MEM, TAG, "no mem for cache");
+    cache->width = config->width;
+    cache->height = config->height;
+    cache->thumb_size = config->width * config->height * 2;
+    cache->slot_count = config->lru_entries;
+    cache->cache_path = strdup(cache_path);
+    cache->slots = calloc(config->lru_entries ? config->lru_entries : 1, sizeof(thumb_slot_t));
+    cache->decode_buf = jpeg_calloc_align(cache->thumb_size, 16);
+    ESP_GOTO_ON_FALSE(cache->cache_path && cache->slots && cache->decode_buf, ESP_ERR_NO_MEM, err, TAG, "no mem for cache");
+
+    cache_load(cache);
+    ESP_LOGI(TAG, "Loaded %u entries", cache->count);
+    *ret_cache = cache;
+    return ESP_OK;
+
+err:
+    thumb_cache_close(cache);
+    return ret;
+}
+
+/* File offset of the chunk head of a video frame about a tenth into the clip, the first chunk without idx1 */
+static uint32_t poster_find(FILE *f, const avi_player_file_info_t *info)
+{
+    uint32_t entries = info->idx1_size / sizeof(idx1_entry_t);
+    idx1_entry_t *batch = malloc(THUMB_IDX1_BATCH * sizeof(idx1_entry_t));
+    if (!info->idx1_offset || entries == 0 || !batch) {
+        free(batch);
+        return info->movi_start;
+    }
+
+    uint32_t target = info->total_frames / THUMB_POSTER_DIV;
+    uint32_t video = 0;
+    uint32_t base = 0;
+    uint32_t fallback = info->movi_start;
+    for (uint32_t i = 0; i < entries;) {
+        uint32_t n = entries - i < THUMB_IDX1_BATCH ? entries - i : THUMB_IDX1_BATCH;
+        if (fseek(f, info->idx1_offset + i * sizeof(idx1_entry_t), SEEK_SET) != 0 ||
+                fread(batch, sizeof(idx1_entry_t), n, f) != n) {
+            break;
+        }
+        if (i == 0) {
+            /*!< Offsets count from the "movi" FourCC, some writers store file offsets instead */
+            base = batch[0].offset >= info->movi_start ? 0 : info->movi_start - 4;
+        }
+        for (uint32_t j = 0; j < n; j++) {
+            if ((batch[j].ckid & 0xFFFF0000) != THUMB_DC_ID || video++ < target) {
+                continue;
+            }
+            if (batch[j].flags & THUMB_AVIIF_KEYFRAME) {
+                free(batch);
+                return base + batch[j].offset;
+            }
+            if (fallback == info->movi_start) {
+                fallback = base + batch[j].offset;
+            }
+        }
+        i += n;
+    }
+    free(batch);
+    return fallback;
+}
+
+static esp_err_t thumb_decode(struct thumb_cache_t *cache, uint8_t *jpeg, size_t len, void *pixels)
+{
+    jpeg_dec_config_t config = DEFAULT_JPEG_DEC_CONFIG();
+    config.output_type = JPEG_PIXEL_FORMAT_RGB565_LE;
+    config.scale.width = cache->width;
+    config.scale.height = cache->height;
+
+    jpeg_dec_handle_t dec = NULL;
+    if (jpeg_dec_open(&config, &dec) != JPEG_ERR_OK) {
+        return ESP_ERR_NO_MEM;
+    }
+    jpeg_dec_io_t io = {
+        .inbuf = jpeg,
+        .inbuf_len = len,
+        .outbuf = cache->decode_buf,
+    };
+    jpeg_dec_header_info_t header;
+    int out_len = 0;
+    esp_err_t ret = ESP_ERR_NOT_SUPPORTED;
+    if (jpeg_dec_parse_header(dec, &io, &header) == JPEG_ERR_OK && jpeg_dec_get_outbuf_len(dec, &out_len) == JPEG_ERR_OK &&
+            out_len == cache->thumb_size && jpeg_dec_process(dec, &io) == JPEG_ERR_OK) {
+        memcpy(pixels, cache->decode_buf, cache->thumb_size);
+        ret = ESP_OK;
+    }
+    jpeg_dec_close(dec);
+    return ret;
+}
+
+static esp_err_t thumb_make(struct thumb_cache_t *cache, const char *path, void *pixels)
+{
+    avi_player_file_info_t info;
+    if (avi_player_probe_file(path, &info) != ESP_OK || info.video_format != FORMAT_MJEPG ||
+            info.width < cache->width || info.height < cache->height) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    esp_err_t ret = ESP_ERR_NOT_SUPPORTED;
+    uint8_t *jpeg = NULL;
+    AVI_CHUNK_HEAD head;
+    uint32_t pos = poster_find(f, &info);
+    if (fseek(f, pos, SEEK_SET) == 0 && fread(&head, sizeof(head), 1, f) == 1 &&
+            (head.FourCC & 0xFFFF0000) == THUMB_DC_ID && head.size > 0 && head.size <= THUMB_FRAME_MAX) {
+        jpeg = malloc(head.size);
+        if (jpeg && fread(jpeg, 1, head.size, f) == head.size) {
+            ret = thumb_decode(cache, jpeg, head.size, pixels);
+        }
+    }
+    free(jpeg);
+    fclose(f);
+    return ret;
+}
+
+/* Append a thumbnail to the cache file, returns its offset or THUMB_NONE */
+static uint32_t thumb_append(struct thumb_cache_t *cache, const void *pixels)
+{
+    FILE *f = fopen(cache->cache_path, cache->file_end ? "r+b" : "w+b");
+    if (!f) {
+        ESP_LOGE(TAG, "Cannot open %s", cache->cache_path);
+        return THUMB_NONE;
+    }
+    if (!cache->file_end) {
+        /*!< Empty head until the first save, the file then holds no entries */
+        thumb_file_head_t head = {
+            .magic = THUMB_CACHE_MAGIC,
+            .version = THUMB_CACHE_VERSION,
+            .width = cache->width,
+            .height = cache->height,
+        };
+        if (fwrite(&head, sizeof(head), 1, f) != 1) {
+            fclose(f);
+            return THUMB_NONE;
+        }
+        cache->file_end = sizeof(head);
+    }
+    uint32_t offset = cache->file_end;
+    bool ok = fseek(f, offset, SEEK_SET) == 0 && fwrite(pixels, 1, cache->thumb_size, f) == cache->thumb_size;
+    ok = (fclose(f) == 0) && ok;
+    if (!ok) {
+        return THUMB_NONE;
+    }
+    cache->file_end += cache->thumb_size;
+    return offset;
+}
+
+esp_err_t thumb_cache_get(thumb_cache_handle_t cache, const char *path, void *pixels)
+{
+    ESP_RETURN_ON_FALSE(cache && path && pixels, ESP_ERR_INVALID_ARG, TAG, "NULL arguments");
+    ESP_RETURN_ON_FALSE(strlen(path) < THUMB_CACHE_PATH_MAX, ESP_ERR_INVALID_ARG, TAG, "path too long");
+
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    bool found;
+    size_t pos = entry_find(cache, path, &found);
+    if (found && cache->entries[pos].file_size == (uint32_t)st.st_size && cache->entries[pos].mtime == (int64_t)st.st_mtime) {
+        uint32_t offset = cache->entries[pos].offset;
+        if (offset == THUMB_NONE) {
+            return ESP_ERR_NOT_SUPPORTED;
+        }
+        if (slot_get(cache, offset, pixels)) {
+            return ESP_OK;
+        }
+        FILE *f = fopen(cache->cache_path, "rb");
+        bool ok = f && fseek(f, offset, SEEK_SET) == 0 && fread(pixels, 1, cache->thumb_size, f) == cache->thumb_size;
+        if (f) {
+            fclose(f);
+        }
+        if (ok) {
+            slot_put(cache, offset, pixels);
+            return ESP_OK;
+        }
+        /*!< Unreadable, make it again */
+    }
+
+    esp_err_t ret = thumb_make(cache, path, pixels);
+    if (ret == ESP_ERR_NOT_FOUND || ret == ESP_ERR_NO_MEM) {
+        return ret; // Not worth remembering
+    }
+    uint32_t offset = THUMB_NONE;
+    if (ret == ESP_OK) {
+        offset = thumb_append(cache, pixels);
+        if (offset == THUMB_NONE) {
+            return ESP_OK; // Thumbnail is valid, it is just not cached
+        }
+        slot_put(cache, offset, pixels);
+    }
+
+    if (!found) {
+        char *dup = strdup(path);
+        if (!dup || entry_reserve(cache, cache->count + 1) != ESP_OK) {
+            free(dup);
+            return ret;
+        }
+        memmove(&cache->entries[pos + 1], &cache->entries[pos], (cache->count - pos) * sizeof(thumb_entry_t));
+        cache->entries[pos].path = dup;
+        cache->count++;
+    }
+    thumb_entry_t *e = &cache->entries[pos];
+    e->file_size = st.st_size;
+    e->mtime = st.st_mtime;
+    e->offset = offset;
+    cache->dirty = true;
+    return ret;
+}
+
+static bool dir_write(const struct thumb_cache_t *cache, const uint32_t *offsets, FILE *f)
+{
+    for (size_t i = 0; i < cache->count; i++) {
+        const thumb_entry_t *e = &cache->entries[i];
+        thumb_record_t rec = {
+            .file_size = e->file_size,
+            .mtime = e->mtime,
+            .offset = offsets ? offsets[i] : e->offset,
+            .path_len = strlen(e->path),
+        };
+        if (fwrite(&rec, sizeof(rec), 1, f) != 1 || fwrite(e->path, 1, rec.path_len, f) != rec.path_len) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool head_write(const struct thumb_cache_t *cache, uint32_t dir_offset, FILE *f)
+{
+    thumb_file_head_t head = {
+        .magic = THUMB_CACHE_MAGIC,
+        .version = THUMB_CACHE_VERSION,
+        .width = cache->width,
+        .height = cache->height,
+        .dir_offset = dir_offset,
+        .count = cache->count,
+    };
+    return fseek(f, 0, SEEK_SET) == 0 && fwrite(&head, sizeof(head), 1, f) == 1;
+}
+
+/* Copy the live thumbnails to a new file, dropping replaced thumbnails and old directories */
+static esp_err_t cache_compact(struct thumb_cache_t *cache)
+{
+    size_t len = strlen(cache->cache_path);
+    char *tmp_path = malloc(len + 5);
+    uint32_t *offsets = malloc((cache->count ? cache->count : 1) * sizeof(uint32_t));
+    uint8_t *pixels = heap_caps_malloc(cache->thumb_size, MALLOC_CAP_SPIRAM);
+    FILE *in = NULL, *out = NULL;
+    esp_err_t ret = ESP_OK;
+    ESP_GOTO_ON_FALSE(tmp_path && offsets && pixels, ESP_ERR_NO_MEM, err, TAG, "no mem");
+    sprintf(tmp_path, "%s.tmp", cache->cache_path);
+
+    in = fopen(cache->cache_path, "rb");
+    out = fopen(tmp_path, "w+b");
+    ESP_GOTO_ON_FALSE(in && out, ESP_FAIL, err, TAG, "Cannot open cache files");
+
+    uint32_t pos = sizeof(thumb_file_head_t);
+    bool ok = head_write(cache, 0, out);
+    for (size_t i = 0; i < cache->count && ok; i++) {
+        offsets[i] = THUMB_NONE;
+        if (cache->entries[i].offset == THUMB_NONE) {
+            continue;
+        }
+        ok = fseek(in, cache->entries[i].offset, SEEK_SET) == 0 && fread(pixels, 1, cache->thumb_size, in) == cache->thumb_size &&
+             fwrite(pixels, 1, cache->thumb_size, out) == cache->thumb_size;
+        offsets[i] = pos;
+        pos += cache->thumb_size;
+    }
+    ok = ok && dir_write(cache, offsets, out) && head_write(cache, pos, out);
+    ok = (fclose(out) == 0) && ok;
+    out = NULL;
+    fclose(in);
+    in = NULL;
+    if (!ok) {
+        ESP_LOGE(TAG, "Write %s failed", tmp_path);
+        remove(tmp_path);
+        ret = ESP_FAIL;
+        goto err;
+    }
+
+    // FAT cannot rename over an existing file
+    remove(cache->cache_path);
+    ESP_GOTO_ON_FALSE(rename(tmp_path, cache->cache_path) == 0, ESP_FAIL, err, TAG, "Cannot rename %s", tmp_path);
+    for (size_t i = 0; i < cache->count; i++) {
+        cache->entries[i].offset = offsets[i];
+    }
+    slots_clear(cache);
+    cache->file_end = pos;
+    cache->dirty = false;
+    ESP_LOGI(TAG, "Compacted to %u entries", cache->count);
+
+err:
+    if (in) {
+        fclose(in);
+    }
+    if (out) {
+        fclose(out);
+    }
+    free(tmp_path);
+    free(offsets);
+    heap_caps_free(pixels);
+    return ret;
+}
+
+esp_err_t thumb_cache_save(thumb_cache_handle_t cache)
+{
+    ESP_RETURN_ON_FALSE(cache, ESP_ERR_INVALID_ARG, TAG, "NULL arguments");
+    if (!cache->dirty) {
+        return ESP_OK;
+    }
+
+    size_t live = 0;
+    for (size_t i = 0; i < cache->count; i++) {
+        live += cache->entries[i].offset != THUMB_NONE ? cache->thumb_size : 0;
+    }
+    size_t stale = cache->file_end > sizeof(thumb_file_head_t) + live ? cache->file_end - sizeof(thumb_file_head_t) - live : 0;
+    if (stale > live && stale > 4 * cache->thumb_size) {
+        return cache_compact(cache);
+    }
+
+    FILE *f = fopen(cache->cache_path, cache->file_end ? "r+b" : "w+b");
+    ESP_RETURN_ON_FALSE(f, ESP_FAIL, TAG, "Cannot open %s", cache->cache_path);
+    uint32_t dir_offset = cache->file_end ? cache->file_end : sizeof(thumb_file_head_t);
+    bool ok = fseek(f, dir_offset, SEEK_SET) == 0 && dir_write(cache, NULL, f) && fflush(f) == 0;
+    long end = ftell(f);
+    ok = ok && head_write(cache, dir_offset, f);
+    ok = (fclose(f) == 0) && ok;
+    ESP_RETURN_ON_FALSE(ok, ESP_FAIL, TAG, "Write %s failed", cache->cache_path);
+
+    // The directory stays in place until the next save appends after it
+    cache->file_end = end;
+    cache->dirty = false;
+    ESP_LOGI(TAG, "Saved %u entries", cache->count);
+    return ESP_OK;
+}
+
+void thumb_cache_close(thumb_cache_handle_t cache)
+{
+    if (!cache) {
+        return;
+    }
+    for (size_t i = 0; i < cache->count; i++) {
+        free(cache->entries[i].path);
+    }
+    for (size_t i = 0; cache->slots && i < cache->slot_count; i++) {
+        heap_caps_free(cache->slots[i].pixels);
+    }
+    free(cache->entries);
+    free(cache->slots);
+    free(cache->cache_path);
+    jpeg_free_align(cache->decode_buf);
+    free(cache);
+}
@@ -0,0 +1,118 @@
+/*
+ * BOOT button gestures
+ */
+
+#include <stdbool.h>
+#include "esp_log.h"
+#include "esp_check.h"
+#include "esp_timer.h"
+#include "esp_attr.h"
+#include "boot_button.h"
+
+static const char *TAG = "boot_button";
+
+/*
+ * An edge only disables the pin interrupt and arms the debounce timer. The timer callbacks
+ * all run in the esp_timer task, so the gesture state below needs no locking.
+ */
+static struct {
+    gpio_num_t gpio;
+    boot_button_cb_t cb;
+    void *user_data;
+    esp_timer_handle_t debounce;
+    esp_timer_handle_t click;       // Double press window after a release
+    esp_timer_handle_t hold;        // Long press
+    bool pressed;
+    bool long_fired;                // The current press was reported as long
+    int clicks;
+} button = {
+    .gpio = GPIO_NUM_NC,
+};
+
+static void IRAM_ATTR button_isr(void *arg)
+{
+    gpio_intr_disable(button.gpio);
+    esp_timer_start_once(button.debounce, BOOT_BUTTON_DEBOUNCE_MS * 1000);
+}
+
+static void button_debounce_cb(void *arg)
+{
+    // Enabled before sampling, an edge in between arms the debounce again
+    gpio_intr_enable(button.gpio);
+    bool pressed = gpio_get_level(button.gpio) == 0;
+    if (pressed == button.pressed) {
+        return; // Bounce
+    }
+    button.pressed = pressed;
+
+    if (pressed) {
+        esp_timer_start_once(button.hold, BOOT_BUTTON_LONG_MS * 1000);
+        return;
+    }
+    esp_timer_stop(button.hold);
+    if (button.long_fired) {
+        button.long_fired = false;
+        return;
+    }
+    if (++button.clicks == 2) {
+        esp_timer_stop(button.click);
+        button.clicks = 0;
+        button.cb(BOOT_BUTTON_DOUBLE, button.user_data);
+    } else {
+        esp_timer_start_once(button.click, BOOT_BUTTON_DOUBLE_MS * 1000);
+    }
+}
+
+/* The window closes even while a second press is held, that press then starts a gesture of its own */
+static void button_click_cb(void *arg)
+{
+    if (button.clicks == 1) {
+        button.clicks = 0;
+        button.cb(BOOT_BUTTON_SINGLE, button.user_data);
+    }
+}
+
+static void button_hold_cb(void *arg)
+{
+    if (!button.pressed) {
+        return;
+    }
+    button.long_fired = true;
+    button.clicks = 0;
+    esp_timer_stop(button.click);
+    button.cb(BOOT_BUTTON_LONG, button.user_data);
+}
+
+esp_err_t boot_button_init(gpio_num_t gpio, boot_button_cb_t cb, void *user_data)
+{
+    ESP_RETURN_ON_FALSE(cb, ESP_ERR_INVALID_ARG, TAG, "NULL callback");
+    ESP_RETURN_ON_FALSE(button.gpio == GPIO_NUM_NC, ESP_ERR_INVALID_STATE, TAG, "Already started");
+
+    const esp_timer_create_args_t timers[] = {
+        { .callback = button_debounce_cb, .dispatch_method = ESP_TIMER_TASK, .name = "btn_debounce" },
+        { .callback = button_click_cb, .dispatch_method = ESP_TIMER_TASK, .name = "btn_click" },
+        { .callback = button_hold_cb, .dispatch_method = ESP_TIMER_TASK, .name = "btn_hold" },
+    };
+    esp_timer_handle_t *handles[] = { &button.debounce, &button.click, &button.hold };
+    for (int i = 0; i < 3; i++) {
+        ESP_RETURN_ON_ERROR(esp_timer_create(&timers[i], handles[i]), TAG, "Timer create failed");
+    }
+
+    button.cb = cb;
+    button.user_data = user_data;
+    button.gpio = gpio;
+    const gpio_config_t io_cfg = {
+        .pin_bit_mask = BIT64(gpio),
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_ENABLE,
+        .intr_type = GPIO_INTR_ANYEDGE,
+    };
+    ESP_RETURN_ON_ERROR(gpio_config(&io_cfg), TAG, "GPIO config failed");
+
+    // The touch driver may have installed the ISR service already
+    esp_err_t ret = gpio_install_isr_service(0);
+    ESP_RETURN_ON_FALSE(ret == ESP_OK || ret == ESP_ERR_INVALID_STATE, ret, TAG, "GPIO ISR install failed");
+    ESP_RETURN_ON_ERROR(gpio_isr_handler_add(gpio, button_isr, NULL), TAG, "GPIO ISR add failed");
+    button.pressed = gpio_get_level(gpio) == 0;
+    return ESP_OK;
+}
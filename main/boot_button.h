@@ -0,0 +1,47 @@
+/*
+ * BOOT button gestures
+ *
+ * Single, double and long presses recognized from GPIO interrupts and esp_timer one shots,
+ * nothing runs while the button is left alone.
+ */
+
+#pragma once
+
+#include "esp_err.h"
+#include "driver/gpio.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BOOT_BUTTON_DEBOUNCE_MS     (20)
+#define BOOT_BUTTON_DOUBLE_MS       (300)   // Release to release window of a double press
+#define BOOT_BUTTON_LONG_MS         (1000)
+
+typedef enum {
+    BOOT_BUTTON_SINGLE,     /*!< Reported once the double press window passed */
+    BOOT_BUTTON_DOUBLE,
+    BOOT_BUTTON_LONG,       /*!< Reported while still held, the release is ignored */
+} boot_button_gesture_t;
+
+/**
+ * @brief Called from the esp_timer task, keep it short.
+ */
+typedef void (*boot_button_cb_t)(boot_button_gesture_t gesture, void *user_data);
+
+/**
+ * @brief Start recognizing gestures of an active low button.
+ *
+ * @param gpio: Button pin, pulled up here
+ * @param cb: Gesture callback
+ *
+ * @return
+ *    - ESP_OK: Success
+ *    - ESP_ERR_INVALID_STATE: Already started
+ *    - Others: GPIO or timer setup failed
+ */
+esp_err_t boot_button_init(gpio_num_t gpio, boot_button_cb_t cb, void *user_data);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,138 @@
+/*
+ * Buffer placement
+ *
+ * Every buffer carries a small header in front of it with its size, owner and pool, so it
+ * can be freed and accounted without the caller keeping track.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "buf_pool.h"
+
+static const char *TAG = "buf_pool";
+
+#define BUF_POOL_ALIGN              (16)            // The JPEG decoder wants 16 byte aligned buffers
+#define BUF_POOL_INTERNAL_RESERVE   (48 * 1024)     // Internal RAM kept free for stacks, drivers and LVGL
+#define KB                          (1024)
+
+typedef struct {
+    uint32_t size;
+    uint8_t owner;
+    uint8_t pool;
+} buf_head_t;
+
+_Static_assert(sizeof(buf_head_t) <= BUF_POOL_ALIGN, "buffer header must fit the alignment");
+
+static const uint32_t pool_caps[BUF_POOL_MAX] = {
+    [BUF_POOL_INTERNAL_DMA] = MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA,
+    [BUF_POOL_INTERNAL_FAST] = MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT,
+    [BUF_POOL_PSRAM_BULK] = MALLOC_CAP_SPIRAM,
+};
+
+static const char *const pool_names[BUF_POOL_MAX] = { "internal-dma", "internal-fast", "psram-bulk" };
+static const char *const owner_names[BUF_OWNER_MAX] = { "player", "decoder", "frame_cache", "browser" };
+
+/* Bytes a subsystem may hold in each pool, internal RAM goes to what is touched every frame */
+static const size_t budgets[BUF_OWNER_MAX][BUF_POOL_MAX] = {
+    [BUF_OWNER_PLAYER] = { 64 * KB, 32 * KB, SIZE_MAX },
+    [BUF_OWNER_DECODER] = { 0, 0, SIZE_MAX },
+    [BUF_OWNER_FRAME_CACHE] = { 0, 0, SIZE_MAX },
+    [BUF_OWNER_BROWSER] = { 0, 0, SIZE_MAX },
+};
+
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static size_t used[BUF_OWNER_MAX][BUF_POOL_MAX];
+static size_t peak[BUF_OWNER_MAX][BUF_POOL_MAX];
+
+/* Count size against the owner's budget, false if it does not fit */
+static bool budget_take(buf_owner_t owner, buf_pool_t pool, size_t size)
+{
+    bool ok;
+    portENTER_CRITICAL(&stats_lock);
+    ok = size <= budgets[owner][pool] - used[owner][pool];
+    if (ok) {
+        used[owner][pool] += size;
+        if (used[owner][pool] > peak[owner][pool]) {
+            peak[owner][pool] = used[owner][pool];
+        }
+    }
+    portEXIT_CRITICAL(&stats_lock);
+    return ok;
+}
+
+static void budget_give(buf_owner_t owner, buf_pool_t pool, size_t size)
+{
+    portENTER_CRITICAL(&stats_lock);
+    used[owner][pool] -= size;
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+static void *pool_alloc(buf_owner_t owner, buf_pool_t pool, size_t size)
+{
+    if (pool != BUF_POOL_PSRAM_BULK &&
+            heap_caps_get_largest_free_block(pool_caps[pool]) < size + BUF_POOL_ALIGN + BUF_POOL_INTERNAL_RESERVE) {
+        return NULL;
+    }
+    if (!budget_take(owner, pool, size)) {
+        return NULL;
+    }
+    buf_head_t *head = heap_caps_aligned_alloc(BUF_POOL_ALIGN, size + BUF_POOL_ALIGN, pool_caps[pool]);
+    if (!head) {
+        budget_give(owner, pool, size);
+        return NULL;
+    }
+    head->size = size;
+    head->owner = owner;
+    head->pool = pool;
+    return (uint8_t *)head + BUF_POOL_ALIGN;
+}
+
+void *buf_pool_alloc(buf_owner_t owner, buf_access_t access, size_t size)
+{
+    if (owner >= BUF_OWNER_MAX || size == 0) {
+        return NULL;
+    }
+    void *ptr = NULL;
+    if (access == BUF_ACCESS_DMA) {
+        ptr = pool_alloc(owner, BUF_POOL_INTERNAL_DMA, size);
+    } else if (access == BUF_ACCESS_HOT) {
+        ptr = pool_alloc(owner, BUF_POOL_INTERNAL_FAST, size);
+    }
+    if (!ptr) {
+        // Also the next tier of the others, slower but it works. DMA goes through a bounce buffer then
+        ptr = pool_alloc(owner, BUF_POOL_PSRAM_BULK, size);
+    }
+    if (!ptr) {
+        ESP_LOGW(TAG, "No pool for %u bytes of %s", size, owner_names[owner]);
+    }
+    return ptr;
+}
+
+void buf_pool_free(void *ptr)
+{
+    if (!ptr) {
+        return;
+    }
+    buf_head_t *head = (buf_head_t *)((uint8_t *)ptr - BUF_POOL_ALIGN);
+    budget_give(head->owner, head->pool, head->size);
+    heap_caps_free(head);
+}
+
+void buf_pool_log_stats(void)
+{
+    for (int p = 0; p < BUF_POOL_MAX; p++) {
+        ESP_LOGI(TAG, "%s: %u KB free, lowest %u KB", pool_names[p],
+                 heap_caps_get_free_size(pool_caps[p]) / KB, heap_caps_get_minimum_free_size(pool_caps[p]) / KB);
+        for (int o = 0; o < BUF_OWNER_MAX; o++) {
+            portENTER_CRITICAL(&stats_lock);
+            size_t u = used[o][p], hw = peak[o][p];
+            portEXIT_CRITICAL(&stats_lock);
+            if (hw) {
+                ESP_LOGI(TAG, "  %s: %u KB, high-water %u KB", owner_names[o], u / KB, hw / KB);
+            }
+        }
+    }
+}
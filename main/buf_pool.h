@@ -0,0 +1,60 @@
+/*
+ * Buffer placement
+ *
+ * Buffers are placed by how they are accessed rather than by where they happened to be
+ * allocated: DMA targets in internal DMA RAM, buffers the CPU touches every frame in
+ * internal RAM, and large streamed data in PSRAM. Each subsystem has a budget per pool.
+ * A buffer that does not fit its budget, or would leave too little internal RAM, drops
+ * to PSRAM.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    BUF_POOL_INTERNAL_DMA,      /*!< Internal RAM reachable by DMA */
+    BUF_POOL_INTERNAL_FAST,     /*!< Internal RAM, no cache misses */
+    BUF_POOL_PSRAM_BULK,        /*!< Octal PSRAM behind the cache */
+    BUF_POOL_MAX,
+} buf_pool_t;
+
+typedef enum {
+    BUF_ACCESS_DMA,             /*!< Filled or drained by a peripheral */
+    BUF_ACCESS_HOT,             /*!< Read or written by the CPU for every frame */
+    BUF_ACCESS_BULK,            /*!< Large, streamed through once or rarely touched */
+} buf_access_t;
+
+typedef enum {
+    BUF_OWNER_PLAYER,           /*!< AVI player: chunk buffers, read ring, prefetch */
+    BUF_OWNER_DECODER,          /*!< JPEG output canvases */
+    BUF_OWNER_FRAME_CACHE,
+    BUF_OWNER_BROWSER,
+    BUF_OWNER_MAX,
+} buf_owner_t;
+
+/**
+ * @brief Allocate a buffer for a subsystem, placed by its access pattern.
+ *
+ * @return 16 byte aligned buffer, NULL if no pool could hold it
+ */
+void *buf_pool_alloc(buf_owner_t owner, buf_access_t access, size_t size);
+
+/**
+ * @brief Free a buffer of buf_pool_alloc(), NULL is ignored.
+ */
+void buf_pool_free(void *ptr);
+
+/**
+ * @brief Log the bytes held and the high-water mark of each subsystem in each pool, and the
+ *        free and lowest free size of the pools.
+ */
+void buf_pool_log_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,191 @@
+/*
+ * Decoded video frame cache
+ *
+ * Entries sit in a hash table for lookup and in a doubly linked list in use order,
+ * the head being the most recently used frame.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_check.h"
+#include "esp_heap_caps.h"
+#include "frame_cache.h"
+#include "buf_pool.h"
+
+static const char *TAG = "frame_cache";
+
+#define FRAME_CACHE_BUCKETS         (256)
+#define FRAME_CACHE_PSRAM_RESERVE   (512 * 1024) // Left free for the player and LVGL
+
+typedef struct frame_entry {
+    uint32_t clip_id;
+    uint32_t frame;
+    size_t len;
+    uint8_t *pixels;
+    struct frame_entry *prev;   // Towards most recently used
+    struct frame_entry *next;   // Towards least recently used
+    struct frame_entry *hnext;  // Next in hash bucket
+} frame_entry_t;
+
+struct frame_cache_t {
+    size_t budget;
+    size_t used;
+    uint32_t frames;
+    uint32_t hits;
+    frame_entry_t *head;
+    frame_entry_t *tail;
+    frame_entry_t *buckets[FRAME_CACHE_BUCKETS];
+};
+
+static inline uint32_t bucket_of(uint32_t clip_id, uint32_t frame)
+{
+    return (clip_id * 31 + frame) % FRAME_CACHE_BUCKETS;
+}
+
+static void lru_unlink(struct frame_cache_t *cache, frame_entry_t *e)
+{
+    if (e->prev) {
+        e->prev->next = e->next;
+    } else {
+        cache->head = e->next;
+    }
+    if (e->next) {
+        e->next->prev = e->prev;
+    } else {
+        cache->tail = e->prev;
+    }
+    e->prev = e->next = NULL;
+}
+
+static void lru_push_front(struct frame_cache_t *cache, frame_entry_t *e)
+{
+    e->prev = NULL;
+    e->next = cache->head;
+    if (cache->head) {
+        cache->head->prev = e;
+    }
+    cache->head = e;
+    if (!cache->tail) {
+        cache->tail = e;
+    }
+}
+
+static void entry_free(struct frame_cache_t *cache, frame_entry_t *e)
+{
+    frame_entry_t **p = &cache->buckets[bucket_of(e->clip_id, e->frame)];
+    while (*p && *p != e) {
+        p = &(*p)->hnext;
+    }
+    if (*p) {
+        *p = e->hnext;
+    }
+    lru_unlink(cache, e);
+    cache->used -= e->len;
+    cache->frames--;
+    buf_pool_free(e->pixels);
+    free(e);
+}
+
+esp_err_t frame_cache_create(size_t budget_bytes, frame_cache_handle_t *ret_cache)
+{
+    ESP_RETURN_ON_FALSE(ret_cache, ESP_ERR_INVALID_ARG, TAG, "ret_cache is NULL");
+    struct frame_cache_t *cache = calloc(1, sizeof(struct frame_cache_t));
+    ESP_RETURN_ON_FALSE(cache, ESP_ERR_NO_MEM, TAG, "no mem for cache");
+    cache->budget = budget_bytes;
+    *ret_cache = cache;
+    return ESP_OK;
+}
+
+const void *frame_cache_get(frame_cache_handle_t cache, uint32_t clip_id, uint32_t frame, size_t *len)
+{
+    if (!cache) {
+        return NULL;
+    }
+    for (frame_entry_t *e = cache->buckets[bucket_of(clip_id, frame)]; e; e = e->hnext) {
+        if (e->clip_id == clip_id && e->frame == frame) {
+            lru_unlink(cache, e);
+            lru_push_front(cache, e);
+            cache->hits++;
+            if (len) {
+                *len = e->len;
+            }
+            return e->pixels;
+        }
+    }
+    return NULL;
+}
+
+esp_err_t frame_cache_put(frame_cache_handle_t cache, uint32_t clip_id, uint32_t frame, const void *pixels, size_t len)
+{
+    ESP_RETURN_ON_FALSE(cache && pixels && len, ESP_ERR_INVALID_ARG, TAG, "invalid arguments");
+    if (len > cache->budget) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (frame_cache_get(cache, clip_id, frame, NULL)) {
+        cache->hits--; // Not a real hit, the frame was decoded anyway
+        return ESP_OK;
+    }
+
+    // Evict least recently used frames of other clips, a looping clip would only evict what it needs next
+    frame_entry_t *victim = cache->tail;
+    while (cache->used + len > cache->budget && victim) {
+        frame_entry_t *prev = victim->prev;
+        if (victim->clip_id != clip_id) {
+            entry_free(cache, victim);
+        }
+        victim = prev;
+    }
+    if (cache->used + len > cache->budget) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (heap_caps_get_free_size(MALLOC_CAP_SPIRAM) < len + FRAME_CACHE_PSRAM_RESERVE) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    frame_entry_t *e = calloc(1, sizeof(frame_entry_t));
+    if (!e) {
+        return ESP_ERR_NO_MEM;
+    }
+    // Same alignment as the canvas buffers, cached frames are handed to the canvas directly
+    e->pixels = buf_pool_alloc(BUF_OWNER_FRAME_CACHE, BUF_ACCESS_BULK, len);
+    if (!e->pixels) {
+        free(e);
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(e->pixels, pixels, len);
+    e->clip_id = clip_id;
+    e->frame = frame;
+    e->len = len;
+
+    uint32_t b = bucket_of(clip_id, frame);
+    e->hnext = cache->buckets[b];
+    cache->buckets[b] = e;
+    lru_push_front(cache, e);
+    cache->used += len;
+    cache->frames++;
+    return ESP_OK;
+}
+
+void frame_cache_clear(frame_cache_handle_t cache)
+{
+    if (!cache) {
+        return;
+    }
+    while (cache->tail) {
+        entry_free(cache, cache->tail);
+    }
+}
+
+void frame_cache_get_usage(frame_cache_handle_t cache, size_t *used_bytes, uint32_t *frames, uint32_t *hits)
+{
+    if (used_bytes) {
+        *used_bytes = cache ? cache->used : 0;
+    }
+    if (frames) {
+        *frames = cache ? cache->frames : 0;
+    }
+    if (hits) {
+        *hits = cache ? cache->hits : 0;
+    }
+}
@@ -0,0 +1,62 @@
+/*
+ * Decoded video frame cache
+ *
+ * Keeps decoded frames in PSRAM so that clips played again are presented without
+ * reading or decoding their JPEG data.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct frame_cache_t *frame_cache_handle_t;
+
+/**
+ * @brief Create a frame cache.
+ *
+ * @param budget_bytes: Memory the cached frames may use
+ * @param ret_cache: Created cache
+ */
+esp_err_t frame_cache_create(size_t budget_bytes, frame_cache_handle_t *ret_cache);
+
+/**
+ * @brief Look up a frame, a hit becomes the most recently used entry.
+ *
+ * The returned pixels stay valid until the next frame_cache_put() or frame_cache_clear().
+ *
+ * @return Pixels of the frame, NULL if it is not cached
+ */
+const void *frame_cache_get(frame_cache_handle_t cache, uint32_t clip_id, uint32_t frame, size_t *len);
+
+/**
+ * @brief Store a copy of a decoded frame.
+ *
+ * Least recently used frames of other clips are evicted to make room. Frames of the same clip
+ * are never evicted for each other, a clip that does not fit keeps its cached part and the
+ * rest is decoded every time.
+ *
+ * @return
+ *    - ESP_OK: Frame stored
+ *    - ESP_ERR_NO_MEM: Over budget or out of PSRAM, frame not stored
+ */
+esp_err_t frame_cache_put(frame_cache_handle_t cache, uint32_t clip_id, uint32_t frame, const void *pixels, size_t len);
+
+/**
+ * @brief Drop every cached frame.
+ */
+void frame_cache_clear(frame_cache_handle_t cache);
+
+/**
+ * @brief Get the memory used by cached frames and the hit count since creation.
+ */
+void frame_cache_get_usage(frame_cache_handle_t cache, size_t *used_bytes, uint32_t *frames, uint32_t *hits);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,10 +1,14 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/event_groups.h"
+#include "freertos/semphr.h"
 #include "nvs_flash.h"
 #include "esp_log.h"
 #include "esp_err.h"
 #include "esp_check.h"
 #include "esp_memory_utils.h"
+#include "esp_timer.h"
 #include "driver/gpio.h"
 
 #include "lvgl.h"
@@ -15,32 +19,113 @@
 #include "lv_demos.h"
 #include "esp_jpeg_dec.h"
 #include "avi_player.h"
+#include "avi_trace.h"
+#include "media_index.h"
+#include "flash_media.h"
+#include "file_iterator.h"
+#include "frame_cache.h"
+#include "thumb_cache.h"
+#include "track_browser.h"
+#include "play_state.h"
+#include "boot_button.h"
+#include "buf_pool.h"
+#include "perf_hud.h"
 
-#include <dirent.h>
 #include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
 
 static const char *TAG = "main";
 
 #define DISP_WIDTH 240
 #define DISP_HEIGHT 240
 
+#define AVI_SCAN_MAX_DEPTH 2 // Subfolder levels of the video folder that are played too
+#define AVI_PATH_MAX 256
+#define FRAME_CACHE_BUDGET_BYTES (4 * 1024 * 1024) // Also capped by free PSRAM
+#define PLAYER_HOT_BUFFER_SIZE (32 * 1024) // JPEG frames and audio chunks up to this size are decoded from internal RAM
+#define FALLBACK_CLIP_NAME "fallback.avi" // Flash clip looped while there is no SD card, else the first one
+#define SPLASH_CLIP_NAME "splash.avi" // Flash clip shown without sound from power on until a card video plays, else the fallback clip
+
+#define CARD_PROBE_MS 100 // Card presence check period during playback
+#define CARD_PROBE_PAUSED_MS 1000 // Nothing is read while paused, a pulled card only matters on resume
+#define MOUNT_RETRY_MIN_MS 20 // Mount retries while there is no card back off from here
+#define MOUNT_RETRY_MAX_MS 160
+
+#define SCREEN_IDLE_OFF_MS 0 // Backlight timeout after the last user input, 0 keeps the screen on
+#define APP_EVENT_QUEUE_LEN 16
+#define SCREEN_TAP_MS 300 // Taps closer than this count together: one toggles pause, three the performance HUD
+#define TRACE_PATH "/sdcard/avi_trace.bin" // Events of the last clip played, with CONFIG_AVI_PLAYER_TRACE
+
 static lv_obj_t *canvas = NULL;
 static lv_color_t *canvas_buf[2] = {NULL};
 static int current_buf_idx = 0;
 static avi_player_handle_t avi_handle = NULL;
-static volatile bool reload_requested = false;
 static lv_obj_t *status_label = NULL;
 static lv_obj_t *title_label = NULL;
+static volatile bool screen_on = true;
+static volatile uint32_t last_input_tick = 0;
+
+static jpeg_dec_handle_t jpeg_handle = NULL;
+
+static file_iterator_instance_t *avi_files = NULL;
+static media_index_handle_t media_index = NULL;
+static frame_cache_handle_t frame_cache = NULL;
+static volatile bool frame_cache_active = false; // Current file repeats, its decoded frames are worth keeping
+static volatile uint32_t frame_cache_clip = 0;
+static flash_media_handle_t flash_media = NULL;
+static bool fallback_playing = false;
+static volatile bool splash_playing = false;
+static thumb_cache_handle_t thumb_cache = NULL; // Set while a card is mounted, under the display lock
+static volatile bool browsing = false;
+static uint32_t mount_retry_ms = MOUNT_RETRY_MIN_MS;
+
+/* Inputs and player events, all handled by avi_play_task */
+typedef enum {
+    APP_EVENT_PLAYER,           // player
+    APP_EVENT_TOGGLE_PAUSE,
+    APP_EVENT_NEXT,
+    APP_EVENT_RELOAD,
+    APP_EVENT_SELECT,           // index
+    APP_EVENT_VOLUME_OPEN,      // Playback holds while the volume popup is shown
+    APP_EVENT_VOLUME_CLOSE,
+} app_event_type_t;
+
+typedef struct {
+    app_event_type_t type;
+    union {
+        avi_player_event_t player;
+        int index;
+    };
+} app_event_t;
+
+static QueueHandle_t app_events = NULL;
+
+/* Playback state, owned by avi_play_task and changed only by app_event_handle() and player_command() */
 static bool loop_playback = true;
 static bool is_playing = false;
-static volatile bool is_paused = false;
-static volatile bool next_track_requested = false;
+static bool is_paused = false;
+static bool was_paused_before_vol = false;
+static bool next_track_requested = false;
+static bool reload_requested = false;
+static int selected_track = -1;
 
-static jpeg_dec_handle_t jpeg_handle = NULL;
+/* Where playback stood when the card went away or the power was cut, resumed if the same card comes back */
+static play_state_t resume_point;
+static bool resume_valid = false;
+static char early_path[AVI_PATH_MAX]; // Started before the scan, see early_start()
+
+/* Codec, display and card come up in parallel at boot */
+#define BOOT_SD_DONE BIT0
+
+static EventGroupHandle_t boot_events = NULL;
+static esp_err_t boot_sd_ret = ESP_FAIL;
+static volatile bool boot_video_pending = true; // First card video frame not shown yet
 
-static char **avi_file_list = NULL;
-static int avi_file_count = 0;
+/* Codec clock asked for by the player, applied once the codec is up */
+static SemaphoreHandle_t codec_lock = NULL;
+static volatile bool codec_ready = false;
+static uint32_t codec_clock[3];
 
 #define LVGL_PORT_INIT_CONFIG()   \
     {                             \
@@ -51,87 +136,195 @@ static int avi_file_count = 0;
         .timer_period_ms = 5,     \
     }
 
-static esp_err_t get_avi_file_list(const char *dir_path)
+/* Boot timeline, in milliseconds since power on */
+static void boot_stage(const char *stage)
+{
+    ESP_LOGI(TAG, "Boot +%"PRIu32" ms: %s", (uint32_t)(esp_timer_get_time() / 1000), stage);
+}
+
+static const char *const avi_extensions[] = { ".avi", NULL };
+
+static esp_err_t scan_avi_files(const char *dir_path)
 {
-    DIR *dir = opendir(dir_path);
-    if (!dir) {
+    const file_iterator_config_t scan_cfg = {
+        .extensions = avi_extensions,
+        .max_depth = AVI_SCAN_MAX_DEPTH,
+        .natural_sort = true,
+    };
+
+    avi_files = file_iterator_new_ex(dir_path, &scan_cfg);
+    if (!avi_files) {
         ESP_LOGW(TAG, "Failed to open directory: %s", dir_path);
         return ESP_FAIL;
     }
+    if (file_iterator_get_count(avi_files) == 0) {
+        ESP_LOGW(TAG, "No AVI files found in directory %s", dir_path);
+        file_iterator_delete(avi_files);
+        avi_files = NULL;
+        return ESP_FAIL;
+    }
 
-    struct dirent *entry;
-    int count = 0;
+    ESP_LOGI(TAG, "Found %d AVI files in directory %s", file_iterator_get_count(avi_files), dir_path);
+    for (int i = 0; i < file_iterator_get_count(avi_files); i++) {
+        ESP_LOGI(TAG, "AVI file %d: %s", i + 1, file_iterator_get_name_from_index(avi_files, i));
+    }
+    return ESP_OK;
+}
 
-    while ((entry = readdir(dir)) != NULL) {
-        if (entry->d_type == DT_REG) {
-            char *ext = strrchr(entry->d_name, '.');
-            if (ext && (strcasecmp(ext, ".avi") == 0)) {
-                count++;
-            }
-        }
+/* Queue an input for avi_play_task, dropped if it is too far behind */
+static void app_event_post(app_event_type_t type, int index)
+{
+    app_event_t ev = {
+        .type = type,
+        .index = index,
+    };
+    if (xQueueSend(app_events, &ev, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "Input %d dropped", type);
     }
+}
 
-    if (count == 0) {
-        closedir(dir);
-        ESP_LOGW(TAG, "No AVI files found in directory %s", dir_path);
-        return ESP_FAIL;
+/* Pause or resume without waiting, a refused pause is undone by its completion event */
+static void player_set_paused(bool paused)
+{
+    avi_player_cmd_t cmd = {
+        .type = paused ? AVI_PLAYER_CMD_PAUSE : AVI_PLAYER_CMD_RESUME,
+    };
+    if (paused != is_paused && avi_player_send_command(avi_handle, &cmd) == ESP_OK) {
+        is_paused = paused;
     }
+}
 
-    avi_file_list = (char **)malloc(sizeof(char *) * count);
-    if (!avi_file_list) {
-        closedir(dir);
-        ESP_LOGE(TAG, "Failed to allocate memory for file list");
-        return ESP_ERR_NO_MEM;
-    }
-    avi_file_count = count;
-    count = 0;
-
-    rewinddir(dir);
-    while ((entry = readdir(dir)) != NULL) {
-        if (entry->d_type == DT_REG) {
-            char *ext = strrchr(entry->d_name, '.');
-            if (ext && (strcasecmp(ext, ".avi") == 0)) {
-                size_t dir_len = strlen(dir_path);
-                size_t file_len = strlen(entry->d_name);
-                char *full_path = (char *)malloc(dir_len + file_len + 2);
-                if (!full_path) {
-                    ESP_LOGE(TAG, "Failed to allocate memory for file path");
-                    for (int i = 0; i < count; i++) {
-                        free(avi_file_list[i]);
-                    }
-                    free(avi_file_list);
-                    avi_file_list = NULL;
-                    avi_file_count = 0;
-                    closedir(dir);
-                    return ESP_ERR_NO_MEM;
-                }
+static void app_event_handle(const app_event_t *ev)
+{
+    switch (ev->type) {
+    case APP_EVENT_PLAYER:
+        if (ev->player.type == AVI_PLAYER_EVENT_PLAY_END) {
+            ESP_LOGI(TAG, "AVI playback finished");
+            is_playing = false;
+            is_paused = false;
+        } else if (ev->player.cmd == AVI_PLAYER_CMD_PLAY || ev->player.cmd == AVI_PLAYER_CMD_NEXT) {
+            is_playing = ev->player.err == ESP_OK;
+        } else if (ev->player.cmd == AVI_PLAYER_CMD_PAUSE && ev->player.err != ESP_OK) {
+            is_paused = false;
+        }
+        break;
+    case APP_EVENT_TOGGLE_PAUSE:
+        player_set_paused(!is_paused);
+        break;
+    case APP_EVENT_NEXT:
+        next_track_requested = true;
+        break;
+    case APP_EVENT_RELOAD:
+        reload_requested = true;
+        break;
+    case APP_EVENT_SELECT:
+        selected_track = ev->index;
+        next_track_requested = true;
+        break;
+    case APP_EVENT_VOLUME_OPEN:
+        was_paused_before_vol = is_paused;
+        player_set_paused(true);
+        break;
+    case APP_EVENT_VOLUME_CLOSE:
+        if (!was_paused_before_vol) {
+            player_set_paused(false);
+        }
+        break;
+    }
+}
 
-                if (dir_len > 0 && dir_path[dir_len - 1] == '/') {
-                    sprintf(full_path, "%s%s", dir_path, entry->d_name);
-                } else {
-                    sprintf(full_path, "%s/%s", dir_path, entry->d_name);
-                }
+/* Handle the next event, returns false if none came within timeout */
+static bool app_event_wait(TickType_t timeout)
+{
+    app_event_t ev;
+    if (xQueueReceive(app_events, &ev, timeout) != pdTRUE) {
+        return false;
+    }
+    app_event_handle(&ev);
+    return true;
+}
 
-                avi_file_list[count++] = full_path;
-            }
+/* Send a command and handle events until it completes, returns its result */
+static esp_err_t player_command(avi_player_cmd_t *cmd)
+{
+    static uint32_t cmd_id = 0;
+    cmd->id = ++cmd_id;
+    ESP_RETURN_ON_ERROR(avi_player_send_command(avi_handle, cmd), TAG, "Command %d not sent", cmd->type);
+
+    app_event_t ev;
+    while (1) {
+        xQueueReceive(app_events, &ev, portMAX_DELAY);
+        app_event_handle(&ev);
+        if (ev.type == APP_EVENT_PLAYER && ev.player.type == AVI_PLAYER_EVENT_CMD_DONE && ev.player.id == cmd->id) {
+            return ev.player.err;
         }
     }
+}
 
-    closedir(dir);
-    ESP_LOGI(TAG, "Found %d AVI files in directory %s", avi_file_count, dir_path);
-    for (int i = 0; i < avi_file_count; i++) {
-        ESP_LOGI(TAG, "AVI file %d: %s", i + 1, avi_file_list[i]);
+static void screen_set_on(bool on)
+{
+    if (screen_on == on) {
+        return;
     }
+    screen_on = on;
+    // With the screen off only audio is delivered: no JPEG decode and no canvas invalidation
+    if (avi_handle) {
+        avi_player_set_stream_mask(avi_handle, on && !browsing ? AVI_PLAYER_STREAM_ALL : AVI_PLAYER_STREAM_AUDIO);
+    }
+    if (on) {
+        bsp_display_backlight_on();
+    } else {
+        bsp_display_backlight_off();
+    }
+    ESP_LOGI(TAG, "Screen %s", on ? "on" : "off, audio only");
+}
 
-    return ESP_OK;
+/* Record user activity, returns true if the input was used to wake the screen */
+static bool user_input_wake(void)
+{
+    last_input_tick = xTaskGetTickCount();
+    if (!screen_on) {
+        screen_set_on(true);
+        return true;
+    }
+    return false;
+}
+
+static lv_timer_t *tap_timer = NULL;
+static int tap_count = 0;
+
+/* From the LVGL task, the taps are over */
+static void tap_timer_cb(lv_timer_t *timer)
+{
+    lv_timer_pause(timer);
+    if (tap_count == 1) {
+        ESP_LOGI(TAG, "Screen clicked: Toggle Pause");
+        app_event_post(APP_EVENT_TOGGLE_PAUSE, 0);
+    }
+    tap_count = 0;
 }
 
 static void screen_touch_cb(lv_event_t *e)
 {
     lv_event_code_t code = lv_event_get_code(e);
-    if(code == LV_EVENT_CLICKED) {
-        ESP_LOGI(TAG, "Screen clicked: Toggle Pause");
-        is_paused = !is_paused;
+    if (code == LV_EVENT_SHORT_CLICKED) {
+        if (user_input_wake()) {
+            return;
+        }
+        if (++tap_count == 3) {
+            tap_count = 0;
+            lv_timer_pause(tap_timer);
+            ESP_LOGI(TAG, "Triple tap: Toggle HUD");
+            perf_hud_toggle();
+            return;
+        }
+        // Pause waits until no second tap came, like the single press of the BOOT button
+        lv_timer_reset(tap_timer);
+        lv_timer_resume(tap_timer);
+    } else if (code == LV_EVENT_LONG_PRESSED) {
+        ESP_LOGI(TAG, "Screen long pressed: Screen off");
+        last_input_tick = xTaskGetTickCount();
+        screen_set_on(false);
     }
 }
 
@@ -139,12 +332,14 @@ static void init_canvas(void)
 {
     if (canvas == NULL) {
         for (int i = 0; i < 2; i++) {
-            canvas_buf[i] = (lv_color_t *)jpeg_calloc_align(DISP_WIDTH * DISP_HEIGHT * sizeof(lv_color_t), 16);
-            if (!canvas_buf[i]) {
+            canvas_buf[i] = buf_pool_alloc(BUF_OWNER_DECODER, BUF_ACCESS_BULK, DISP_WIDTH * DISP_HEIGHT * sizeof(lv_color_t));
+            if (canvas_buf[i]) {
+                memset(canvas_buf[i], 0, DISP_WIDTH * DISP_HEIGHT * sizeof(lv_color_t));
+            } else {
                 ESP_LOGE("init_canvas", "Failed to allocate memory for canvas buffer %d", i);
                 for (int j = 0; j < i; j++) {
                     if (canvas_buf[j]) {
-                        jpeg_free_align(canvas_buf[j]);
+                        buf_pool_free(canvas_buf[j]);
                         canvas_buf[j] = NULL;
                     }
                 }
@@ -157,7 +352,10 @@ static void init_canvas(void)
         lv_obj_center(canvas);
 
         lv_obj_add_flag(canvas, LV_OBJ_FLAG_CLICKABLE);
-        lv_obj_add_event_cb(canvas, screen_touch_cb, LV_EVENT_CLICKED, NULL);
+        lv_obj_add_event_cb(canvas, screen_touch_cb, LV_EVENT_SHORT_CLICKED, NULL);
+        lv_obj_add_event_cb(canvas, screen_touch_cb, LV_EVENT_LONG_PRESSED, NULL);
+        tap_timer = lv_timer_create(tap_timer_cb, SCREEN_TAP_MS, NULL);
+        lv_timer_pause(tap_timer);
     }
 }
 
@@ -183,10 +381,6 @@ static esp_err_t init_jpeg_decoder(void)
 
 static void video_cb(frame_data_t *data, void *arg)
 {
-    while (is_paused) {
-        vTaskDelay(pdMS_TO_TICKS(100));
-    }
-
     if (!data || !data->data || data->data_bytes == 0)
         return;
 
@@ -203,7 +397,10 @@ static void video_cb(frame_data_t *data, void *arg)
     };
 
     jpeg_dec_header_info_t header_info;
+    int64_t decode_start = esp_timer_get_time();
+    AVI_TRACE(AVI_TRACE_JPEG_PARSE_BEGIN, 0);
     jpeg_error_t err = jpeg_dec_parse_header(jpeg_handle, &io, &header_info);
+    AVI_TRACE(AVI_TRACE_JPEG_PARSE_END, 0);
     if (err != JPEG_ERR_OK) {
         ESP_LOGE("video_cb", "JPEG header parsing failed: %d", err);
         return;
@@ -222,11 +419,14 @@ static void video_cb(frame_data_t *data, void *arg)
         return;
     }
 
+    AVI_TRACE(AVI_TRACE_JPEG_DECODE_BEGIN, 0);
     err = jpeg_dec_process(jpeg_handle, &io);
+    AVI_TRACE(AVI_TRACE_JPEG_DECODE_END, outbuf_len);
     if (err != JPEG_ERR_OK) {
         ESP_LOGE("video_cb", "JPEG decoding failed: %d", err);
         return;
     }
+    perf_hud_add_decode_time(esp_timer_get_time() - decode_start);
 
     bsp_display_lock(0);
     if (canvas == NULL) {
@@ -234,21 +434,75 @@ static void video_cb(frame_data_t *data, void *arg)
     }
 
     lv_canvas_set_buffer(canvas, canvas_buf[next_buf_idx], DISP_WIDTH, DISP_HEIGHT, LV_COLOR_FORMAT_RGB565);
+    AVI_TRACE(AVI_TRACE_CANVAS_SWAP, data->video_info.frame_index);
     current_buf_idx = next_buf_idx;
     lv_obj_invalidate(canvas);
 
     bsp_display_unlock();
+    perf_hud_frame_presented(data->video_info.frame_index);
+
+    if (boot_video_pending && !splash_playing && !fallback_playing) {
+        boot_video_pending = false;
+        boot_stage("first video frame");
+    }
+
+    // Only after the canvas moved off any cached frame, storing may evict one
+    if (frame_cache_active && outbuf_len == DISP_WIDTH * DISP_HEIGHT * 2) {
+        frame_cache_put(frame_cache, frame_cache_clip, data->video_info.frame_index, canvas_buf[next_buf_idx], outbuf_len);
+    }
 }
 
-static void audio_cb(frame_data_t *data, void *arg)
+/* Present a cached frame straight from the cache, the player then skips its JPEG data */
+static bool cached_frame_cb(const video_frame_info_t *info, void *arg)
+{
+    if (!frame_cache_active) {
+        return false;
+    }
+    const void *pixels = frame_cache_get(frame_cache, frame_cache_clip, info->frame_index, NULL);
+    if (!pixels) {
+        return false;
+    }
+
+    bsp_display_lock(0);
+    if (canvas == NULL) {
+        init_canvas();
+    }
+    lv_canvas_set_buffer(canvas, (void *)pixels, DISP_WIDTH, DISP_HEIGHT, LV_COLOR_FORMAT_RGB565);
+    AVI_TRACE(AVI_TRACE_CANVAS_SWAP, info->frame_index);
+    lv_obj_invalidate(canvas);
+    bsp_display_unlock();
+    perf_hud_frame_presented(info->frame_index);
+    return true;
+}
+
+/* Point the canvas back at its own buffer before cached frames are dropped */
+static void frame_cache_release(void)
+{
+    frame_cache_active = false;
+    bsp_display_lock(0);
+    if (canvas) {
+        lv_canvas_set_buffer(canvas, canvas_buf[current_buf_idx], DISP_WIDTH, DISP_HEIGHT, LV_COLOR_FORMAT_RGB565);
+    }
+    bsp_display_unlock();
+    frame_cache_clear(frame_cache);
+}
+
+static uint32_t clip_id_of(const char *path, const avi_player_file_info_t *info)
 {
-    while (is_paused) {
-        vTaskDelay(pdMS_TO_TICKS(10));
+    uint32_t h = 2166136261u; // FNV-1a
+    for (; *path; path++) {
+        h = (h ^ (uint8_t)*path) * 16777619u;
     }
+    return h ^ (info->movi_size * 2654435761u);
+}
 
-    if (data && data->type == FRAME_TYPE_AUDIO && data->data && data->data_bytes > 0) {
+static void audio_cb(frame_data_t *data, void *arg)
+{
+    if (codec_ready && data && data->type == FRAME_TYPE_AUDIO && data->data && data->data_bytes > 0) {
         size_t bytes_written = 0;
+        AVI_TRACE(AVI_TRACE_I2S_WRITE_BEGIN, data->data_bytes);
         esp_err_t err = bsp_extra_i2s_write(data->data, data->data_bytes, &bytes_written, portMAX_DELAY);
+        AVI_TRACE(AVI_TRACE_I2S_WRITE_END, bytes_written);
         if (err != ESP_OK) {
             ESP_LOGE(TAG, "Audio write failed: %s", esp_err_to_name(err));
         } else if (bytes_written != data->data_bytes) {
@@ -257,6 +511,18 @@ static void audio_cb(frame_data_t *data, void *arg)
     }
 }
 
+/* Caller holds codec_lock */
+static void codec_apply_clock(void)
+{
+    uint32_t rate = codec_clock[0], bits_cfg = codec_clock[1], ch = codec_clock[2];
+    ESP_LOGI(TAG, "Setting I2S clock: sample rate=%u, bit width=%u, channels=%u", rate, bits_cfg, ch);
+    i2s_slot_mode_t slot_mode = (ch == 2) ? I2S_SLOT_MODE_STEREO : I2S_SLOT_MODE_MONO;
+    esp_err_t err = bsp_extra_codec_set_fs(rate, bits_cfg, slot_mode);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to set codec parameters: %s", esp_err_to_name(err));
+    }
+}
+
 static void audio_set_clock_callback(uint32_t rate, uint32_t bits_cfg, uint32_t ch, void *arg)
 {
     if (rate == 0) {
@@ -268,84 +534,92 @@ static void audio_set_clock_callback(uint32_t rate, uint32_t bits_cfg, uint32_t
         ESP_LOGW(TAG, "Using default bit width: %u", bits_cfg);
     }
 
-    ESP_LOGI(TAG, "Setting I2S clock: sample rate=%u, bit width=%u, channels=%u", rate, bits_cfg, ch);
-    i2s_slot_mode_t slot_mode = (ch == 2) ? I2S_SLOT_MODE_STEREO : I2S_SLOT_MODE_MONO;
-    esp_err_t err = bsp_extra_codec_set_fs(rate, bits_cfg, slot_mode);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to set codec parameters: %s", esp_err_to_name(err));
+    xSemaphoreTake(codec_lock, portMAX_DELAY);
+    codec_clock[0] = rate;
+    codec_clock[1] = bits_cfg;
+    codec_clock[2] = ch;
+    if (codec_ready) {
+        codec_apply_clock();
     }
+    xSemaphoreGive(codec_lock);
 }
 
-static void avi_end_cb(void *arg)
+static void log_audio_stats(const char *name)
 {
-    ESP_LOGI(TAG, "AVI playback finished");
-    is_playing = false;
+    size_t cache_used;
+    uint32_t cache_frames, cache_hits;
+    frame_cache_get_usage(frame_cache, &cache_used, &cache_frames, &cache_hits);
+    ESP_LOGI(TAG, "Frame cache: %u frames, %u KB, %u hits", cache_frames, cache_used / 1024, cache_hits);
+
+    bsp_extra_audio_stats_t st;
+    if (bsp_extra_audio_get_stats(&st) != ESP_OK || st.write_calls == 0) {
+        return;
+    }
+    ESP_LOGI(TAG, "Audio %s: %u writes, %u errors, %u underruns, queue min %u B, write p50 %u us p99 %u us max %u us",
+             name, st.write_calls, st.write_errors, st.underruns,
+             st.queued_bytes_min == UINT32_MAX ? 0 : st.queued_bytes_min,
+             bsp_extra_audio_stats_percentile(&st, 50), bsp_extra_audio_stats_percentile(&st, 99), st.write_us_max);
 }
 
-static void input_task(void *arg)
+#if CONFIG_AVI_PLAYER_TRACE
+/* From the LVGL task: the flush callback and the wait for its transfer to end */
+static void display_trace_cb(lv_event_t *e)
 {
-    gpio_set_direction(GPIO_NUM_0, GPIO_MODE_INPUT);
-    gpio_set_pull_mode(GPIO_NUM_0, GPIO_PULLUP_ONLY);
+    switch (lv_event_get_code(e)) {
+    case LV_EVENT_FLUSH_START:
+        AVI_TRACE(AVI_TRACE_FLUSH_BEGIN, lv_area_get_height(lv_event_get_param(e)));
+        break;
+    case LV_EVENT_FLUSH_FINISH:
+        AVI_TRACE(AVI_TRACE_FLUSH_END, 0);
+        break;
+    case LV_EVENT_FLUSH_WAIT_START:
+        AVI_TRACE(AVI_TRACE_FLUSH_WAIT_BEGIN, 0);
+        break;
+    case LV_EVENT_FLUSH_WAIT_FINISH:
+        AVI_TRACE(AVI_TRACE_FLUSH_WAIT_END, 0);
+        break;
+    default:
+        break;
+    }
+}
+#endif
 
-    const TickType_t double_click_window = pdMS_TO_TICKS(300);
-    uint32_t first_click_tick = 0;
-    int pending_clicks = 0;
-    
-    while (1) {
-        if (pending_clicks == 1 && (xTaskGetTickCount() - first_click_tick) > double_click_window) {
-            ESP_LOGI(TAG, "Single click: Toggle Pause");
-            is_paused = !is_paused;
-            pending_clicks = 0;
-        }
+/* From the player task, the event is handled by avi_play_task */
+static void player_event_cb(const avi_player_event_t *event, void *arg)
+{
+    app_event_t ev = {
+        .type = APP_EVENT_PLAYER,
+        .player = *event,
+    };
+    // Never dropped, player_command() waits for the completion
+    xQueueSend(app_events, &ev, portMAX_DELAY);
+}
 
-        if (gpio_get_level(GPIO_NUM_0) == 0) {
-            uint32_t press_start = xTaskGetTickCount();
-            bool long_press_handled = false;
-            
-            while (gpio_get_level(GPIO_NUM_0) == 0) {
-                vTaskDelay(pdMS_TO_TICKS(50));
-                if (!long_press_handled && (xTaskGetTickCount() - press_start) > pdMS_TO_TICKS(1000)) {
-                    // Long press detected
-                    ESP_LOGI(TAG, "Long press: Reloading...");
-                    is_paused = false; // Unpause if paused so the task can proceed to stop
-                    pending_clicks = 0;
-                    reload_requested = true;
-                    if (avi_handle) {
-                        avi_player_play_stop(avi_handle);
-                    }
-                    long_press_handled = true;
-                }
-            }
-            
-            if (!long_press_handled) {
-                // Short press: defer action to distinguish single vs double click
-                uint32_t now = xTaskGetTickCount();
-                if (pending_clicks == 0) {
-                    pending_clicks = 1;
-                    first_click_tick = now;
-                } else if ((now - first_click_tick) <= double_click_window) {
-                    ESP_LOGI(TAG, "Double click: Next track");
-                    pending_clicks = 0;
-                    next_track_requested = true;
-                    is_paused = false;
-                    if (avi_handle) {
-                        avi_player_play_stop(avi_handle);
-                    }
-                } else {
-                    // Window expired but not yet processed; treat as new first click
-                    pending_clicks = 1;
-                    first_click_tick = now;
-                }
-            }
+/* From the esp_timer task */
+static void boot_button_cb(boot_button_gesture_t gesture, void *user_data)
+{
+    switch (gesture) {
+    case BOOT_BUTTON_SINGLE:
+        if (!user_input_wake()) {
+            ESP_LOGI(TAG, "Single click: Toggle Pause");
+            app_event_post(APP_EVENT_TOGGLE_PAUSE, 0);
         }
-        vTaskDelay(pdMS_TO_TICKS(20));
+        break;
+    case BOOT_BUTTON_DOUBLE:
+        ESP_LOGI(TAG, "Double click: Next track");
+        user_input_wake();
+        app_event_post(APP_EVENT_NEXT, 0);
+        break;
+    case BOOT_BUTTON_LONG:
+        ESP_LOGI(TAG, "Long press: Reloading...");
+        user_input_wake();
+        app_event_post(APP_EVENT_RELOAD, 0);
+        break;
     }
-    vTaskDelete(NULL);
 }
 
 static lv_obj_t *vol_popup = NULL;
 static lv_obj_t *vol_slider = NULL;
-static bool was_paused_before_vol = false;
 
 static void volume_slider_cb(lv_event_t *e)
 {
@@ -359,16 +633,13 @@ static void volume_ok_cb(lv_event_t *e)
     if (vol_popup) {
         lv_obj_add_flag(vol_popup, LV_OBJ_FLAG_HIDDEN);
     }
-    if (!was_paused_before_vol) {
-        is_paused = false;
-    }
+    app_event_post(APP_EVENT_VOLUME_CLOSE, 0);
 }
 
 static void volume_btn_cb(lv_event_t *e)
 {
     if (lv_event_get_code(e) == LV_EVENT_CLICKED) {
-        was_paused_before_vol = is_paused;
-        is_paused = true;
+        app_event_post(APP_EVENT_VOLUME_OPEN, 0);
 
         if (vol_popup == NULL) {
             vol_popup = lv_obj_create(lv_layer_top());
@@ -401,14 +672,290 @@ static void volume_btn_cb(lv_event_t *e)
     }
 }
 
+/* Browser closed, from the LVGL task */
+static void track_selected_cb(int index, void *user_data)
+{
+    browsing = false;
+    avi_player_set_stream_mask(avi_handle, screen_on ? AVI_PLAYER_STREAM_ALL : AVI_PLAYER_STREAM_AUDIO);
+    if (index >= 0) {
+        ESP_LOGI(TAG, "Track %d selected", index);
+        app_event_post(APP_EVENT_SELECT, index);
+    }
+}
+
+static void browse_btn_cb(lv_event_t *e)
+{
+    if (user_input_wake() || !thumb_cache || browsing) {
+        return;
+    }
+    // Audio keeps playing under the browser, video frames would not be seen
+    if (track_browser_open(avi_files, thumb_cache, track_selected_cb, NULL) == ESP_OK) {
+        browsing = true;
+        avi_player_set_stream_mask(avi_handle, AVI_PLAYER_STREAM_AUDIO);
+    }
+}
+
+/* Stop playback, returns once the player has ended it */
+static void play_stop_wait(void)
+{
+    avi_player_cmd_t cmd = {
+        .type = AVI_PLAYER_CMD_STOP,
+    };
+    player_command(&cmd);
+    is_playing = false;
+}
+
+/* Loop a flash clip without sound from power on until the first card video plays */
+static void splash_start(void)
+{
+    flash_media_clip_t clip;
+    if (!flash_media || (flash_media_find(flash_media, SPLASH_CLIP_NAME, &clip) != ESP_OK &&
+                         flash_media_find(flash_media, FALLBACK_CLIP_NAME, &clip) != ESP_OK &&
+                         flash_media_get(flash_media, 0, &clip) != ESP_OK)) {
+        return;
+    }
+    avi_player_play_cfg_t play_cfg = { .loop = true };
+    avi_player_set_stream_mask(avi_handle, AVI_PLAYER_STREAM_VIDEO);
+    is_playing = true;
+    if (avi_player_play_from_memory_ex(avi_handle, clip.data, clip.size, &play_cfg) != ESP_OK) {
+        is_playing = false;
+        avi_player_set_stream_mask(avi_handle, AVI_PLAYER_STREAM_ALL);
+        return;
+    }
+    splash_playing = true;
+    boot_stage("splash");
+}
+
+/* The next play replaces the splash, sound comes back with it */
+static void splash_end(void)
+{
+    if (splash_playing) {
+        splash_playing = false;
+        avi_player_set_stream_mask(avi_handle, screen_on && !browsing ? AVI_PLAYER_STREAM_ALL : AVI_PLAYER_STREAM_AUDIO);
+    }
+}
+
+/* Loop a clip from the flash partition while there is no SD card, returns false if there is none */
+static bool fallback_clip_start(void)
+{
+    if (fallback_playing && is_playing) {
+        return true;
+    }
+    if (splash_playing) {
+        splash_end();
+        play_stop_wait();
+    }
+    flash_media_clip_t clip;
+    if (!flash_media || (flash_media_find(flash_media, FALLBACK_CLIP_NAME, &clip) != ESP_OK &&
+                         flash_media_get(flash_media, 0, &clip) != ESP_OK)) {
+        return false;
+    }
+
+    // Frames are decoded straight from mapped flash, nothing is read from the card
+    avi_player_play_cfg_t play_cfg = { .loop = true };
+    frame_cache_active = false;
+    is_playing = true;
+    if (avi_player_play_from_memory_ex(avi_handle, clip.data, clip.size, &play_cfg) != ESP_OK) {
+        is_playing = false;
+        return false;
+    }
+    ESP_LOGI(TAG, "No SD card, playing %s from flash", clip.name);
+    fallback_playing = true;
+    return true;
+}
+
+static void fallback_clip_stop(void)
+{
+    if (!fallback_playing) {
+        return;
+    }
+    fallback_playing = false;
+    play_stop_wait();
+}
+
+/* Wait before the next mount attempt, the wait doubles up to MOUNT_RETRY_MAX_MS */
+static void mount_retry_wait(void)
+{
+    app_event_wait(pdMS_TO_TICKS(mount_retry_ms));
+    mount_retry_ms = mount_retry_ms * 2 < MOUNT_RETRY_MAX_MS ? mount_retry_ms * 2 : MOUNT_RETRY_MAX_MS;
+}
+
+/* First video of the top folder, found without scanning subfolders. Usually the first one of the library */
+static bool first_video_file(char *path, size_t len)
+{
+    static const char *const dirs[] = { "/sdcard/videos", "/sdcard/avi" };
+    const file_iterator_config_t top_cfg = {
+        .extensions = avi_extensions,
+        .max_depth = 0,
+        .natural_sort = true,
+    };
+    for (int d = 0; d < sizeof(dirs) / sizeof(dirs[0]); d++) {
+        file_iterator_instance_t *top = file_iterator_new_ex(dirs[d], &top_cfg);
+        if (!top) {
+            continue;
+        }
+        int path_len = file_iterator_get_count(top) ? file_iterator_get_full_path_from_index(top, 0, path, len) : 0;
+        file_iterator_delete(top);
+        if (path_len > 0 && path_len < len) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Start the resume point, else the first video, before the file list is built. Returns true if
+ * early_path plays.
+ */
+static bool early_start(avi_player_file_info_t *info)
+{
+    uint32_t start_frame = 0;
+    if (resume_valid && memcmp(&bsp_sdcard->cid, &resume_point.cid, sizeof(resume_point.cid)) == 0) {
+        strcpy(early_path, resume_point.path);
+        start_frame = resume_point.frame;
+        if (avi_player_probe_file(early_path, info) != ESP_OK || clip_id_of(early_path, info) != resume_point.clip_id) {
+            return false;
+        }
+    } else if (!first_video_file(early_path, sizeof(early_path)) || avi_player_probe_file(early_path, info) != ESP_OK) {
+        return false;
+    }
+    avi_player_cmd_t cmd = {
+        .type = AVI_PLAYER_CMD_PLAY,
+        .play = {
+            .filename = early_path,
+            .cfg = {
+                .info = info,
+                .start_frame = start_frame,
+            },
+        },
+    };
+    frame_cache_active = false;
+    splash_end();
+    if (player_command(&cmd) != ESP_OK) {
+        return false;
+    }
+    ESP_LOGI(TAG, "Playing %s at frame %"PRIu32" before the scan", early_path, start_frame);
+
+    bsp_display_lock(0);
+    if (status_label) {
+        lv_obj_add_flag(status_label, LV_OBJ_FLAG_HIDDEN);
+    }
+    if (canvas) {
+        lv_obj_clear_flag(canvas, LV_OBJ_FLAG_HIDDEN);
+    }
+    bsp_display_unlock();
+    return true;
+}
+
+/* Save where the current file is, play_state_save() decides whether it is written */
+static void play_state_update(const char *path, uint32_t clip_id)
+{
+    play_state_t state = {
+        .cid = bsp_sdcard->cid,
+        .clip_id = clip_id,
+    };
+    if (avi_player_get_position(avi_handle, &state.frame) != ESP_OK) {
+        return;
+    }
+    strcpy(state.path, path); // Callers keep paths below AVI_PATH_MAX
+    play_state_save(&state);
+}
+
+/* Index of path in the file list, -1 if it is not there */
+static int library_index(const char *path)
+{
+    char entry[AVI_PATH_MAX];
+    for (int i = 0; i < file_iterator_get_count(avi_files); i++) {
+        if (file_iterator_get_full_path_from_index(avi_files, i, entry, sizeof(entry)) < sizeof(entry) &&
+                strcmp(entry, path) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Index of the file to resume in the new file list, 0 if this is another card or the file is gone */
+static int resume_index(void)
+{
+    if (!resume_valid) {
+        return 0;
+    }
+    if (memcmp(&bsp_sdcard->cid, &resume_point.cid, sizeof(resume_point.cid)) == 0) {
+        int index = library_index(resume_point.path);
+        if (index >= 0) {
+            return index;
+        }
+    }
+    resume_valid = false;
+    return 0;
+}
+
+/* The first mount runs at boot next to the display and codec bring up, see sd_mount_task() */
+static esp_err_t sdcard_mount(void)
+{
+    static bool boot_mount_used = false;
+    if (!boot_mount_used) {
+        boot_mount_used = true;
+        xEventGroupWaitBits(boot_events, BOOT_SD_DONE, pdFALSE, pdTRUE, portMAX_DELAY);
+        return boot_sd_ret;
+    }
+    return bsp_sdcard_mount();
+}
+
+static void sdcard_unmount(void)
+{
+    avi_player_set_direct_read(avi_handle, NULL, NULL); // Drops the card and the prefetched file before they go away
+    bsp_sdcard_unmount();
+}
+
+/* Let the player preload the file that follows index while index plays */
+static void queue_next_file(int index)
+{
+    char next_file[AVI_PATH_MAX];
+    int next_index = (index + 1) % file_iterator_get_count(avi_files);
+    int path_len = file_iterator_get_full_path_from_index(avi_files, next_index, next_file, sizeof(next_file));
+    if (path_len <= 0 || path_len >= sizeof(next_file)) {
+        return;
+    }
+
+    avi_player_file_info_t next_info;
+    avi_player_play_cfg_t next_cfg = { 0 };
+    if (media_index && media_index_get(media_index, next_file, &next_info) == ESP_OK) {
+        next_cfg.info = &next_info;
+    }
+    avi_player_set_next(avi_handle, next_file, &next_cfg);
+}
+
+/* Chunks the decoder reads every frame go to internal RAM, the rest is streamed through PSRAM */
+static void *player_buf_alloc(avi_player_buf_t buf, size_t size, void *arg)
+{
+    switch (buf) {
+    case AVI_PLAYER_BUF_FRAME_HOT:
+        return buf_pool_alloc(BUF_OWNER_PLAYER, BUF_ACCESS_HOT, size);
+    case AVI_PLAYER_BUF_DIRECT:
+        return buf_pool_alloc(BUF_OWNER_PLAYER, BUF_ACCESS_DMA, size);
+    default:
+        return buf_pool_alloc(BUF_OWNER_PLAYER, BUF_ACCESS_BULK, size);
+    }
+}
+
+static void player_buf_free(avi_player_buf_t buf, void *ptr, void *arg)
+{
+    buf_pool_free(ptr);
+}
+
 static void avi_play_task(void *arg)
 {
     avi_player_config_t cfg = {
         .buffer_size = 1 * 1024 * 1024, // 1MB psram buffer (1-2 seconds of video)
+        .hot_buffer_size = PLAYER_HOT_BUFFER_SIZE,
+        .buf_alloc_cb = player_buf_alloc,
+        .buf_free_cb = player_buf_free,
         .video_cb = video_cb,
         .audio_cb = audio_cb,
         .audio_set_clock_cb = audio_set_clock_callback,
-        .avi_play_end_cb = avi_end_cb,
+        .video_skip_cb = cached_frame_cb,
+        .event_cb = player_event_cb,
         .priority = 7,
         .coreID = 1,
         .user_data = NULL,
@@ -425,6 +972,11 @@ static void avi_play_task(void *arg)
     bsp_display_unlock();
 
     ESP_ERROR_CHECK(avi_player_init(cfg, &avi_handle));
+    ESP_ERROR_CHECK(frame_cache_create(FRAME_CACHE_BUDGET_BYTES, &frame_cache));
+    resume_valid = play_state_load(&resume_point) == ESP_OK;
+    flash_media_open(FLASH_MEDIA_DEFAULT_PARTITION, &flash_media); // Optional, see scripts/pack_flash_media.py
+    avi_player_set_stream_mask(avi_handle, screen_on ? AVI_PLAYER_STREAM_ALL : AVI_PLAYER_STREAM_AUDIO);
+    splash_start();
 
     bsp_display_lock(0);
     lv_obj_t *vol_btn = lv_btn_create(lv_layer_top());
@@ -438,6 +990,19 @@ static void avi_play_task(void *arg)
     lv_obj_center(lbl);
     
     lv_obj_add_event_cb(vol_btn, volume_btn_cb, LV_EVENT_CLICKED, NULL);
+
+    lv_obj_t *browse_btn = lv_btn_create(lv_layer_top());
+    lv_obj_set_size(browse_btn, 40, 40);
+    lv_obj_align(browse_btn, LV_ALIGN_TOP_LEFT, 50, 5);
+    lv_obj_set_style_bg_color(browse_btn, lv_palette_main(LV_PALETTE_BLUE), 0);
+    lv_obj_set_style_bg_opa(browse_btn, LV_OPA_50, 0);
+
+    lbl = lv_label_create(browse_btn);
+    lv_label_set_text(lbl, LV_SYMBOL_LIST);
+    lv_obj_center(lbl);
+
+    lv_obj_add_event_cb(browse_btn, browse_btn_cb, LV_EVENT_CLICKED, NULL);
+    perf_hud_init(avi_handle, DISP_HEIGHT); // Optional, a triple tap shows it
     bsp_display_unlock();
 
     while (1) {
@@ -449,12 +1014,25 @@ static void avi_play_task(void *arg)
                 lv_obj_invalidate(canvas);
             }
             bsp_display_unlock();
-            bsp_sdcard_unmount();
-            vTaskDelay(pdMS_TO_TICKS(500));
+            sdcard_unmount();
+            resume_valid = false; // A reload starts the list over
         }
 
         // Mount SD
-        if (bsp_sdcard_mount() != ESP_OK) {
+        if (sdcard_mount() != ESP_OK) {
+            if (fallback_clip_start()) {
+                bsp_display_lock(0);
+                if (status_label) {
+                    lv_obj_add_flag(status_label, LV_OBJ_FLAG_HIDDEN);
+                }
+                if (canvas) {
+                    lv_obj_clear_flag(canvas, LV_OBJ_FLAG_HIDDEN);
+                }
+                bsp_display_unlock();
+                mount_retry_wait();
+                continue;
+            }
+            screen_set_on(true);
             bsp_display_lock(0);
             if (canvas) {
                 lv_obj_add_flag(canvas, LV_OBJ_FLAG_HIDDEN);
@@ -470,18 +1048,31 @@ static void avi_play_task(void *arg)
             lv_label_set_text(status_label, "Insert SD Card\nPress BOOT to reload");
             lv_obj_clear_flag(status_label, LV_OBJ_FLAG_HIDDEN);
             bsp_display_unlock();
-            
-            vTaskDelay(pdMS_TO_TICKS(1000));
+
+            mount_retry_wait();
             continue;
         }
 
+        mount_retry_ms = MOUNT_RETRY_MIN_MS;
+        fallback_clip_stop();
+        // The reader streams contiguous files straight from the card sectors, bypassing the file system
+        avi_player_set_direct_read(avi_handle, bsp_sdcard, BSP_SD_MOUNT_POINT);
+
+        // A known card shows its resume frame right away, else the first video plays. The library scan can take a while
+        avi_player_file_info_t early_info;
+        bool early_playing = early_start(&early_info);
+
         // Scan files
-        esp_err_t scan_ret = get_avi_file_list("/sdcard/videos");
-        if (scan_ret != ESP_OK || avi_file_count == 0) {
-             scan_ret = get_avi_file_list("/sdcard/avi");
+        esp_err_t scan_ret = scan_avi_files("/sdcard/videos");
+        if (scan_ret != ESP_OK) {
+             scan_ret = scan_avi_files("/sdcard/avi");
         }
 
-        if (scan_ret != ESP_OK || avi_file_count == 0) {
+        if (scan_ret != ESP_OK) {
+            if (early_playing || splash_playing) {
+                splash_end();
+                play_stop_wait();
+            }
             bsp_display_lock(0);
             if (canvas) {
                 lv_obj_add_flag(canvas, LV_OBJ_FLAG_HIDDEN);
@@ -498,11 +1089,34 @@ static void avi_play_task(void *arg)
             lv_obj_clear_flag(status_label, LV_OBJ_FLAG_HIDDEN);
             bsp_display_unlock();
 
-            bsp_sdcard_unmount();
+            sdcard_unmount();
             vTaskDelay(pdMS_TO_TICKS(1000));
             continue;
         }
 
+        // Header info of known files comes from the index, new or changed files are parsed on first play
+        if (media_index_load(MEDIA_INDEX_DEFAULT_PATH, &media_index) == ESP_OK) {
+            char path[AVI_PATH_MAX];
+            for (int i = 0; i < file_iterator_get_count(avi_files); i++) {
+                if (file_iterator_get_full_path_from_index(avi_files, i, path, sizeof(path)) < sizeof(path)) {
+                    media_index_keep(media_index, path);
+                }
+            }
+            media_index_prune(media_index);
+        }
+
+        thumb_cache_config_t thumb_cfg = {
+            .width = TRACK_BROWSER_THUMB_SIZE,
+            .height = TRACK_BROWSER_THUMB_SIZE,
+            .lru_entries = 32,
+        };
+        thumb_cache_handle_t thumbs = NULL;
+        if (thumb_cache_open(THUMB_CACHE_DEFAULT_PATH, &thumb_cfg, &thumbs) == ESP_OK) {
+            bsp_display_lock(0);
+            thumb_cache = thumbs;
+            bsp_display_unlock();
+        }
+
         // Hide status label
         bsp_display_lock(0);
         if (status_label) {
@@ -511,7 +1125,21 @@ static void avi_play_task(void *arg)
         bsp_display_unlock();
 
         loop_playback = true;
+        bool card_present = true;
         int current_file_index = 0;
+        if (boot_video_pending) {
+            boot_stage("library scanned");
+        }
+        int start_index = resume_index();
+        if (early_playing) {
+            int early_index = library_index(early_path);
+            if (early_index >= 0) {
+                start_index = early_index;
+            } else {
+                play_stop_wait(); // Not part of the library
+                early_playing = false;
+            }
+        }
 
         bsp_display_lock(0);
         if (canvas) {
@@ -520,12 +1148,18 @@ static void avi_play_task(void *arg)
         bsp_display_unlock();
 
         while (loop_playback && !reload_requested) {
-            for (current_file_index = 0; current_file_index < avi_file_count && loop_playback && !reload_requested; current_file_index++) {
-                const char *current_file = avi_file_list[current_file_index];
+            bool played_any = false;
+            for (current_file_index = start_index; current_file_index < file_iterator_get_count(avi_files) && loop_playback && !reload_requested; current_file_index++) {
+                char current_file[AVI_PATH_MAX];
+                int path_len = file_iterator_get_full_path_from_index(avi_files, current_file_index, current_file, sizeof(current_file));
+                if (path_len <= 0 || path_len >= sizeof(current_file)) {
+                    ESP_LOGW(TAG, "Skipping entry %d, path too long", current_file_index);
+                    continue;
+                }
                 ESP_LOGI(TAG, "Playing: %s", current_file);
 
                 bsp_display_lock(0);
-                if (!title_label) {
+                if (!title_label && screen_on) {
                      title_label = lv_label_create(lv_scr_act());
                      lv_obj_set_width(title_label, DISP_WIDTH - 10);
                      lv_obj_set_style_text_align(title_label, LV_TEXT_ALIGN_CENTER, 0);
@@ -539,17 +1173,63 @@ static void avi_play_task(void *arg)
                 const char *fname = strrchr(current_file, '/');
                 if (fname) fname++; else fname = current_file;
                 
-                lv_label_set_text(title_label, fname);
-                lv_obj_clear_flag(title_label, LV_OBJ_FLAG_HIDDEN);
-                lv_obj_move_foreground(title_label);
+                if (title_label && screen_on) {
+                    lv_label_set_text(title_label, fname);
+                    lv_obj_clear_flag(title_label, LV_OBJ_FLAG_HIDDEN);
+                    lv_obj_move_foreground(title_label);
+                }
                 bsp_display_unlock();
 
                 uint32_t play_start_time = xTaskGetTickCount();
                 bool title_hidden = false;
                 
-                is_playing = true;
+                // Playing since before the scan, see early_start()
+                bool resumed = early_playing && strcmp(current_file, early_path) == 0;
+                if (early_playing && !resumed) {
+                    play_stop_wait();
+                }
+                early_playing = false;
+
                 next_track_requested = false;
-                if (avi_player_play_from_file(avi_handle, current_file) != ESP_OK) {
+                bsp_extra_audio_stats_reset();
+                avi_player_file_info_t file_info;
+                avi_player_play_cfg_t play_cfg = {
+                    .loop = file_iterator_get_count(avi_files) == 1, // A single clip loops inside the player without restarting
+                };
+                if (resumed) {
+                    file_info = early_info;
+                    play_cfg.info = &file_info;
+                } else if (media_index && media_index_get(media_index, current_file, &file_info) == ESP_OK) {
+                    play_cfg.info = &file_info;
+                }
+                if (resume_valid) {
+                    // Same card and the file is unchanged: seek back to where it was removed
+                    if (!resumed && play_cfg.info && strcmp(current_file, resume_point.path) == 0 &&
+                            clip_id_of(current_file, &file_info) == resume_point.clip_id) {
+                        play_cfg.start_frame = resume_point.frame;
+                        ESP_LOGI(TAG, "Resuming at frame %"PRIu32"", resume_point.frame);
+                    }
+                    resume_valid = false;
+                }
+                // Cache decoded frames of a looping clip, or of a clip that fits entirely and comes round again
+                frame_cache_active = false;
+                if (play_cfg.info) {
+                    uint64_t clip_bytes = (uint64_t)file_info.total_frames * DISP_WIDTH * DISP_HEIGHT * 2;
+                    frame_cache_clip = clip_id_of(current_file, &file_info);
+                    frame_cache_active = play_cfg.loop || clip_bytes <= FRAME_CACHE_BUDGET_BYTES;
+                }
+                avi_player_cmd_t play_cmd = {
+                    .type = AVI_PLAYER_CMD_PLAY,
+                    .play = {
+                        .filename = current_file,
+                        .cfg = play_cfg,
+                    },
+                };
+                if (!resumed) {
+                    splash_end();
+                }
+                perf_hud_set_clip(play_cfg.info);
+                if (!resumed && player_command(&play_cmd) != ESP_OK) {
                     FILE *f = fopen(current_file, "r");
                     if (f) {
                         fclose(f);
@@ -561,8 +1241,42 @@ static void avi_play_task(void *arg)
                     vTaskDelay(pdMS_TO_TICKS(1000));
                     continue;
                 }
+                if (!play_cfg.loop) {
+                    queue_next_file(current_file_index);
+                }
+                played_any = true;
+
+                TickType_t last_probe = xTaskGetTickCount();
+                while (is_playing && loop_playback) {
+                    TickType_t probe_period = pdMS_TO_TICKS(is_paused ? CARD_PROBE_PAUSED_MS : CARD_PROBE_MS);
+                    // A status request is enough to notice a pulled card long before a read times out
+                    if (xTaskGetTickCount() - last_probe >= probe_period) {
+                        last_probe = xTaskGetTickCount();
+                        if (sdmmc_get_status(bsp_sdcard) != ESP_OK) {
+                            uint32_t frame;
+                            ESP_LOGW(TAG, "SD card removed");
+                            if (play_cfg.info && avi_player_get_position(avi_handle, &frame) == ESP_OK) {
+                                resume_point.cid = bsp_sdcard->cid;
+                                strcpy(resume_point.path, current_file);
+                                resume_point.clip_id = clip_id_of(current_file, &file_info);
+                                resume_point.frame = frame;
+                                resume_valid = true;
+                            }
+                            card_present = false;
+                            loop_playback = false;
+                            play_stop_wait();
+                            break;
+                        }
+                        if (play_cfg.info) {
+                            play_state_update(current_file, clip_id_of(current_file, &file_info));
+                        }
+                    }
+
+                    if (SCREEN_IDLE_OFF_MS > 0 && screen_on && !is_paused &&
+                            (xTaskGetTickCount() - last_input_tick) > pdMS_TO_TICKS(SCREEN_IDLE_OFF_MS)) {
+                        screen_set_on(false);
+                    }
 
-                while (is_playing && loop_playback && !reload_requested) {
                     if (!title_hidden && (xTaskGetTickCount() - play_start_time > pdMS_TO_TICKS(2000))) {
                         bsp_display_lock(0);
                         if (title_label) lv_obj_add_flag(title_label, LV_OBJ_FLAG_HIDDEN);
@@ -570,39 +1284,112 @@ static void avi_play_task(void *arg)
                         title_hidden = true;
                     }
 
-                    if (next_track_requested) {
+                    // Blocks until an input or player event, or the next card probe
+                    app_event_wait(probe_period);
+                    if (next_track_requested || reload_requested) {
                         next_track_requested = false;
-                        is_paused = false;
-                        avi_player_play_stop(avi_handle);
-                        is_playing = false;
+                        play_stop_wait();
                         break;
                     }
-                    vTaskDelay(pdMS_TO_TICKS(30));
+                }
+                log_audio_stats(fname);
+                buf_pool_log_stats();
+#if CONFIG_AVI_PLAYER_TRACE
+                if (card_present) {
+                    avi_trace_save(TRACE_PATH);
+                }
+#endif
+                if (media_index && card_present) {
+                    media_index_save(media_index);
+                }
+                if (selected_track >= 0) {
+                    current_file_index = selected_track - 1; // Incremented by the loop
+                    selected_track = -1;
                 }
             }
+            start_index = 0;
             if (!loop_playback || reload_requested) break;
-            vTaskDelay(pdMS_TO_TICKS(1000));
+            if (!played_any) {
+                vTaskDelay(pdMS_TO_TICKS(1000)); // Nothing playable, do not spin
+            }
+        }
+
+        // The browser uses the file list and the thumbnails until it is closed
+        bsp_display_lock(0);
+        thumbs = thumb_cache;
+        thumb_cache = NULL;
+        bsp_display_unlock();
+        track_browser_close();
+        browsing = false;
+        avi_player_set_stream_mask(avi_handle, screen_on ? AVI_PLAYER_STREAM_ALL : AVI_PLAYER_STREAM_AUDIO);
+        if (thumbs) {
+            if (card_present) {
+                thumb_cache_save(thumbs);
+            }
+            thumb_cache_close(thumbs);
         }
 
         // Cleanup file list
-        if (avi_file_list) {
-            for (int i = 0; i < avi_file_count; i++) {
-                free(avi_file_list[i]);
+        if (avi_files) {
+            file_iterator_delete(avi_files);
+            avi_files = NULL;
+        }
+        frame_cache_release(); // The next card may reuse the same names
+        if (media_index) {
+            if (card_present) {
+                media_index_save(media_index);
             }
-            free(avi_file_list);
-            avi_file_list = NULL;
-            avi_file_count = 0;
+            media_index_free(media_index);
+            media_index = NULL;
         }
 
-        bsp_sdcard_unmount();
-        vTaskDelay(pdMS_TO_TICKS(1000));
+        // Straight back to mounting, a returning card is picked up by the retry backoff
+        sdcard_unmount();
     }
 }
 
-void app_main(void)
+/* Codec bring up over I2C runs next to the display start, audio is dropped until it is ready */
+static void codec_init_task(void *arg)
 {
     ESP_ERROR_CHECK(bsp_extra_codec_init());
     bsp_extra_codec_volume_set(80, NULL);
+    xSemaphoreTake(codec_lock, portMAX_DELAY);
+    codec_ready = true;
+    if (codec_clock[0]) {
+        codec_apply_clock(); // A clip started while the codec came up
+    }
+    xSemaphoreGive(codec_lock);
+    boot_stage("codec ready");
+    vTaskDelete(NULL);
+}
+
+static void sd_mount_task(void *arg)
+{
+    boot_sd_ret = bsp_sdcard_mount();
+    boot_stage(boot_sd_ret == ESP_OK ? "card mounted" : "no card");
+    xEventGroupSetBits(boot_events, BOOT_SD_DONE);
+    vTaskDelete(NULL);
+}
+
+void app_main(void)
+{
+    boot_stage("app_main");
+    // Holds the playback position across power cycles
+    esp_err_t ret = nvs_flash_init();
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        ret = nvs_flash_init();
+    }
+    ESP_ERROR_CHECK(ret);
+
+    // Codec and touch share the I2C bus, it is created here before both come up in parallel
+    ESP_ERROR_CHECK(bsp_i2c_init());
+    codec_lock = xSemaphoreCreateMutex();
+    boot_events = xEventGroupCreate();
+    assert(codec_lock && boot_events);
+    xTaskCreatePinnedToCore(codec_init_task, "codec_init", 4096, NULL, 6, NULL, 1);
+    xTaskCreatePinnedToCore(sd_mount_task, "sd_mount", 4096, NULL, 6, NULL, 1);
+
     bsp_display_cfg_t cfg = {
         .lvgl_port_cfg = LVGL_PORT_INIT_CONFIG(),
         .buffer_size = DISP_WIDTH * DISP_HEIGHT / 2, // Partial double buffer
@@ -617,10 +1404,17 @@ void app_main(void)
     
     bsp_display_lock(0);
     // bsp_display_rotate(disp, LV_DISPLAY_ROTATION_270); // Rotated in video file
+#if CONFIG_AVI_PLAYER_TRACE
+    ESP_ERROR_CHECK(avi_trace_init(CONFIG_AVI_PLAYER_TRACE_EVENTS));
+    lv_display_add_event_cb(lv_display_get_default(), display_trace_cb, LV_EVENT_ALL, NULL);
+#endif
     bsp_display_unlock();
 
     bsp_display_backlight_on();
+    boot_stage("display ready");
 
+    app_events = xQueueCreate(APP_EVENT_QUEUE_LEN, sizeof(app_event_t));
+    assert(app_events);
     xTaskCreatePinnedToCore(avi_play_task, "avi_play_task", 12288, NULL, 7, NULL, 0);
-    xTaskCreatePinnedToCore(input_task, "input_task", 4096, NULL, 5, NULL, 0);
-}
\ No newline at end of file
+    ESP_ERROR_CHECK(boot_button_init(GPIO_NUM_0, boot_button_cb, NULL));
+}
@@ -0,0 +1,275 @@
+/*
+ * Performance HUD
+ *
+ * Rates are taken over the refresh period from the player counters, CPU load from the run time
+ * of the idle tasks. The labels have a fixed size inside the free rows, a refresh only
+ * invalidates those rows.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_check.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "lvgl.h"
+#include "bsp_board_extra.h"
+#include "perf_hud.h"
+
+static const char *TAG = "perf_hud";
+
+#define HUD_LINES           (2)         // Per strip
+#define HUD_TOP_INSET       (96)        // Keeps the top strip clear of the volume and browse buttons
+#define HUD_TEXT_LEN        (64)
+#define KB                  (1024)
+
+static struct {
+    avi_player_handle_t player;
+    lv_obj_t *top;
+    lv_obj_t *bottom;
+    lv_timer_t *timer;
+    bool visible;
+
+    // Written by the player task
+    portMUX_TYPE lock;
+    uint32_t decode_us[PERF_HUD_DECODE_SAMPLES];
+    uint32_t decode_count;
+    uint32_t presented;
+    uint32_t frame_period_us;
+    uint32_t audio_byte_rate;
+    uint32_t clip_byte_rate;            // Average movi bytes per second of the clip
+    bool av_anchored;
+    uint32_t av_frame;                  // Frame presented when its audio had just been written
+    uint64_t av_bytes;                  // Audio bytes written by then
+    int32_t av_offset_us;               // Video ahead of what is heard, the I2S queue included
+    bool av_valid;
+
+    // Last refresh
+    int64_t last_us;
+    uint32_t last_presented;
+    avi_player_stats_t last_stats;
+    uint32_t last_idle[portNUM_PROCESSORS];
+} hud = {
+    .lock = portMUX_INITIALIZER_UNLOCKED,
+};
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+#if CONFIG_FREERTOS_RUN_TIME_STATS_USING_ESP_TIMER
+/* Idle run time in esp_timer microseconds, the CPU clock would not compare with elapsed times */
+static uint32_t idle_run_time(int core)
+{
+    TaskStatus_t status;
+    vTaskGetInfo(xTaskGetIdleTaskHandleForCore(core), &status, pdFALSE, eRunning);
+    return status.ulRunTimeCounter;
+}
+#endif
+
+/* Counters the next refresh takes its rates from */
+static void hud_baseline(void)
+{
+    hud.last_us = esp_timer_get_time();
+    hud.last_presented = hud.presented;
+    avi_player_get_stats(hud.player, &hud.last_stats);
+#if CONFIG_FREERTOS_RUN_TIME_STATS_USING_ESP_TIMER
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+        hud.last_idle[i] = idle_run_time(i);
+    }
+#endif
+}
+
+/* Rate per second in tenths */
+static uint32_t per_sec_x10(uint64_t delta, int64_t elapsed_us)
+{
+    return elapsed_us > 0 ? delta * 10000000ull / elapsed_us : 0;
+}
+
+static void hud_refresh(lv_timer_t *timer)
+{
+    int64_t now = esp_timer_get_time();
+    int64_t elapsed = now - hud.last_us;
+    avi_player_stats_t st;
+    avi_player_get_stats(hud.player, &st);
+    uint32_t presented = hud.presented;
+
+    uint32_t samples[PERF_HUD_DECODE_SAMPLES];
+    uint32_t clip_byte_rate;
+    int32_t av_offset_us;
+    bool av_valid;
+    portENTER_CRITICAL(&hud.lock);
+    uint32_t n = hud.decode_count < PERF_HUD_DECODE_SAMPLES ? hud.decode_count : PERF_HUD_DECODE_SAMPLES;
+    memcpy(samples, hud.decode_us, n * sizeof(uint32_t));
+    clip_byte_rate = hud.clip_byte_rate;
+    av_offset_us = hud.av_offset_us;
+    av_valid = hud.av_valid;
+    portEXIT_CRITICAL(&hud.lock);
+    uint32_t p50 = 0, p99 = 0;
+    if (n) {
+        qsort(samples, n, sizeof(uint32_t), cmp_u32);
+        p50 = samples[n / 2];
+        p99 = samples[n * 99 / 100];
+    }
+
+    uint32_t fps = per_sec_x10(presented - hud.last_presented, elapsed);
+    uint32_t dropped = per_sec_x10(st.missed_ticks - hud.last_stats.missed_ticks, elapsed);
+    uint32_t sd = elapsed > 0 ? (st.read_bytes - hud.last_stats.read_bytes) * 100000000ull / elapsed / (KB * KB) : 0; // Hundredths of MB/s
+    uint32_t ring_s = clip_byte_rate ? (uint64_t)st.ring_fill * 10 / clip_byte_rate : 0;
+
+    char text[HUD_TEXT_LEN * HUD_LINES];
+    snprintf(text, sizeof(text), "%u.%u fps  %u.%u drop\ndecode %u.%u/%u.%u ms",
+             (unsigned)(fps / 10), (unsigned)(fps % 10), (unsigned)(dropped / 10), (unsigned)(dropped % 10),
+             (unsigned)(p50 / 1000), (unsigned)(p50 % 1000 / 100), (unsigned)(p99 / 1000), (unsigned)(p99 % 1000 / 100));
+    lv_label_set_text(hud.top, text);
+
+    char av[16] = "--";
+    if (av_valid) {
+        snprintf(av, sizeof(av), "%+d ms", (int)(av_offset_us / 1000));
+    }
+    bsp_extra_audio_stats_t audio = {};
+    bsp_extra_audio_get_stats(&audio);
+    char cpu[24] = "--";
+#if CONFIG_FREERTOS_RUN_TIME_STATS_USING_ESP_TIMER
+    int len = 0;
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+        uint32_t idle = idle_run_time(i);
+        uint32_t idle_pct = elapsed > 0 ? (uint64_t)(idle - hud.last_idle[i]) * 100 / elapsed : 100;
+        len += snprintf(cpu + len, sizeof(cpu) - len, "%s%u%%", i ? " " : "", (unsigned)(idle_pct < 100 ? 100 - idle_pct : 0));
+    }
+#endif
+    snprintf(text, sizeof(text), "ring %uK %u.%us  sd %u.%02u MB/s  av %s\ni2s ur %u  cpu %s  int %uK  psram %uK",
+             (unsigned)(st.ring_fill / KB), (unsigned)(ring_s / 10), (unsigned)(ring_s % 10),
+             (unsigned)(sd / 100), (unsigned)(sd % 100), av, (unsigned)audio.underruns, cpu,
+             (unsigned)(heap_caps_get_free_size(MALLOC_CAP_INTERNAL) / KB),
+             (unsigned)(heap_caps_get_free_size(MALLOC_CAP_SPIRAM) / KB));
+    lv_label_set_text(hud.bottom, text);
+
+    hud_baseline();
+}
+
+static lv_obj_t *strip_create(int32_t x, int32_t y, int32_t w, int32_t h)
+{
+    lv_obj_t *label = lv_label_create(lv_scr_act());
+    if (!label) {
+        return NULL;
+    }
+    // A fixed size: new text only redraws the strip, never the video next to it
+    lv_obj_set_pos(label, x, y);
+    lv_obj_set_size(label, w, h);
+    lv_label_set_long_mode(label, LV_LABEL_LONG_CLIP);
+    lv_obj_set_style_text_font(label, &lv_font_montserrat_8, 0);
+    lv_obj_set_style_text_line_space(label, 0, 0);
+    lv_obj_set_style_text_color(label, lv_color_white(), 0);
+    lv_obj_set_style_bg_color(label, lv_color_black(), 0);
+    lv_obj_set_style_bg_opa(label, LV_OPA_COVER, 0);
+    lv_obj_set_style_pad_hor(label, 2, 0);
+    lv_obj_remove_flag(label, LV_OBJ_FLAG_CLICKABLE);
+    lv_obj_add_flag(label, LV_OBJ_FLAG_HIDDEN);
+    lv_label_set_text(label, "");
+    return label;
+}
+
+esp_err_t perf_hud_init(avi_player_handle_t player, int32_t video_height)
+{
+    ESP_RETURN_ON_FALSE(!hud.top, ESP_ERR_INVALID_STATE, TAG, "Already created");
+    int32_t width = lv_display_get_horizontal_resolution(NULL);
+    int32_t strip = (lv_display_get_vertical_resolution(NULL) - video_height) / 2;
+    ESP_RETURN_ON_FALSE(strip >= HUD_LINES * lv_font_get_line_height(&lv_font_montserrat_8), ESP_ERR_INVALID_SIZE,
+                        TAG, "%d rows outside the video are too few", (int)strip * 2);
+
+    hud.player = player;
+    hud.top = strip_create(HUD_TOP_INSET, 0, width - HUD_TOP_INSET, strip);
+    hud.bottom = strip_create(0, strip + video_height, width, strip);
+    hud.timer = lv_timer_create(hud_refresh, PERF_HUD_PERIOD_MS, NULL);
+    if (!hud.top || !hud.bottom || !hud.timer) {
+        if (hud.top) {
+            lv_obj_delete(hud.top);
+        }
+        if (hud.bottom) {
+            lv_obj_delete(hud.bottom);
+        }
+        if (hud.timer) {
+            lv_timer_delete(hud.timer);
+        }
+        hud.top = hud.bottom = NULL;
+        hud.timer = NULL;
+        ESP_RETURN_ON_FALSE(false, ESP_ERR_NO_MEM, TAG, "Cannot create the HUD");
+    }
+    lv_timer_pause(hud.timer);
+    return ESP_OK;
+}
+
+void perf_hud_toggle(void)
+{
+    if (!hud.top) {
+        return;
+    }
+    hud.visible = !hud.visible;
+    if (hud.visible) {
+        lv_label_set_text(hud.top, "...");
+        lv_label_set_text(hud.bottom, "");
+        lv_obj_remove_flag(hud.top, LV_OBJ_FLAG_HIDDEN);
+        lv_obj_remove_flag(hud.bottom, LV_OBJ_FLAG_HIDDEN);
+        lv_obj_move_foreground(hud.top);
+        lv_obj_move_foreground(hud.bottom);
+        hud_baseline();
+        lv_timer_reset(hud.timer);
+        lv_timer_resume(hud.timer);
+    } else {
+        lv_timer_pause(hud.timer);
+        lv_obj_add_flag(hud.top, LV_OBJ_FLAG_HIDDEN);
+        lv_obj_add_flag(hud.bottom, LV_OBJ_FLAG_HIDDEN);
+    }
+    ESP_LOGI(TAG, "%s", hud.visible ? "Shown" : "Hidden");
+}
+
+void perf_hud_set_clip(const avi_player_file_info_t *info)
+{
+    uint64_t clip_us = info ? (uint64_t)info->total_frames * info->frame_period_us : 0;
+    portENTER_CRITICAL(&hud.lock);
+    hud.frame_period_us = info ? info->frame_period_us : 0;
+    hud.audio_byte_rate = info ? info->audio_sample_rate * info->audio_channels * (info->audio_bits / 8) : 0;
+    hud.clip_byte_rate = clip_us ? (uint64_t)info->movi_size * 1000000 / clip_us : 0;
+    hud.av_anchored = false;
+    hud.av_valid = false;
+    portEXIT_CRITICAL(&hud.lock);
+}
+
+void perf_hud_add_decode_time(uint32_t us)
+{
+    portENTER_CRITICAL(&hud.lock);
+    hud.decode_us[hud.decode_count++ % PERF_HUD_DECODE_SAMPLES] = us;
+    portEXIT_CRITICAL(&hud.lock);
+}
+
+void perf_hud_frame_presented(uint32_t frame_index)
+{
+    hud.presented++;
+    if (!hud.visible) {
+        return;
+    }
+    bsp_extra_audio_stats_t audio;
+    if (bsp_extra_audio_get_stats(&audio) != ESP_OK) {
+        return;
+    }
+    portENTER_CRITICAL(&hud.lock);
+    if (hud.audio_byte_rate && hud.frame_period_us) {
+        // The player writes a frame's audio right next to it. Loops and a new clip start over
+        if (!hud.av_anchored || frame_index < hud.av_frame || audio.bytes_written < hud.av_bytes) {
+            hud.av_anchored = true;
+            hud.av_frame = frame_index;
+            hud.av_bytes = audio.bytes_written;
+        }
+        int64_t video_us = (int64_t)(frame_index - hud.av_frame) * hud.frame_period_us;
+        int64_t heard = (int64_t)(audio.bytes_written - audio.queued_bytes) - (int64_t)hud.av_bytes;
+        hud.av_offset_us = video_us - heard * 1000000 / hud.audio_byte_rate;
+        hud.av_valid = true;
+    }
+    portEXIT_CRITICAL(&hud.lock);
+}
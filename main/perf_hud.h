@@ -0,0 +1,57 @@
+/*
+ * Performance HUD
+ *
+ * Live playback figures for diagnosing a stuttering unit without a serial cable. They are drawn
+ * in the panel rows above and below the video, so refreshing them never redraws the canvas.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "avi_player.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PERF_HUD_PERIOD_MS          (1000)
+#define PERF_HUD_DECODE_SAMPLES     (128)   // Decode times the percentiles are taken over, about 4 s at 30 fps
+
+/**
+ * @brief Create the hidden HUD on the active screen, call with the display lock held.
+ *
+ * @param player: Player whose counters are shown
+ * @param video_height: Rows of the centered video, the HUD takes the rest of the panel
+ *
+ * @return
+ *    - ESP_OK: Success
+ *    - ESP_ERR_INVALID_STATE: Already created
+ *    - ESP_ERR_INVALID_SIZE: Not enough rows left outside the video
+ *    - ESP_ERR_NO_MEM: Out of memory
+ */
+esp_err_t perf_hud_init(avi_player_handle_t player, int32_t video_height);
+
+/**
+ * @brief Show or hide the HUD, from the LVGL task or with the display lock held.
+ */
+void perf_hud_toggle(void);
+
+/**
+ * @brief A clip starts, the ring time and the A/V offset need its info. NULL if it is unknown
+ */
+void perf_hud_set_clip(const avi_player_file_info_t *info);
+
+/**
+ * @brief Time a JPEG frame took to decode, from the player task.
+ */
+void perf_hud_add_decode_time(uint32_t us);
+
+/**
+ * @brief A frame went to the canvas, decoded or from the frame cache, from the player task.
+ */
+void perf_hud_frame_presented(uint32_t frame_index);
+
+#ifdef __cplusplus
+}
+#endif
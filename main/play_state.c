@@ -0,0 +1,78 @@
+/*
+ * Playback position kept in NVS
+ */
+
+#include <string.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "esp_check.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "play_state.h"
+
+static const char *TAG = "play_state";
+
+#define PLAY_STATE_NAMESPACE    "player"
+#define PLAY_STATE_KEY          "position"
+#define PLAY_STATE_VERSION      (1)
+
+typedef struct {
+    uint32_t version;
+    play_state_t state;
+} play_state_blob_t;
+
+static play_state_t last_saved;
+static int64_t last_save_us = INT64_MIN / 2; // First save is always due
+
+esp_err_t play_state_load(play_state_t *state)
+{
+    ESP_RETURN_ON_FALSE(state, ESP_ERR_INVALID_ARG, TAG, "NULL arguments");
+    nvs_handle_t nvs;
+    if (nvs_open(PLAY_STATE_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return ESP_ERR_NOT_FOUND; // Namespace is created by the first save
+    }
+    play_state_blob_t blob;
+    size_t len = sizeof(blob);
+    esp_err_t ret = nvs_get_blob(nvs, PLAY_STATE_KEY, &blob, &len);
+    nvs_close(nvs);
+    if (ret != ESP_OK || len != sizeof(blob) || blob.version != PLAY_STATE_VERSION ||
+            !memchr(blob.state.path, '\0', sizeof(blob.state.path))) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    *state = blob.state;
+    last_saved = blob.state;
+    ESP_LOGI(TAG, "Saved position: %s, frame %"PRIu32"", state->path, state->frame);
+    return ESP_OK;
+}
+
+esp_err_t play_state_save(const play_state_t *state)
+{
+    ESP_RETURN_ON_FALSE(state, ESP_ERR_INVALID_ARG, TAG, "NULL arguments");
+    bool same_file = last_saved.clip_id == state->clip_id && strcmp(last_saved.path, state->path) == 0 &&
+                     memcmp(&last_saved.cid, &state->cid, sizeof(state->cid)) == 0;
+    if (same_file && last_saved.frame == state->frame) {
+        return ESP_OK;
+    }
+    int64_t elapsed_ms = (esp_timer_get_time() - last_save_us) / 1000;
+    if (elapsed_ms < (same_file ? PLAY_STATE_SAVE_PERIOD_MS : PLAY_STATE_MIN_PERIOD_MS)) {
+        return ESP_OK;
+    }
+
+    play_state_blob_t blob = {
+        .version = PLAY_STATE_VERSION,
+    };
+    blob.state = *state;
+    nvs_handle_t nvs;
+    ESP_RETURN_ON_ERROR(nvs_open(PLAY_STATE_NAMESPACE, NVS_READWRITE, &nvs), TAG, "Open NVS failed");
+    esp_err_t ret = nvs_set_blob(nvs, PLAY_STATE_KEY, &blob, sizeof(blob));
+    if (ret == ESP_OK) {
+        ret = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+    ESP_RETURN_ON_ERROR(ret, TAG, "Write position failed");
+
+    last_saved = *state;
+    last_save_us = esp_timer_get_time();
+    ESP_LOGD(TAG, "Position saved: %s, frame %"PRIu32"", state->path, state->frame);
+    return ESP_OK;
+}
@@ -0,0 +1,56 @@
+/*
+ * Playback position kept in NVS
+ *
+ * Lets the player continue where it was after a power cycle. Writes are rate limited so a
+ * playing video does not wear the flash.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "sdmmc_cmd.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PLAY_STATE_PATH_MAX         (256)
+#define PLAY_STATE_SAVE_PERIOD_MS   (30 * 1000) // Position updates of the same file
+#define PLAY_STATE_MIN_PERIOD_MS    (5 * 1000)  // Any write, e.g. when tracks are skipped quickly
+
+/**
+ * @brief Playback position
+ */
+typedef struct {
+    sdmmc_cid_t cid;                    /*!< Card the file is on */
+    char path[PLAY_STATE_PATH_MAX];     /*!< File path */
+    uint32_t clip_id;                   /*!< Hash of path and size, tells a replaced file apart */
+    uint32_t frame;                     /*!< Video frame */
+} play_state_t;
+
+/**
+ * @brief Read the position saved last.
+ *
+ * @return
+ *    - ESP_OK: Success
+ *    - ESP_ERR_NOT_FOUND: Nothing saved, or saved by an older firmware
+ */
+esp_err_t play_state_load(play_state_t *state);
+
+/**
+ * @brief Save the position, call it as often as convenient.
+ *
+ * A new file is written once PLAY_STATE_MIN_PERIOD_MS passed since the last write, a new
+ * position in the same file once PLAY_STATE_SAVE_PERIOD_MS passed. Skipped updates are
+ * simply dropped, the next call carries a newer position anyway.
+ *
+ * @return
+ *    - ESP_OK: Written or not due yet
+ *    - Others: NVS error
+ */
+esp_err_t play_state_save(const play_state_t *state);
+
+#ifdef __cplusplus
+}
+#endif
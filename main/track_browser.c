@@ -0,0 +1,299 @@
+/*
+ * Track browser
+ *
+ * A fixed pool of rows is moved along the scrolled list, row r always shows a file whose
+ * index is r modulo the pool size. Binding a row to a file queues its thumbnail; the
+ * thumbnail task drops requests of rows that moved on or of a browser that was closed.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_check.h"
+#include "lvgl.h"
+#include "bsp/esp-bsp.h"
+#include "track_browser.h"
+#include "buf_pool.h"
+
+static const char *TAG = "track_browser";
+
+#define BROWSER_HEADER_HEIGHT   (40)
+#define BROWSER_ROW_HEIGHT      (TRACK_BROWSER_THUMB_SIZE + 8)
+#define BROWSER_ROWS            (5)  // At most 3 rows are visible, 2 more cover a scroll step
+#define BROWSER_PATH_MAX        (256)
+#define THUMB_BYTES             (TRACK_BROWSER_THUMB_SIZE * TRACK_BROWSER_THUMB_SIZE * 2)
+#define THUMB_QUEUE_LEN         (BROWSER_ROWS * 2)
+#define THUMB_TASK_STACK        (4 * 1024)
+#define THUMB_TASK_PRIORITY     (3)  // Below playback and input
+
+typedef struct {
+    int index;
+    int row;
+    uint32_t generation;
+} thumb_request_t;
+
+typedef struct {
+    lv_obj_t *obj;
+    lv_obj_t *image;
+    lv_obj_t *label;
+    lv_image_dsc_t dsc;
+    uint8_t *pixels;
+    volatile int index;         // File shown, -1 if the row is unused
+} browser_row_t;
+
+static struct {
+    lv_obj_t *panel;
+    lv_obj_t *list;
+    browser_row_t rows[BROWSER_ROWS];
+    file_iterator_instance_t *files;
+    thumb_cache_handle_t thumbs;
+    track_browser_select_cb_t select_cb;
+    void *user_data;
+    volatile uint32_t generation;   // Changes on open and close, older requests are dropped
+    QueueHandle_t queue;
+    SemaphoreHandle_t busy;         // Held by the thumbnail task while it uses files and thumbs
+    uint8_t *thumb_buf;
+} browser;
+
+static void thumb_task(void *arg)
+{
+    char path[BROWSER_PATH_MAX];
+    thumb_request_t req;
+    while (1) {
+        xQueueReceive(browser.queue, &req, portMAX_DELAY);
+        xSemaphoreTake(browser.busy, portMAX_DELAY);
+        browser_row_t *row = &browser.rows[req.row];
+        if (req.generation != browser.generation || row->index != req.index) {
+            xSemaphoreGive(browser.busy);
+            continue; // Scrolled past or closed
+        }
+
+        int len = file_iterator_get_full_path_from_index(browser.files, req.index, path, sizeof(path));
+        esp_err_t ret = ESP_ERR_INVALID_SIZE;
+        if (len > 0 && len < sizeof(path)) {
+            ret = thumb_cache_get(browser.thumbs, path, browser.thumb_buf);
+        }
+
+        bsp_display_lock(0);
+        if (ret == ESP_OK && req.generation == browser.generation && row->index == req.index) {
+            memcpy(row->pixels, browser.thumb_buf, THUMB_BYTES);
+            lv_image_cache_drop(&row->dsc);
+            lv_image_set_src(row->image, &row->dsc);
+            lv_obj_clear_flag(row->image, LV_OBJ_FLAG_HIDDEN);
+        }
+        bsp_display_unlock();
+        xSemaphoreGive(browser.busy);
+    }
+}
+
+static esp_err_t browser_init(void)
+{
+    if (browser.queue) {
+        return ESP_OK;
+    }
+    for (int r = 0; r < BROWSER_ROWS; r++) {
+        browser.rows[r].pixels = buf_pool_alloc(BUF_OWNER_BROWSER, BUF_ACCESS_BULK, THUMB_BYTES);
+        ESP_RETURN_ON_FALSE(browser.rows[r].pixels, ESP_ERR_NO_MEM, TAG, "no mem for row %d", r);
+    }
+    browser.thumb_buf = buf_pool_alloc(BUF_OWNER_BROWSER, BUF_ACCESS_BULK, THUMB_BYTES);
+    ESP_RETURN_ON_FALSE(browser.thumb_buf, ESP_ERR_NO_MEM, TAG, "no mem for thumbnail");
+    browser.busy = xSemaphoreCreateMutex();
+    ESP_RETURN_ON_FALSE(browser.busy, ESP_ERR_NO_MEM, TAG, "no mem for mutex");
+    QueueHandle_t queue = xQueueCreate(THUMB_QUEUE_LEN, sizeof(thumb_request_t));
+    ESP_RETURN_ON_FALSE(queue, ESP_ERR_NO_MEM, TAG, "no mem for queue");
+    if (xTaskCreatePinnedToCore(thumb_task, "thumb_task", THUMB_TASK_STACK, NULL, THUMB_TASK_PRIORITY, NULL, 0) != pdPASS) {
+        vQueueDelete(queue);
+        ESP_LOGE(TAG, "Cannot create thumbnail task");
+        return ESP_ERR_NO_MEM;
+    }
+    browser.queue = queue;
+    return ESP_OK;
+}
+
+static void row_bind(int r, int index)
+{
+    browser_row_t *row = &browser.rows[r];
+    if (index >= file_iterator_get_count(browser.files)) {
+        row->index = -1;
+        lv_obj_add_flag(row->obj, LV_OBJ_FLAG_HIDDEN);
+        return;
+    }
+    lv_obj_clear_flag(row->obj, LV_OBJ_FLAG_HIDDEN);
+    lv_obj_set_y(row->obj, index * BROWSER_ROW_HEIGHT);
+    if (row->index == index) {
+        return;
+    }
+
+    row->index = index;
+    lv_label_set_text(row->label, file_iterator_get_name_from_index(browser.files, index));
+    lv_obj_add_flag(row->image, LV_OBJ_FLAG_HIDDEN); // Until its thumbnail arrives
+
+    thumb_request_t req = {
+        .index = index,
+        .row = r,
+        .generation = browser.generation,
+    };
+    if (xQueueSend(browser.queue, &req, 0) != pdTRUE) {
+        // Full while scrolling fast, the oldest request is the least likely to be on screen
+        thumb_request_t oldest;
+        xQueueReceive(browser.queue, &oldest, 0);
+        xQueueSend(browser.queue, &req, 0);
+    }
+}
+
+static void list_refresh(void)
+{
+    int first = lv_obj_get_scroll_y(browser.list) / BROWSER_ROW_HEIGHT;
+    if (first < 0) {
+        first = 0;
+    }
+    for (int index = first; index < first + BROWSER_ROWS; index++) {
+        row_bind(index % BROWSER_ROWS, index);
+    }
+}
+
+static void list_scroll_cb(lv_event_t *e)
+{
+    list_refresh();
+}
+
+static void browser_hide(void)
+{
+    if (!browser.panel) {
+        return;
+    }
+    browser.generation++;
+    for (int r = 0; r < BROWSER_ROWS; r++) {
+        lv_image_cache_drop(&browser.rows[r].dsc);
+        browser.rows[r].index = -1;
+    }
+    lv_obj_delete(browser.panel);
+    browser.panel = NULL;
+    browser.list = NULL;
+}
+
+static void row_click_cb(lv_event_t *e)
+{
+    int index = browser.rows[(intptr_t)lv_event_get_user_data(e)].index;
+    browser_hide();
+    if (browser.select_cb) {
+        browser.select_cb(index, browser.user_data);
+    }
+}
+
+static void close_click_cb(lv_event_t *e)
+{
+    browser_hide();
+    if (browser.select_cb) {
+        browser.select_cb(-1, browser.user_data);
+    }
+}
+
+static void row_create(int r)
+{
+    browser_row_t *row = &browser.rows[r];
+    row->index = -1;
+    row->dsc = (lv_image_dsc_t) {
+        .header = {
+            .magic = LV_IMAGE_HEADER_MAGIC,
+            .cf = LV_COLOR_FORMAT_RGB565,
+            .w = TRACK_BROWSER_THUMB_SIZE,
+            .h = TRACK_BROWSER_THUMB_SIZE,
+            .stride = TRACK_BROWSER_THUMB_SIZE * 2,
+        },
+        .data_size = THUMB_BYTES,
+        .data = row->pixels,
+    };
+
+    row->obj = lv_obj_create(browser.list);
+    lv_obj_remove_style_all(row->obj);
+    lv_obj_set_size(row->obj, lv_pct(100), BROWSER_ROW_HEIGHT);
+    lv_obj_clear_flag(row->obj, LV_OBJ_FLAG_SCROLLABLE);
+    lv_obj_add_flag(row->obj, LV_OBJ_FLAG_CLICKABLE | LV_OBJ_FLAG_HIDDEN);
+    lv_obj_set_style_bg_color(row->obj, lv_palette_main(LV_PALETTE_BLUE), LV_STATE_PRESSED);
+    lv_obj_set_style_bg_opa(row->obj, LV_OPA_50, LV_STATE_PRESSED);
+    lv_obj_add_event_cb(row->obj, row_click_cb, LV_EVENT_CLICKED, (void *)(intptr_t)r);
+
+    row->image = lv_image_create(row->obj);
+    lv_obj_align(row->image, LV_ALIGN_LEFT_MID, 8, 0);
+
+    row->label = lv_label_create(row->obj);
+    lv_obj_set_width(row->label, LV_HOR_RES - TRACK_BROWSER_THUMB_SIZE - 24);
+    lv_label_set_long_mode(row->label, LV_LABEL_LONG_DOT);
+    lv_obj_set_style_text_color(row->label, lv_color_white(), 0);
+    lv_obj_align(row->label, LV_ALIGN_LEFT_MID, TRACK_BROWSER_THUMB_SIZE + 16, 0);
+}
+
+esp_err_t track_browser_open(file_iterator_instance_t *files, thumb_cache_handle_t thumbs,
+                             track_browser_select_cb_t select_cb, void *user_data)
+{
+    ESP_RETURN_ON_FALSE(files && thumbs, ESP_ERR_INVALID_ARG, TAG, "NULL arguments");
+    ESP_RETURN_ON_FALSE(!browser.panel, ESP_ERR_INVALID_STATE, TAG, "already shown");
+    ESP_RETURN_ON_ERROR(browser_init(), TAG, "init failed");
+
+    browser.files = files;
+    browser.thumbs = thumbs;
+    browser.select_cb = select_cb;
+    browser.user_data = user_data;
+    browser.generation++;
+
+    browser.panel = lv_obj_create(lv_layer_top());
+    lv_obj_remove_style_all(browser.panel);
+    lv_obj_set_size(browser.panel, LV_HOR_RES, LV_VER_RES);
+    lv_obj_set_style_bg_color(browser.panel, lv_color_black(), 0);
+    lv_obj_set_style_bg_opa(browser.panel, LV_OPA_COVER, 0);
+    lv_obj_clear_flag(browser.panel, LV_OBJ_FLAG_SCROLLABLE);
+
+    lv_obj_t *title = lv_label_create(browser.panel);
+    lv_label_set_text(title, "Tracks");
+    lv_obj_set_style_text_color(title, lv_color_white(), 0);
+    lv_obj_set_style_text_font(title, &lv_font_montserrat_20, 0);
+    lv_obj_align(title, LV_ALIGN_TOP_MID, 0, 10);
+
+    lv_obj_t *close_btn = lv_btn_create(browser.panel);
+    lv_obj_set_size(close_btn, 40, 32);
+    lv_obj_align(close_btn, LV_ALIGN_TOP_RIGHT, -5, 4);
+    lv_obj_add_event_cb(close_btn, close_click_cb, LV_EVENT_CLICKED, NULL);
+    lv_obj_t *close_lbl = lv_label_create(close_btn);
+    lv_label_set_text(close_lbl, LV_SYMBOL_CLOSE);
+    lv_obj_center(close_lbl);
+
+    browser.list = lv_obj_create(browser.panel);
+    lv_obj_remove_style_all(browser.list);
+    lv_obj_set_size(browser.list, LV_HOR_RES, LV_VER_RES - BROWSER_HEADER_HEIGHT);
+    lv_obj_align(browser.list, LV_ALIGN_BOTTOM_MID, 0, 0);
+    lv_obj_set_scroll_dir(browser.list, LV_DIR_VER);
+    lv_obj_add_event_cb(browser.list, list_scroll_cb, LV_EVENT_SCROLL, NULL);
+
+    // Gives the list its full height, rows only exist for the visible part
+    lv_obj_t *spacer = lv_obj_create(browser.list);
+    lv_obj_remove_style_all(spacer);
+    lv_obj_set_size(spacer, 1, file_iterator_get_count(files) * BROWSER_ROW_HEIGHT);
+    lv_obj_clear_flag(spacer, LV_OBJ_FLAG_CLICKABLE);
+
+    for (int r = 0; r < BROWSER_ROWS; r++) {
+        row_create(r);
+    }
+    list_refresh();
+    ESP_LOGI(TAG, "Browsing %u tracks", file_iterator_get_count(files));
+    return ESP_OK;
+}
+
+void track_browser_close(void)
+{
+    bsp_display_lock(0);
+    browser_hide();
+    bsp_display_unlock();
+
+    // The task checks the generation first, once it is idle it no longer touches files or thumbs
+    if (browser.busy) {
+        xSemaphoreTake(browser.busy, portMAX_DELAY);
+        browser.files = NULL;
+        browser.thumbs = NULL;
+        xSemaphoreGive(browser.busy);
+    }
+}
@@ -0,0 +1,52 @@
+/*
+ * Track browser
+ *
+ * Scrollable list of the videos on the card with a thumbnail per video. Only the visible
+ * rows exist, thumbnails are fetched from the thumbnail cache by a background task.
+ */
+
+#pragma once
+
+#include "esp_err.h"
+#include "file_iterator.h"
+#include "thumb_cache.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TRACK_BROWSER_THUMB_SIZE    (80) // Thumbnail width and height in pixels
+
+/**
+ * @brief Called when the browser closes, from the LVGL task.
+ *
+ * @param index: File iterator index of the tapped video, -1 if closed without a choice
+ */
+typedef void (*track_browser_select_cb_t)(int index, void *user_data);
+
+/**
+ * @brief Show the browser on the top layer. Call with the display lock held.
+ *
+ * @param files: Videos to list, must stay valid until track_browser_close()
+ * @param thumbs: Thumbnail cache, used only by the browser until track_browser_close()
+ * @param select_cb: Called when the browser closes
+ *
+ * @return
+ *    - ESP_OK: Success
+ *    - ESP_ERR_INVALID_STATE: Already shown
+ *    - ESP_ERR_NO_MEM: Out of memory
+ */
+esp_err_t track_browser_open(file_iterator_instance_t *files, thumb_cache_handle_t thumbs,
+                             track_browser_select_cb_t select_cb, void *user_data);
+
+/**
+ * @brief Remove the browser and wait until the thumbnail in progress is done.
+ *
+ * Call without the display lock before the file list or the thumbnail cache is freed.
+ * select_cb is not called.
+ */
+void track_browser_close(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -18,55 +18,231 @@
  */
 
 #include <dirent.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include "esp_check.h"
 #include "esp_log.h"
 #include "file_iterator.h"
 
 static const char *TAG = "file_iterator";
 
+#define SCAN_PATH_MAX   (256)
+
+typedef struct {
+    file_iterator_instance_t *i;
+    const file_iterator_config_t *config;
+    size_t names_len;
+    size_t names_cap;
+    size_t offsets_cap;
+    char path[SCAN_PATH_MAX];   /*!< base_path/relative of the folder being read */
+    size_t base_len;            /*!< Length of base_path plus separator in path */
+} file_scan_ctx_t;
+
+static bool name_accepted(const file_scan_ctx_t *ctx, const char *name)
+{
+    const char *const *ext = ctx->config->extensions;
+    if (ext == NULL) {
+        return true;
+    }
+    const char *dot = strrchr(name, '.');
+    if (dot == NULL) {
+        return false;
+    }
+    for (; *ext; ext++) {
+        if (strcasecmp(dot, *ext) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Append relative name to the arena, names are referenced by offset so the arena can move */
+static esp_err_t name_add(file_scan_ctx_t *ctx, const char *rel_dir, const char *name)
+{
+    file_iterator_instance_t *i = ctx->i;
+    size_t dir_len = strlen(rel_dir);
+    size_t len = dir_len + (dir_len ? 1 : 0) + strlen(name) + 1;
+
+    if (i->count == ctx->offsets_cap) {
+        size_t cap = ctx->offsets_cap ? ctx->offsets_cap * 2 : 32;
+        uint32_t *offsets = realloc(i->offsets, cap * sizeof(uint32_t));
+        ESP_RETURN_ON_FALSE(offsets, ESP_ERR_NO_MEM, TAG, "Failed allocate file list");
+        i->offsets = offsets;
+        ctx->offsets_cap = cap;
+    }
+    if (ctx->names_len + len > ctx->names_cap) {
+        size_t cap = ctx->names_cap ? ctx->names_cap * 2 : 1024;
+        while (cap < ctx->names_len + len) {
+            cap *= 2;
+        }
+        char *names = realloc(i->names, cap);
+        ESP_RETURN_ON_FALSE(names, ESP_ERR_NO_MEM, TAG, "Failed allocate file names");
+        i->names = names;
+        ctx->names_cap = cap;
+    }
+
+    char *dst = i->names + ctx->names_len;
+    if (dir_len) {
+        sprintf(dst, "%s/%s", rel_dir, name);
+    } else {
+        strcpy(dst, name);
+    }
+    i->offsets[i->count++] = ctx->names_len;
+    ctx->names_len += len;
+    return ESP_OK;
+}
+
+/* Read the folder at ctx->path once, descending into subfolders up to max_depth */
+static esp_err_t dir_scan(file_scan_ctx_t *ctx, int depth)
+{
+    DIR *dir = opendir(ctx->path);
+    if (dir == NULL) {
+        ESP_LOGW(TAG, "Cannot open %s", ctx->path);
+        return depth == 0 ? ESP_ERR_NOT_FOUND : ESP_OK;
+    }
+
+    esp_err_t ret = ESP_OK;
+    size_t path_len = strlen(ctx->path);
+    const char *rel_dir = path_len > ctx->base_len ? ctx->path + ctx->base_len : "";
+    struct dirent *p_dirent;
+    while (ret == ESP_OK && (p_dirent = readdir(dir)) != NULL) {
+        if (p_dirent->d_name[0] == '.') {
+            continue;
+        }
+        if (p_dirent->d_type == DT_DIR) {
+            if (depth >= ctx->config->max_depth) {
+                continue;
+            }
+            if (path_len + 1 + strlen(p_dirent->d_name) >= SCAN_PATH_MAX) {
+                ESP_LOGW(TAG, "Path too long, skipping %s/%s", ctx->path, p_dirent->d_name);
+                continue;
+            }
+            sprintf(ctx->path + path_len, "/%s", p_dirent->d_name);
+            ret = dir_scan(ctx, depth + 1);
+            ctx->path[path_len] = '\0';
+        } else if (name_accepted(ctx, p_dirent->d_name)) {
+            ret = name_add(ctx, rel_dir, p_dirent->d_name);
+        }
+    }
+    closedir(dir);
+    return ret;
+}
+
+/* Case insensitive compare where runs of digits compare by numeric value */
+static int natural_cmp(const char *a, const char *b)
+{
+    while (*a && *b) {
+        if (isdigit((unsigned char)*a) && isdigit((unsigned char)*b)) {
+            while (*a == '0') {
+                a++;
+            }
+            while (*b == '0') {
+                b++;
+            }
+            const char *da = a, *db = b;
+            while (isdigit((unsigned char)*a)) {
+                a++;
+            }
+            while (isdigit((unsigned char)*b)) {
+                b++;
+            }
+            size_t la = a - da, lb = b - db;
+            if (la != lb) {
+                return la < lb ? -1 : 1;
+            }
+            int c = strncmp(da, db, la);
+            if (c) {
+                return c;
+            }
+            continue;
+        }
+        int ca = tolower((unsigned char)*a), cb = tolower((unsigned char)*b);
+        if (ca != cb) {
+            return ca - cb;
+        }
+        a++;
+        b++;
+    }
+    return (unsigned char)*a - (unsigned char)*b;
+}
+
+static int name_ptr_cmp(const void *a, const void *b)
+{
+    return natural_cmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+static esp_err_t names_sort(file_iterator_instance_t *i)
+{
+    if (i->count < 2) {
+        return ESP_OK;
+    }
+    // qsort has no context argument, sort pointers and turn them back into offsets
+    const char **names = malloc(i->count * sizeof(char *));
+    ESP_RETURN_ON_FALSE(names, ESP_ERR_NO_MEM, TAG, "Failed allocate sort buffer");
+    for (size_t n = 0; n < i->count; n++) {
+        names[n] = i->names + i->offsets[n];
+    }
+    qsort(names, i->count, sizeof(char *), name_ptr_cmp);
+    for (size_t n = 0; n < i->count; n++) {
+        i->offsets[n] = names[n] - i->names;
+    }
+    free(names);
+    return ESP_OK;
+}
+
+/* Plain listing of every entry, the behaviour of file_iterator_new() */
+static esp_err_t dir_list(file_scan_ctx_t *ctx)
+{
+    DIR *dir = opendir(ctx->path);
+    ESP_RETURN_ON_FALSE(dir, ESP_ERR_NOT_FOUND, TAG, "Cannot open %s", ctx->path);
+    esp_err_t ret = ESP_OK;
+    struct dirent *p_dirent;
+    while (ret == ESP_OK && (p_dirent = readdir(dir)) != NULL) {
+        ret = name_add(ctx, "", p_dirent->d_name);
+    }
+    closedir(dir);
+    return ret;
+}
+
 /**
- * @brief Scans the given base_path, if any errors occur memory allocated and assigned
+ * @brief Scans the given base_path in a single pass, if any errors occur memory allocated and assigned
  * to instance entries is freed.
  */
-static esp_err_t file_scan(file_iterator_instance_t *i, const char *base_path)
+static esp_err_t file_scan(file_iterator_instance_t *i, const char *base_path, const file_iterator_config_t *config)
 {
     i->count = 0;
-    struct dirent *p_dirent = NULL;
-    DIR *p_dir_stream = opendir(base_path);
+    i->offsets = NULL;
+    i->names = NULL;
 
-    do {    /* Get total file count */
-        p_dirent = readdir(p_dir_stream);
-        if (NULL != p_dirent) {
-            i->count++;
-        } else {
-            closedir(p_dir_stream);
-            break;
-        }
-    } while (1);
-
-    i->list = (char **) malloc(i->count * sizeof(char *));
-    ESP_RETURN_ON_FALSE(NULL != i->list, ESP_ERR_NO_MEM,
-        TAG, "Failed allocate audio list buffer");
-
-    p_dir_stream = opendir(base_path);
-    for (size_t file_index = 0; file_index < i->count; file_index++) {
-        p_dirent = readdir(p_dir_stream);
-        if (NULL != p_dirent) {
-            i->list[file_index] = malloc(sizeof(p_dirent->d_name));
-            ESP_LOGI(TAG, "File : %s", strcpy(i->list[file_index], p_dirent->d_name));
-        } else {
-            ESP_LOGE(TAG, "The file system may be corrupted");
-            closedir(p_dir_stream);
-            for (int j = file_index - 1; j >= 0; j--) {
-                free(i->list[file_index]);
-            }
-            free(i->list);
-            return ESP_ERR_INVALID_STATE;
-        }
+    ESP_RETURN_ON_FALSE(strlen(base_path) < SCAN_PATH_MAX, ESP_ERR_INVALID_ARG, TAG, "Base path too long");
+    file_scan_ctx_t *ctx = calloc(1, sizeof(file_scan_ctx_t));
+    ESP_RETURN_ON_FALSE(ctx, ESP_ERR_NO_MEM, TAG, "Failed allocate scan context");
+    ctx->i = i;
+    ctx->config = config;
+    strcpy(ctx->path, base_path);
+    ctx->base_len = strlen(base_path) + 1;
+
+    esp_err_t ret = config ? dir_scan(ctx, 0) : dir_list(ctx);
+    if (ret == ESP_OK && config && config->natural_sort) {
+        ret = names_sort(i);
     }
+    free(ctx);
 
-    closedir(p_dir_stream);
+    if (ret != ESP_OK) {
+        free(i->offsets);
+        free(i->names);
+        i->offsets = NULL;
+        i->names = NULL;
+        i->count = 0;
+        return ret;
+    }
+    for (size_t n = 0; n < i->count; n++) {
+        ESP_LOGD(TAG, "File : %s", i->names + i->offsets[n]);
+    }
+    ESP_LOGI(TAG, "%u files in %s", i->count, base_path);
     return ESP_OK;
 }
 
@@ -96,13 +272,10 @@ const char* file_iterator_get_name_from_index(file_iterator_instance_t *i, size_
     ESP_RETURN_ON_FALSE(index < i->count, NULL,
         TAG, "File index out of range");
 
-    ESP_RETURN_ON_FALSE(NULL != i->list, NULL,
-        TAG, "File not found");
-
-    ESP_RETURN_ON_FALSE(NULL != i->list[index], NULL,
+    ESP_RETURN_ON_FALSE(NULL != i->offsets && NULL != i->names, NULL,
         TAG, "File not found");
 
-    return i->list[index];
+    return i->names + i->offsets[index];
 }
 
 int file_iterator_get_full_path_from_index(file_iterator_instance_t* i, size_t index, char* path, size_t path_len)
@@ -135,7 +308,7 @@ esp_err_t file_iterator_prev(file_iterator_instance_t *i)
     return ESP_OK;
 }
 
-file_iterator_instance_t* file_iterator_new(const char *base_path)
+file_iterator_instance_t* file_iterator_new_ex(const char *base_path, const file_iterator_config_t *config)
 {
     file_iterator_instance_t *i = NULL;
     esp_err_t ret;
@@ -143,8 +316,9 @@ file_iterator_instance_t* file_iterator_new(const char *base_path)
     /* Scan audio file */
     if (NULL != base_path) {
         i = malloc(sizeof(file_iterator_instance_t));
+        ESP_RETURN_ON_FALSE(i, NULL, TAG, "Failed allocate iterator");
         i->index = 0;
-        ret = file_scan(i, base_path);
+        ret = file_scan(i, base_path, config);
         if(ret == ESP_OK) {
             i->directory_path = strdup(base_path);
         } else {
@@ -157,3 +331,19 @@ file_iterator_instance_t* file_iterator_new(const char *base_path)
 
     return i;
 }
+
+file_iterator_instance_t* file_iterator_new(const char *base_path)
+{
+    return file_iterator_new_ex(base_path, NULL);
+}
+
+void file_iterator_delete(file_iterator_instance_t *i)
+{
+    if (i == NULL) {
+        return;
+    }
+    free(i->offsets);
+    free(i->names);
+    free((void *)i->directory_path);
+    free(i);
+}
@@ -20,6 +20,8 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include "esp_err.h"
 
 #ifdef __cplusplus
@@ -29,10 +31,20 @@ extern "C" {
 typedef struct  {
     size_t count;
     size_t index;
-    char **list;
+    uint32_t *offsets;          /*!< Start of each name in names */
+    char *names;                /*!< All names, NUL separated, relative to directory_path */
     const char *directory_path;
 } file_iterator_instance_t;
 
+/**
+ * @brief Scan options for file_iterator_new_ex()
+ */
+typedef struct {
+    const char *const *extensions;  /*!< NULL terminated list of accepted extensions such as ".avi", case insensitive. NULL accepts all files */
+    uint8_t max_depth;              /*!< Subfolder levels to descend into, 0 scans base_path only */
+    bool natural_sort;              /*!< Sort names so that "clip2" comes before "clip10" */
+} file_iterator_config_t;
+
 /**
  * @brief Initialize the iterator
  *
@@ -43,6 +55,18 @@ typedef struct  {
  */
 file_iterator_instance_t* file_iterator_new(const char *base_path);
 
+/**
+ * @brief Initialize the iterator with scan options
+ *
+ * The directory tree is read once. Names of files in subfolders include the subfolder
+ * ("sub/clip.avi"), folders themselves and hidden entries (starting with '.') are not listed.
+ *
+ * @param base_path Folder containing files file(s)
+ * @param config Scan options, NULL lists every entry of base_path in directory order like file_iterator_new()
+ * @return Iterator instance, NULL if base_path cannot be read or on allocation failure
+ */
+file_iterator_instance_t* file_iterator_new_ex(const char *base_path, const file_iterator_config_t *config);
+
 /**
  * @brief Delete the iterator instance
  *
@@ -0,0 +1,202 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_check.h"
+#include "esp_timer.h"
+#include "avi_io_fault.h"
+
+static const char *TAG = "avi io fault";
+
+typedef struct {
+    uint32_t bytes;
+    uint32_t us;
+} trace_entry_t;
+
+struct avi_io_fault {
+    avi_io_fault_cfg_t cfg;
+    int64_t start;                 // Stalls are placed from here
+    trace_entry_t *trace;
+    size_t trace_len;
+    size_t trace_pos;
+    FILE *record;
+    void *timer;                   // One shot of cfg.clock a read waits for
+    SemaphoreHandle_t timer_done;
+    avi_io_fault_stats_t stats;
+};
+
+static int64_t fault_now(avi_io_fault_t *fault)
+{
+    return fault->cfg.clock ? fault->cfg.clock->get_time(fault->cfg.clock) : esp_timer_get_time();
+}
+
+static void fault_timer_cb(void *arg)
+{
+    avi_io_fault_t *fault = arg;
+    xSemaphoreGive(fault->timer_done);
+}
+
+/* Block until deadline on the clock of the player */
+static void fault_wait(avi_io_fault_t *fault, int64_t deadline)
+{
+    avi_player_clock_t *clock = fault->cfg.clock;
+    int64_t now = fault_now(fault);
+    if (deadline <= now) {
+        return;
+    }
+    if (!clock) {
+        while (esp_timer_get_time() < deadline) {
+            vTaskDelay(1);
+        }
+        return;
+    }
+    /*!< Handled once started as well, a virtual clock only moves on when the starter waits */
+    clock->timer_start(clock, fault->timer, deadline - now, false);
+    if (clock->timer_handled) {
+        clock->timer_handled(clock, fault->timer);
+    }
+    xSemaphoreTake(fault->timer_done, portMAX_DELAY);
+    if (clock->timer_handled) {
+        clock->timer_handled(clock, fault->timer);
+    }
+}
+
+static esp_err_t load_trace(avi_io_fault_t *fault, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    ESP_RETURN_ON_FALSE(f, ESP_ERR_NOT_FOUND, TAG, "Cannot open trace %s", path);
+    esp_err_t ret = ESP_OK;
+    size_t cap = 0;
+    uint32_t bytes, us;
+    char line[64];
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%" SCNu32 " %" SCNu32, &bytes, &us) != 2 || bytes == 0) {
+            continue; // Comments and empty lines
+        }
+        if (fault->trace_len == cap) {
+            cap = cap ? cap * 2 : 256;
+            trace_entry_t *trace = realloc(fault->trace, cap * sizeof(trace_entry_t));
+            ESP_GOTO_ON_FALSE(trace, ESP_ERR_NO_MEM, err, TAG, "Cannot allocate trace");
+            fault->trace = trace;
+        }
+        fault->trace[fault->trace_len++] = (trace_entry_t) {
+            .bytes = bytes, .us = us
+        };
+    }
+    ESP_GOTO_ON_FALSE(fault->trace_len, ESP_ERR_INVALID_SIZE, err, TAG, "No reads in trace %s", path);
+err:
+    fclose(f);
+    return ret;
+}
+
+esp_err_t avi_io_fault_create(const avi_io_fault_cfg_t *cfg, avi_io_fault_t **fault)
+{
+    ESP_RETURN_ON_FALSE(cfg && fault, ESP_ERR_INVALID_ARG, TAG, "NULL arguments");
+    ESP_RETURN_ON_FALSE(!cfg->stall_every_ms || cfg->stall_ms < cfg->stall_every_ms, ESP_ERR_INVALID_ARG, TAG,
+                        "Stall of %" PRIu32 " ms does not fit its period", cfg->stall_ms);
+    esp_err_t ret = ESP_OK;
+    avi_io_fault_t *f = calloc(1, sizeof(avi_io_fault_t));
+    ESP_RETURN_ON_FALSE(f, ESP_ERR_NO_MEM, TAG, "Cannot allocate fault injector");
+    f->cfg = *cfg;
+    if (cfg->trace_path) {
+        ESP_GOTO_ON_ERROR(load_trace(f, cfg->trace_path), err, TAG, "Trace load failed");
+    }
+    if (cfg->record_path) {
+        f->record = fopen(cfg->record_path, "w");
+        ESP_GOTO_ON_FALSE(f->record, ESP_ERR_NOT_FOUND, err, TAG, "Cannot create %s", cfg->record_path);
+    }
+    if (cfg->clock) {
+        f->timer_done = xSemaphoreCreateBinary();
+        ESP_GOTO_ON_FALSE(f->timer_done, ESP_ERR_NO_MEM, err, TAG, "Cannot create timer semaphore");
+        ESP_GOTO_ON_ERROR(cfg->clock->timer_create(cfg->clock, fault_timer_cb, f, &f->timer), err, TAG, "Cannot create timer");
+    }
+    f->start = fault_now(f);
+    *fault = f;
+    return ESP_OK;
+err:
+    avi_io_fault_delete(f);
+    return ret;
+}
+
+void avi_io_fault_apply(avi_io_fault_t *fault, size_t len, int64_t elapsed_us)
+{
+    int64_t end = fault_now(fault);
+    int64_t begin = end - elapsed_us;
+    if (fault->record) {
+        fprintf(fault->record, "%u %" PRId64 "\n", (unsigned)len, elapsed_us);
+    }
+
+    int64_t duration = 0;
+    if (fault->trace_len) {
+        const trace_entry_t *e = &fault->trace[fault->trace_pos];
+        fault->trace_pos = (fault->trace_pos + 1) % fault->trace_len;
+        duration = (int64_t)e->us * len / e->bytes;
+    }
+    if (fault->cfg.rate_kbps) {
+        duration += (int64_t)len * 1000000 / (fault->cfg.rate_kbps * 1024LL);
+    }
+    if (duration < elapsed_us) {
+        duration = elapsed_us;
+    }
+
+    // The card does not move during a stall, the read needs duration outside of them
+    int64_t deadline = begin + duration;
+    if (fault->cfg.stall_every_ms) {
+        int64_t every = fault->cfg.stall_every_ms * 1000LL;
+        int64_t stall = fault->cfg.stall_ms * 1000LL;
+        int64_t t = begin;
+        int64_t left = duration;
+        for (;;) {
+            int64_t k = (t - fault->start) / every;
+            int64_t stall_end = fault->start + k * every + stall;
+            if (k > 0 && t < stall_end) {
+                fault->stats.stalls++;
+                t = stall_end;
+            }
+            int64_t next = fault->start + (k + 1) * every;
+            if (t + left <= next) {
+                break;
+            }
+            left -= next - t;
+            t = next;
+        }
+        deadline = t + left;
+    }
+
+    fault->stats.reads++;
+    fault->stats.bytes += len;
+    if (deadline > end) {
+        fault->stats.injected_us += deadline - end;
+    }
+    fault_wait(fault, deadline);
+}
+
+void avi_io_fault_get_stats(avi_io_fault_t *fault, avi_io_fault_stats_t *stats)
+{
+    *stats = fault->stats;
+}
+
+void avi_io_fault_delete(avi_io_fault_t *fault)
+{
+    if (!fault) {
+        return;
+    }
+    if (fault->record) {
+        fclose(fault->record);
+    }
+    if (fault->timer) {
+        fault->cfg.clock->timer_delete(fault->cfg.clock, fault->timer);
+    }
+    if (fault->timer_done) {
+        vSemaphoreDelete(fault->timer_done);
+    }
+    free(fault->trace);
+    free(fault);
+}
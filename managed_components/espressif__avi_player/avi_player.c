@@ -9,6 +9,7 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
+#include "freertos/queue.h"
 #include "freertos/idf_additions.h"
 #include "esp_timer.h"
 #include "esp_log.h"
@@ -16,12 +17,33 @@
 #include "esp_check.h"
 #include "esp_idf_version.h"
 #include "esp_heap_caps.h"
+#include "esp_memory_utils.h"
+#include "ff.h"
+#include "diskio_sdmmc.h"
 
 #include "avifile.h"
 #include "avi_player.h"
+#include "fat_extent.h"
+#include "avi_trace.h"
 
 static const char *TAG = "avi player";
 
+#define AVI_PROBE_HEADER_SIZE (64 * 1024)
+#define AVI_RING_BUFFER_SIZE  (CONFIG_AVI_PLAYER_RING_SIZE_KB * 1024)
+#define AVI_READ_CHUNK_SIZE   (AVI_RING_BUFFER_SIZE >= 1024 * 1024 ? 128 * 1024 : AVI_RING_BUFFER_SIZE / 8)
+#define AVI_READER_WAKE_SPACE (4 * AVI_READ_CHUNK_SIZE) // Free ring space that wakes a parked reader
+#define AVI_PREFETCH_SIZE     (CONFIG_AVI_PLAYER_PREFETCH_SIZE_KB * 1024)
+#define AVI_PATH_MAX          (256)
+#define AVI_DIRECT_READ_SIZE  (CONFIG_AVI_PLAYER_DIRECT_READ_BUF_KB * 1024)
+#define AVI_HEADER_MIN        (2 * sizeof(AVI_LIST_HEAD) + sizeof(AVI_AVIH_CHUNK)) // RIFF and hdrl heads, avih chunk
+#define AVI_IDX1_BATCH        (64)         // idx1 entries read at once when seeking
+#define AVI_IDX1_KEYFRAME     (0x10)       // AVIIF_KEYFRAME
+#define AVI_CMD_QUEUE_LEN     (8)
+#define AVI_SPEED_MIN         (25)         // Percent of the file's frame rate
+#define AVI_SPEED_MAX         (400)
+
+_Static_assert(AVI_PREFETCH_SIZE >= AVI_PROBE_HEADER_SIZE, "prefetch_load() parses headers in the prefetch buffer");
+
 #define EVENT_FPS_TIME_UP     ((1 << 0))
 #define EVENT_START_PLAY      ((1 << 1))
 #define EVENT_STOP_PLAY       ((1 << 2))
@@ -29,8 +51,16 @@ static const char *TAG = "avi player";
 #define EVENT_DEINIT_DONE     ((1 << 4))
 #define EVENT_VIDEO_BUF_READY ((1 << 5))
 #define EVENT_AUDIO_BUF_READY ((1 << 6))
+#define EVENT_COMMAND         ((1 << 7))
+
+#define EVENT_ALL          (EVENT_FPS_TIME_UP | EVENT_START_PLAY | EVENT_STOP_PLAY | EVENT_DEINIT | EVENT_COMMAND)
 
-#define EVENT_ALL          (EVENT_FPS_TIME_UP | EVENT_START_PLAY | EVENT_STOP_PLAY | EVENT_DEINIT)
+typedef struct {
+    uint32_t ckid;
+    uint32_t flags;
+    uint32_t offset;
+    uint32_t size;
+} __attribute__((packed)) avi_idx1_entry_t;
 
 typedef enum {
     PLAY_FILE,
@@ -44,17 +74,25 @@ typedef enum {
     AVI_PARSER_END,
 } avi_play_state_t;
 
+typedef enum {
+    PREFETCH_IDLE,     // Nothing queued
+    PREFETCH_PENDING,  // Queued by avi_player_set_next(), not loaded yet
+    PREFETCH_LOADING,  // Reader is loading it
+    PREFETCH_READY,    // Header parsed and standby buffer filled
+} prefetch_state_t;
+
 typedef struct {
     play_mode_t mode;
-    union {
+    struct {
         struct {
-            uint8_t *data;
+            const uint8_t *data;
             uint32_t size;
             uint32_t read_offset;
         } memory;
         struct {
             FILE *avi_file;
             uint8_t *ring_buffer;
+            uint8_t *chunk_buf;             // Reader staging buffer, AVI_READ_CHUNK_SIZE bytes
             uint32_t rb_size;
             volatile uint32_t rb_head; // Write index
             volatile uint32_t rb_tail; // Read index
@@ -62,20 +100,71 @@ typedef struct {
             TaskHandle_t reader_task;
             SemaphoreHandle_t rb_mutex;
             volatile bool reader_running;
-            volatile bool reader_finished;
+            volatile bool reader_finished;  // Reader is idle, waiting for avi_reader_start()
+            volatile bool reader_exit;      // Reader task ends at its next start, see avi_player_deinit()
+            bool reader_parked;             // Reader sleeps until woken, guarded by rb_mutex
+            uint32_t read_pos;              // File offset the reader stopped at
+            bool fast_start;                // Started from the prefetch, skip the prebuffer wait
+            bool direct;                    // Read through direct.map instead of avi_file
+            volatile bool reader_in_io;     // Reader is in config.io_cb, which may wait for the clock
         } file;
     };
+    struct {
+        SemaphoreHandle_t lock;             // Guards state, path, info and file
+        volatile prefetch_state_t state;
+        char path[AVI_PATH_MAX];
+        avi_player_file_info_t info;
+        bool has_info;
+        avi_typedef AVI_file;
+        FILE *file;                         // Positioned right after the preloaded data
+        uint8_t *buffer;                    // Standby buffer, owned by the reader while loading
+        uint32_t len;
+    } next;
     uint8_t *pbuffer;
+    uint8_t *hot_buffer;           // Optional, hot_buffer_size bytes of internal RAM for small chunks
+    const uint8_t *frame;          // Payload of the last chunk, in hot_buffer, pbuffer or in place in memory mode
     uint32_t str_size;
     avi_play_state_t state;
     avi_typedef AVI_file;
+    bool has_info;                 // AVI_file was filled from avi_player_file_info_t, skip the header
+    bool loop;                     // Wrap to movi_start at the end of the movi list
+    uint32_t segment_size;         // Size of the movi list being played, OpenDML files have one per RIFF
+    uint32_t loops;                // Completed passes in loop mode
+    uint32_t start_frame;          // Requested first video frame
+    volatile uint32_t video_frame; // Index of the next video chunk in the current pass
 } avi_data_t;
 
+typedef struct {
+    sdmmc_card_t *card;            // Set by avi_player_set_direct_read(), NULL when disabled
+    char mount_point[32];
+    uint8_t *buffer;               // DMA capable, AVI_DIRECT_READ_SIZE bytes
+    fat_extent_map_t map;          // Sectors of the playing file
+} direct_read_t;
+
+typedef struct {
+    avi_player_cmd_t cmd;
+    char path[AVI_PATH_MAX];        // cmd.play.filename points here
+    avi_player_file_info_t info;    // cmd.play.cfg.info points here
+} avi_cmd_item_t;
+
 typedef struct {
     EventGroupHandle_t event_group;
-    esp_timer_handle_t timer_handle;
+    avi_player_clock_t *timebase;  // config.clock or esp_clock
+    void *timer;                   // Frame clock, a timer of timebase
+    QueueHandle_t cmd_queue;       // avi_cmd_item_t
+    avi_cmd_item_t cmd;            // Command being carried out
     avi_player_config_t config;
     avi_data_t avi_data;
+    bool paused;                   // Frame clock stopped by AVI_PLAYER_CMD_PAUSE
+    uint16_t speed_pct;
+    uint32_t fps_time;             // Frame period of the playing file at normal speed, us
+    int64_t tick_time;             // Last frame clock tick handled, us
+    uint32_t pause_phase;          // Time into the frame period when paused, us
+    bool rearm;                    // One shot tick finishing a paused period, periodic again after it
+    volatile uint32_t stream_mask; // AVI_PLAYER_STREAM_* delivered to callbacks
+    uint32_t clock[3];             // Last rate, bits and channels passed to audio_set_clock_cb
+    direct_read_t direct;
+    avi_player_stats_t stats;
 } avi_player_t;
 
 static uint32_t _REV(uint32_t value)
@@ -84,16 +173,395 @@ static uint32_t _REV(uint32_t value)
            (value & 0x00FF0000U) >> 8 | (value & 0xFF000000U) >> 24;
 }
 
-static void avi_reader_task(void *arg)
+static void avi_info_from_header(avi_player_file_info_t *info, const avi_typedef *avi)
 {
-    avi_player_t *player = (avi_player_t *)arg;
-    // Increase chunk size to 128KB to improve throughput during high latency
-    uint8_t *chunk_buf = heap_caps_malloc(128 * 1024, MALLOC_CAP_SPIRAM);
-    if (!chunk_buf) {
-        ESP_LOGE(TAG, "Failed to alloc reader chunk buf");
-        vTaskDelete(NULL);
+    memset(info, 0, sizeof(avi_player_file_info_t));
+    info->video_format = avi->vids_format;
+    info->width = avi->vids_width;
+    info->height = avi->vids_height;
+    info->fps = avi->vids_fps;
+    info->us_per_frame = avi->us_per_frame;
+    info->frame_period_us = avi->vids_period_us;
+    info->total_frames = avi->total_frames;
+    info->audio_channels = avi->auds_channels;
+    info->audio_bits = avi->auds_bits;
+    info->audio_sample_rate = avi->auds_sample_rate;
+    info->movi_start = avi->movi_start;
+    info->movi_size = avi->movi_size;
+
+    info->duration_ms = (uint32_t)((uint64_t)avi->total_frames * avi->vids_period_us / 1000);
+}
+
+static void avi_header_from_info(avi_typedef *avi, const avi_player_file_info_t *info)
+{
+    memset(avi, 0, sizeof(avi_typedef));
+    avi->vids_format = info->video_format;
+    avi->vids_width = info->width;
+    avi->vids_height = info->height;
+    avi->vids_fps = info->fps;
+    avi->vids_period_us = info->frame_period_us;
+    avi->us_per_frame = info->us_per_frame;
+    avi->total_frames = info->total_frames;
+    avi->auds_channels = info->audio_channels;
+    avi->auds_bits = info->audio_bits;
+    avi->auds_sample_rate = info->audio_sample_rate;
+    avi->movi_start = info->movi_start;
+    avi->movi_size = info->movi_size;
+}
+
+/* Parse the header of f into info with header_size bytes of scratch, see avi_player_probe_file() */
+static esp_err_t avi_probe(FILE *f, uint8_t *header, size_t header_size, avi_player_file_info_t *info)
+{
+    avi_typedef avi = {0};
+    AVI_CHUNK_HEAD idx1 = {0};
+
+    size_t len = fread(header, 1, header_size, f);
+    ESP_RETURN_ON_FALSE(len > AVI_HEADER_MIN, ESP_ERR_INVALID_RESPONSE, TAG, "file too short");
+    ESP_RETURN_ON_FALSE(avi_parser(&avi, header, len) == 0 && avi.vids_period_us != 0, ESP_ERR_INVALID_RESPONSE, TAG, "parse failed");
+    avi_info_from_header(info, &avi);
+
+    /*!< idx1 follows the movi list, movi_size counts from the "movi" FourCC */
+    uint32_t idx1_pos = avi.movi_start - 4 + avi.movi_size;
+    if (fseek(f, idx1_pos, SEEK_SET) == 0 && fread(&idx1, sizeof(idx1), 1, f) == 1 &&
+            idx1.FourCC == _REV(0x69647831)) {
+        info->idx1_offset = idx1_pos + sizeof(AVI_CHUNK_HEAD);
+        info->idx1_size = idx1.size;
+    }
+    return ESP_OK;
+}
+
+/* Default time source */
+
+static int64_t esp_clock_get_time(avi_player_clock_t *clock)
+{
+    return esp_timer_get_time();
+}
+
+static esp_err_t esp_clock_timer_create(avi_player_clock_t *clock, void (*cb)(void *arg), void *arg, void **timer)
+{
+    esp_timer_create_args_t args = {
+        .callback = cb,
+        .arg = arg,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "avi_player_timer",
+    };
+    return esp_timer_create(&args, (esp_timer_handle_t *)timer);
+}
+
+static esp_err_t esp_clock_timer_start(avi_player_clock_t *clock, void *timer, uint64_t us, bool periodic)
+{
+    return periodic ? esp_timer_start_periodic(timer, us) : esp_timer_start_once(timer, us);
+}
+
+static esp_err_t esp_clock_timer_stop(avi_player_clock_t *clock, void *timer)
+{
+    return esp_timer_stop(timer);
+}
+
+static void esp_clock_timer_delete(avi_player_clock_t *clock, void *timer)
+{
+    esp_timer_stop(timer);
+    esp_timer_delete(timer);
+}
+
+static void esp_clock_sleep(avi_player_clock_t *clock, uint32_t ms)
+{
+    vTaskDelay(pdMS_TO_TICKS(ms));
+}
+
+static avi_player_clock_t esp_clock = {
+    .get_time = esp_clock_get_time,
+    .timer_create = esp_clock_timer_create,
+    .timer_start = esp_clock_timer_start,
+    .timer_stop = esp_clock_timer_stop,
+    .timer_delete = esp_clock_timer_delete,
+    .sleep = esp_clock_sleep,
+};
+
+static inline int64_t avi_now(avi_player_t *player)
+{
+    return player->timebase->get_time(player->timebase);
+}
+
+static void *avi_buf_alloc(avi_player_t *player, avi_player_buf_t buf, size_t size)
+{
+    if (player->config.buf_alloc_cb) {
+        return player->config.buf_alloc_cb(buf, size, player->config.user_data);
+    }
+    switch (buf) {
+    case AVI_PLAYER_BUF_FRAME:
+        return malloc(size);
+    case AVI_PLAYER_BUF_FRAME_HOT:
+        return heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    case AVI_PLAYER_BUF_DIRECT:
+        return heap_caps_malloc(size, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+    default:
+        /*!< Reserved by avi_player_init() even for memory playback, so work without PSRAM too */
+        return heap_caps_malloc_prefer(size, 2, MALLOC_CAP_SPIRAM, MALLOC_CAP_8BIT);
+    }
+}
+
+static void avi_buf_free(avi_player_t *player, avi_player_buf_t buf, void *ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+    if (player->config.buf_free_cb) {
+        player->config.buf_free_cb(buf, ptr, player->config.user_data);
+    } else {
+        free(ptr);
+    }
+}
+
+/* Drop a loaded or queued prefetch, caller holds next.lock */
+static void prefetch_discard(avi_data_t *avi)
+{
+    if (avi->next.file) {
+        fclose(avi->next.file);
+        avi->next.file = NULL;
+    }
+    avi->next.len = 0;
+    avi->next.state = PREFETCH_IDLE;
+}
+
+/* Load the file queued by avi_player_set_next(), runs in the reader task */
+static void prefetch_load(avi_player_t *player)
+{
+    avi_data_t *avi = &player->avi_data;
+    char path[AVI_PATH_MAX];
+    avi_player_file_info_t info;
+    bool has_info;
+
+    xSemaphoreTake(avi->next.lock, portMAX_DELAY);
+    if (avi->next.state != PREFETCH_PENDING) {
+        xSemaphoreGive(avi->next.lock);
         return;
     }
+    avi->next.state = PREFETCH_LOADING;
+    strcpy(path, avi->next.path);
+    info = avi->next.info;
+    has_info = avi->next.has_info;
+    xSemaphoreGive(avi->next.lock);
+
+    int64_t start = esp_timer_get_time();
+    uint32_t len = 0;
+    FILE *f = fopen(path, "rb");
+    /*!< The standby buffer is free until the load completes, the header is parsed in it */
+    bool ok = f != NULL && (has_info || avi_probe(f, avi->next.buffer, AVI_PROBE_HEADER_SIZE, &info) == ESP_OK);
+    if (ok) {
+        ok = fseek(f, info.movi_start, SEEK_SET) == 0;
+    }
+    if (ok) {
+        /*!< Stop at the end of movi like avi_reader_fill(), a looped short clip must not take idx1 into the ring */
+        uint32_t movi_len = info.movi_size > 4 ? info.movi_size - 4 : 0;
+        len = fread(avi->next.buffer, 1, movi_len < AVI_PREFETCH_SIZE ? movi_len : AVI_PREFETCH_SIZE, f);
+        player->stats.read_bytes += len;
+        ok = len > 0;
+    }
+
+    xSemaphoreTake(avi->next.lock, portMAX_DELAY);
+    if (ok && avi->next.state == PREFETCH_LOADING) {
+        avi_header_from_info(&avi->next.AVI_file, &info);
+        avi->next.file = f;
+        avi->next.len = len;
+        avi->next.state = PREFETCH_READY;
+        f = NULL;
+        ESP_LOGI(TAG, "Prefetched %"PRIu32" KB of %s in %"PRIu32" ms", len / 1024, path, (uint32_t)((esp_timer_get_time() - start) / 1000));
+    } else if (avi->next.state == PREFETCH_LOADING) {
+        /*!< Failed, playing it later simply opens it again */
+        ESP_LOGW(TAG, "Prefetch of %s failed", path);
+        avi->next.state = PREFETCH_IDLE;
+    }
+    /*!< Otherwise avi_player_set_next() replaced it meanwhile */
+    xSemaphoreGive(avi->next.lock);
+    if (f) {
+        fclose(f);
+    }
+}
+
+/* Read from the source at an absolute offset, only while the reader task is not running */
+static bool avi_read_at(avi_data_t *avi, uint32_t pos, void *buf, uint32_t len)
+{
+    if (avi->mode == PLAY_MEMORY) {
+        if (pos > avi->memory.size || len > avi->memory.size - pos) {
+            return false;
+        }
+        memcpy(buf, avi->memory.data + pos, len);
+        return true;
+    }
+    return fseek(avi->file.avi_file, pos, SEEK_SET) == 0 && fread(buf, 1, len, avi->file.avi_file) == len;
+}
+
+/*
+ * Find the last key frame up to start_frame in idx1. Sets *offset to its chunk offset from movi_start and
+ * *frame to its index, both 0 when no key frame precedes it.
+ */
+static esp_err_t avi_seek_offset(avi_data_t *avi, uint32_t start_frame, uint32_t *offset, uint32_t *frame)
+{
+    const uint32_t movi_start = avi->AVI_file.movi_start;
+    const uint32_t movi_end = movi_start - 4 + avi->AVI_file.movi_size;
+    AVI_CHUNK_HEAD idx1;
+    *offset = 0;
+    *frame = 0;
+    if (!avi_read_at(avi, movi_end, &idx1, sizeof(idx1)) || idx1.FourCC != _REV(0x69647831)) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    avi_idx1_entry_t batch[AVI_IDX1_BATCH];
+    uint32_t entries = idx1.size / sizeof(avi_idx1_entry_t);
+    uint32_t base = 0;
+    uint32_t video = 0;
+    for (uint32_t i = 0; i < entries && video <= start_frame;) {
+        uint32_t n = entries - i < AVI_IDX1_BATCH ? entries - i : AVI_IDX1_BATCH;
+        if (!avi_read_at(avi, movi_end + sizeof(idx1) + i * sizeof(avi_idx1_entry_t), batch, n * sizeof(avi_idx1_entry_t))) {
+            break;
+        }
+        if (i == 0) {
+            /*!< Offsets count from the "movi" FourCC, some writers store file offsets instead */
+            base = batch[0].offset >= movi_start ? 0 : movi_start - 4;
+        }
+        for (uint32_t j = 0; j < n && video <= start_frame; j++) {
+            if ((batch[j].ckid & 0xFFFF0000) != DC_ID) {
+                continue;
+            }
+            uint32_t pos = base + batch[j].offset;
+            if ((batch[j].flags & AVI_IDX1_KEYFRAME) && pos >= movi_start && pos < movi_end) {
+                *offset = pos - movi_start;
+                *frame = video;
+            }
+            video++;
+        }
+        i += n;
+    }
+    return ESP_OK;
+}
+
+static int direct_read_sectors(void *ctx, uint32_t lba, uint32_t count, void *buf)
+{
+    return sdmmc_read_sectors((sdmmc_card_t *)ctx, buf, lba, count) == ESP_OK ? 0 : -1;
+}
+
+/*
+ * Map the sectors of filename so the reader can bypass the file system. Returns false, and the file
+ * is read through avi_file as usual, when direct reads are disabled, the file is on another volume
+ * or it is fragmented.
+ */
+static bool direct_read_open(avi_player_t *player, const char *filename)
+{
+    direct_read_t *direct = &player->direct;
+    size_t len = strlen(direct->mount_point);
+    if (!direct->card || strncmp(filename, direct->mount_point, len) != 0 || filename[len] != '/') {
+        return false;
+    }
+    BYTE pdrv = ff_diskio_get_pdrv_card(direct->card);
+    if (pdrv == 0xFF) {
+        return false;
+    }
+
+    /*!< The start cluster comes from FatFs, which also knows the volume layout */
+    char path[AVI_PATH_MAX + 4];
+    snprintf(path, sizeof(path), "%u:%s", pdrv, filename + len);
+    FIL fil;
+    if (f_open(&fil, path, FA_READ) != FR_OK) {
+        return false;
+    }
+    const FATFS *fs = fil.obj.fs;
+    int ret = -4;
+    if (fs->fs_type >= FS_FAT12 && fs->fs_type <= FS_FAT32
+#if FF_MAX_SS != FF_MIN_SS
+            && fs->ssize == FAT_EXTENT_SECTOR_SIZE
+#endif
+       ) {
+        const fat_extent_volume_t vol = {
+            .fat_bits = fs->fs_type == FS_FAT12 ? 12 : fs->fs_type == FS_FAT16 ? 16 : 32,
+            .cluster_sectors = fs->csize,
+            .fat_lba = fs->fatbase,
+            .data_lba = fs->database,
+            .fat_entries = fs->n_fatent,
+        };
+        ret = fat_extent_build(&vol, direct_read_sectors, direct->card, direct->buffer, fil.obj.sclust, fil.obj.objsize, &direct->map);
+    }
+    f_close(&fil);
+
+    if (ret != 0) {
+        ESP_LOGI(TAG, "Direct read not possible (%d), using file reads", ret);
+        return false;
+    }
+    ESP_LOGI(TAG, "Direct read, %"PRIu32" extents", direct->map.count);
+    return true;
+}
+
+/* sdmmc_read_sectors() reads into anything else one sector at a time through its own bounce buffer */
+static inline bool direct_dma_ok(const void *ptr)
+{
+    return esp_ptr_dma_capable(ptr) && ((uintptr_t)ptr & 3) == 0;
+}
+
+/* Read len bytes at file offset pos through the sector map, returns bytes read, 0 at the end or on error */
+static size_t direct_read(direct_read_t *direct, uint8_t *dst, uint32_t pos, size_t len)
+{
+    if (pos >= direct->map.file_size) {
+        return 0;
+    }
+    if (len > direct->map.file_size - pos) {
+        len = direct->map.file_size - pos;
+    }
+
+    size_t done = 0;
+    while (done < len) {
+        uint32_t offset = (pos + done) % FAT_EXTENT_SECTOR_SIZE;
+        size_t want = len - done;
+        uint32_t lba;
+        uint32_t count = fat_extent_lookup(&direct->map, (pos + done) / FAT_EXTENT_SECTOR_SIZE, &lba);
+        /*!< Never more than the sectors the request still covers */
+        uint32_t needed = (offset + want + FAT_EXTENT_SECTOR_SIZE - 1) / FAT_EXTENT_SECTOR_SIZE;
+        if (count > needed) {
+            count = needed;
+        }
+        if (count == 0) {
+            break;
+        }
+
+        size_t copy;
+        if (offset == 0 && want >= FAT_EXTENT_SECTOR_SIZE && direct_dma_ok(dst + done)) {
+            /*!< Whole sectors go straight into dst */
+            if (count > want / FAT_EXTENT_SECTOR_SIZE) {
+                count = want / FAT_EXTENT_SECTOR_SIZE;
+            }
+            if (sdmmc_read_sectors(direct->card, dst + done, lba, count) != ESP_OK) {
+                break;
+            }
+            copy = count * FAT_EXTENT_SECTOR_SIZE;
+        } else {
+            /*!< A partial head or tail sector, or a dst the card cannot DMA into, takes the bounce buffer */
+            if (direct_dma_ok(dst + done)) {
+                count = 1;
+            } else if (count > AVI_DIRECT_READ_SIZE / FAT_EXTENT_SECTOR_SIZE) {
+                count = AVI_DIRECT_READ_SIZE / FAT_EXTENT_SECTOR_SIZE;
+            }
+            if (sdmmc_read_sectors(direct->card, direct->buffer, lba, count) != ESP_OK) {
+                break;
+            }
+            copy = count * FAT_EXTENT_SECTOR_SIZE - offset;
+            if (copy > want) {
+                copy = want;
+            }
+            memcpy(dst + done, direct->buffer + offset, copy);
+        }
+        done += copy;
+    }
+    return done;
+}
+
+/* Fill the ring from the current file until stopped or at its end */
+static void avi_reader_fill(avi_player_t *player)
+{
+    // Large chunks improve throughput during high latency
+    uint8_t *chunk_buf = player->avi_data.file.chunk_buf;
+    FILE *f = player->avi_data.file.avi_file;
+    const uint32_t movi_start = player->avi_data.AVI_file.movi_start;
+    const uint32_t movi_end = movi_start - 4 + player->avi_data.AVI_file.movi_size;
+    uint32_t pos = ftell(f);
 
     while (player->avi_data.file.reader_running) {
         xSemaphoreTake(player->avi_data.file.rb_mutex, portMAX_DELAY);
@@ -103,14 +571,63 @@ static void avi_reader_task(void *arg)
 
         uint32_t space = size - fill;
 
-        if (space < 128 * 1024) {
-            vTaskDelay(pdMS_TO_TICKS(50));
+        if (space < AVI_READ_CHUNK_SIZE) {
+            if (player->avi_data.next.state == PREFETCH_PENDING) {
+                /*!< Ring is full, use the idle time to load the next file */
+                prefetch_load(player);
+                continue;
+            }
+            /*!< Sleep until rb_read() frees AVI_READER_WAKE_SPACE, which takes forever while paused */
+            xSemaphoreTake(player->avi_data.file.rb_mutex, portMAX_DELAY);
+            bool park = player->avi_data.file.reader_running && player->avi_data.next.state != PREFETCH_PENDING &&
+                        size - player->avi_data.file.rb_fill < AVI_READ_CHUNK_SIZE;
+            player->avi_data.file.reader_parked = park;
+            xSemaphoreGive(player->avi_data.file.rb_mutex);
+            if (park) {
+                ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            }
             continue;
         }
 
-        size_t read_len = fread(chunk_buf, 1, 128 * 1024, player->avi_data.file.avi_file);
+        size_t to_read = AVI_READ_CHUNK_SIZE;
+        if (player->avi_data.loop) {
+            /*!< Only the movi list goes to the ring, the next pass follows its last chunk directly */
+            if (pos >= movi_end) {
+                if (!player->avi_data.file.direct) {
+                    fseek(f, movi_start, SEEK_SET);
+                }
+                pos = movi_start;
+            }
+            if (movi_end - pos < to_read) {
+                to_read = movi_end - pos;
+            }
+        }
+
+        size_t read_len;
+        int64_t read_start = avi_now(player);
+        AVI_TRACE(AVI_TRACE_READ_BEGIN, to_read);
+        if (player->avi_data.file.direct) {
+            read_len = direct_read(&player->direct, chunk_buf, pos, to_read);
+            if (read_len == 0 && pos < player->direct.map.file_size) {
+                ESP_LOGW(TAG, "Direct read failed at %"PRIu32", using file reads", pos);
+                player->avi_data.file.direct = false;
+                fseek(f, pos, SEEK_SET);
+                continue;
+            }
+        } else {
+            read_len = fread(chunk_buf, 1, to_read, f);
+        }
+        if (player->config.io_cb && read_len) {
+            player->avi_data.file.reader_in_io = true;
+            player->config.io_cb(pos, read_len, avi_now(player) - read_start, player->config.user_data);
+            player->avi_data.file.reader_in_io = false;
+        }
+        AVI_TRACE(AVI_TRACE_READ_END, read_len); // After io_cb, a simulated card takes its time there
+        pos += read_len;
+        player->stats.read_bytes += read_len;
         if (read_len == 0) {
             player->avi_data.file.reader_running = false; // Signal EOF
+            prefetch_load(player);
             break; // EOF
         }
 
@@ -127,17 +644,46 @@ static void avi_reader_task(void *arg)
         
         player->avi_data.file.rb_head = (head + read_len) % size;
         player->avi_data.file.rb_fill += read_len;
+        AVI_TRACE(AVI_TRACE_RING_FILL, player->avi_data.file.rb_fill);
         xSemaphoreGive(player->avi_data.file.rb_mutex);
+        player->stats.ring_copies++;
+        player->stats.ring_bytes += read_len;
     }
 
-    free(chunk_buf);
+    player->avi_data.file.read_pos = pos;
+}
+
+/* Lives as long as the player, each avi_reader_start() has it read one file */
+static void avi_reader_task(void *arg)
+{
+    avi_player_t *player = (avi_player_t *)arg;
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (player->avi_data.file.reader_exit) {
+            break;
+        }
+        avi_reader_fill(player);
+        player->avi_data.file.reader_finished = true;
+    }
     player->avi_data.file.reader_finished = true;
     vTaskDelete(NULL);
 }
 
-static uint32_t rb_read(avi_data_t *avi, uint8_t *buffer, uint32_t length)
+/* Wait for the reader. A simulated card may hold it on the clock, the tick in progress must not hold the time then */
+static void avi_wait_reader(avi_player_t *player, uint32_t ms)
+{
+    if (player->avi_data.file.reader_in_io && player->timebase->timer_handled) {
+        player->timebase->timer_handled(player->timebase, player->timer);
+    }
+    player->timebase->sleep(player->timebase, ms);
+}
+
+/* Consume length bytes from the ring, buffer can be NULL to drop them without copying */
+static uint32_t rb_read(avi_player_t *player, uint8_t *buffer, uint32_t length)
 {
+    avi_data_t *avi = &player->avi_data;
     uint32_t bytes_read = 0;
+    bool dry = false;
     while (bytes_read < length) {
         xSemaphoreTake(avi->file.rb_mutex, portMAX_DELAY);
         uint32_t fill = avi->file.rb_fill;
@@ -145,7 +691,12 @@ static uint32_t rb_read(avi_data_t *avi, uint8_t *buffer, uint32_t length)
         if (fill == 0) {
             xSemaphoreGive(avi->file.rb_mutex);
             if (!avi->file.reader_running) break;
-            vTaskDelay(pdMS_TO_TICKS(10));
+            if (!dry) {
+                dry = true;
+                player->stats.underruns++;
+                AVI_TRACE(AVI_TRACE_UNDERRUN, 0);
+            }
+            avi_wait_reader(player, 10);
             continue;
         }
 
@@ -156,7 +707,9 @@ static uint32_t rb_read(avi_data_t *avi, uint8_t *buffer, uint32_t length)
         uint32_t size = avi->file.rb_size;
         uint32_t first_chunk = size - tail;
 
-        if (to_read <= first_chunk) {
+        if (buffer == NULL) {
+            /* skip only */
+        } else if (to_read <= first_chunk) {
             memcpy(buffer + bytes_read, avi->file.ring_buffer + tail, to_read);
         } else {
             memcpy(buffer + bytes_read, avi->file.ring_buffer + tail, first_chunk);
@@ -165,113 +718,336 @@ static uint32_t rb_read(avi_data_t *avi, uint8_t *buffer, uint32_t length)
 
         avi->file.rb_tail = (tail + to_read) % size;
         avi->file.rb_fill -= to_read;
+        AVI_TRACE(AVI_TRACE_RING_FILL, avi->file.rb_fill);
         bytes_read += to_read;
+        if (avi->file.reader_parked && size - avi->file.rb_fill >= AVI_READER_WAKE_SPACE) {
+            avi->file.reader_parked = false;
+            xTaskNotifyGive(avi->file.reader_task);
+        }
         xSemaphoreGive(avi->file.rb_mutex);
     }
     return bytes_read;
 }
 
-static uint32_t read_frame(avi_data_t *avi, uint8_t *buffer, uint32_t length, uint32_t *fourcc)
+static bool stream_enabled(uint32_t fourcc, uint32_t stream_mask)
 {
-    AVI_CHUNK_HEAD head;
+    if ((fourcc & 0xFFFF0000) == DC_ID) {
+        return stream_mask & AVI_PLAYER_STREAM_VIDEO;
+    }
+    if ((fourcc & 0xFFFF0000) == WB_ID) {
+        return stream_mask & AVI_PLAYER_STREAM_AUDIO;
+    }
+    return true;
+}
 
+/* Streams delivered right now, audio only plays at normal speed */
+static uint32_t active_streams(avi_player_t *player)
+{
+    uint32_t mask = player->stream_mask;
+    if (player->paused || player->speed_pct != 100) {
+        mask &= ~AVI_PLAYER_STREAM_AUDIO;
+    }
+    return mask;
+}
+
+/* Consume len bytes of the movi data in either mode, buffer can be NULL to skip them. False at the end of the data */
+static bool avi_consume(avi_player_t *player, void *buffer, uint32_t len)
+{
+    avi_data_t *avi = &player->avi_data;
     if (avi->mode == PLAY_MEMORY) {
-        if (sizeof(AVI_CHUNK_HEAD) > (avi->memory.size - avi->memory.read_offset)) {
-            ESP_LOGE(TAG, "not enough data for chunk head");
-            return 0;
+        if (len > avi->memory.size - avi->memory.read_offset) {
+            return false;
         }
-        memcpy(&head, avi->memory.data + avi->memory.read_offset, sizeof(AVI_CHUNK_HEAD));
-        avi->memory.read_offset += sizeof(AVI_CHUNK_HEAD);
-    } else if (avi->mode == PLAY_FILE) {
-        if (rb_read(avi, (uint8_t*)&head, sizeof(AVI_CHUNK_HEAD)) != sizeof(AVI_CHUNK_HEAD)) {
-            return 0;
+        if (buffer) {
+            memcpy(buffer, avi->memory.data + avi->memory.read_offset, len);
         }
+        avi->memory.read_offset += len;
+        return true;
     }
+    return rb_read(player, buffer, len) == len;
+}
+
+/* Chunks that may sit between the stream chunks and carry nothing to play */
+static bool chunk_ignored(uint32_t fourcc)
+{
+    return fourcc == JUNK_ID || fourcc == IDX1_ID || (fourcc & 0xFFFF) == (IX_ID & 0xFFFF) ||
+           (fourcc & 0xFFFF0000) == PC_ID;
+}
 
-    if (head.FourCC) {
-        /* handle FourCC if needed */
+/*
+ * Read the next chunk, its payload is then at avi->frame. Payloads of streams disabled in the stream mask,
+ * video frames the application presents itself through video_skip_cb, empty chunks and chunks that carry
+ * nothing to play are skipped without being copied. *skipped is set in that case and avi->frame is undefined.
+ * Of a LIST or RIFF only the list type is read, its chunks follow.
+ *
+ * In memory mode video payloads are not copied, avi->frame points into the source. Audio payloads are
+ * still copied to buffer because the codec scales samples in place and the source may be read only flash.
+ *
+ * Returns the payload size, the pad byte after an odd size is consumed too. *fourcc is 0 at the end of the data.
+ */
+static uint32_t read_frame(avi_player_t *player, uint8_t *buffer, uint32_t length, uint32_t *fourcc, bool *skipped)
+{
+    avi_data_t *avi = &player->avi_data;
+    AVI_CHUNK_HEAD head;
+
+    *fourcc = 0;
+    if (!avi_consume(player, &head, sizeof(AVI_CHUNK_HEAD))) {
+        return 0;
+    }
+    if (head.FourCC == LIST_ID || head.FourCC == RIFF_ID) {
+        uint32_t type;
+        if (!avi_consume(player, &type, sizeof(type))) {
+            return 0;
+        }
+        *fourcc = head.FourCC;
+        *skipped = true;
+        return sizeof(type);
+    }
+    bool video = (head.FourCC & 0xFFFF0000) == DC_ID;
+    bool audio = (head.FourCC & 0xFFFF0000) == WB_ID;
+    if (!video && !audio && !chunk_ignored(head.FourCC)) {
+        *fourcc = head.FourCC; /*!< Not consumed, the caller stops */
+        return 0;
     }
-    *fourcc = head.FourCC;
 
-    if (head.size % 2) {
-        head.size++;    /*!< add a byte if size is odd */
+    uint32_t pad = head.size % 2; /*!< Chunks are word aligned, the pad byte is not part of the payload */
+    *skipped = !video && !audio;
+    *skipped |= head.size == 0 || !stream_enabled(head.FourCC, active_streams(player));
+    if (video) {
+        video_frame_info_t info = {
+            .width = avi->AVI_file.vids_width,
+            .height = avi->AVI_file.vids_height,
+            .frame_format = avi->AVI_file.vids_format,
+            .frame_index = avi->video_frame++,
+        };
+        if (!*skipped && player->config.video_skip_cb) {
+            *skipped = player->config.video_skip_cb(&info, player->config.user_data);
+        }
     }
 
-    if (avi->mode == PLAY_MEMORY) {
-        if (head.size > (avi->memory.size - avi->memory.read_offset) || length < head.size) {
-            ESP_LOGE(TAG, "frame size %"PRIu32" exceeds available data", head.size);
+    if (avi->hot_buffer && head.size <= player->config.hot_buffer_size) {
+        buffer = avi->hot_buffer; /*!< Small chunks reach the callbacks from internal RAM */
+    }
+    bool in_place = video && avi->mode == PLAY_MEMORY;
+    if (!*skipped && !in_place && length < head.size) {
+        ESP_LOGE(TAG, "frame size %"PRIu32" exceeds the buffer, dropped", head.size);
+        *skipped = true;
+    }
+    if (*skipped) {
+        if (!avi_consume(player, NULL, head.size + pad)) {
             return 0;
         }
-        memcpy(buffer, avi->memory.data + avi->memory.read_offset, head.size);
-        avi->memory.read_offset += head.size;
-    } else if (avi->mode == PLAY_FILE) {
-        if (length < head.size) {
-            ESP_LOGE(TAG, "frame size %"PRIu32" exceeds available data", head.size);
+        if (video || audio) {
+            player->stats.skipped_frames++;
+        }
+        *fourcc = head.FourCC;
+        return head.size;
+    }
+
+    if (in_place) {
+        if (head.size + pad > avi->memory.size - avi->memory.read_offset) {
             return 0;
         }
-        if (rb_read(avi, buffer, head.size) != head.size) {
+        avi->frame = avi->memory.data + avi->memory.read_offset;
+        avi->memory.read_offset += head.size + pad;
+    } else {
+        if (!avi_consume(player, buffer, head.size) || !avi_consume(player, NULL, pad)) {
             return 0;
         }
+        avi->frame = buffer;
+        player->stats.copies++;
+        player->stats.copy_bytes += head.size;
     }
-
+    *fourcc = head.FourCC;
     return head.size;
 }
 
+/*
+ * Called once the chunks of the movi list are consumed. Skips the index and continues in the movi list
+ * of the next RIFF segment of an OpenDML file. False when the file has no more segments.
+ */
+static bool avi_next_segment(avi_player_t *player, size_t *BytesRD)
+{
+    AVI_CHUNK_HEAD head;
+    uint32_t type;
+    while (avi_consume(player, &head, sizeof(head))) {
+        if (head.FourCC == RIFF_ID || head.FourCC == LIST_ID) {
+            if (!avi_consume(player, &type, sizeof(type))) {
+                break;
+            }
+            if (head.FourCC == LIST_ID && type == MOVI_ID) {
+                player->avi_data.segment_size = head.size;
+                *BytesRD = sizeof(type);
+                ESP_LOGD(TAG, "movi segment of %"PRIu32" bytes", head.size);
+                return true;
+            }
+            if (head.FourCC == RIFF_ID && type == AVIX_ID) {
+                continue; /*!< Its movi list follows */
+            }
+            head.size -= sizeof(type);
+        }
+        if (!avi_consume(player, NULL, head.size + head.size % 2)) {
+            break;
+        }
+    }
+    return false;
+}
+
+static uint32_t avi_frame_period(avi_player_t *player)
+{
+    return (uint64_t)player->fps_time * 100 / player->speed_pct;
+}
+
+/* (Re)start the frame clock at the current speed, the first tick comes after first_us */
+static void avi_timer_start(avi_player_t *player, uint32_t first_us)
+{
+    uint32_t period = avi_frame_period(player);
+    player->timebase->timer_stop(player->timebase, player->timer);
+    player->tick_time = avi_now(player) + first_us - period; /*!< Where the previous tick would have been */
+    player->rearm = first_us < period;
+    if (player->rearm) {
+        player->timebase->timer_start(player->timebase, player->timer, first_us, false);
+    } else {
+        player->timebase->timer_start(player->timebase, player->timer, period, true);
+    }
+}
+
+/* Wake the reader if it is parked, caller has changed what it waits for */
+static void avi_reader_wake(avi_data_t *avi)
+{
+    if (avi->file.rb_mutex == NULL) {
+        return;
+    }
+    xSemaphoreTake(avi->file.rb_mutex, portMAX_DELAY);
+    if (avi->file.reader_parked) {
+        avi->file.reader_parked = false;
+        xTaskNotifyGive(avi->file.reader_task);
+    }
+    xSemaphoreGive(avi->file.rb_mutex);
+}
+
+static void avi_reader_start(avi_player_t *player)
+{
+    player->avi_data.file.reader_running = true;
+    player->avi_data.file.reader_finished = false;
+    xTaskNotifyGive(player->avi_data.file.reader_task);
+}
+
+static void avi_reader_stop(avi_data_t *avi)
+{
+    avi->file.reader_running = false;
+    avi_reader_wake(avi);
+    // Wait for the reader to go idle
+    int timeout = 0;
+    while (!avi->file.reader_finished && timeout < 200) { // Wait up to 2s
+        vTaskDelay(pdMS_TO_TICKS(10));
+        timeout++;
+    }
+}
+
+static void avi_player_emit(avi_player_t *player, avi_player_event_type_t type, avi_player_cmd_type_t cmd, uint32_t id, esp_err_t err)
+{
+    if (player->config.event_cb) {
+        avi_player_event_t event = {
+            .type = type,
+            .cmd = cmd,
+            .id = id,
+            .err = err,
+        };
+        player->config.event_cb(&event, player->config.user_data);
+    }
+}
+
 static esp_err_t avi_player(avi_player_handle_t handle, size_t *BytesRD, uint32_t *Strtype)
 {
     avi_player_t *player = (avi_player_t *)handle;
     uint32_t buffer_size = player->config.buffer_size;
+    bool playing = player->avi_data.state == AVI_PARSER_DATA;
     int ret;
 
     switch (player->avi_data.state) {
     case AVI_PARSER_HEADER: {
-        if (player->avi_data.mode == PLAY_MEMORY) {
-            memcpy(player->avi_data.pbuffer, player->avi_data.memory.data, buffer_size);
-            *BytesRD = buffer_size;
+        if (player->avi_data.has_info) {
+            /*!< Header already known, the file is positioned at movi_start below */
         } else {
-            *BytesRD = fread(player->avi_data.pbuffer, buffer_size, 1, player->avi_data.file.avi_file);
-        }
+            const uint8_t *header = player->avi_data.pbuffer;
+            if (player->avi_data.mode == PLAY_MEMORY) {
+                /*!< Parsed in place, never past the end of the source */
+                header = player->avi_data.memory.data;
+                *BytesRD = player->avi_data.memory.size < buffer_size ? player->avi_data.memory.size : buffer_size;
+            } else {
+                *BytesRD = fread(player->avi_data.pbuffer, 1, buffer_size, player->avi_data.file.avi_file);
+            }
 
-        ret = avi_parser(&player->avi_data.AVI_file, player->avi_data.pbuffer, *BytesRD);
-        if (0 > ret) {
-            ESP_LOGE(TAG, "parse failed (%d)", ret);
-            xEventGroupSetBits(player->event_group, EVENT_STOP_PLAY);
-            return ESP_FAIL;
+            ret = avi_parser(&player->avi_data.AVI_file, header, *BytesRD);
+            if (0 > ret) {
+                ESP_LOGE(TAG, "parse failed (%d)", ret);
+                xEventGroupSetBits(player->event_group, EVENT_STOP_PLAY);
+                return ESP_FAIL;
+            }
         }
 
-        /*!< Set the video callback */
-        if (player->config.audio_set_clock_cb) {
-            player->config.audio_set_clock_cb(
-                              player->avi_data.AVI_file.auds_sample_rate,
-                              player->avi_data.AVI_file.auds_bits,
-                              player->avi_data.AVI_file.auds_channels,
-                              player->config.user_data);
+        /*!< Set the video callback, a prefetched file with the same audio format keeps the running clock */
+        uint32_t clock[3] = {
+            player->avi_data.AVI_file.auds_sample_rate,
+            player->avi_data.AVI_file.auds_bits,
+            player->avi_data.AVI_file.auds_channels,
+        };
+        bool same_clock = memcmp(clock, player->clock, sizeof(clock)) == 0;
+        if (player->config.audio_set_clock_cb && !(player->avi_data.file.fast_start && same_clock)) {
+            player->config.audio_set_clock_cb(clock[0], clock[1], clock[2], player->config.user_data);
         }
+        memcpy(player->clock, clock, sizeof(clock));
 
-        uint32_t fps_time = 1000 * 1000 / player->avi_data.AVI_file.vids_fps;
-        ESP_LOGD(TAG, "vids_fps=%d", player->avi_data.AVI_file.vids_fps);
-        esp_timer_start_periodic(player->timer_handle, fps_time);
+        player->fps_time = player->avi_data.AVI_file.vids_period_us;
+        if (player->fps_time == 0) {
+            player->fps_time = 1000 * 1000 / player->avi_data.AVI_file.vids_fps; /*!< Info filled in without the period */
+        }
+        ESP_LOGD(TAG, "vids_fps=%d, period %"PRIu32" us", player->avi_data.AVI_file.vids_fps, player->fps_time);
+        player->paused = false;
+        avi_timer_start(player, avi_frame_period(player));
+
+        /*!< Bytes of the movi list skipped to reach the start frame, counted like the chunks played */
+        uint32_t first_frame = 0;
+        uint32_t skip = 0;
+        if (player->avi_data.start_frame) {
+            if (avi_seek_offset(&player->avi_data, player->avi_data.start_frame, &skip, &first_frame) != ESP_OK) {
+                ESP_LOGW(TAG, "No idx1, starting at frame 0");
+            }
+            ESP_LOGI(TAG, "Start at frame %"PRIu32"", first_frame);
+        }
 
         if (player->avi_data.mode == PLAY_MEMORY) {
-            player->avi_data.memory.read_offset = player->avi_data.AVI_file.movi_start;
+            player->avi_data.memory.read_offset = player->avi_data.AVI_file.movi_start + skip;
         } else {
-            fseek(player->avi_data.file.avi_file, player->avi_data.AVI_file.movi_start, SEEK_SET);
-            
+            if (!player->avi_data.file.fast_start) {
+                fseek(player->avi_data.file.avi_file, player->avi_data.AVI_file.movi_start + skip, SEEK_SET);
+            }
+
             // Start reader task
-            player->avi_data.file.reader_running = true;
-            xTaskCreatePinnedToCore(avi_reader_task, "avi_reader", 4096, player, 10, &player->avi_data.file.reader_task, 1);
+            avi_reader_start(player);
         }
 
+        player->avi_data.video_frame = first_frame;
+        player->avi_data.segment_size = player->avi_data.AVI_file.movi_size;
         player->avi_data.state = AVI_PARSER_DATA;
-        *BytesRD = 0;
+        *BytesRD = skip;
     }
     case AVI_PARSER_DATA: {
-        // Initial buffering: wait for 50% buffer fill
+        // Initial buffering: wait for 50% buffer fill, a prefetched start plays from the standby data meanwhile
         if (player->avi_data.mode == PLAY_FILE) {
-            if (player->avi_data.file.reader_running && player->avi_data.file.rb_fill < player->avi_data.file.rb_size / 2) {
+            if (player->avi_data.file.fast_start && player->avi_data.file.rb_fill >= player->avi_data.file.rb_size / 2) {
+                player->avi_data.file.fast_start = false;
+            }
+            if (!player->avi_data.file.fast_start &&
+                    player->avi_data.file.reader_running && player->avi_data.file.rb_fill < player->avi_data.file.rb_size / 2) {
                 ESP_LOGI(TAG, "Buffering...");
+                if (playing) {
+                    player->stats.underruns++; // The reader fell behind, not the start of a file
+                    AVI_TRACE(AVI_TRACE_UNDERRUN, player->avi_data.file.rb_fill);
+                }
                 while (player->avi_data.file.reader_running && player->avi_data.file.rb_fill < player->avi_data.file.rb_size / 2) {
-                    vTaskDelay(pdMS_TO_TICKS(100));
+                    avi_wait_reader(player, 100);
                 }
                 ESP_LOGI(TAG, "Buffering done");
             }
@@ -280,37 +1056,71 @@ static esp_err_t avi_player(avi_player_handle_t handle, size_t *BytesRD, uint32_
         /*!< clear event */
         xEventGroupClearBits(player->event_group, EVENT_AUDIO_BUF_READY | EVENT_VIDEO_BUF_READY);
         while (1) {
-            player->avi_data.str_size = read_frame(&player->avi_data, player->avi_data.pbuffer, buffer_size, Strtype);
-            ESP_LOGD(TAG, "type=%"PRIu32", size=%"PRIu32"", *Strtype, player->avi_data.str_size);
-            *BytesRD += player->avi_data.str_size + 8;
-
-            if (*BytesRD >= player->avi_data.AVI_file.movi_size) {
+            if (!player->avi_data.loop && *BytesRD + 4 >= player->avi_data.segment_size &&
+                    !avi_next_segment(player, BytesRD)) {
                 ESP_LOGI(TAG, "play end");
                 player->avi_data.state = AVI_PARSER_END;
                 xEventGroupSetBits(player->event_group, EVENT_STOP_PLAY);
                 return ESP_OK;
             }
 
+            bool skipped = false;
+            AVI_TRACE(AVI_TRACE_FRAME_BEGIN, 0);
+            player->avi_data.str_size = read_frame(player, player->avi_data.pbuffer, buffer_size, Strtype, &skipped);
+            AVI_TRACE(AVI_TRACE_FRAME_END, player->avi_data.str_size);
+            ESP_LOGD(TAG, "type=%"PRIx32", size=%"PRIu32"", *Strtype, player->avi_data.str_size);
+            *BytesRD += player->avi_data.str_size + player->avi_data.str_size % 2 + 8;
+
+            if (*Strtype == 0) {
+                /*!< File ended before the movi list did */
+                ESP_LOGW(TAG, "unexpected end of file");
+                player->avi_data.state = AVI_PARSER_END;
+                xEventGroupSetBits(player->event_group, EVENT_STOP_PLAY);
+                return ESP_OK;
+            }
+
+            if (player->avi_data.loop && *BytesRD >= player->avi_data.AVI_file.movi_size - 4) {
+                /*!< Last chunk of this pass, it is still handled below. The data that follows is the first chunk again */
+                *BytesRD = 0;
+                player->avi_data.loops++;
+                player->avi_data.video_frame = 0;
+                if (player->avi_data.mode == PLAY_MEMORY) {
+                    player->avi_data.memory.read_offset = player->avi_data.AVI_file.movi_start;
+                }
+                ESP_LOGD(TAG, "loop %"PRIu32"", player->avi_data.loops);
+            }
+
             if ((*Strtype & 0xFFFF0000) == DC_ID) { // Display frame
+                if (skipped) {
+                    /*!< Video disabled or presented by the application: the frame still consumes its time slot so audio keeps its pace */
+                    break;
+                }
                 int64_t fr_end = esp_timer_get_time();
                 if (player->config.video_cb) {
                     frame_data_t data = {
-                        .data = player->avi_data.pbuffer,
+                        .data = (uint8_t *)player->avi_data.frame,
                         .data_bytes = player->avi_data.str_size,
                         .type = FRAME_TYPE_VIDEO,
                         .video_info.width = player->avi_data.AVI_file.vids_width,
                         .video_info.height = player->avi_data.AVI_file.vids_height,
                         .video_info.frame_format = player->avi_data.AVI_file.vids_format,
+                        .video_info.frame_index = player->avi_data.video_frame - 1,
                     };
+                    AVI_TRACE(AVI_TRACE_VIDEO_CB_BEGIN, data.video_info.frame_index);
                     player->config.video_cb(&data, player->config.user_data);
+                    AVI_TRACE(AVI_TRACE_VIDEO_CB_END, 0);
+                    player->stats.video_frames++;
                 }
                 xEventGroupSetBits(player->event_group, EVENT_VIDEO_BUF_READY);
                 ESP_LOGD(TAG, "Draw %"PRIu32"ms", (uint32_t)((esp_timer_get_time() - fr_end) / 1000));
                 break;
             } else if ((*Strtype & 0xFFFF0000) == WB_ID) { // Audio output
+                if (skipped) {
+                    continue;
+                }
                 if (player->config.audio_cb) {
                     frame_data_t data = {
-                        .data = player->avi_data.pbuffer,
+                        .data = (uint8_t *)player->avi_data.frame,
                         .data_bytes = player->avi_data.str_size,
                         .type = FRAME_TYPE_AUDIO,
                         .audio_info.channel = player->avi_data.AVI_file.auds_channels,
@@ -318,9 +1128,14 @@ static esp_err_t avi_player(avi_player_handle_t handle, size_t *BytesRD, uint32_
                         .audio_info.sample_rate = player->avi_data.AVI_file.auds_sample_rate,
                         .audio_info.format = FORMAT_PCM,
                     };
+                    AVI_TRACE(AVI_TRACE_AUDIO_CB_BEGIN, data.data_bytes);
                     player->config.audio_cb(&data, player->config.user_data);
+                    AVI_TRACE(AVI_TRACE_AUDIO_CB_END, 0);
+                    player->stats.audio_frames++;
                 }
                 xEventGroupSetBits(player->event_group, EVENT_AUDIO_BUF_READY);
+            } else if (skipped) {
+                continue; /*!< Lists, padding and indexes */
             } else {
                 ESP_LOGE(TAG, "unknown frame %"PRIx32"", *Strtype);
                 xEventGroupSetBits(player->event_group, EVENT_STOP_PLAY);
@@ -330,31 +1145,20 @@ static esp_err_t avi_player(avi_player_handle_t handle, size_t *BytesRD, uint32_
         break;
     }
     case AVI_PARSER_END:
-        esp_timer_stop(player->timer_handle);
+        player->timebase->timer_stop(player->timebase, player->timer);
         if (player->avi_data.mode == PLAY_FILE) {
-            player->avi_data.file.reader_running = false;
-            // Wait for reader task to finish
-            int timeout = 0;
-            while (!player->avi_data.file.reader_finished && timeout < 200) { // Wait up to 2s
-                vTaskDelay(pdMS_TO_TICKS(10));
-                timeout++;
-            }
-            
+            avi_reader_stop(&player->avi_data);
             fclose(player->avi_data.file.avi_file);
-            if (player->avi_data.file.ring_buffer) {
-                free(player->avi_data.file.ring_buffer);
-                player->avi_data.file.ring_buffer = NULL;
-            }
-            if (player->avi_data.file.rb_mutex) {
-                vSemaphoreDelete(player->avi_data.file.rb_mutex);
-                player->avi_data.file.rb_mutex = NULL;
-            }
+            player->avi_data.file.avi_file = NULL;
+            player->avi_data.file.fast_start = false;
+            /*!< Ring buffer and mutex are kept for the next file, they are freed by avi_player_deinit() */
         }
 
         player->avi_data.state = AVI_PARSER_NONE;
         if (player->config.avi_play_end_cb) {
             player->config.avi_play_end_cb(player->config.user_data);
         }
+        avi_player_emit(player, AVI_PLAYER_EVENT_PLAY_END, 0, 0, ESP_OK);
 
         break;
     default:
@@ -363,6 +1167,206 @@ static esp_err_t avi_player(avi_player_handle_t handle, size_t *BytesRD, uint32_
     return ESP_OK;
 }
 
+/* Prepare playing filename, the player task then starts it in AVI_PARSER_HEADER */
+static esp_err_t avi_open_file(avi_player_t *player, const char *filename, const avi_player_play_cfg_t *cfg)
+{
+    player->avi_data.has_info = false;
+    player->avi_data.loop = cfg && cfg->loop;
+    player->avi_data.loops = 0;
+    player->avi_data.start_frame = cfg ? cfg->start_frame : 0;
+    if (cfg && cfg->info) {
+        ESP_RETURN_ON_FALSE(cfg->info->fps != 0 && cfg->info->movi_start != 0, ESP_ERR_INVALID_ARG, TAG, "invalid file info");
+        avi_header_from_info(&player->avi_data.AVI_file, cfg->info);
+        player->avi_data.has_info = true;
+    }
+
+    player->avi_data.mode = PLAY_FILE;
+    player->avi_data.file.fast_start = false;
+
+    /*!< Take over the prefetched file if it is the one asked for, drop it otherwise. Its data starts at frame 0 */
+    xSemaphoreTake(player->avi_data.next.lock, portMAX_DELAY);
+    bool same = strcmp(player->avi_data.next.path, filename) == 0;
+    if (player->avi_data.next.state == PREFETCH_READY && same && player->avi_data.start_frame == 0) {
+        player->avi_data.file.avi_file = player->avi_data.next.file;
+        player->avi_data.AVI_file = player->avi_data.next.AVI_file;
+        player->avi_data.has_info = true;
+        player->avi_data.file.fast_start = true;
+        player->avi_data.next.file = NULL;
+        player->avi_data.next.state = PREFETCH_IDLE;
+    } else if (player->avi_data.next.state == PREFETCH_READY || (player->avi_data.next.state == PREFETCH_PENDING && same)) {
+        prefetch_discard(&player->avi_data);
+    }
+    if (same) {
+        /*!< Played, no longer queued for AVI_PLAYER_CMD_NEXT */
+        player->avi_data.next.path[0] = '\0';
+    }
+    xSemaphoreGive(player->avi_data.next.lock);
+
+    if (!player->avi_data.file.fast_start) {
+        player->avi_data.file.avi_file = fopen(filename, "rb");
+        if (player->avi_data.file.avi_file == NULL) {
+            ESP_LOGE(TAG, "Cannot open %s", filename);
+            return ESP_FAIL;
+        }
+    }
+
+    player->avi_data.file.rb_head = 0;
+    player->avi_data.file.rb_tail = 0;
+    player->avi_data.file.rb_fill = 0;
+    if (player->avi_data.file.fast_start) {
+        /*!< Standby data becomes the start of the ring, the reader continues from the file position */
+        memcpy(player->avi_data.file.ring_buffer, player->avi_data.next.buffer, player->avi_data.next.len);
+        player->stats.ring_copies++;
+        player->stats.ring_bytes += player->avi_data.next.len;
+        player->stats.prefetch_starts++;
+        player->avi_data.file.rb_head = player->avi_data.next.len;
+        player->avi_data.file.rb_fill = player->avi_data.next.len;
+    }
+    player->avi_data.file.reader_running = false; // Start later
+    player->avi_data.file.reader_finished = false;
+    player->avi_data.file.direct = direct_read_open(player, filename);
+    return ESP_OK;
+}
+
+/* Stop the playing file, avi_play_end_cb and AVI_PLAYER_EVENT_PLAY_END follow */
+static esp_err_t avi_cmd_stop(avi_player_t *player, size_t *BytesRD, uint32_t *Strtype)
+{
+    if (player->avi_data.state == AVI_PARSER_NONE) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    /*!< Also finishes a file that just ended, its pending EVENT_STOP_PLAY must not end the next one */
+    xEventGroupClearBits(player->event_group, EVENT_STOP_PLAY);
+    player->avi_data.state = AVI_PARSER_END;
+    return avi_player(player, BytesRD, Strtype);
+}
+
+static esp_err_t avi_cmd_play(avi_player_t *player, const char *filename, const avi_player_play_cfg_t *cfg, size_t *BytesRD, uint32_t *Strtype)
+{
+    avi_cmd_stop(player, BytesRD, Strtype);
+    esp_err_t ret = avi_open_file(player, filename, cfg);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    player->avi_data.state = AVI_PARSER_HEADER;
+    return avi_player(player, BytesRD, Strtype);
+}
+
+/* Continue at the last key frame up to frame, the reader restarts there with an empty ring */
+static esp_err_t avi_cmd_seek(avi_player_t *player, uint32_t frame, size_t *BytesRD)
+{
+    avi_data_t *avi = &player->avi_data;
+    if (avi->state != AVI_PARSER_DATA) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (avi->mode == PLAY_FILE) {
+        avi_reader_stop(avi);
+    }
+
+    uint32_t skip;
+    uint32_t first_frame;
+    esp_err_t ret = avi_seek_offset(avi, frame, &skip, &first_frame);
+    if (ret == ESP_OK) {
+        ESP_LOGI(TAG, "Seek to frame %"PRIu32"", first_frame);
+        *BytesRD = skip;
+        avi->video_frame = first_frame;
+        if (avi->mode == PLAY_MEMORY) {
+            avi->memory.read_offset = avi->AVI_file.movi_start + skip;
+        } else {
+            xSemaphoreTake(avi->file.rb_mutex, portMAX_DELAY);
+            avi->file.rb_head = 0;
+            avi->file.rb_tail = 0;
+            avi->file.rb_fill = 0;
+            xSemaphoreGive(avi->file.rb_mutex);
+            avi->file.fast_start = false;
+            avi->file.read_pos = avi->AVI_file.movi_start + skip;
+        }
+    }
+    if (avi->mode == PLAY_FILE) {
+        /*!< Without an index the reader simply continues where it stopped */
+        fseek(avi->file.avi_file, avi->file.read_pos, SEEK_SET);
+        avi_reader_start(player);
+    }
+    return ret;
+}
+
+static esp_err_t avi_player_command(avi_player_t *player, const avi_player_cmd_t *cmd, size_t *BytesRD, uint32_t *Strtype)
+{
+    bool playing = player->avi_data.state == AVI_PARSER_DATA;
+
+    switch (cmd->type) {
+    case AVI_PLAYER_CMD_PLAY: {
+        /*!< The pointers of the queued copy refer to the sender's memory */
+        avi_player_play_cfg_t cfg = cmd->play.cfg;
+        if (cfg.info) {
+            cfg.info = &player->cmd.info;
+        }
+        return avi_cmd_play(player, player->cmd.path, &cfg, BytesRD, Strtype);
+    }
+    case AVI_PLAYER_CMD_PAUSE: {
+        ESP_RETURN_ON_FALSE(playing, ESP_ERR_INVALID_STATE, TAG, "AVI player not playing");
+        if (player->paused) {
+            return ESP_OK;
+        }
+        /*!< The clock stops mid period, the reader parks once the ring is full */
+        player->timebase->timer_stop(player->timebase, player->timer);
+        xEventGroupClearBits(player->event_group, EVENT_FPS_TIME_UP);
+        int64_t phase = avi_now(player) - player->tick_time;
+        player->pause_phase = phase < avi_frame_period(player) ? phase : avi_frame_period(player);
+        player->paused = true;
+        return ESP_OK;
+    }
+    case AVI_PLAYER_CMD_RESUME:
+        ESP_RETURN_ON_FALSE(playing, ESP_ERR_INVALID_STATE, TAG, "AVI player not playing");
+        if (player->paused) {
+            /*!< The rest of the paused period first, the ring is full so no buffering wait follows */
+            player->paused = false;
+            avi_timer_start(player, avi_frame_period(player) - player->pause_phase);
+        }
+        return ESP_OK;
+    case AVI_PLAYER_CMD_STOP:
+        return avi_cmd_stop(player, BytesRD, Strtype);
+    case AVI_PLAYER_CMD_SEEK:
+        return avi_cmd_seek(player, cmd->seek_frame, BytesRD);
+    case AVI_PLAYER_CMD_STEP:
+        ESP_RETURN_ON_FALSE(playing && player->paused, ESP_ERR_INVALID_STATE, TAG, "AVI player not paused");
+        for (uint32_t i = 0; i < cmd->step_frames && player->avi_data.state == AVI_PARSER_DATA; i++) {
+            ESP_RETURN_ON_ERROR(avi_player(player, BytesRD, Strtype), TAG, "step failed");
+        }
+        return ESP_OK;
+    case AVI_PLAYER_CMD_NEXT: {
+        xSemaphoreTake(player->avi_data.next.lock, portMAX_DELAY);
+        bool queued = player->avi_data.next.path[0] != '\0';
+        avi_player_play_cfg_t cfg = {
+            .info = player->avi_data.next.has_info ? &player->cmd.info : NULL,
+        };
+        /*!< player->cmd is this command, its buffers are free */
+        strcpy(player->cmd.path, player->avi_data.next.path);
+        player->cmd.info = player->avi_data.next.info;
+        xSemaphoreGive(player->avi_data.next.lock);
+        if (!queued) {
+            return ESP_ERR_NOT_FOUND;
+        }
+        return avi_cmd_play(player, player->cmd.path, &cfg, BytesRD, Strtype);
+    }
+    case AVI_PLAYER_CMD_SET_SPEED:
+        ESP_RETURN_ON_FALSE(cmd->speed_pct >= AVI_SPEED_MIN && cmd->speed_pct <= AVI_SPEED_MAX, ESP_ERR_INVALID_ARG, TAG, "invalid speed");
+        if (player->paused) {
+            /*!< Keep the paused position within the period */
+            player->pause_phase = (uint64_t)player->pause_phase * player->speed_pct / cmd->speed_pct;
+        }
+        player->speed_pct = cmd->speed_pct;
+        if (player->pause_phase > avi_frame_period(player)) {
+            player->pause_phase = avi_frame_period(player);
+        }
+        if (playing && !player->paused) {
+            avi_timer_start(player, avi_frame_period(player));
+        }
+        return ESP_OK;
+    default:
+        return ESP_ERR_INVALID_ARG;
+    }
+}
+
 static void avi_player_task(void *args)
 {
     avi_player_t *player = (avi_player_t *)args;
@@ -370,9 +1374,15 @@ static void avi_player_task(void *args)
     bool exit = false;
     size_t BytesRD = 0;
     uint32_t Strtype = 0;
+    bool tick_seen = false;
     while (!exit) {
+        if (tick_seen && player->timebase->timer_handled && !(xEventGroupGetBits(player->event_group) & EVENT_ALL)) {
+            /*!< A virtual clock only moves on once the tick and all it caused, like the end of the file, is done */
+            tick_seen = false;
+            player->timebase->timer_handled(player->timebase, player->timer);
+        }
         uxBits = xEventGroupWaitBits(player->event_group, EVENT_ALL, pdTRUE, pdFALSE, portMAX_DELAY);
-        if (uxBits & EVENT_STOP_PLAY) {
+        if ((uxBits & EVENT_STOP_PLAY) && player->avi_data.state != AVI_PARSER_NONE) {
             player->avi_data.state = AVI_PARSER_END;
             esp_err_t ret = avi_player(player, &BytesRD, &Strtype);
             if (ret != ESP_OK) {
@@ -380,6 +1390,14 @@ static void avi_player_task(void *args)
             }
         }
 
+        if (uxBits & EVENT_COMMAND) {
+            /*!< Carried out one by one between frames, each completes with an event */
+            while (xQueueReceive(player->cmd_queue, &player->cmd, 0) == pdTRUE) {
+                esp_err_t ret = avi_player_command(player, &player->cmd.cmd, &BytesRD, &Strtype);
+                avi_player_emit(player, AVI_PLAYER_EVENT_CMD_DONE, player->cmd.cmd.type, player->cmd.cmd.id, ret);
+            }
+        }
+
         if (uxBits & EVENT_START_PLAY) {
             player->avi_data.state = AVI_PARSER_HEADER;
             esp_err_t ret = avi_player(player, &BytesRD, &Strtype);
@@ -388,12 +1406,27 @@ static void avi_player_task(void *args)
             }
         }
 
-        if (uxBits & EVENT_FPS_TIME_UP) {
+        if ((uxBits & EVENT_FPS_TIME_UP) && !player->paused) {
+            int64_t now = avi_now(player);
+            uint32_t period = avi_frame_period(player);
+            if (now - player->tick_time >= 2 * period) {
+                /*!< The player was held up for more than a period, the ticks in between were lost */
+                player->stats.missed_ticks += (now - player->tick_time) / period - 1;
+                AVI_TRACE(AVI_TRACE_MISSED_TICKS, (now - player->tick_time) / period - 1);
+            }
+            AVI_TRACE(AVI_TRACE_TICK, player->avi_data.video_frame);
+            player->tick_time = now;
+            if (player->rearm) {
+                player->rearm = false;
+                player->timebase->timer_start(player->timebase, player->timer, avi_frame_period(player), true);
+            }
             esp_err_t ret = avi_player(player, &BytesRD, &Strtype);
             if (ret != ESP_OK) {
                 ESP_LOGE(TAG, "AVI Perse failed");
             }
         }
+        /*!< A start or a command may have started the timer, the first tick waits for its frames too */
+        tick_seen |= (uxBits & (EVENT_FPS_TIME_UP | EVENT_START_PLAY | EVENT_COMMAND)) != 0;
 
         if (uxBits & EVENT_DEINIT) {
             exit = true;
@@ -427,11 +1460,12 @@ esp_err_t avi_player_get_video_buffer(avi_player_handle_t handle, void **buffer,
         return ESP_ERR_NO_MEM;
     }
 
-    memcpy(*buffer, player->avi_data.pbuffer, player->avi_data.str_size);
+    memcpy(*buffer, player->avi_data.frame, player->avi_data.str_size);
     *buffer_size = player->avi_data.str_size;
     info->width = player->avi_data.AVI_file.vids_width;
     info->height = player->avi_data.AVI_file.vids_height;
     info->frame_format = player->avi_data.AVI_file.vids_format;
+    info->frame_index = player->avi_data.video_frame - 1;
     return ESP_OK;
 }
 
@@ -453,7 +1487,7 @@ esp_err_t avi_player_get_audio_buffer(avi_player_handle_t handle, void **buffer,
         return ESP_ERR_NO_MEM;
     }
 
-    memcpy(*buffer, player->avi_data.pbuffer, player->avi_data.str_size);
+    memcpy(*buffer, player->avi_data.frame, player->avi_data.str_size);
     *buffer_size = player->avi_data.str_size;
     info->channel = player->avi_data.AVI_file.auds_channels;
     info->bits_per_sample = player->avi_data.AVI_file.auds_bits;
@@ -463,9 +1497,25 @@ esp_err_t avi_player_get_audio_buffer(avi_player_handle_t handle, void **buffer,
 }
 
 esp_err_t avi_player_play_from_memory(avi_player_handle_t handle, uint8_t *avi_data, size_t avi_size)
+{
+    return avi_player_play_from_memory_ex(handle, avi_data, avi_size, NULL);
+}
+
+esp_err_t avi_player_play_from_memory_ex(avi_player_handle_t handle, const uint8_t *avi_data, size_t avi_size, const avi_player_play_cfg_t *cfg)
 {
     avi_player_t *player = (avi_player_t *)handle;
+    ESP_RETURN_ON_FALSE(avi_data != NULL && avi_size > AVI_HEADER_MIN, ESP_ERR_INVALID_ARG, TAG, "invalid AVI data");
     ESP_RETURN_ON_FALSE(player->avi_data.state == AVI_PARSER_NONE, ESP_ERR_INVALID_STATE, TAG, "AVI player not ready");
+    player->avi_data.has_info = false;
+    player->avi_data.loop = cfg && cfg->loop;
+    player->avi_data.loops = 0;
+    player->avi_data.start_frame = cfg ? cfg->start_frame : 0;
+    if (cfg && cfg->info) {
+        ESP_RETURN_ON_FALSE(cfg->info->fps != 0 && cfg->info->movi_start != 0 && cfg->info->movi_start < avi_size,
+                            ESP_ERR_INVALID_ARG, TAG, "invalid file info");
+        avi_header_from_info(&player->avi_data.AVI_file, cfg->info);
+        player->avi_data.has_info = true;
+    }
     player->avi_data.mode = PLAY_MEMORY;
     player->avi_data.memory.data = avi_data;
     player->avi_data.memory.size = avi_size;
@@ -474,39 +1524,128 @@ esp_err_t avi_player_play_from_memory(avi_player_handle_t handle, uint8_t *avi_d
     return ESP_OK;
 }
 
+
 esp_err_t  avi_player_play_from_file(avi_player_handle_t handle, const char *filename)
+{
+    return avi_player_play_from_file_ex(handle, filename, NULL);
+}
+
+esp_err_t avi_player_play_from_file_ex(avi_player_handle_t handle, const char *filename, const avi_player_play_cfg_t *cfg)
 {
     avi_player_t *player = (avi_player_t *)handle;
     ESP_RETURN_ON_FALSE(player->avi_data.state == AVI_PARSER_NONE, ESP_ERR_INVALID_STATE, TAG, "AVI player not ready");
+    ESP_RETURN_ON_ERROR(avi_open_file(player, filename, cfg), TAG, "Cannot play %s", filename);
+    xEventGroupSetBits(player->event_group, EVENT_START_PLAY);
+    return ESP_OK;
+}
 
-    player->avi_data.mode = PLAY_FILE;
-    player->avi_data.file.avi_file = fopen(filename, "rb");
-    if (player->avi_data.file.avi_file == NULL) {
-        ESP_LOGE(TAG, "Cannot open %s", filename);
-        return ESP_FAIL;
+
+esp_err_t avi_player_set_direct_read(avi_player_handle_t handle, sdmmc_card_t *card, const char *mount_point)
+{
+    avi_player_t *player = (avi_player_t *)handle;
+    ESP_RETURN_ON_FALSE(player != NULL, ESP_ERR_INVALID_ARG, TAG, "handle can’t be NULL");
+    ESP_RETURN_ON_FALSE(card == NULL || (mount_point && strlen(mount_point) < sizeof(player->direct.mount_point)),
+                        ESP_ERR_INVALID_ARG, TAG, "invalid mount point");
+
+    if (card && !player->direct.buffer) {
+        player->direct.buffer = avi_buf_alloc(player, AVI_PLAYER_BUF_DIRECT, AVI_DIRECT_READ_SIZE);
+        ESP_RETURN_ON_FALSE(player->direct.buffer != NULL, ESP_ERR_NO_MEM, TAG, "Cannot alloc direct read buffer");
     }
-    
-    // Allocate 4MB ring buffer in PSRAM
-    player->avi_data.file.rb_size = 4 * 1024 * 1024;
-    player->avi_data.file.ring_buffer = heap_caps_malloc(player->avi_data.file.rb_size, MALLOC_CAP_SPIRAM);
-    if (!player->avi_data.file.ring_buffer) {
-        ESP_LOGE(TAG, "Failed to alloc ring buffer");
-        fclose(player->avi_data.file.avi_file);
-        return ESP_ERR_NO_MEM;
+    if (!card) {
+        /*!< The prefetched FILE belongs to the file system about to go away, its descriptor must not outlive it */
+        xSemaphoreTake(player->avi_data.next.lock, portMAX_DELAY);
+        prefetch_discard(&player->avi_data);
+        player->avi_data.next.path[0] = '\0';
+        xSemaphoreGive(player->avi_data.next.lock);
     }
-    player->avi_data.file.rb_head = 0;
-    player->avi_data.file.rb_tail = 0;
-    player->avi_data.file.rb_fill = 0;
-    player->avi_data.file.rb_mutex = xSemaphoreCreateMutex();
-    player->avi_data.file.reader_running = false; // Start later
-    player->avi_data.file.reader_finished = false;
+    player->direct.card = card;
+    strcpy(player->direct.mount_point, card ? mount_point : "");
+    return ESP_OK;
+}
 
-    // xTaskCreatePinnedToCore(avi_reader_task, "avi_reader", 4096, player, 5, &player->avi_data.file.reader_task, 1);
+esp_err_t avi_player_set_next(avi_player_handle_t handle, const char *filename, const avi_player_play_cfg_t *cfg)
+{
+    avi_player_t *player = (avi_player_t *)handle;
+    ESP_RETURN_ON_FALSE(player != NULL, ESP_ERR_INVALID_ARG, TAG, "handle can’t be NULL");
+    ESP_RETURN_ON_FALSE(filename == NULL || strlen(filename) < AVI_PATH_MAX, ESP_ERR_INVALID_ARG, TAG, "filename too long");
+
+    xSemaphoreTake(player->avi_data.next.lock, portMAX_DELAY);
+    if (filename && strcmp(player->avi_data.next.path, filename) == 0 && player->avi_data.next.state != PREFETCH_IDLE) {
+        /*!< Already queued or loaded */
+        xSemaphoreGive(player->avi_data.next.lock);
+        return ESP_OK;
+    }
+    prefetch_discard(&player->avi_data);
+    player->avi_data.next.path[0] = '\0';
+    if (filename) {
+        strcpy(player->avi_data.next.path, filename);
+        player->avi_data.next.has_info = cfg && cfg->info;
+        if (player->avi_data.next.has_info) {
+            player->avi_data.next.info = *cfg->info;
+        }
+        player->avi_data.next.state = PREFETCH_PENDING;
+    }
+    xSemaphoreGive(player->avi_data.next.lock);
+    if (filename) {
+        /*!< A reader parked on a full ring loads it right away */
+        avi_reader_wake(&player->avi_data);
+    }
+    return ESP_OK;
+}
 
-    xEventGroupSetBits(player->event_group, EVENT_START_PLAY);
+esp_err_t avi_player_probe_file(const char *filename, avi_player_file_info_t *info)
+{
+    ESP_RETURN_ON_FALSE(filename != NULL && info != NULL, ESP_ERR_INVALID_ARG, TAG, "NULL arguments");
+    esp_err_t ret = ESP_OK;
+    uint8_t *header = NULL;
+
+    FILE *f = fopen(filename, "rb");
+    ESP_RETURN_ON_FALSE(f != NULL, ESP_ERR_NOT_FOUND, TAG, "Cannot open %s", filename);
+
+    header = malloc(AVI_PROBE_HEADER_SIZE);
+    ESP_GOTO_ON_FALSE(header != NULL, ESP_ERR_NO_MEM, err, TAG, "no mem for header");
+    ESP_GOTO_ON_ERROR(avi_probe(f, header, AVI_PROBE_HEADER_SIZE, info), err, TAG, "Cannot probe %s", filename);
+
+err:
+    free(header);
+    fclose(f);
+    return ret;
+}
+
+esp_err_t avi_player_get_position(avi_player_handle_t handle, uint32_t *frame)
+{
+    avi_player_t *player = (avi_player_t *)handle;
+    ESP_RETURN_ON_FALSE(player != NULL && frame != NULL, ESP_ERR_INVALID_ARG, TAG, "NULL arguments");
+    ESP_RETURN_ON_FALSE(player->avi_data.state == AVI_PARSER_DATA, ESP_ERR_INVALID_STATE, TAG, "AVI player not playing");
+    *frame = player->avi_data.video_frame;
     return ESP_OK;
 }
 
+esp_err_t avi_player_get_stats(avi_player_handle_t handle, avi_player_stats_t *stats)
+{
+    avi_player_t *player = (avi_player_t *)handle;
+    ESP_RETURN_ON_FALSE(player != NULL && stats != NULL, ESP_ERR_INVALID_ARG, TAG, "NULL arguments");
+    *stats = player->stats;
+    stats->ring_fill = player->avi_data.mode == PLAY_FILE ? player->avi_data.file.rb_fill : 0;
+    stats->ring_size = player->avi_data.file.rb_size;
+    return ESP_OK;
+}
+
+esp_err_t avi_player_set_stream_mask(avi_player_handle_t handle, uint32_t mask)
+{
+    avi_player_t *player = (avi_player_t *)handle;
+    ESP_RETURN_ON_FALSE(player != NULL, ESP_ERR_INVALID_ARG, TAG, "handle can’t be NULL");
+    ESP_RETURN_ON_FALSE((mask & ~AVI_PLAYER_STREAM_ALL) == 0, ESP_ERR_INVALID_ARG, TAG, "invalid stream mask");
+    player->stream_mask = mask;
+    return ESP_OK;
+}
+
+uint32_t avi_player_get_stream_mask(avi_player_handle_t handle)
+{
+    avi_player_t *player = (avi_player_t *)handle;
+    return player ? player->stream_mask : 0;
+}
+
 esp_err_t avi_player_play_stop(avi_player_handle_t handle)
 {
     avi_player_t *player = (avi_player_t *)handle;
@@ -516,18 +1655,87 @@ esp_err_t avi_player_play_stop(avi_player_handle_t handle)
     return ESP_OK;
 }
 
-static void esp_timer_cb(void *arg)
+esp_err_t avi_player_send_command(avi_player_handle_t handle, const avi_player_cmd_t *cmd)
+{
+    avi_player_t *player = (avi_player_t *)handle;
+    ESP_RETURN_ON_FALSE(player != NULL && cmd != NULL, ESP_ERR_INVALID_ARG, TAG, "NULL arguments");
+
+    avi_cmd_item_t item = {
+        .cmd = *cmd,
+    };
+    if (cmd->type == AVI_PLAYER_CMD_PLAY) {
+        ESP_RETURN_ON_FALSE(cmd->play.filename != NULL && strlen(cmd->play.filename) < AVI_PATH_MAX,
+                            ESP_ERR_INVALID_ARG, TAG, "invalid filename");
+        strcpy(item.path, cmd->play.filename);
+        if (cmd->play.cfg.info) {
+            item.info = *cmd->play.cfg.info;
+        }
+    }
+    ESP_RETURN_ON_FALSE(xQueueSend(player->cmd_queue, &item, 0) == pdTRUE, ESP_ERR_TIMEOUT, TAG, "command queue full");
+    xEventGroupSetBits(player->event_group, EVENT_COMMAND);
+    return ESP_OK;
+}
+
+static void avi_timer_cb(void *arg)
 {
     avi_player_t *player = (avi_player_t *)arg;
     /*!< Give the Event */
     xEventGroupSetBits(player->event_group, EVENT_FPS_TIME_UP);
 }
 
+/* Free what avi_player_init() created, the player and reader tasks have ended */
+static void avi_player_free(avi_player_t *player)
+{
+    if (player->timer != NULL) {
+        player->timebase->timer_delete(player->timebase, player->timer);
+    }
+
+    avi_buf_free(player, AVI_PLAYER_BUF_FRAME, player->avi_data.pbuffer);
+    avi_buf_free(player, AVI_PLAYER_BUF_FRAME_HOT, player->avi_data.hot_buffer);
+
+    if (player->avi_data.next.lock != NULL) {
+        prefetch_discard(&player->avi_data);
+        vSemaphoreDelete(player->avi_data.next.lock);
+    }
+    avi_buf_free(player, AVI_PLAYER_BUF_PREFETCH, player->avi_data.next.buffer);
+    avi_buf_free(player, AVI_PLAYER_BUF_RING, player->avi_data.file.ring_buffer);
+    avi_buf_free(player, AVI_PLAYER_BUF_READ, player->avi_data.file.chunk_buf);
+    avi_buf_free(player, AVI_PLAYER_BUF_DIRECT, player->direct.buffer);
+    if (player->avi_data.file.rb_mutex != NULL) {
+        vSemaphoreDelete(player->avi_data.file.rb_mutex);
+    }
+
+    if (player->event_group != NULL) {
+        vEventGroupDelete(player->event_group);
+    }
+    if (player->cmd_queue != NULL) {
+        vQueueDelete(player->cmd_queue);
+    }
+
+    free(player);
+}
+
+/* End the reader task, returns once it no longer touches the player */
+static void avi_reader_exit(avi_data_t *avi)
+{
+    avi_reader_stop(avi);
+    avi->file.reader_exit = true;
+    avi->file.reader_finished = false;
+    xTaskNotifyGive(avi->file.reader_task);
+    avi_reader_stop(avi);
+}
+
 esp_err_t avi_player_init(avi_player_config_t config, avi_player_handle_t *handle)
 {
     ESP_LOGI(TAG, "AVI Player Version: %d.%d.%d", AVI_PLAYER_VER_MAJOR, AVI_PLAYER_VER_MINOR, AVI_PLAYER_VER_PATCH);
+    ESP_RETURN_ON_FALSE(!config.buf_alloc_cb == !config.buf_free_cb, ESP_ERR_INVALID_ARG, TAG, "Set both allocation hooks or none");
     avi_player_t *player = (avi_player_t *)calloc(1, sizeof(avi_player_t));
+    ESP_RETURN_ON_FALSE(player != NULL, ESP_ERR_NO_MEM, TAG, "Cannot alloc memory for player");
+    esp_err_t ret = ESP_OK;
     player->config = config;
+    player->stream_mask = AVI_PLAYER_STREAM_ALL;
+    player->speed_pct = 100;
+    player->timebase = config.clock ? config.clock : &esp_clock;
 
     if (player->config.buffer_size == 0) {
         player->config.buffer_size = 20 * 1024;
@@ -539,19 +1747,40 @@ esp_err_t avi_player_init(avi_player_config_t config, avi_player_handle_t *handl
         player->config.stack_size = 4096;
     }
 
-    player->avi_data.pbuffer = malloc(player->config.buffer_size);
-    ESP_RETURN_ON_FALSE(player->avi_data.pbuffer != NULL, ESP_ERR_NO_MEM, TAG, "Cannot alloc memory for player");
+    player->avi_data.pbuffer = avi_buf_alloc(player, AVI_PLAYER_BUF_FRAME, player->config.buffer_size);
+    ESP_GOTO_ON_FALSE(player->avi_data.pbuffer != NULL, ESP_ERR_NO_MEM, err, TAG, "Cannot alloc memory for player");
+    if (player->config.hot_buffer_size > player->config.buffer_size) {
+        player->config.hot_buffer_size = player->config.buffer_size;
+    }
+    if (player->config.hot_buffer_size) {
+        /*!< Optional, without it every chunk goes through pbuffer */
+        player->avi_data.hot_buffer = avi_buf_alloc(player, AVI_PLAYER_BUF_FRAME_HOT, player->config.hot_buffer_size);
+    }
+
+    /*!< Everything a file needs is reserved once here, switching tracks makes no heap calls */
+    player->avi_data.file.rb_size = AVI_RING_BUFFER_SIZE;
+    player->avi_data.file.ring_buffer = avi_buf_alloc(player, AVI_PLAYER_BUF_RING, AVI_RING_BUFFER_SIZE);
+    player->avi_data.file.chunk_buf = avi_buf_alloc(player, AVI_PLAYER_BUF_READ, AVI_READ_CHUNK_SIZE);
+    player->avi_data.next.buffer = avi_buf_alloc(player, AVI_PLAYER_BUF_PREFETCH, AVI_PREFETCH_SIZE);
+    ESP_GOTO_ON_FALSE(player->avi_data.file.ring_buffer && player->avi_data.file.chunk_buf && player->avi_data.next.buffer,
+                      ESP_ERR_NO_MEM, err, TAG, "Cannot alloc ring, read and prefetch buffers");
+    player->avi_data.file.rb_mutex = xSemaphoreCreateMutex();
+    ESP_GOTO_ON_FALSE(player->avi_data.file.rb_mutex != NULL, ESP_ERR_NO_MEM, err, TAG, "Cannot create ring lock");
+
+    player->avi_data.next.lock = xSemaphoreCreateMutex();
+    ESP_GOTO_ON_FALSE(player->avi_data.next.lock != NULL, ESP_ERR_NO_MEM, err, TAG, "Cannot create prefetch lock");
 
-    esp_timer_create_args_t timer = {0};
-    timer.arg = player;
-    timer.callback = esp_timer_cb;
-    timer.dispatch_method = ESP_TIMER_TASK;
-    timer.name = "avi_player_timer";
-    esp_timer_create(&timer, &player->timer_handle);
+    ESP_GOTO_ON_ERROR(player->timebase->timer_create(player->timebase, avi_timer_cb, player, &player->timer), err, TAG, "Cannot create frame timer");
 
     player->event_group = xEventGroupCreate();
-    assert(player->event_group);
-    ESP_RETURN_ON_FALSE(player->event_group != NULL, ESP_ERR_NO_MEM, TAG, "Cannot create event group");
+    ESP_GOTO_ON_FALSE(player->event_group != NULL, ESP_ERR_NO_MEM, err, TAG, "Cannot create event group");
+
+    player->cmd_queue = xQueueCreate(AVI_CMD_QUEUE_LEN, sizeof(avi_cmd_item_t));
+    ESP_GOTO_ON_FALSE(player->cmd_queue != NULL, ESP_ERR_NO_MEM, err, TAG, "Cannot create command queue");
+
+    player->avi_data.file.reader_finished = true;
+    ESP_GOTO_ON_FALSE(xTaskCreatePinnedToCore(avi_reader_task, "avi_reader", 4096, player, 10, &player->avi_data.file.reader_task, 1) == pdPASS,
+                      ESP_ERR_NO_MEM, err, TAG, "Cannot create reader task");
 
     *handle = (avi_player_handle_t *)player;
 
@@ -562,6 +1791,13 @@ esp_err_t avi_player_init(avi_player_config_t config, avi_player_handle_t *handl
     xTaskCreatePinnedToCore(avi_player_task, "avi_player", player->config.stack_size, player, player->config.priority, NULL, player->config.coreID);
 #endif
     return ESP_OK;
+
+err:
+    if (player->avi_data.file.reader_task != NULL) {
+        avi_reader_exit(&player->avi_data);
+    }
+    avi_player_free(player);
+    return ret;
 }
 
 esp_err_t avi_player_deinit(avi_player_handle_t handle)
@@ -578,20 +1814,7 @@ esp_err_t avi_player_deinit(avi_player_handle_t handle)
         return ESP_ERR_TIMEOUT;
     }
 
-    if (player->timer_handle != NULL) {
-        esp_timer_stop(player->timer_handle);
-        esp_timer_delete(player->timer_handle);
-    }
-
-    if (player->avi_data.pbuffer != NULL) {
-        free(player->avi_data.pbuffer);
-    }
-
-    if (player->event_group != NULL) {
-        vEventGroupDelete(player->event_group);
-    }
-
-    free(player);
-    player = NULL;
+    avi_reader_exit(&player->avi_data);
+    avi_player_free(player);
     return ESP_OK;
 }
@@ -0,0 +1,145 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_check.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "avi_trace.h"
+
+static const char *TAG = "avi trace";
+
+_Static_assert(sizeof(avi_trace_record_t) == 12, "the dump format has 12 byte records");
+_Static_assert(sizeof(avi_trace_file_header_t) == 16, "the dump header is 16 bytes");
+
+static const avi_trace_event_desc_t event_descs[AVI_TRACE_EVENT_MAX] = {
+    [AVI_TRACE_READ_BEGIN] = { "read", "reader", AVI_TRACE_KIND_BEGIN },
+    [AVI_TRACE_READ_END] = { "read", "reader", AVI_TRACE_KIND_END },
+    [AVI_TRACE_RING_FILL] = { "ring fill", "ring", AVI_TRACE_KIND_COUNTER },
+    [AVI_TRACE_FRAME_BEGIN] = { "read_frame", "player", AVI_TRACE_KIND_BEGIN },
+    [AVI_TRACE_FRAME_END] = { "read_frame", "player", AVI_TRACE_KIND_END },
+    [AVI_TRACE_TICK] = { "tick", "player", AVI_TRACE_KIND_INSTANT },
+    [AVI_TRACE_MISSED_TICKS] = { "missed ticks", "player", AVI_TRACE_KIND_INSTANT },
+    [AVI_TRACE_UNDERRUN] = { "underrun", "player", AVI_TRACE_KIND_INSTANT },
+    [AVI_TRACE_VIDEO_CB_BEGIN] = { "video_cb", "player", AVI_TRACE_KIND_BEGIN },
+    [AVI_TRACE_VIDEO_CB_END] = { "video_cb", "player", AVI_TRACE_KIND_END },
+    [AVI_TRACE_AUDIO_CB_BEGIN] = { "audio_cb", "player", AVI_TRACE_KIND_BEGIN },
+    [AVI_TRACE_AUDIO_CB_END] = { "audio_cb", "player", AVI_TRACE_KIND_END },
+    [AVI_TRACE_JPEG_PARSE_BEGIN] = { "jpeg parse", "player", AVI_TRACE_KIND_BEGIN },
+    [AVI_TRACE_JPEG_PARSE_END] = { "jpeg parse", "player", AVI_TRACE_KIND_END },
+    [AVI_TRACE_JPEG_DECODE_BEGIN] = { "jpeg decode", "player", AVI_TRACE_KIND_BEGIN },
+    [AVI_TRACE_JPEG_DECODE_END] = { "jpeg decode", "player", AVI_TRACE_KIND_END },
+    [AVI_TRACE_CANVAS_SWAP] = { "canvas swap", "player", AVI_TRACE_KIND_INSTANT },
+    [AVI_TRACE_FLUSH_BEGIN] = { "flush", "display", AVI_TRACE_KIND_BEGIN },
+    [AVI_TRACE_FLUSH_END] = { "flush", "display", AVI_TRACE_KIND_END },
+    [AVI_TRACE_FLUSH_WAIT_BEGIN] = { "flush wait", "display", AVI_TRACE_KIND_BEGIN },
+    [AVI_TRACE_FLUSH_WAIT_END] = { "flush wait", "display", AVI_TRACE_KIND_END },
+    [AVI_TRACE_I2S_WRITE_BEGIN] = { "i2s write", "player", AVI_TRACE_KIND_BEGIN },
+    [AVI_TRACE_I2S_WRITE_END] = { "i2s write", "player", AVI_TRACE_KIND_END },
+};
+
+static struct {
+    avi_trace_record_t *records;
+    uint32_t mask;
+    uint32_t head;                  // Records ever emitted, the next one goes to head & mask
+    uint32_t inflight;              // Emits past their recording check that have not written their record yet
+    bool recording;
+} trace;
+
+/* Stop recording and wait for the emits in progress, the ring is ours afterwards */
+static void trace_stop(void)
+{
+    // Sequentially consistent with the increment and the check in avi_trace_emit(), so one of us sees the other
+    __atomic_store_n(&trace.recording, false, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&trace.inflight, __ATOMIC_SEQ_CST)) {
+        vTaskDelay(1);
+    }
+}
+
+esp_err_t avi_trace_init(size_t events)
+{
+    ESP_RETURN_ON_FALSE(events && events <= 0x80000000u, ESP_ERR_INVALID_ARG, TAG, "Bad number of events");
+    ESP_RETURN_ON_FALSE(!trace.records, ESP_ERR_INVALID_STATE, TAG, "Already initialized");
+    size_t cap = 1;
+    while (cap < events) {
+        cap <<= 1;
+    }
+    // Written from both cores at about a thousand records per second, PSRAM is fast enough
+    avi_trace_record_t *records = heap_caps_malloc(cap * sizeof(avi_trace_record_t), MALLOC_CAP_SPIRAM);
+    if (!records) {
+        records = heap_caps_malloc(cap * sizeof(avi_trace_record_t), MALLOC_CAP_DEFAULT);
+    }
+    ESP_RETURN_ON_FALSE(records, ESP_ERR_NO_MEM, TAG, "Cannot allocate %u events", (unsigned)cap);
+    trace.records = records;
+    trace.mask = cap - 1;
+    __atomic_store_n(&trace.head, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&trace.recording, true, __ATOMIC_SEQ_CST);
+    return ESP_OK;
+}
+
+void avi_trace_deinit(void)
+{
+    trace_stop();
+    heap_caps_free(trace.records);
+    trace.records = NULL;
+}
+
+void avi_trace_emit(avi_trace_event_t event, uint32_t arg)
+{
+    if (!__atomic_load_n(&trace.recording, __ATOMIC_RELAXED)) {
+        return;
+    }
+    // Counted before the check that counts, trace_stop() waits for the record then
+    __atomic_add_fetch(&trace.inflight, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&trace.recording, __ATOMIC_SEQ_CST)) {
+        // esp_timer time is the same on both cores, the cycle counters are not
+        uint32_t now = (uint32_t)esp_timer_get_time();
+        uint32_t idx = __atomic_fetch_add(&trace.head, 1, __ATOMIC_RELAXED);
+        avi_trace_record_t *rec = &trace.records[idx & trace.mask];
+        rec->time_us = now;
+        rec->event = event;
+        rec->arg = arg;
+    }
+    __atomic_sub_fetch(&trace.inflight, 1, __ATOMIC_RELEASE);
+}
+
+esp_err_t avi_trace_save(const char *path)
+{
+    ESP_RETURN_ON_FALSE(trace.records, ESP_ERR_INVALID_STATE, TAG, "Not initialized");
+    FILE *f = fopen(path, "wb");
+    ESP_RETURN_ON_FALSE(f, ESP_ERR_NOT_FOUND, TAG, "Cannot create %s", path);
+
+    trace_stop();
+    uint32_t head = __atomic_load_n(&trace.head, __ATOMIC_RELAXED);
+    uint32_t cap = trace.mask + 1;
+    uint32_t count = head < cap ? head : cap;
+    avi_trace_file_header_t hdr = {
+        .magic = { 'A', 'V', 'T', 'R' },
+        .version = AVI_TRACE_VERSION,
+        .record_size = sizeof(avi_trace_record_t),
+        .records = count,
+        .lost = head - count,
+    };
+    uint32_t first = (head - count) & trace.mask;
+    uint32_t first_len = cap - first < count ? cap - first : count;
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+              fwrite(trace.records + first, sizeof(avi_trace_record_t), first_len, f) == first_len &&
+              fwrite(trace.records, sizeof(avi_trace_record_t), count - first_len, f) == count - first_len;
+    ok = fclose(f) == 0 && ok;
+    __atomic_store_n(&trace.head, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&trace.recording, true, __ATOMIC_SEQ_CST);
+    ESP_RETURN_ON_FALSE(ok, ESP_FAIL, TAG, "Write to %s failed", path);
+    ESP_LOGI(TAG, "%" PRIu32 " events saved to %s, %" PRIu32 " older ones lost", count, path, hdr.lost);
+    return ESP_OK;
+}
+
+const avi_trace_event_desc_t *avi_trace_event_desc(uint32_t event)
+{
+    return event < AVI_TRACE_EVENT_MAX ? &event_descs[event] : NULL;
+}
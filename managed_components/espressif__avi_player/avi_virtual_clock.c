@@ -0,0 +1,271 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_check.h"
+#include "avi_virtual_clock.h"
+
+static const char *TAG = "avi virtual clock";
+
+typedef struct vclock_timer {
+    void (*cb)(void *arg);
+    void *arg;
+    int64_t alarm;                 // Virtual time of the next call
+    uint64_t period;               // 0 for one shot
+    bool armed;
+    struct vclock_timer *next;
+} vclock_timer_t;
+
+/*
+ * One task moves the time. It calls the earliest due timer and then waits until the player
+ * reports the tick handled, or stops or deletes the timer, before it looks for the next one.
+ */
+typedef struct {
+    avi_player_clock_t clock;      // First, the player passes it back to us
+    SemaphoreHandle_t lock;        // Guards everything below
+    SemaphoreHandle_t idle;        // Given when run_until() got to its limit
+    SemaphoreHandle_t done;        // Given by the task when it ends
+    TaskHandle_t task;
+    int64_t now;
+    int64_t limit;                 // Time does not pass this, INT64_MAX runs freely
+    vclock_timer_t *timers;
+    vclock_timer_t *fired;         // Called and not yet handled
+    vclock_timer_t *running;       // In its callback right now
+    bool waiting;                  // run_until() waits for idle
+    bool exit;
+} vclock_t;
+
+static void vclock_task(void *arg)
+{
+    vclock_t *vc = arg;
+    while (true) {
+        xSemaphoreTake(vc->lock, portMAX_DELAY);
+        if (vc->exit) {
+            xSemaphoreGive(vc->lock);
+            break;
+        }
+        if (vc->fired == NULL) {
+            vclock_timer_t *due = NULL;
+            for (vclock_timer_t *t = vc->timers; t; t = t->next) {
+                if (t->armed && (due == NULL || t->alarm < due->alarm)) {
+                    due = t;
+                }
+            }
+            if (due && due->alarm <= vc->limit) {
+                vc->now = due->alarm > vc->now ? due->alarm : vc->now;
+                if (due->period) {
+                    due->alarm += due->period;
+                } else {
+                    due->armed = false;
+                }
+                vc->fired = due;
+                vc->running = due;
+                xSemaphoreGive(vc->lock);
+                due->cb(due->arg);
+                xSemaphoreTake(vc->lock, portMAX_DELAY);
+                vc->running = NULL;
+                xSemaphoreGive(vc->lock);
+                continue;
+            }
+            /*!< Nothing due before the limit, the time between passes anyway */
+            if (vc->limit != INT64_MAX && vc->now < vc->limit) {
+                vc->now = vc->limit;
+            }
+            if (vc->waiting) {
+                vc->waiting = false;
+                xSemaphoreGive(vc->idle);
+            }
+        }
+        xSemaphoreGive(vc->lock);
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+    xSemaphoreGive(vc->done);
+    vTaskDelete(NULL);
+}
+
+/* Called with the lock held, the task looks again once it is released */
+static void vclock_kick(vclock_t *vc)
+{
+    xTaskNotifyGive(vc->task);
+}
+
+static int64_t vclock_get_time(avi_player_clock_t *clock)
+{
+    vclock_t *vc = (vclock_t *)clock;
+    xSemaphoreTake(vc->lock, portMAX_DELAY);
+    int64_t now = vc->now;
+    xSemaphoreGive(vc->lock);
+    return now;
+}
+
+static esp_err_t vclock_timer_create(avi_player_clock_t *clock, void (*cb)(void *arg), void *arg, void **timer)
+{
+    vclock_t *vc = (vclock_t *)clock;
+    vclock_timer_t *t = calloc(1, sizeof(vclock_timer_t));
+    ESP_RETURN_ON_FALSE(t != NULL, ESP_ERR_NO_MEM, TAG, "Cannot alloc timer");
+    t->cb = cb;
+    t->arg = arg;
+    xSemaphoreTake(vc->lock, portMAX_DELAY);
+    t->next = vc->timers;
+    vc->timers = t;
+    xSemaphoreGive(vc->lock);
+    *timer = t;
+    return ESP_OK;
+}
+
+static esp_err_t vclock_timer_start(avi_player_clock_t *clock, void *timer, uint64_t us, bool periodic)
+{
+    vclock_t *vc = (vclock_t *)clock;
+    vclock_timer_t *t = timer;
+    esp_err_t ret = ESP_OK;
+    xSemaphoreTake(vc->lock, portMAX_DELAY);
+    if (t->armed) {
+        ret = ESP_ERR_INVALID_STATE;
+    } else {
+        t->alarm = vc->now + us;
+        t->period = periodic ? us : 0;
+        t->armed = true;
+        vc->fired = t; /*!< The starter is still busy, like after a tick, time moves on once it is handled */
+        vclock_kick(vc);
+    }
+    xSemaphoreGive(vc->lock);
+    return ret;
+}
+
+static esp_err_t vclock_timer_stop(avi_player_clock_t *clock, void *timer)
+{
+    vclock_t *vc = (vclock_t *)clock;
+    vclock_timer_t *t = timer;
+    xSemaphoreTake(vc->lock, portMAX_DELAY);
+    esp_err_t ret = t->armed ? ESP_OK : ESP_ERR_INVALID_STATE;
+    t->armed = false;
+    if (vc->fired == t) {
+        vc->fired = NULL; /*!< Its pending tick is dropped with it */
+    }
+    vclock_kick(vc);
+    xSemaphoreGive(vc->lock);
+    return ret;
+}
+
+static void vclock_timer_handled(avi_player_clock_t *clock, void *timer)
+{
+    vclock_t *vc = (vclock_t *)clock;
+    xSemaphoreTake(vc->lock, portMAX_DELAY);
+    if (vc->fired == timer) {
+        vc->fired = NULL;
+        vclock_kick(vc);
+    }
+    xSemaphoreGive(vc->lock);
+}
+
+static void vclock_timer_delete(avi_player_clock_t *clock, void *timer)
+{
+    vclock_t *vc = (vclock_t *)clock;
+    vclock_timer_t *t = timer;
+    xSemaphoreTake(vc->lock, portMAX_DELAY);
+    /*!< The callback may still be running, its argument is about to be freed */
+    while (vc->running == t) {
+        xSemaphoreGive(vc->lock);
+        vTaskDelay(1);
+        xSemaphoreTake(vc->lock, portMAX_DELAY);
+    }
+    for (vclock_timer_t **p = &vc->timers; *p; p = &(*p)->next) {
+        if (*p == t) {
+            *p = t->next;
+            break;
+        }
+    }
+    if (vc->fired == t) {
+        vc->fired = NULL;
+    }
+    vclock_kick(vc);
+    xSemaphoreGive(vc->lock);
+    free(t);
+}
+
+/* Only the reader is waited for, which takes no virtual time. Poll it often */
+static void vclock_sleep(avi_player_clock_t *clock, uint32_t ms)
+{
+    vTaskDelay(1);
+}
+
+esp_err_t avi_virtual_clock_create(avi_player_clock_t **clock)
+{
+    ESP_RETURN_ON_FALSE(clock != NULL, ESP_ERR_INVALID_ARG, TAG, "clock can't be NULL");
+    esp_err_t ret = ESP_OK;
+    vclock_t *vc = calloc(1, sizeof(vclock_t));
+    ESP_RETURN_ON_FALSE(vc != NULL, ESP_ERR_NO_MEM, TAG, "Cannot alloc clock");
+    vc->clock = (avi_player_clock_t) {
+        .get_time = vclock_get_time,
+        .timer_create = vclock_timer_create,
+        .timer_start = vclock_timer_start,
+        .timer_stop = vclock_timer_stop,
+        .timer_delete = vclock_timer_delete,
+        .timer_handled = vclock_timer_handled,
+        .sleep = vclock_sleep,
+    };
+    vc->limit = INT64_MAX;
+    vc->lock = xSemaphoreCreateMutex();
+    vc->idle = xSemaphoreCreateBinary();
+    vc->done = xSemaphoreCreateBinary();
+    ESP_GOTO_ON_FALSE(vc->lock && vc->idle && vc->done, ESP_ERR_NO_MEM, err, TAG, "Cannot create clock locks");
+    ESP_GOTO_ON_FALSE(xTaskCreate(vclock_task, "avi_vclock", 3072, vc, 10, &vc->task) == pdPASS,
+                      ESP_ERR_NO_MEM, err, TAG, "Cannot create clock task");
+    *clock = &vc->clock;
+    return ESP_OK;
+
+err:
+    if (vc->lock) {
+        vSemaphoreDelete(vc->lock);
+    }
+    if (vc->idle) {
+        vSemaphoreDelete(vc->idle);
+    }
+    if (vc->done) {
+        vSemaphoreDelete(vc->done);
+    }
+    free(vc);
+    return ret;
+}
+
+esp_err_t avi_virtual_clock_run_until(avi_player_clock_t *clock, int64_t time_us, TickType_t ticks_to_wait)
+{
+    ESP_RETURN_ON_FALSE(clock != NULL, ESP_ERR_INVALID_ARG, TAG, "clock can't be NULL");
+    vclock_t *vc = (vclock_t *)clock;
+    xSemaphoreTake(vc->lock, portMAX_DELAY);
+    vc->limit = time_us;
+    vc->waiting = time_us != INT64_MAX;
+    xSemaphoreTake(vc->idle, 0); /*!< Drop a stale idle of an earlier call that timed out */
+    vclock_kick(vc);
+    xSemaphoreGive(vc->lock);
+    if (time_us == INT64_MAX) {
+        return ESP_OK;
+    }
+    return xSemaphoreTake(vc->idle, ticks_to_wait) == pdTRUE ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+void avi_virtual_clock_delete(avi_player_clock_t *clock)
+{
+    if (clock == NULL) {
+        return;
+    }
+    vclock_t *vc = (vclock_t *)clock;
+    xSemaphoreTake(vc->lock, portMAX_DELAY);
+    vc->exit = true;
+    vclock_kick(vc);
+    xSemaphoreGive(vc->lock);
+    xSemaphoreTake(vc->done, portMAX_DELAY);
+    if (vc->timers) {
+        ESP_LOGW(TAG, "Deleted with timers left");
+    }
+    vSemaphoreDelete(vc->lock);
+    vSemaphoreDelete(vc->idle);
+    vSemaphoreDelete(vc->done);
+    free(vc);
+}
@@ -116,7 +116,12 @@ static int strl_parser(avi_typedef *AVI_file, const uint8_t *buffer, uint32_t le
         printf("Number of colors in palette:%"PRIu32"\r\n", strf->num_colors);
         printf("Number of important colors:%"PRIu32"\r\n\n", strf->imp_colors);
 #endif
-        AVI_file->vids_fps = strh->rate / strh->scale;
+        if (strh->rate == 0 || strh->scale == 0) {
+            return -5;
+        }
+        /*!< NTSC rates like 30000 / 1001 keep their exact interval, fps is only rounded for display */
+        AVI_file->vids_fps = (strh->rate + strh->scale / 2) / strh->scale;
+        AVI_file->vids_period_us = (uint64_t)strh->scale * 1000000 / strh->rate;
         AVI_file->vids_width = strf->width;
         AVI_file->vids_height = strf->height;
         pdata += sizeof(AVI_VIDS_STRF_CHUNK);
@@ -124,7 +129,7 @@ static int strl_parser(avi_typedef *AVI_file, const uint8_t *buffer, uint32_t le
         ESP_LOGI(TAG, "Find a audio stream");
         AVI_AUDS_STRF_CHUNK *strf = (AVI_AUDS_STRF_CHUNK*)pdata;
         if (strf->FourCC != STRF_ID || (strf->size + 8 != sizeof(AVI_AUDS_STRF_CHUNK) && strf->size + 10 != sizeof(AVI_AUDS_STRF_CHUNK))) {
-            ESP_LOGE(TAG, "FourCC=0x%"PRIx32"|%"PRIx32", size=%"PRIu32"|%d", strf->FourCC, STRF_ID, strf->size, sizeof(AVI_AUDS_STRF_CHUNK));
+            ESP_LOGE(TAG, "FourCC=0x%"PRIx32"|%"PRIx32", size=%"PRIu32"|%zu", strf->FourCC, STRF_ID, strf->size, sizeof(AVI_AUDS_STRF_CHUNK));
             return -5;
         }
 #ifdef CONFIG_AVI_PLAYER_DEBUG_INFO
@@ -173,6 +178,8 @@ int avi_parser(avi_typedef *AVI_file, const uint8_t *buffer, uint32_t length)
     }
     /*!< avih data block length */
     AVI_file->avihsize = avih->size;
+    AVI_file->us_per_frame = avih->us_per_frame;
+    AVI_file->total_frames = avih->total_frames;
 
 #ifdef CONFIG_AVI_PLAYER_DEBUG_INFO
     printf("-----avih info------\r\n");
@@ -190,12 +197,26 @@ int avi_parser(avi_typedef *AVI_file, const uint8_t *buffer, uint32_t length)
 
     pdata += sizeof(AVI_AVIH_CHUNK);
 
+    /*!< In OpenDML files avih only counts the frames of the first RIFF, dmlh has the total */
+    const uint8_t *hdrl_end = (const uint8_t *)list + 8 + list->size;
+    if (hdrl_end > buffer + length) {
+        hdrl_end = buffer + length;
+    }
+    if (hdrl_end - pdata > 12) {
+        int dmlh_offset = search_fourcc(DMLH_ID, pdata, hdrl_end - pdata);
+        if (dmlh_offset >= 0 && hdrl_end - pdata >= dmlh_offset + 12) {
+            uint32_t total_frames;
+            memcpy(&total_frames, pdata + dmlh_offset + 8, sizeof(total_frames));
+            AVI_file->total_frames = total_frames;
+        }
+    }
+
     /*!< process all streams in turn */
     for (size_t i = 0; i < avih->streams; i++) {
         uint32_t strl_size = 0;
         int ret = strl_parser(AVI_file, pdata, length - (pdata - buffer), &strl_size);
         if (0 > ret) {
-            ESP_LOGE(TAG, "strl of stream%d prase failed", i);
+            ESP_LOGE(TAG, "strl of stream%zu prase failed", i);
             break;
             /**
              * TODO: how to deal this error? maybe we should search for the next strl.
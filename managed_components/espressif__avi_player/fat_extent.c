@@ -0,0 +1,145 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stddef.h>
+#include <string.h>
+#include "fat_extent.h"
+
+#define RD16(p) ((uint32_t)(p)[0] | (uint32_t)(p)[1] << 8)
+#define RD32(p) (RD16(p) | (uint32_t)(p)[2] << 16 | (uint32_t)(p)[3] << 24)
+
+typedef struct {
+    const fat_extent_volume_t *vol;
+    fat_extent_read_cb read;
+    void *ctx;
+    uint8_t *buf;
+    uint32_t cached_lba;    // FAT sector currently in buf
+} fat_walk_t;
+
+int fat_extent_parse_volume(fat_extent_volume_t *vol, const uint8_t *boot_sector, uint32_t volume_lba)
+{
+    const uint8_t *bs = boot_sector;
+    if (bs[510] != 0x55 || bs[511] != 0xAA || RD16(bs + 11) != FAT_EXTENT_SECTOR_SIZE) {
+        return -1;
+    }
+    uint32_t cluster_sectors = bs[13];
+    uint32_t reserved = RD16(bs + 14);
+    uint32_t fats = bs[16];
+    uint32_t root_sectors = (RD16(bs + 17) * 32 + FAT_EXTENT_SECTOR_SIZE - 1) / FAT_EXTENT_SECTOR_SIZE;
+    uint32_t fat_size = RD16(bs + 22) ? RD16(bs + 22) : RD32(bs + 36);
+    uint32_t total = RD16(bs + 19) ? RD16(bs + 19) : RD32(bs + 32);
+    if (cluster_sectors == 0 || (cluster_sectors & (cluster_sectors - 1)) || reserved == 0 || fats == 0 || fats > 2 || fat_size == 0) {
+        return -1;
+    }
+    uint32_t meta = reserved + fats * fat_size + root_sectors;
+    if (total <= meta) {
+        return -1;
+    }
+
+    /*!< The FAT type follows from the cluster count alone, as in the specification */
+    uint32_t clusters = (total - meta) / cluster_sectors;
+    vol->fat_bits = clusters < 4085 ? 12 : clusters < 65525 ? 16 : 32;
+    vol->cluster_sectors = cluster_sectors;
+    vol->fat_lba = volume_lba + reserved;
+    vol->data_lba = volume_lba + meta;
+    vol->fat_entries = clusters + 2;
+    return 0;
+}
+
+static int fat_read_byte(fat_walk_t *w, uint32_t offset, uint8_t *byte)
+{
+    uint32_t lba = w->vol->fat_lba + offset / FAT_EXTENT_SECTOR_SIZE;
+    if (lba != w->cached_lba) {
+        if (w->read(w->ctx, lba, 1, w->buf) != 0) {
+            return -1;
+        }
+        w->cached_lba = lba;
+    }
+    *byte = w->buf[offset % FAT_EXTENT_SECTOR_SIZE];
+    return 0;
+}
+
+/* Read the FAT entry of a cluster, an FAT12 entry may straddle two sectors */
+static int fat_next_cluster(fat_walk_t *w, uint32_t cluster, uint32_t *next)
+{
+    uint32_t bytes = w->vol->fat_bits == 12 ? 2 : w->vol->fat_bits / 8;
+    uint32_t offset = w->vol->fat_bits == 12 ? cluster + cluster / 2 : cluster * bytes;
+    uint8_t entry[4];
+    for (uint32_t i = 0; i < bytes; i++) {
+        if (fat_read_byte(w, offset + i, &entry[i]) != 0) {
+            return -1;
+        }
+    }
+
+    if (w->vol->fat_bits == 12) {
+        uint32_t v = RD16(entry);
+        *next = (cluster & 1) ? v >> 4 : v & 0xFFF;
+    } else if (w->vol->fat_bits == 16) {
+        *next = RD16(entry);
+    } else {
+        *next = RD32(entry) & 0x0FFFFFFF;
+    }
+    return 0;
+}
+
+int fat_extent_build(const fat_extent_volume_t *vol, fat_extent_read_cb read, void *ctx, uint8_t *sector_buf,
+                     uint32_t start_cluster, uint32_t file_size, fat_extent_map_t *map)
+{
+    fat_walk_t w = {
+        .vol = vol,
+        .read = read,
+        .ctx = ctx,
+        .buf = sector_buf,
+        .cached_lba = UINT32_MAX,
+    };
+    uint64_t cluster_bytes = (uint64_t)vol->cluster_sectors * FAT_EXTENT_SECTOR_SIZE;
+    uint32_t clusters = (file_size + cluster_bytes - 1) / cluster_bytes;
+
+    memset(map, 0, sizeof(*map));
+    map->file_size = file_size;
+
+    /*!< Only the clusters covering file_size are followed, a looped chain cannot run away */
+    uint32_t cluster = start_cluster;
+    for (uint32_t i = 0; i < clusters; i++) {
+        if (cluster < 2 || cluster >= vol->fat_entries) {
+            return -2;
+        }
+        uint32_t lba = vol->data_lba + (cluster - 2) * vol->cluster_sectors;
+        fat_extent_t *last = map->count ? &map->extents[map->count - 1] : NULL;
+        if (last && last->lba + last->sectors == lba) {
+            last->sectors += vol->cluster_sectors;
+        } else {
+            if (map->count == FAT_EXTENT_MAX) {
+                return -3;
+            }
+            map->extents[map->count].lba = lba;
+            map->extents[map->count].sectors = vol->cluster_sectors;
+            map->count++;
+        }
+
+        if (i + 1 < clusters && fat_next_cluster(&w, cluster, &cluster) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+uint32_t fat_extent_lookup(const fat_extent_map_t *map, uint32_t sector, uint32_t *lba)
+{
+    uint32_t total = (map->file_size + FAT_EXTENT_SECTOR_SIZE - 1) / FAT_EXTENT_SECTOR_SIZE;
+    if (sector >= total) {
+        return 0;
+    }
+    uint32_t left = total - sector;
+    for (uint32_t i = 0; i < map->count; i++) {
+        const fat_extent_t *e = &map->extents[i];
+        if (sector < e->sectors) {
+            *lba = e->lba + sector;
+            return e->sectors - sector < left ? e->sectors - sector : left;
+        }
+        sector -= e->sectors;
+    }
+    return 0;
+}
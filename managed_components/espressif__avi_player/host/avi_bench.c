@@ -0,0 +1,340 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/*
+ * Plays AVI files on the host through the player core and reports the work it took.
+ *
+ *   avi_bench [-s sink]... [-o dir] [-x speed] [-n passes] [-b buffer_kb] [-f faults] [-t trace] [-m] [-v] file.avi
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "avi_player.h"
+#include "avi_io_fault.h"
+#include "avi_trace.h"
+#include "avi_virtual_clock.h"
+#include "sinks.h"
+
+static const char *TAG = "avi_bench";
+
+#define BENCH_SINKS_MAX         4
+#define BENCH_END_TIMEOUT_MS    (10 * 60 * 1000)
+
+static struct {
+    avi_sink_t *sinks[BENCH_SINKS_MAX];
+    int num_sinks;
+    SemaphoreHandle_t end;
+    int64_t last_video_us;      // Wall clock of the last video frame
+    int64_t max_gap_us;
+    int64_t cb_us;              // Wall clock spent in the sinks
+    avi_io_fault_t *fault;
+} bench;
+
+static int64_t wall_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int64_t cpu_us(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (int64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+static void video_write(frame_data_t *data, void *arg)
+{
+    int64_t start = wall_us();
+    if (bench.last_video_us && start - bench.last_video_us > bench.max_gap_us) {
+        bench.max_gap_us = start - bench.last_video_us;
+    }
+    bench.last_video_us = start;
+    for (int i = 0; i < bench.num_sinks; i++) {
+        bench.sinks[i]->video(bench.sinks[i], data);
+    }
+    bench.cb_us += wall_us() - start;
+}
+
+static void audio_write(frame_data_t *data, void *arg)
+{
+    int64_t start = wall_us();
+    for (int i = 0; i < bench.num_sinks; i++) {
+        bench.sinks[i]->audio(bench.sinks[i], data);
+    }
+    bench.cb_us += wall_us() - start;
+}
+
+static void audio_set_clock(uint32_t rate, uint32_t bits_cfg, uint32_t ch, void *arg)
+{
+    for (int i = 0; i < bench.num_sinks; i++) {
+        if (bench.sinks[i]->set_clock) {
+            bench.sinks[i]->set_clock(bench.sinks[i], rate, bits_cfg, ch);
+        }
+    }
+}
+
+static void io_delay(uint32_t pos, size_t len, int64_t elapsed_us, void *arg)
+{
+    avi_io_fault_apply(bench.fault, len, elapsed_us);
+}
+
+static void play_end(void *arg)
+{
+    xSemaphoreGive(bench.end);
+}
+
+static uint8_t *load_file(const char *path, size_t *size)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = len > 0 ? malloc(len) : NULL;
+    if (data && fread(data, 1, len, f) != (size_t)len) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    *size = len;
+    return data;
+}
+
+/* "rate=800,stall=250/2000,trace=sd.txt,record=out.txt" */
+static bool parse_faults(char *spec, avi_io_fault_cfg_t *cfg)
+{
+    for (char *item = strtok(spec, ","); item; item = strtok(NULL, ",")) {
+        char *value = strchr(item, '=');
+        if (!value) {
+            return false;
+        }
+        *value++ = '\0';
+        if (!strcmp(item, "rate")) {
+            cfg->rate_kbps = strtoul(value, NULL, 0);
+        } else if (!strcmp(item, "stall")) {
+            if (sscanf(value, "%" SCNu32 "/%" SCNu32, &cfg->stall_ms, &cfg->stall_every_ms) != 2) {
+                return false;
+            }
+        } else if (!strcmp(item, "trace")) {
+            cfg->trace_path = value;
+        } else if (!strcmp(item, "record")) {
+            cfg->record_path = value;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options] file.avi\n"
+            "  -s sink     null, frames or wav, can be repeated (default null)\n"
+            "  -o dir      Output directory of the sinks (default .)\n"
+            "  -x speed    Frame clock speed factor, 0 runs on a virtual clock as fast as possible (default 0)\n"
+            "  -n passes   Play the file this many times (default 1)\n"
+            "  -b kb       Frame buffer size (default 256)\n"
+            "  -f faults   Simulate a slower card (default -x 1), comma separated:\n"
+            "              rate=KB/s, stall=ms/every_ms, trace=file to replay, record=file to write\n"
+            "              record needs a real clock, reads take no virtual time\n"
+            "  -t file     Save the last events of the player to a trace, see avi_trace2json\n"
+            "  -m          Play from memory instead of the file\n"
+            "  -v          Debug logs\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = ".";
+    int speed = -1;
+    bool faults = false;
+    avi_io_fault_cfg_t fault_cfg = {};
+    int passes = 1;
+    size_t buffer_kb = 256;
+    bool memory = false;
+    const char *trace_path = NULL;
+    const char *sink_names[BENCH_SINKS_MAX];
+    int num_sink_names = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:o:x:n:b:f:t:mvh")) != -1) {
+        switch (opt) {
+        case 's':
+            if (num_sink_names == BENCH_SINKS_MAX) {
+                fprintf(stderr, "At most %d sinks\n", BENCH_SINKS_MAX);
+                return 2;
+            }
+            sink_names[num_sink_names++] = optarg;
+            break;
+        case 'o':
+            dir = optarg;
+            break;
+        case 'x':
+            speed = atoi(optarg);
+            break;
+        case 'n':
+            passes = atoi(optarg);
+            break;
+        case 'b':
+            buffer_kb = strtoul(optarg, NULL, 0);
+            break;
+        case 'f':
+            if (!parse_faults(optarg, &fault_cfg)) {
+                fprintf(stderr, "Bad fault spec\n");
+                return 2;
+            }
+            faults = true;
+            break;
+        case 't':
+            trace_path = optarg;
+            break;
+        case 'm':
+            memory = true;
+            break;
+        case 'v':
+            esp_log_level_set("*", ESP_LOG_DEBUG);
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (speed < 0) {
+        speed = faults ? 1 : 0;
+    }
+    if (optind != argc - 1 || passes < 1 || buffer_kb == 0 || (fault_cfg.record_path && speed == 0)) {
+        usage(argv[0]);
+        return 2;
+    }
+    const char *path = argv[optind];
+
+    if (num_sink_names == 0) {
+        sink_names[num_sink_names++] = "null";
+    }
+    for (int i = 0; i < num_sink_names; i++) {
+        bench.sinks[i] = avi_sink_create(sink_names[i], dir);
+        if (!bench.sinks[i]) {
+            return 1;
+        }
+        bench.num_sinks++;
+    }
+
+    avi_player_file_info_t info;
+    ESP_ERROR_CHECK(avi_player_probe_file(path, &info));
+    ESP_LOGI(TAG, "%s: %ux%u %s, %u fps, %u frames, audio %u Hz %u bit %u ch",
+             path, info.width, info.height, info.video_format == FORMAT_H264 ? "H264" : "MJPEG", info.fps,
+             (unsigned)info.total_frames, (unsigned)info.audio_sample_rate, info.audio_bits, info.audio_channels);
+
+    size_t avi_size = 0;
+    uint8_t *avi_data = NULL;
+    if (memory) {
+        avi_data = load_file(path, &avi_size);
+        if (!avi_data) {
+            ESP_LOGE(TAG, "Cannot load %s", path);
+            return 1;
+        }
+    }
+
+    avi_player_clock_t *clock = NULL;
+    if (speed) {
+        esp_timer_shim_set_speed(speed);
+    } else {
+        ESP_ERROR_CHECK(avi_virtual_clock_create(&clock));
+    }
+    if (faults) {
+        fault_cfg.clock = clock;
+        ESP_ERROR_CHECK(avi_io_fault_create(&fault_cfg, &bench.fault));
+    }
+    if (trace_path) {
+        ESP_ERROR_CHECK(avi_trace_init(CONFIG_AVI_PLAYER_TRACE_EVENTS));
+    }
+    bench.end = xSemaphoreCreateBinary();
+
+    avi_player_config_t config = {
+        .buffer_size = buffer_kb * 1024,
+        .video_cb = video_write,
+        .audio_cb = audio_write,
+        .audio_set_clock_cb = audio_set_clock,
+        .avi_play_end_cb = play_end,
+        .clock = clock,
+        .io_cb = bench.fault ? io_delay : NULL,
+    };
+    avi_player_handle_t handle;
+    ESP_ERROR_CHECK(avi_player_init(config, &handle));
+
+    int64_t wall_start = wall_us();
+    int64_t cpu_start = cpu_us();
+    int64_t clock_start = clock ? clock->get_time(clock) : esp_timer_get_time();
+    for (int i = 0; i < passes; i++) {
+        if (memory) {
+            ESP_ERROR_CHECK(avi_player_play_from_memory(handle, avi_data, avi_size));
+        } else {
+            ESP_ERROR_CHECK(avi_player_play_from_file_ex(handle, path, &(avi_player_play_cfg_t) {
+                .info = &info,
+            }));
+        }
+        if (xSemaphoreTake(bench.end, pdMS_TO_TICKS(BENCH_END_TIMEOUT_MS)) != pdTRUE) {
+            ESP_LOGE(TAG, "Pass %d did not end", i);
+            return 1;
+        }
+    }
+    int64_t wall = wall_us() - wall_start;
+    int64_t cpu = cpu_us() - cpu_start;
+    int64_t played = (clock ? clock->get_time(clock) : esp_timer_get_time()) - clock_start;
+
+    avi_player_stats_t stats;
+    avi_player_get_stats(handle, &stats);
+    ESP_ERROR_CHECK(avi_player_deinit(handle));
+    if (trace_path) {
+        ESP_ERROR_CHECK(avi_trace_save(trace_path));
+        avi_trace_deinit();
+    }
+    avi_io_fault_stats_t fault_stats = {};
+    if (bench.fault) {
+        avi_io_fault_get_stats(bench.fault, &fault_stats);
+        avi_io_fault_delete(bench.fault);
+    }
+    avi_virtual_clock_delete(clock);
+    for (int i = 0; i < bench.num_sinks; i++) {
+        avi_sink_destroy(bench.sinks[i]);
+    }
+    free(avi_data);
+
+    double secs = wall / 1e6;
+    uint64_t movi_bytes = (uint64_t)info.movi_size * passes;
+    printf("passes          %d, %s\n", passes, memory ? "from memory" : "from file");
+    if (speed) {
+        printf("wall time       %.3f s, cpu %.3f s, frame clock %.3f s at %dx\n", secs, cpu / 1e6, played / 1e6, speed);
+    } else {
+        printf("wall time       %.3f s, cpu %.3f s, virtual clock %.3f s\n", secs, cpu / 1e6, played / 1e6);
+    }
+    printf("demux           %.1f MB/s of movi data, %.1f video fps\n",
+           movi_bytes / secs / (1024 * 1024), stats.video_frames / secs);
+    printf("read            %" PRIu64 " bytes\n", stats.read_bytes);
+    printf("ring copies     %" PRIu32 ", %" PRIu64 " bytes\n", stats.ring_copies, stats.ring_bytes);
+    printf("payload copies  %" PRIu32 ", %" PRIu64 " bytes\n", stats.copies, stats.copy_bytes);
+    printf("frames          %" PRIu32 " video, %" PRIu32 " audio, %" PRIu32 " skipped\n",
+           stats.video_frames, stats.audio_frames, stats.skipped_frames);
+    printf("underruns       %" PRIu32 ", %" PRIu32 " frame ticks missed\n", stats.underruns, stats.missed_ticks);
+    if (faults) {
+        printf("card            %" PRIu32 " reads, %.3f s added, %" PRIu32 " stalls\n",
+               fault_stats.reads, fault_stats.injected_us / 1e6, fault_stats.stalls);
+    }
+    printf("sinks           %.3f s, longest video gap %.3f ms\n", bench.cb_us / 1e6, bench.max_gap_us / 1e3);
+    return 0;
+}
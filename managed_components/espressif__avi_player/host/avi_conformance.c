@@ -0,0 +1,521 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/*
+ * Generates a corpus of AVI files with their golden expectations, plays every file from the file
+ * system and from memory on a virtual clock, and reports where the player differs and how fast it was.
+ *
+ *   avi_conformance [-k] [-c case] dir
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "avi_player.h"
+#include "avi_virtual_clock.h"
+#include "avi_gen.h"
+
+#define CONF_BUFFER_SIZE        (256 * 1024)
+#define CONF_END_TIMEOUT_MS     (60 * 1000)
+#define CONF_LOOP_PASSES        2
+#define CONF_SETTLE_POLLS       5   // 10 ms polls without a read before the reader counts as idle
+
+typedef struct {
+    const char *name;
+    void (*setup)(avi_gen_params_t *p);
+    bool prefetch_loop;             // Also queued with avi_player_set_next() and looped from the prefetch
+} conf_case_t;
+
+static void case_basic(avi_gen_params_t *p)
+{
+}
+
+static void case_ntsc(avi_gen_params_t *p)
+{
+    p->rate = 30000;
+    p->scale = 1001;
+    p->frames = 300;
+}
+
+static void case_odd_sizes(avi_gen_params_t *p)
+{
+    p->odd_sizes = true;
+    p->audio_rate = 11025;
+    p->audio_bits = 8;
+}
+
+static void case_interleave(avi_gen_params_t *p)
+{
+    p->audio_rate = 44100;
+    p->audio_channels = 2;
+    p->audio_interleave = 5;
+}
+
+static void case_junk(avi_gen_params_t *p)
+{
+    p->junk_align = true;
+    p->junk_every = 7;
+    p->junk_size = 333;
+}
+
+static void case_rec_lists(avi_gen_params_t *p)
+{
+    p->rec_lists = true;
+}
+
+static void case_no_idx1(avi_gen_params_t *p)
+{
+    p->idx1 = false;
+}
+
+static void case_opendml(avi_gen_params_t *p)
+{
+    p->frames = 300;
+    p->segments = 3;
+}
+
+static void case_empty_frames(avi_gen_params_t *p)
+{
+    p->empty_every = 4;
+}
+
+static void case_video_only(avi_gen_params_t *p)
+{
+    p->audio_rate = 0;
+}
+
+static void case_low_rate(avi_gen_params_t *p)
+{
+    p->rate = 2;
+    p->scale = 5;
+    p->frames = 10;
+}
+
+static void case_everything(avi_gen_params_t *p)
+{
+    p->rate = 24000;
+    p->scale = 1001;
+    p->frames = 240;
+    p->odd_sizes = true;
+    p->audio_rate = 22050;
+    p->audio_bits = 8;
+    p->audio_interleave = 3;
+    p->empty_every = 5;
+    p->junk_align = true;
+    p->junk_every = 11;
+    p->junk_size = 101;
+    p->rec_lists = true;
+    p->idx1 = false;
+    p->segments = 2;
+}
+
+/* Throughput more than structure */
+static void case_large_frames(avi_gen_params_t *p)
+{
+    p->width = 320;
+    p->height = 240;
+    p->frames = 600;
+    p->frame_min = 16 * 1024;
+    p->frame_max = 32 * 1024;
+    p->audio_rate = 44100;
+    p->audio_channels = 2;
+}
+
+static const conf_case_t cases[] = {
+    { "basic", case_basic, true },
+    { "ntsc", case_ntsc },
+    { "odd_sizes", case_odd_sizes },
+    { "interleave", case_interleave },
+    { "junk", case_junk, true },
+    { "rec_lists", case_rec_lists },
+    { "no_idx1", case_no_idx1 },
+    { "opendml", case_opendml },
+    { "empty_frames", case_empty_frames },
+    { "video_only", case_video_only },
+    { "low_rate", case_low_rate },
+    { "everything", case_everything },
+    { "large_frames", case_large_frames },
+};
+
+/* What one playback delivered */
+static struct {
+    avi_player_clock_t *clock;
+    SemaphoreHandle_t end;
+    SemaphoreHandle_t cmd_done;
+    uint32_t period;
+    avi_gen_expect_t got;
+    uint32_t mistimed;
+    const avi_gen_expect_t *want;   // Looped runs check every pass against it
+    uint16_t width;                 // Looped runs ignore frames of other sizes, the lead file has its own
+    uint32_t last_index;
+    uint32_t passes;
+    uint32_t bad_passes;
+} run;
+
+static void video_check(frame_data_t *data, void *arg)
+{
+    uint32_t index = data->video_info.frame_index;
+    int64_t pts = (int64_t)index * run.period;
+    if (run.clock->get_time(run.clock) != pts) {
+        run.mistimed++;
+    }
+    run.got.video_frames++;
+    run.got.video_bytes += data->data_bytes;
+    run.got.video_crc = avi_gen_crc32(run.got.video_crc, &index, sizeof(index));
+    run.got.video_crc = avi_gen_crc32(run.got.video_crc, data->data, data->data_bytes);
+    run.got.last_pts_us = pts;
+}
+
+static void loop_check(frame_data_t *data, void *arg)
+{
+    uint32_t index = data->video_info.frame_index;
+    if (data->video_info.width != run.width) {
+        return;
+    }
+    if (run.got.video_frames && index <= run.last_index) {
+        /*!< Back at the start, the pass that ended must have been the whole clip */
+        if (run.got.video_frames != run.want->video_frames || run.got.video_crc != run.want->video_crc) {
+            printf("    loop: pass %" PRIu32 " has %" PRIu32 " frames, crc 0x%08" PRIx32 "\n", run.passes,
+                   run.got.video_frames, run.got.video_crc);
+            run.bad_passes++;
+        }
+        run.passes++;
+        run.got.video_frames = 0;
+        run.got.video_crc = 0;
+    }
+    run.last_index = index;
+    run.got.video_frames++;
+    run.got.video_crc = avi_gen_crc32(run.got.video_crc, &index, sizeof(index));
+    run.got.video_crc = avi_gen_crc32(run.got.video_crc, data->data, data->data_bytes);
+}
+
+static void audio_check(frame_data_t *data, void *arg)
+{
+    run.got.audio_chunks++;
+    run.got.audio_bytes += data->data_bytes;
+    run.got.audio_crc = avi_gen_crc32(run.got.audio_crc, data->data, data->data_bytes);
+}
+
+static void play_end(void *arg)
+{
+    xSemaphoreGive(run.end);
+}
+
+static void cmd_event(const avi_player_event_t *event, void *arg)
+{
+    if (event->type == AVI_PLAYER_EVENT_CMD_DONE) {
+        xSemaphoreGive(run.cmd_done);
+    }
+}
+
+static int64_t wall_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint8_t *load_file(const char *path, size_t *size)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = len > 0 ? malloc(len) : NULL;
+    if (data && fread(data, 1, len, f) != (size_t)len) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    *size = len;
+    return data;
+}
+
+/* Play path once, from memory if data is set. Returns the wall time, -1 if it did not end */
+static int64_t play(const char *path, const uint8_t *data, size_t size, const avi_player_file_info_t *info,
+                    avi_player_stats_t *stats)
+{
+    memset(&run.got, 0, sizeof(run.got));
+    run.mistimed = 0;
+    run.period = info->frame_period_us;
+    ESP_ERROR_CHECK(avi_virtual_clock_create(&run.clock));
+    avi_player_config_t config = {
+        .buffer_size = CONF_BUFFER_SIZE,
+        .video_cb = video_check,
+        .audio_cb = audio_check,
+        .avi_play_end_cb = play_end,
+        .clock = run.clock,
+    };
+    avi_player_handle_t handle;
+    ESP_ERROR_CHECK(avi_player_init(config, &handle));
+
+    int64_t start = wall_us();
+    if (data) {
+        ESP_ERROR_CHECK(avi_player_play_from_memory(handle, (uint8_t *)data, size));
+    } else {
+        ESP_ERROR_CHECK(avi_player_play_from_file(handle, (char *)path));
+    }
+    bool ended = xSemaphoreTake(run.end, pdMS_TO_TICKS(CONF_END_TIMEOUT_MS)) == pdTRUE;
+    int64_t wall = wall_us() - start;
+
+    avi_player_get_stats(handle, stats);
+    if (!ended) {
+        avi_player_play_stop(handle);
+        xSemaphoreTake(run.end, pdMS_TO_TICKS(CONF_END_TIMEOUT_MS));
+    }
+    ESP_ERROR_CHECK(avi_player_deinit(handle));
+    avi_virtual_clock_delete(run.clock);
+    return ended ? wall : -1;
+}
+
+/* Wait until the reader stopped reading, that is read its file to the end and loaded the prefetch */
+static void wait_reader_idle(avi_player_handle_t handle)
+{
+    avi_player_stats_t stats;
+    uint64_t read_bytes = UINT64_MAX;
+    for (int quiet = 0, polls = 0; quiet < CONF_SETTLE_POLLS && polls < CONF_END_TIMEOUT_MS / 10; polls++) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+        avi_player_get_stats(handle, &stats);
+        quiet = stats.read_bytes == read_bytes ? quiet + 1 : 0;
+        read_bytes = stats.read_bytes;
+    }
+}
+
+/*
+ * Queue path with avi_player_set_next() while lead plays, then loop it from the prefetch for
+ * CONF_LOOP_PASSES passes and a half. A clip shorter than the prefetch is in it completely,
+ * every pass must still deliver the clip and nothing that follows its movi list.
+ */
+static int play_prefetch_loop(const char *path, const char *lead, const avi_player_file_info_t *info,
+                              const avi_gen_expect_t *want)
+{
+    memset(&run.got, 0, sizeof(run.got));
+    run.want = want;
+    run.width = info->width;
+    run.last_index = 0;
+    run.passes = 0;
+    run.bad_passes = 0;
+    ESP_ERROR_CHECK(avi_virtual_clock_create(&run.clock));
+    avi_player_config_t config = {
+        .buffer_size = CONF_BUFFER_SIZE,
+        .video_cb = loop_check,
+        .audio_cb = audio_check,
+        .avi_play_end_cb = play_end,
+        .event_cb = cmd_event,
+        .clock = run.clock,
+    };
+    avi_player_handle_t handle;
+    ESP_ERROR_CHECK(avi_player_init(config, &handle));
+
+    /*!< Time holds at 0, so the lead file only reads. The reader loads the queued file at its end */
+    int failures = 0;
+    avi_virtual_clock_run_until(run.clock, 0, pdMS_TO_TICKS(CONF_END_TIMEOUT_MS));
+    ESP_ERROR_CHECK(avi_player_set_next(handle, path, NULL));
+    ESP_ERROR_CHECK(avi_player_play_from_file(handle, (char *)lead));
+    wait_reader_idle(handle);
+    avi_player_cmd_t cmd = {
+        .type = AVI_PLAYER_CMD_PLAY,
+        .play.filename = path,
+        .play.cfg.loop = true,
+    };
+    ESP_ERROR_CHECK(avi_player_send_command(handle, &cmd));
+    /*!< Time only runs on once the clip armed its frame timer */
+    xSemaphoreTake(run.cmd_done, pdMS_TO_TICKS(CONF_END_TIMEOUT_MS));
+    int64_t pass_us = (int64_t)info->total_frames * info->frame_period_us;
+    if (avi_virtual_clock_run_until(run.clock, CONF_LOOP_PASSES * pass_us + pass_us / 2,
+                                    pdMS_TO_TICKS(CONF_END_TIMEOUT_MS)) != ESP_OK) {
+        printf("    loop: stuck at pass %" PRIu32 "\n", run.passes);
+        failures++;
+    }
+    avi_player_stats_t stats;
+    avi_player_get_stats(handle, &stats);
+    if (stats.prefetch_starts != 1) {
+        printf("    loop: %" PRIu32 " starts from the prefetch, want 1\n", stats.prefetch_starts);
+        failures++;
+    }
+    if (run.passes < CONF_LOOP_PASSES) {
+        printf("    loop: %" PRIu32 " passes, want %d\n", run.passes, CONF_LOOP_PASSES);
+        failures++;
+    }
+    failures += run.bad_passes;
+
+    /*!< The lead file ended when the clip replaced it */
+    xSemaphoreTake(run.end, 0);
+    avi_virtual_clock_run_until(run.clock, INT64_MAX, 0);
+    avi_player_play_stop(handle);
+    xSemaphoreTake(run.end, pdMS_TO_TICKS(CONF_END_TIMEOUT_MS));
+    ESP_ERROR_CHECK(avi_player_deinit(handle));
+    avi_virtual_clock_delete(run.clock);
+    return failures;
+}
+
+#define CHECK_FIELD(field, fmt) \
+    if (got->field != want->field) { \
+        printf("    %s: %s " fmt ", want " fmt "\n", mode, #field, got->field, want->field); \
+        failures++; \
+    }
+
+static int compare(const char *mode, const avi_gen_expect_t *got, const avi_gen_expect_t *want,
+                   const avi_player_stats_t *stats)
+{
+    int failures = 0;
+    CHECK_FIELD(video_frames, "%" PRIu32);
+    CHECK_FIELD(video_bytes, "%" PRIu64);
+    CHECK_FIELD(video_crc, "0x%08" PRIx32);
+    CHECK_FIELD(audio_chunks, "%" PRIu32);
+    CHECK_FIELD(audio_bytes, "%" PRIu64);
+    CHECK_FIELD(audio_crc, "0x%08" PRIx32);
+    CHECK_FIELD(last_pts_us, "%" PRId64);
+    if (stats->skipped_frames != want->skipped) {
+        printf("    %s: skipped %" PRIu32 ", want %" PRIu32 "\n", mode, stats->skipped_frames, want->skipped);
+        failures++;
+    }
+    if (run.mistimed) {
+        printf("    %s: %" PRIu32 " frames off their presentation time\n", mode, run.mistimed);
+        failures++;
+    }
+    return failures;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options] dir\n"
+            "  -c case     Only run this case, can be repeated\n"
+            "  -k          Keep the corpus and play it as it is, without generating it again\n"
+            "  -v          Debug logs\n", prog);
+}
+
+static bool selected(const char *name, const char **only, int num_only)
+{
+    for (int i = 0; i < num_only; i++) {
+        if (!strcmp(name, only[i])) {
+            return true;
+        }
+    }
+    return num_only == 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *only[sizeof(cases) / sizeof(cases[0])];
+    int num_only = 0;
+    bool keep = false;
+    esp_log_level_t log_level = ESP_LOG_WARN;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:kvh")) != -1) {
+        switch (opt) {
+        case 'c':
+            if (num_only < (int)(sizeof(only) / sizeof(only[0]))) {
+                only[num_only++] = optarg;
+            }
+            break;
+        case 'k':
+            keep = true;
+            break;
+        case 'v':
+            log_level = ESP_LOG_DEBUG;
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 2;
+    }
+    const char *dir = argv[optind];
+    mkdir(dir, 0755);
+    esp_log_level_set("*", log_level);
+    run.end = xSemaphoreCreateBinary();
+    run.cmd_done = xSemaphoreCreateBinary();
+
+    /*!< Plays while a looped case is queued, smaller frames than any case */
+    char lead[512];
+    snprintf(lead, sizeof(lead), "%s/lead.avi", dir);
+    avi_gen_params_t lead_params;
+    avi_gen_expect_t lead_expect;
+    avi_gen_default_params(&lead_params);
+    lead_params.width = 32;
+    lead_params.height = 24;
+    lead_params.frames = 30;
+    if (avi_gen_write(lead, &lead_params, &lead_expect) != 0) {
+        printf("Cannot write %s\n", lead);
+        return 1;
+    }
+
+    int failed = 0, total = 0;
+    printf("%-14s %9s %7s %7s %10s %10s  %s\n", "case", "size", "frames", "audio", "file MB/s", "mem MB/s", "result");
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        if (!selected(cases[c].name, only, num_only)) {
+            continue;
+        }
+        total++;
+        char path[512], golden[512];
+        snprintf(path, sizeof(path), "%s/%s.avi", dir, cases[c].name);
+        snprintf(golden, sizeof(golden), "%s/%s.golden", dir, cases[c].name);
+        if (!keep) {
+            avi_gen_params_t params;
+            avi_gen_expect_t expect;
+            avi_gen_default_params(&params);
+            cases[c].setup(&params);
+            if (avi_gen_write(path, &params, &expect) != 0 || avi_gen_write_golden(golden, &expect) != 0) {
+                printf("%-14s cannot write the corpus file\n", cases[c].name);
+                failed++;
+                continue;
+            }
+        }
+
+        /*!< Golden files are read back, so a kept corpus is checked the same way */
+        avi_gen_expect_t want;
+        avi_player_file_info_t info;
+        if (avi_gen_read_golden(golden, &want) != 0 || avi_player_probe_file(path, &info) != ESP_OK) {
+            printf("%-14s cannot read %s or its golden file\n", cases[c].name, path);
+            failed++;
+            continue;
+        }
+        int failures = 0;
+        if (info.frame_period_us != want.frame_period_us) {
+            printf("    frame period %" PRIu32 " us, want %" PRIu32 "\n", info.frame_period_us, want.frame_period_us);
+            failures++;
+        }
+        if (info.total_frames != want.video_chunks) {
+            printf("    total_frames %" PRIu32 ", want %" PRIu32 "\n", info.total_frames, want.video_chunks);
+            failures++;
+        }
+
+        avi_player_stats_t stats;
+        int64_t file_us = play(path, NULL, 0, &info, &stats);
+        failures += file_us < 0 ? 1 : compare("file", &run.got, &want, &stats);
+
+        size_t size = 0;
+        uint8_t *data = load_file(path, &size);
+        int64_t mem_us = data ? play(path, data, size, &info, &stats) : -1;
+        failures += mem_us < 0 ? 1 : compare("memory", &run.got, &want, &stats);
+        free(data);
+        if (cases[c].prefetch_loop) {
+            failures += play_prefetch_loop(path, lead, &info, &want);
+        }
+
+        printf("%-14s %9" PRIu64 " %7" PRIu32 " %7" PRIu32 " %10.1f %10.1f  %s\n", cases[c].name, want.file_size,
+               want.video_frames, want.audio_chunks, file_us > 0 ? want.file_size / (file_us / 1e6) / (1024 * 1024) : 0,
+               mem_us > 0 ? want.file_size / (mem_us / 1e6) / (1024 * 1024) : 0, failures ? "FAIL" : "ok");
+        failed += failures != 0;
+    }
+    printf("%d of %d cases passed\n", total - failed, total);
+    return failed ? 1 : 0;
+}
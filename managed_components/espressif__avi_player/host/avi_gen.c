@@ -0,0 +1,456 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "avi_def.h"
+#include "avi_gen.h"
+
+#define FOURCC(s)           ((uint32_t)(s)[0] | (uint32_t)(s)[1] << 8 | (uint32_t)(s)[2] << 16 | (uint32_t)(s)[3] << 24)
+#define AVIF_HASINDEX       0x10
+#define AVIF_ISINTERLEAVED  0x100
+#define AVIIF_KEYFRAME      0x10
+#define MOVI_ALIGN          2048
+#define DMLH_SIZE           248
+
+typedef struct {
+    uint32_t ckid;
+    uint32_t flags;
+    uint32_t offset;
+    uint32_t size;
+} idx1_entry_t;
+
+typedef struct {
+    FILE *f;
+    const avi_gen_params_t *p;
+    avi_gen_expect_t *expect;
+    uint32_t rand;
+    uint8_t *payload;
+    idx1_entry_t *idx1;             // Entries of the first segment
+    uint32_t idx1_len;
+    uint32_t *ix_offsets;           // Video chunks of the current segment, for its ix00
+    uint32_t *ix_sizes;
+    uint32_t ix_len;
+    long movi_data;                 // File offset of the current "movi" FourCC
+    uint64_t samples;               // Audio samples written
+    bool first_segment;
+} gen_t;
+
+uint32_t avi_gen_crc32(uint32_t crc, const void *data, size_t len)
+{
+    static uint32_t table[256];
+    if (table[1] == 0) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c >> 1) ^ (0xEDB88320 & -(c & 1));
+            }
+            table[i] = c;
+        }
+    }
+    const uint8_t *p = data;
+    crc = ~crc;
+    while (len--) {
+        crc = table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static uint32_t gen_rand(gen_t *g)
+{
+    g->rand ^= g->rand << 13;
+    g->rand ^= g->rand >> 17;
+    g->rand ^= g->rand << 5;
+    return g->rand;
+}
+
+static void put_u32(gen_t *g, uint32_t value)
+{
+    fwrite(&value, sizeof(value), 1, g->f);
+}
+
+/* Returns the offset of the size field, end_list() fills it in */
+static long begin_list(gen_t *g, const char *list, const char *type)
+{
+    put_u32(g, FOURCC(list));
+    long size_pos = ftell(g->f);
+    put_u32(g, 0);
+    put_u32(g, FOURCC(type));
+    return size_pos;
+}
+
+static void end_list(gen_t *g, long size_pos)
+{
+    long end = ftell(g->f);
+    fseek(g->f, size_pos, SEEK_SET);
+    put_u32(g, (uint32_t)(end - size_pos - 4));
+    fseek(g->f, end, SEEK_SET);
+}
+
+/* Returns the offset of the chunk */
+static long put_chunk(gen_t *g, uint32_t fourcc, const void *data, uint32_t size)
+{
+    long pos = ftell(g->f);
+    put_u32(g, fourcc);
+    put_u32(g, size);
+    fwrite(data, 1, size, g->f);
+    if (size % 2) {
+        fputc(0, g->f);
+    }
+    return pos;
+}
+
+static void put_struct_chunk(gen_t *g, void *chunk, size_t size)
+{
+    fwrite(chunk, 1, size, g->f);
+}
+
+static void write_header(gen_t *g, uint32_t first_frames)
+{
+    const avi_gen_params_t *p = g->p;
+    uint16_t block_align = p->audio_channels * p->audio_bits / 8;
+    long hdrl = begin_list(g, "LIST", "hdrl");
+    AVI_AVIH_CHUNK avih = {
+        .FourCC = FOURCC("avih"),
+        .size = sizeof(AVI_AVIH_CHUNK) - 8,
+        .us_per_frame = g->expect->frame_period_us,
+        .flags = (p->idx1 ? AVIF_HASINDEX : 0) | AVIF_ISINTERLEAVED,
+        .total_frames = first_frames,
+        .streams = p->audio_rate ? 2 : 1,
+        .suggest_buff_size = p->frame_max,
+        .width = p->width,
+        .height = p->height,
+    };
+    put_struct_chunk(g, &avih, sizeof(avih));
+
+    long strl = begin_list(g, "LIST", "strl");
+    AVI_STRH_CHUNK strh = {
+        .FourCC = FOURCC("strh"),
+        .size = sizeof(AVI_STRH_CHUNK) - 8,
+        .fourcc_type = FOURCC("vids"),
+        .fourcc_codec = FOURCC("MJPG"),
+        .scale = p->scale,
+        .rate = p->rate,
+        .length = p->frames,
+        .suggest_buff_size = p->frame_max,
+        .rcFrame = { 0, 0, p->width, p->height },
+    };
+    put_struct_chunk(g, &strh, sizeof(strh));
+    AVI_VIDS_STRF_CHUNK strf = {
+        .FourCC = FOURCC("strf"),
+        .size = sizeof(AVI_VIDS_STRF_CHUNK) - 8,
+        .size1 = sizeof(AVI_VIDS_STRF_CHUNK) - 8,
+        .width = p->width,
+        .height = p->height,
+        .planes = 1,
+        .bitcount = 24,
+        .fourcc_compression = FOURCC("MJPG"),
+        .image_size = (uint32_t)p->width * p->height * 3,
+    };
+    put_struct_chunk(g, &strf, sizeof(strf));
+    end_list(g, strl);
+
+    if (p->audio_rate) {
+        strl = begin_list(g, "LIST", "strl");
+        AVI_STRH_CHUNK strh_a = {
+            .FourCC = FOURCC("strh"),
+            .size = sizeof(AVI_STRH_CHUNK) - 8,
+            .fourcc_type = FOURCC("auds"),
+            .scale = block_align,
+            .rate = p->audio_rate * block_align,
+            .sample_size = block_align,
+        };
+        put_struct_chunk(g, &strh_a, sizeof(strh_a));
+        AVI_AUDS_STRF_CHUNK strf_a = {
+            .FourCC = FOURCC("strf"),
+            .size = sizeof(AVI_AUDS_STRF_CHUNK) - 8,  // WAVEFORMATEX, cbSize shares bits_per_sample
+            .format_tag = 1,
+            .channels = p->audio_channels,
+            .samples_per_sec = p->audio_rate,
+            .avg_bytes_per_sec = p->audio_rate * block_align,
+            .block_align = block_align,
+            .bits_per_sample = p->audio_bits,
+        };
+        put_struct_chunk(g, &strf_a, sizeof(strf_a));
+        end_list(g, strl);
+    }
+
+    if (p->segments > 1) {
+        long odml = begin_list(g, "LIST", "odml");
+        uint8_t dmlh[DMLH_SIZE] = { 0 };
+        memcpy(dmlh, &p->frames, sizeof(p->frames));
+        put_chunk(g, FOURCC("dmlh"), dmlh, sizeof(dmlh));
+        end_list(g, odml);
+    }
+    end_list(g, hdrl);
+
+    if (p->junk_align) {
+        /*!< The first chunk of movi starts on a sector boundary, after a JUNK and the movi list head */
+        long pos = ftell(g->f) + 8 + 12;
+        uint32_t pad = (MOVI_ALIGN - pos % MOVI_ALIGN) % MOVI_ALIGN;
+        uint8_t *junk = calloc(1, pad + 1);
+        put_chunk(g, FOURCC("JUNK"), junk, pad);
+        free(junk);
+    }
+}
+
+static void add_idx1(gen_t *g, uint32_t ckid, uint32_t flags, long pos, uint32_t size)
+{
+    if (!g->first_segment || !g->p->idx1) {
+        return;
+    }
+    idx1_entry_t *e = &g->idx1[g->idx1_len++];
+    e->ckid = ckid;
+    e->flags = flags;
+    e->offset = (uint32_t)(pos - g->movi_data);
+    e->size = size;
+}
+
+static void write_video(gen_t *g, uint32_t index)
+{
+    const avi_gen_params_t *p = g->p;
+    avi_gen_expect_t *e = g->expect;
+    uint32_t size = 0;
+    if (!p->empty_every || (index + 1) % p->empty_every) {
+        size = p->frame_min + gen_rand(g) % (p->frame_max - p->frame_min + 1);
+        size = p->odd_sizes ? size | 1 : size & ~1;
+        if (size > p->frame_max) {
+            size -= 2;
+        }
+        /*!< Enough of a JPEG to be recognized, the rest is noise */
+        for (uint32_t i = 0; i < size; i++) {
+            g->payload[i] = gen_rand(g);
+        }
+        memcpy(g->payload, "\xFF\xD8\xFF\xE0", 4);
+        memcpy(g->payload + size - 2, "\xFF\xD9", 2);
+    }
+    long pos = put_chunk(g, FOURCC("00dc"), g->payload, size);
+    add_idx1(g, FOURCC("00dc"), size ? AVIIF_KEYFRAME : 0, pos, size);
+    g->ix_offsets[g->ix_len] = (uint32_t)(pos + 8 - g->movi_data);
+    g->ix_sizes[g->ix_len++] = size;
+
+    e->video_chunks++;
+    if (size) {
+        uint32_t index_le = index;
+        e->video_frames++;
+        e->video_bytes += size;
+        e->video_crc = avi_gen_crc32(e->video_crc, &index_le, sizeof(index_le));
+        e->video_crc = avi_gen_crc32(e->video_crc, g->payload, size);
+        e->last_pts_us = (int64_t)index * e->frame_period_us;
+    } else {
+        e->skipped++;
+    }
+}
+
+/* Audio up to the end of video frame index */
+static void write_audio(gen_t *g, uint32_t index, bool last)
+{
+    const avi_gen_params_t *p = g->p;
+    avi_gen_expect_t *e = g->expect;
+    uint32_t block_align = p->audio_channels * p->audio_bits / 8;
+    uint64_t due = (uint64_t)(index + 1) * p->scale * p->audio_rate / p->rate;
+    uint32_t samples = (uint32_t)(due - g->samples);
+    if (p->odd_sizes && !last && samples > 1 && samples % 2 == 0) {
+        samples--; /*!< The rest goes with the next chunk */
+    }
+    if (samples == 0) {
+        return;
+    }
+    uint32_t size = samples * block_align;
+    for (uint32_t i = 0; i < size; i++) {
+        g->payload[i] = gen_rand(g);
+    }
+    long pos = put_chunk(g, FOURCC("01wb"), g->payload, size);
+    add_idx1(g, FOURCC("01wb"), AVIIF_KEYFRAME, pos, size);
+    g->samples += samples;
+    e->audio_chunks++;
+    e->audio_bytes += size;
+    e->audio_crc = avi_gen_crc32(e->audio_crc, g->payload, size);
+}
+
+/* OpenDML standard index of the video chunks of a segment */
+static void write_ix00(gen_t *g)
+{
+    put_u32(g, FOURCC("ix00"));
+    put_u32(g, 24 + g->ix_len * 8);
+    uint16_t longs_per_entry = 2;
+    uint8_t sub_type = 0, type = 1; // AVI_INDEX_OF_CHUNKS
+    fwrite(&longs_per_entry, 2, 1, g->f);
+    fwrite(&sub_type, 1, 1, g->f);
+    fwrite(&type, 1, 1, g->f);
+    put_u32(g, g->ix_len);
+    put_u32(g, FOURCC("00dc"));
+    uint64_t base = g->movi_data;
+    fwrite(&base, sizeof(base), 1, g->f);
+    put_u32(g, 0);
+    for (uint32_t i = 0; i < g->ix_len; i++) {
+        put_u32(g, g->ix_offsets[i]);
+        put_u32(g, g->ix_sizes[i]);
+    }
+}
+
+static void write_movi(gen_t *g, uint32_t first, uint32_t end)
+{
+    const avi_gen_params_t *p = g->p;
+    long movi = begin_list(g, "LIST", "movi");
+    g->movi_data = movi + 4;
+    g->ix_len = 0;
+    for (uint32_t i = first; i < end; i++) {
+        long rec = p->rec_lists ? begin_list(g, "LIST", "rec ") : 0;
+        write_video(g, i);
+        bool last = i == p->frames - 1;
+        if (p->audio_rate && ((i + 1) % p->audio_interleave == 0 || last)) {
+            write_audio(g, i, last);
+        }
+        if (rec) {
+            end_list(g, rec);
+        }
+        if (p->junk_every && (i + 1) % p->junk_every == 0) {
+            memset(g->payload, 0, p->junk_size);
+            put_chunk(g, FOURCC("JUNK"), g->payload, p->junk_size);
+        }
+    }
+    if (p->segments > 1) {
+        write_ix00(g);
+    }
+    end_list(g, movi);
+}
+
+void avi_gen_default_params(avi_gen_params_t *params)
+{
+    *params = (avi_gen_params_t) {
+        .width = 64,
+        .height = 48,
+        .rate = 30,
+        .scale = 1,
+        .frames = 90,
+        .frame_min = 1000,
+        .frame_max = 3000,
+        .audio_rate = 16000,
+        .audio_channels = 1,
+        .audio_bits = 16,
+        .audio_interleave = 1,
+        .idx1 = true,
+        .segments = 1,
+        .seed = 1,
+    };
+}
+
+int avi_gen_write(const char *path, const avi_gen_params_t *p, avi_gen_expect_t *expect)
+{
+    uint32_t block_align = p->audio_channels * p->audio_bits / 8;
+    if (!p->rate || !p->scale || !p->frames || p->frame_min < 6 || p->frame_max < p->frame_min ||
+            p->segments < 1 || p->segments > p->frames ||
+            (p->audio_rate && (!block_align || !p->audio_interleave))) {
+        return -1;
+    }
+    gen_t g = {
+        .p = p,
+        .expect = expect,
+        .rand = p->seed ? p->seed : 1,
+        .first_segment = true,
+    };
+    memset(expect, 0, sizeof(avi_gen_expect_t));
+    expect->frame_period_us = (uint64_t)p->scale * 1000000 / p->rate;
+
+    /*!< Audio chunks carry at most interleave frames of samples, plus the rounding */
+    size_t audio_max = p->audio_rate ?
+                       ((uint64_t)p->audio_interleave * p->scale * p->audio_rate / p->rate + 2) * block_align : 0;
+    size_t payload_size = p->frame_max > audio_max ? p->frame_max : audio_max;
+    if (p->junk_size > payload_size) {
+        payload_size = p->junk_size;
+    }
+    uint32_t seg_frames = (p->frames + p->segments - 1) / p->segments;
+    g.payload = malloc(payload_size + 1);
+    g.idx1 = malloc(sizeof(idx1_entry_t) * 2 * (seg_frames + 1));
+    g.ix_offsets = malloc(sizeof(uint32_t) * seg_frames);
+    g.ix_sizes = malloc(sizeof(uint32_t) * seg_frames);
+    g.f = fopen(path, "wb");
+    int ret = -1;
+    if (!g.payload || !g.idx1 || !g.ix_offsets || !g.ix_sizes || !g.f) {
+        goto err;
+    }
+
+    for (uint32_t s = 0; s < p->segments; s++) {
+        uint32_t first = s * seg_frames;
+        uint32_t end = first + seg_frames < p->frames ? first + seg_frames : p->frames;
+        if (first >= end) {
+            break;
+        }
+        long riff = begin_list(&g, "RIFF", s ? "AVIX" : "AVI ");
+        if (s == 0) {
+            write_header(&g, end - first);
+        }
+        write_movi(&g, first, end);
+        if (s == 0 && p->idx1) {
+            put_chunk(&g, FOURCC("idx1"), g.idx1, g.idx1_len * sizeof(idx1_entry_t));
+        }
+        end_list(&g, riff);
+        g.first_segment = false;
+    }
+    expect->file_size = ftell(g.f);
+    ret = ferror(g.f) ? -1 : 0;
+
+err:
+    if (g.f && fclose(g.f) != 0) {
+        ret = -1;
+    }
+    free(g.payload);
+    free(g.idx1);
+    free(g.ix_offsets);
+    free(g.ix_sizes);
+    return ret;
+}
+
+#define GOLDEN_FIELDS(X) \
+    X(video_chunks, "%" PRIu32, SCNu32) \
+    X(video_frames, "%" PRIu32, SCNu32) \
+    X(video_bytes, "%" PRIu64, SCNu64) \
+    X(video_crc, "0x%08" PRIx32, SCNx32) \
+    X(audio_chunks, "%" PRIu32, SCNu32) \
+    X(audio_bytes, "%" PRIu64, SCNu64) \
+    X(audio_crc, "0x%08" PRIx32, SCNx32) \
+    X(skipped, "%" PRIu32, SCNu32) \
+    X(frame_period_us, "%" PRIu32, SCNu32) \
+    X(last_pts_us, "%" PRId64, SCNd64) \
+    X(file_size, "%" PRIu64, SCNu64)
+
+int avi_gen_write_golden(const char *path, const avi_gen_expect_t *expect)
+{
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        return -1;
+    }
+#define WRITE_FIELD(name, fmt, scn) fprintf(f, #name " " fmt "\n", expect->name);
+    GOLDEN_FIELDS(WRITE_FIELD)
+#undef WRITE_FIELD
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+int avi_gen_read_golden(const char *path, avi_gen_expect_t *expect)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+    memset(expect, 0, sizeof(avi_gen_expect_t));
+    int fields = 0;
+    char line[128];
+    while (fgets(line, sizeof(line), f)) {
+#define READ_FIELD(name, fmt, scn) \
+        if (!strncmp(line, #name " ", sizeof(#name))) { \
+            fields += sscanf(line + sizeof(#name), "%" scn, &expect->name) == 1; \
+            continue; \
+        }
+        GOLDEN_FIELDS(READ_FIELD)
+#undef READ_FIELD
+    }
+    fclose(f);
+#define COUNT_FIELD(name, fmt, scn) + 1
+    return fields == 0 GOLDEN_FIELDS(COUNT_FIELD) ? 0 : -1;
+#undef COUNT_FIELD
+}
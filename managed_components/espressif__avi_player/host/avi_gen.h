@@ -0,0 +1,84 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/*
+ * Synthetic AVI files with the structures real writers produce, and what the player must deliver from them.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint16_t width;
+    uint16_t height;
+    uint32_t rate;                  /*!< Frame rate is rate / scale, 30000 / 1001 for NTSC */
+    uint32_t scale;
+    uint32_t frames;                /*!< Video chunks, empty ones included */
+    uint32_t frame_min;             /*!< JPEG frame sizes, picked between these */
+    uint32_t frame_max;
+    uint32_t empty_every;           /*!< Every Nth video chunk is empty, 0 for none */
+    bool odd_sizes;                 /*!< Odd payload sizes, a pad byte follows them */
+    uint32_t audio_rate;            /*!< PCM sample rate, 0 for no audio stream */
+    uint16_t audio_channels;
+    uint16_t audio_bits;
+    uint32_t audio_interleave;      /*!< Video frames per audio chunk */
+    uint32_t junk_every;            /*!< A JUNK chunk after every Nth video chunk, 0 for none */
+    uint32_t junk_size;
+    bool junk_align;                /*!< JUNK before the movi list aligns it to 2048 bytes */
+    bool rec_lists;                 /*!< Each video chunk and its audio in a LIST rec */
+    bool idx1;
+    uint32_t segments;              /*!< RIFF segments, more than 1 writes an OpenDML file with AVIX segments */
+    uint32_t seed;
+} avi_gen_params_t;
+
+/**
+ * @brief What playing a generated file must deliver
+ */
+typedef struct {
+    uint32_t video_chunks;
+    uint32_t video_frames;          /*!< Non-empty video chunks, the ones delivered */
+    uint64_t video_bytes;
+    uint32_t video_crc;             /*!< Over frame index and payload of every delivered frame */
+    uint32_t audio_chunks;          /*!< Non-empty audio chunks */
+    uint64_t audio_bytes;
+    uint32_t audio_crc;             /*!< Over the audio payloads in order */
+    uint32_t skipped;               /*!< Empty chunks */
+    uint32_t frame_period_us;
+    int64_t last_pts_us;            /*!< Presentation time of the last delivered frame */
+    uint64_t file_size;
+} avi_gen_expect_t;
+
+/**
+ * @brief Defaults: 64x48 MJPEG at 30 fps, 16 kHz mono 16 bit audio, one chunk per frame, idx1, one segment
+ */
+void avi_gen_default_params(avi_gen_params_t *params);
+
+/**
+ * @brief Write an AVI file and fill in what playing it must deliver
+ *
+ * @return 0 on success, -1 if the file cannot be written or the parameters are invalid
+ */
+int avi_gen_write(const char *path, const avi_gen_params_t *params, avi_gen_expect_t *expect);
+
+/**
+ * @brief Write and read the expectations as a text file, one "key value" per line
+ */
+int avi_gen_write_golden(const char *path, const avi_gen_expect_t *expect);
+int avi_gen_read_golden(const char *path, avi_gen_expect_t *expect);
+
+/**
+ * @brief CRC-32 (IEEE), start with 0
+ */
+uint32_t avi_gen_crc32(uint32_t crc, const void *data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
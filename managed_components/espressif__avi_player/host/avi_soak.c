@@ -0,0 +1,212 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/*
+ * Track switch soak: sends PLAY commands back to back, each one stops the playing file and starts
+ * the other of two generated files, queued before with avi_player_set_next(). Heap in use and
+ * open file descriptors must not grow.
+ *
+ *   avi_soak [-n switches] [-v] dir
+ */
+
+#include <dirent.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "avi_player.h"
+#include "avi_virtual_clock.h"
+#include "avi_gen.h"
+
+#define SOAK_SWITCHES       10000
+#define SOAK_WARMUP         10
+#define SOAK_CMD_TIMEOUT_MS 2000
+#define SOAK_HEAP_SLACK     (4 * 1024)  // Allocator bookkeeping may settle a little after the warm up
+
+static SemaphoreHandle_t cmd_done;
+static esp_err_t cmd_err;
+
+static void soak_frame(frame_data_t *data, void *arg)
+{
+}
+
+static void soak_event(const avi_player_event_t *event, void *arg)
+{
+    if (event->type == AVI_PLAYER_EVENT_CMD_DONE) {
+        cmd_err = event->err;
+        xSemaphoreGive(cmd_done);
+    }
+}
+
+/* Bytes allocated with malloc, ASan has its own allocator and reports leaks itself at exit */
+static size_t heap_in_use(void)
+{
+    return mallinfo2().uordblks;
+}
+
+static int open_fds(void)
+{
+    DIR *d = opendir("/proc/self/fd");
+    if (!d) {
+        return -1;
+    }
+    int n = 0;
+    while (readdir(d)) {
+        n++;
+    }
+    closedir(d);
+    return n;
+}
+
+static int64_t wall_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static bool send_and_wait(avi_player_handle_t handle, const avi_player_cmd_t *cmd)
+{
+    if (avi_player_send_command(handle, cmd) != ESP_OK) {
+        printf("    command %" PRIu32 " not accepted\n", cmd->id);
+        return false;
+    }
+    if (!xSemaphoreTake(cmd_done, pdMS_TO_TICKS(SOAK_CMD_TIMEOUT_MS))) {
+        printf("    command %" PRIu32 " not done after %d ms\n", cmd->id, SOAK_CMD_TIMEOUT_MS);
+        return false;
+    }
+    if (cmd_err != ESP_OK) {
+        printf("    command %" PRIu32 " failed: %s\n", cmd->id, esp_err_to_name(cmd_err));
+        return false;
+    }
+    return true;
+}
+
+/* Stop and drop the queued file, so the heap and the descriptors are measured in the same state */
+static bool stop_and_measure(avi_player_handle_t handle, size_t *heap, int *fds)
+{
+    avi_player_cmd_t cmd = {
+        .type = AVI_PLAYER_CMD_STOP,
+        .id = UINT32_MAX,
+    };
+    bool ok = send_and_wait(handle, &cmd);
+    ESP_ERROR_CHECK(avi_player_set_next(handle, NULL, NULL));
+    *heap = heap_in_use();
+    *fds = open_fds();
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    int switches = SOAK_SWITCHES;
+    esp_log_level_t log_level = ESP_LOG_WARN;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:vh")) != -1) {
+        switch (opt) {
+        case 'n':
+            switches = atoi(optarg);
+            break;
+        case 'v':
+            log_level = ESP_LOG_DEBUG;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n switches] [-v] dir\n", argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc - 1 || switches <= SOAK_WARMUP) {
+        fprintf(stderr, "Usage: %s [-n switches] [-v] dir\n", argv[0]);
+        return 2;
+    }
+    const char *dir = argv[optind];
+    mkdir(dir, 0755);
+    esp_log_level_set("*", log_level);
+
+    /*!< Two files of different sizes, so a switch also changes the stream layout */
+    char paths[2][512];
+    for (int i = 0; i < 2; i++) {
+        avi_gen_params_t params;
+        avi_gen_expect_t expect;
+        avi_gen_default_params(&params);
+        params.frames = 300;
+        params.seed = i + 1;
+        if (i) {
+            params.width = 320;
+            params.height = 240;
+            params.frame_min = 8 * 1024;
+            params.frame_max = 16 * 1024;
+            params.audio_rate = 44100;
+            params.audio_channels = 2;
+        }
+        snprintf(paths[i], sizeof(paths[i]), "%s/soak%d.avi", dir, i);
+        if (avi_gen_write(paths[i], &params, &expect) != 0) {
+            printf("Cannot write %s\n", paths[i]);
+            return 1;
+        }
+    }
+
+    /*!< On the virtual clock the prebuffer waits and the frame ticks take no wall time */
+    avi_player_clock_t *clock;
+    ESP_ERROR_CHECK(avi_virtual_clock_create(&clock));
+    cmd_done = xSemaphoreCreateBinary();
+    avi_player_config_t config = {
+        .buffer_size = 64 * 1024,
+        .audio_cb = soak_frame,
+        .video_cb = soak_frame,
+        .event_cb = soak_event,
+        .clock = clock,
+    };
+    avi_player_handle_t handle;
+    ESP_ERROR_CHECK(avi_player_init(config, &handle));
+
+    avi_player_cmd_t cmd = {
+        .type = AVI_PLAYER_CMD_PLAY,
+    };
+    size_t warm_heap = 0, end_heap = 0;
+    int warm_fds = 0, end_fds = 0;
+    bool ok = true;
+    int64_t start = wall_us();
+    for (int i = 0; ok && i < switches; i++) {
+        cmd.id = i;
+        cmd.play.filename = paths[i & 1];
+        ok = send_and_wait(handle, &cmd);
+        /*!< The other file is queued without its info, the reader parses its header for the prefetch */
+        ESP_ERROR_CHECK(avi_player_set_next(handle, paths[(i + 1) & 1], NULL));
+        if (i == SOAK_WARMUP) {
+            ok = ok && stop_and_measure(handle, &warm_heap, &warm_fds);
+        }
+    }
+    int64_t wall = wall_us() - start;
+    avi_player_stats_t stats;
+    avi_player_get_stats(handle, &stats);
+    ok = stop_and_measure(handle, &end_heap, &end_fds) && ok;
+    ESP_ERROR_CHECK(avi_player_deinit(handle));
+    avi_virtual_clock_delete(clock);
+    vSemaphoreDelete(cmd_done);
+
+    printf("%d track switches in %.1f s, %" PRIu32 " from the prefetch: %zu heap bytes in use (%zu after warm up), "
+           "%d open fds (%d)\n", switches, wall / 1e6, stats.prefetch_starts, end_heap, warm_heap, end_fds, warm_fds);
+    if (stats.prefetch_starts == 0) {
+        printf("    no switch started from the prefetch\n");
+        ok = false;
+    }
+    if (end_heap > warm_heap + SOAK_HEAP_SLACK) {
+        printf("    heap grew by %zu bytes\n", end_heap - warm_heap);
+        ok = false;
+    }
+    if (end_fds > warm_fds) {
+        printf("    %d file descriptors leaked\n", end_fds - warm_fds);
+        ok = false;
+    }
+    printf("%s\n", ok ? "ok" : "FAIL");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,179 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/*
+ * Converts a trace saved by avi_trace_save() to the Chrome trace event format, for
+ * chrome://tracing or ui.perfetto.dev, and prints how long each span took.
+ *
+ *   avi_trace2json trace.bin [trace.json]
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "avi_trace.h"
+
+#define TRACKS_MAX      8
+#define DEPTH_MAX       16
+
+typedef struct {
+    const char *name;
+    uint32_t event;
+    int64_t begin_us;
+} span_t;
+
+typedef struct {
+    const char *name;
+    span_t stack[DEPTH_MAX];
+    int depth;
+} track_t;
+
+typedef struct {
+    uint32_t count;
+    int64_t total_us;
+    int64_t max_us;
+    int64_t max_at_us;
+} span_stats_t;
+
+static track_t tracks[TRACKS_MAX];
+static int num_tracks;
+static span_stats_t span_stats[AVI_TRACE_EVENT_MAX];
+
+/* Tracks become threads in the viewer, numbered from 1 in the order they show up */
+static int track_id(FILE *out, const char *name)
+{
+    for (int i = 0; i < num_tracks; i++) {
+        if (strcmp(tracks[i].name, name) == 0) {
+            return i + 1;
+        }
+    }
+    if (num_tracks == TRACKS_MAX) {
+        return 0;
+    }
+    tracks[num_tracks].name = name;
+    num_tracks++;
+    fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+            num_tracks, name);
+    return num_tracks;
+}
+
+static void write_event(FILE *out, const avi_trace_event_desc_t *desc, int tid, char ph, int64_t ts, uint32_t arg)
+{
+    fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%" PRId64 ",\"pid\":1,\"tid\":%d", desc->name, ph, ts, tid);
+    if (ph == 'C') {
+        fprintf(out, ",\"args\":{\"bytes\":%" PRIu32 "}}", arg);
+    } else if (ph == 'i') {
+        fprintf(out, ",\"s\":\"t\",\"args\":{\"arg\":%" PRIu32 "}}", arg);
+    } else {
+        fprintf(out, ",\"args\":{\"arg\":%" PRIu32 "}}", arg);
+    }
+}
+
+static void span_end(FILE *out, track_t *track, int tid, const avi_trace_event_desc_t *desc, int64_t ts, uint32_t arg)
+{
+    // Spans opened before the oldest record kept have no begin, they are left out
+    if (track->depth == 0 || strcmp(track->stack[track->depth - 1].name, desc->name) != 0) {
+        return;
+    }
+    span_t *span = &track->stack[--track->depth];
+    int64_t us = ts - span->begin_us;
+    span_stats_t *st = &span_stats[span->event];
+    st->count++;
+    st->total_us += us;
+    if (us > st->max_us) {
+        st->max_us = us;
+        st->max_at_us = span->begin_us;
+    }
+    write_event(out, desc, tid, 'E', ts, arg);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: %s trace.bin [trace.json]\n", argv[0]);
+        return 2;
+    }
+    FILE *in = fopen(argv[1], "rb");
+    if (!in) {
+        fprintf(stderr, "Cannot open %s\n", argv[1]);
+        return 1;
+    }
+    avi_trace_file_header_t hdr;
+    if (fread(&hdr, sizeof(hdr), 1, in) != 1 || memcmp(hdr.magic, "AVTR", 4) != 0 ||
+            hdr.version != AVI_TRACE_VERSION || hdr.record_size != sizeof(avi_trace_record_t)) {
+        fprintf(stderr, "%s is not a version %d trace\n", argv[1], AVI_TRACE_VERSION);
+        fclose(in);
+        return 1;
+    }
+    FILE *out = argc == 3 ? fopen(argv[2], "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "Cannot create %s\n", argv[2]);
+        fclose(in);
+        return 1;
+    }
+
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+            "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"avi_player\"}}");
+    avi_trace_record_t rec;
+    uint32_t records = 0, unknown = 0;
+    uint32_t last_us = 0;
+    int64_t ts = 0;
+    while (records < hdr.records && fread(&rec, sizeof(rec), 1, in) == 1) {
+        // Records are in emit order, the times of the two cores can be a little out of order
+        if (records++ > 0) {
+            ts += (int32_t)(rec.time_us - last_us);
+        }
+        last_us = rec.time_us;
+        const avi_trace_event_desc_t *desc = avi_trace_event_desc(rec.event);
+        int tid = desc ? track_id(out, desc->track) : 0;
+        if (!tid) {
+            unknown++;
+            continue;
+        }
+        track_t *track = &tracks[tid - 1];
+        switch (desc->kind) {
+        case AVI_TRACE_KIND_BEGIN:
+            if (track->depth < DEPTH_MAX) {
+                track->stack[track->depth++] = (span_t) {
+                    .name = desc->name, .event = rec.event, .begin_us = ts
+                };
+                write_event(out, desc, tid, 'B', ts, rec.arg);
+            }
+            break;
+        case AVI_TRACE_KIND_END:
+            span_end(out, track, tid, desc, ts, rec.arg);
+            break;
+        case AVI_TRACE_KIND_COUNTER:
+            write_event(out, desc, tid, 'C', ts, rec.arg);
+            break;
+        case AVI_TRACE_KIND_INSTANT:
+            write_event(out, desc, tid, 'i', ts, rec.arg);
+            break;
+        }
+    }
+    fprintf(out, "\n]}\n");
+    fclose(in);
+    if (out != stdout && fclose(out) != 0) {
+        fprintf(stderr, "Write to %s failed\n", argv[2]);
+        return 1;
+    }
+    if (records != hdr.records) {
+        fprintf(stderr, "Trace truncated, %" PRIu32 " of %" PRIu32 " records\n", records, hdr.records);
+    }
+
+    FILE *report = out == stdout ? stderr : stdout;
+    fprintf(report, "%" PRIu32 " records over %.3f s, %" PRIu32 " lost before the dump, %" PRIu32 " unknown\n",
+            records, ts / 1e6, hdr.lost, unknown);
+    fprintf(report, "%-12s %8s %10s %10s %12s\n", "span", "count", "avg us", "max us", "max at ms");
+    for (int i = 0; i < AVI_TRACE_EVENT_MAX; i++) {
+        const span_stats_t *st = &span_stats[i];
+        if (st->count) {
+            fprintf(report, "%-12s %8" PRIu32 " %10" PRId64 " %10" PRId64 " %12.3f\n", avi_trace_event_desc(i)->name,
+                    st->count, st->total_us / st->count, st->max_us, st->max_at_us / 1e3);
+        }
+    }
+    return 0;
+}
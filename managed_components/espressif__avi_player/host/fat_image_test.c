@@ -0,0 +1,461 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/*
+ * Formats FAT12, FAT16 and FAT32 image files holding contiguous, fragmented and broken files, then
+ * finds every file through its directory entry the way FatFs does, maps it with fat_extent_build()
+ * and checks that reading the image through the map returns the bytes of the file.
+ *
+ *   fat_image_test dir
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "fat_extent.h"
+
+#define SECTOR          FAT_EXTENT_SECTOR_SIZE
+#define FILES_MAX       8
+#define CHAIN_MAX       128
+#define ROOT_ENTRIES    512     // FAT12 and FAT16 root directory
+
+#define WR16(p, v)      do { (p)[0] = (uint8_t)(v); (p)[1] = (uint8_t)((v) >> 8); } while (0)
+#define WR32(p, v)      do { WR16(p, v); WR16((p) + 2, (v) >> 16); } while (0)
+#define RD16(p)         ((uint32_t)(p)[0] | (uint32_t)(p)[1] << 8)
+#define RD32(p)         (RD16(p) | RD16((p) + 2) << 16)
+
+typedef struct {
+    const char *name;           // 8.3 name as stored in the directory entry
+    uint32_t size;
+    uint32_t chain[CHAIN_MAX];  // Clusters in file order
+    uint32_t clusters;          // Clusters in the chain, fewer than size needs for a broken file
+    uint32_t want_extents;
+    int want_ret;               // fat_extent_build() result
+} test_file_t;
+
+typedef struct {
+    const char *name;
+    uint8_t fat_bits;
+    uint32_t total_sectors;
+    uint32_t cluster_sectors;
+    uint32_t volume_lba;        // Behind an MBR when not 0
+} layout_t;
+
+/* Both the image writer and the checker derive the bytes of a file from its name and an offset */
+static uint8_t file_byte(const char *name, uint32_t i)
+{
+    uint32_t seed = (uint8_t)name[0] * 131u + (uint8_t)name[1];
+    return (uint8_t)((i ^ (i >> 9) ^ (i >> 17)) * 167u + seed);
+}
+
+static uint32_t run(test_file_t *f, uint32_t first, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        f->chain[f->clusters++] = first + i;
+    }
+    return first + count;
+}
+
+/*
+ * Cluster plan, the same on every volume so cluster sizes change the byte offsets. Cluster 2 is the
+ * FAT32 root directory and 3 to 6 are left free until FRAG takes them last, a jump backwards.
+ */
+static int plan_files(test_file_t *files, uint32_t cluster_bytes)
+{
+    memset(files, 0, sizeof(test_file_t) * FILES_MAX);
+    int n = 0;
+    uint32_t next = 7;
+
+    test_file_t *contig = &files[n++];
+    contig->name = "CONTIG  BIN";
+    next = run(contig, next, 37);
+    contig->size = 36 * cluster_bytes + 123;
+    contig->want_extents = 1;
+
+    test_file_t *frag = &files[n++];
+    test_file_t *filler = &files[n++];
+    frag->name = "FRAG    BIN";
+    filler->name = "FILLER  BIN";
+    next = run(frag, next, 3);
+    next = run(filler, next, 2);
+    next = run(frag, next, 1);
+    next = run(filler, next, 1);
+    next = run(frag, next, 5);
+    run(frag, 3, 4);
+    frag->size = frag->clusters * cluster_bytes;
+    frag->want_extents = 4;
+    filler->size = filler->clusters * cluster_bytes - 1;
+    filler->want_extents = 2;
+
+    test_file_t *small = &files[n++];
+    small->name = "SMALL   BIN";
+    next = run(small, next, 1);
+    small->size = 300;
+    small->want_extents = 1;
+
+    test_file_t *empty = &files[n++];
+    empty->name = "EMPTY   BIN";
+
+    test_file_t *scatter = &files[n++];
+    scatter->name = "SCATTER BIN";
+    for (int i = 0; i < FAT_EXTENT_MAX + 8; i++) {
+        next = run(scatter, next, 1) + 1; // Every other cluster stays free
+    }
+    scatter->size = scatter->clusters * cluster_bytes;
+    scatter->want_ret = -3;
+
+    test_file_t *broken = &files[n++];
+    broken->name = "BROKEN  BIN";
+    next = run(broken, next, 2);
+    broken->size = 4 * cluster_bytes;
+    broken->want_ret = -2;
+    return n;
+}
+
+static void set_fat(uint8_t *fat, uint8_t bits, uint32_t cluster, uint32_t value)
+{
+    if (bits == 12) {
+        uint8_t *p = fat + cluster + cluster / 2;
+        uint32_t v = RD16(p);
+        v = (cluster & 1) ? (v & 0x000F) | (value << 4) : (v & 0xF000) | (value & 0xFFF);
+        WR16(p, v);
+    } else if (bits == 16) {
+        WR16(fat + cluster * 2, value);
+    } else {
+        WR32(fat + cluster * 4, value & 0x0FFFFFFF);
+    }
+}
+
+static bool write_at(FILE *img, uint64_t offset, const void *data, size_t len)
+{
+    return fseek(img, (long)offset, SEEK_SET) == 0 && fwrite(data, 1, len, img) == len;
+}
+
+/* Write a freshly formatted volume holding files, returns false on an I/O error or a wrong layout */
+static bool make_image(const char *path, const layout_t *l, const test_file_t *files, int num_files)
+{
+    const uint32_t cs = l->cluster_sectors;
+    const uint32_t reserved = l->fat_bits == 32 ? 32 : 1;
+    const uint32_t root_sectors = l->fat_bits == 32 ? 0 : ROOT_ENTRIES * 32 / SECTOR;
+    uint32_t clusters = (l->total_sectors - reserved - root_sectors) / cs;
+    const uint32_t fat_sectors = ((clusters + 2) * l->fat_bits / 8 + 1 + SECTOR - 1) / SECTOR;
+    const uint32_t data_start = reserved + 2 * fat_sectors + root_sectors;
+    clusters = (l->total_sectors - data_start) / cs;
+    uint8_t type = clusters < 4085 ? 12 : clusters < 65525 ? 16 : 32;
+    if (type != l->fat_bits) {
+        printf("    %u clusters make a FAT%u volume, not FAT%u\n", (unsigned)clusters, type, l->fat_bits);
+        return false;
+    }
+
+    FILE *img = fopen(path, "wb");
+    if (!img) {
+        return false;
+    }
+    uint8_t *fat = calloc(fat_sectors, SECTOR);
+    uint8_t *sector = calloc(1, SECTOR);
+    uint8_t *cluster = calloc(cs, SECTOR);
+    uint8_t *root = calloc(l->fat_bits == 32 ? cs : root_sectors, SECTOR);
+    const uint64_t base = (uint64_t)l->volume_lba * SECTOR;
+    bool ok = fat && sector && cluster && root;
+
+    if (ok && l->volume_lba) {
+        uint8_t *pe = sector + 446;
+        pe[4] = l->fat_bits == 12 ? 0x01 : l->fat_bits == 16 ? 0x06 : 0x0C;
+        WR32(pe + 8, l->volume_lba);
+        WR32(pe + 12, l->total_sectors);
+        sector[510] = 0x55;
+        sector[511] = 0xAA;
+        ok = write_at(img, 0, sector, SECTOR);
+    }
+
+    /*!< Boot sector, with the FSInfo sector and the backup boot sector on FAT32 */
+    if (ok) {
+        uint8_t *bs = sector;
+        memset(bs, 0, SECTOR);
+        memcpy(bs, "\xEB\x58\x90" "MSWIN4.1", 11);
+        WR16(bs + 11, SECTOR);
+        bs[13] = (uint8_t)cs;
+        WR16(bs + 14, reserved);
+        bs[16] = 2;
+        WR16(bs + 17, root_sectors * SECTOR / 32);
+        if (l->total_sectors < 0x10000 && l->fat_bits != 32) {
+            WR16(bs + 19, l->total_sectors);
+        } else {
+            WR32(bs + 32, l->total_sectors);
+        }
+        bs[21] = 0xF8;
+        WR16(bs + 24, 63);
+        WR16(bs + 26, 255);
+        WR32(bs + 28, l->volume_lba);
+        uint8_t *ext = bs + 36;
+        if (l->fat_bits == 32) {
+            WR32(bs + 36, fat_sectors);
+            WR32(bs + 44, 2);
+            WR16(bs + 48, 1);
+            WR16(bs + 50, 6);
+            ext = bs + 64;
+        } else {
+            WR16(bs + 22, fat_sectors);
+        }
+        ext[0] = 0x80;
+        ext[2] = 0x29;
+        WR32(ext + 3, 0x20250101);
+        memcpy(ext + 7, "NO NAME    ", 11);
+        memcpy(ext + 18, l->fat_bits == 12 ? "FAT12   " : l->fat_bits == 16 ? "FAT16   " : "FAT32   ", 8);
+        bs[510] = 0x55;
+        bs[511] = 0xAA;
+        ok = write_at(img, base, bs, SECTOR);
+        if (ok && l->fat_bits == 32) {
+            ok = write_at(img, base + 6 * SECTOR, bs, SECTOR);
+            memset(bs, 0, SECTOR);
+            WR32(bs, 0x41615252);
+            WR32(bs + 484, 0x61417272);
+            WR32(bs + 488, 0xFFFFFFFF);
+            WR32(bs + 492, 0xFFFFFFFF);
+            WR32(bs + 508, 0xAA550000);
+            ok = ok && write_at(img, base + SECTOR, bs, SECTOR);
+        }
+    }
+
+    /*!< FAT and directory entries, then the data of every cluster */
+    if (ok) {
+        const uint32_t eoc = l->fat_bits == 12 ? 0xFFF : l->fat_bits == 16 ? 0xFFFF : 0x0FFFFFFF;
+        set_fat(fat, l->fat_bits, 0, 0xFFFFFF00 | 0xF8);
+        set_fat(fat, l->fat_bits, 1, eoc);
+        if (l->fat_bits == 32) {
+            set_fat(fat, l->fat_bits, 2, eoc);
+        }
+        uint8_t *de = root;
+        memcpy(de, "AVI TEST   ", 11);
+        de[11] = 0x08;
+        de += 32;
+
+        const uint64_t cluster_bytes = (uint64_t)cs * SECTOR;
+        for (int i = 0; ok && i < num_files; i++) {
+            const test_file_t *f = &files[i];
+            for (uint32_t c = 0; c < f->clusters; c++) {
+                uint32_t cl = f->chain[c];
+                if (cl + 1 > clusters + 2) {
+                    printf("    %s does not fit\n", f->name);
+                    ok = false;
+                    break;
+                }
+                set_fat(fat, l->fat_bits, cl, c + 1 < f->clusters ? f->chain[c + 1] : eoc);
+                for (uint32_t b = 0; b < cluster_bytes; b++) {
+                    uint64_t pos = c * cluster_bytes + b;
+                    cluster[b] = pos < f->size ? file_byte(f->name, (uint32_t)pos) : 0;
+                }
+                ok = ok && write_at(img, base + (data_start + (uint64_t)(cl - 2) * cs) * SECTOR, cluster, cluster_bytes);
+            }
+            uint32_t first = f->clusters ? f->chain[0] : 0;
+            memcpy(de, f->name, 11);
+            de[11] = 0x20;
+            WR16(de + 20, first >> 16);
+            WR16(de + 26, first);
+            WR32(de + 28, f->size);
+            de += 32;
+        }
+        for (int copy = 0; ok && copy < 2; copy++) {
+            ok = write_at(img, base + (reserved + copy * fat_sectors) * (uint64_t)SECTOR, fat, fat_sectors * SECTOR);
+        }
+        ok = ok && write_at(img, base + (uint64_t)(reserved + 2 * fat_sectors) * SECTOR, root,
+                            (l->fat_bits == 32 ? cs : root_sectors) * SECTOR);
+        /*!< The last sector sets the image size, the rest stays a hole */
+        memset(sector, 0, SECTOR);
+        ok = ok && write_at(img, base + ((uint64_t)l->total_sectors - 1) * SECTOR, sector, SECTOR);
+    }
+
+    free(fat);
+    free(sector);
+    free(cluster);
+    free(root);
+    ok = fclose(img) == 0 && ok;
+    return ok;
+}
+
+static int image_read(void *ctx, uint32_t lba, uint32_t count, void *buf)
+{
+    FILE *img = ctx;
+    if (fseek(img, (long)((uint64_t)lba * SECTOR), SEEK_SET) != 0 || fread(buf, SECTOR, count, img) != count) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Find name in the root directory, as FatFs gives the start cluster and size to the player */
+static bool find_entry(FILE *img, const fat_extent_volume_t *vol, const uint8_t *boot, const char *name,
+                       uint32_t *cluster, uint32_t *size)
+{
+    uint32_t first, sectors;
+    if (vol->fat_bits == 32) {
+        /*!< The root directory is a cluster chain itself, the test volumes keep it to one cluster */
+        fat_extent_map_t map;
+        uint8_t buf[SECTOR];
+        if (fat_extent_build(vol, image_read, img, buf, RD32(boot + 44), vol->cluster_sectors * SECTOR, &map) != 0) {
+            return false;
+        }
+        first = map.extents[0].lba;
+        sectors = map.extents[0].sectors;
+    } else {
+        sectors = (RD16(boot + 17) * 32 + SECTOR - 1) / SECTOR;
+        first = vol->data_lba - sectors;
+    }
+    uint8_t buf[SECTOR];
+    for (uint32_t s = 0; s < sectors; s++) {
+        if (image_read(img, first + s, 1, buf) != 0) {
+            return false;
+        }
+        for (const uint8_t *de = buf; de < buf + SECTOR; de += 32) {
+            if (de[0] == 0x00) {
+                return false;
+            }
+            if (de[0] != 0xE5 && !(de[11] & 0x08) && memcmp(de, name, 11) == 0) {
+                *cluster = RD16(de + 26) | (vol->fat_bits == 32 ? RD16(de + 20) << 16 : 0);
+                *size = RD32(de + 28);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/* Read len bytes at pos through the map like the player's direct reads, false on a mismatch */
+static bool check_read(FILE *img, const fat_extent_map_t *map, const char *name, uint32_t pos, uint32_t len)
+{
+    static uint8_t buf[64 * SECTOR];
+    uint32_t end = pos + len > map->file_size ? map->file_size : pos + len;
+    while (pos < end) {
+        uint32_t offset = pos % SECTOR;
+        uint32_t lba;
+        uint32_t count = fat_extent_lookup(map, pos / SECTOR, &lba);
+        uint32_t needed = (offset + end - pos + SECTOR - 1) / SECTOR;
+        count = count < needed ? count : needed;
+        count = count < sizeof(buf) / SECTOR ? count : sizeof(buf) / SECTOR;
+        if (count == 0 || image_read(img, lba, count, buf) != 0) {
+            printf("    %s: no sectors at %" PRIu32 "\n", name, pos);
+            return false;
+        }
+        uint32_t copy = count * SECTOR - offset;
+        copy = copy < end - pos ? copy : end - pos;
+        for (uint32_t i = 0; i < copy; i++) {
+            if (buf[offset + i] != file_byte(name, pos + i)) {
+                printf("    %s: wrong byte at %" PRIu32 "\n", name, pos + i);
+                return false;
+            }
+        }
+        pos += copy;
+    }
+    return true;
+}
+
+static int check_image(const char *path, const layout_t *l, const test_file_t *files, int num_files)
+{
+    FILE *img = fopen(path, "rb");
+    if (!img) {
+        printf("    cannot open %s\n", path);
+        return 1;
+    }
+    int failures = 0;
+    uint8_t boot[SECTOR], buf[SECTOR];
+    fat_extent_volume_t vol;
+    uint32_t volume_lba = 0;
+    /*!< A partitioned card has an MBR in sector 0, the volume starts where its first entry says */
+    bool ok = image_read(img, 0, 1, boot) == 0;
+    if (ok && fat_extent_parse_volume(&vol, boot, 0) != 0) {
+        volume_lba = RD32(boot + 446 + 8);
+        ok = image_read(img, volume_lba, 1, boot) == 0;
+    }
+    if (!ok || fat_extent_parse_volume(&vol, boot, volume_lba) != 0) {
+        printf("    no FAT volume found\n");
+        fclose(img);
+        return 1;
+    }
+    if (vol.fat_bits != l->fat_bits || volume_lba != l->volume_lba) {
+        printf("    parsed FAT%u at %" PRIu32 ", want FAT%u at %" PRIu32 "\n", vol.fat_bits, volume_lba,
+               l->fat_bits, l->volume_lba);
+        failures++;
+    }
+
+    for (int i = 0; i < num_files; i++) {
+        const test_file_t *f = &files[i];
+        uint32_t cluster, size;
+        fat_extent_map_t map;
+        if (!find_entry(img, &vol, boot, f->name, &cluster, &size)) {
+            printf("    %s: no directory entry\n", f->name);
+            failures++;
+            continue;
+        }
+        int ret = fat_extent_build(&vol, image_read, img, buf, cluster, size, &map);
+        if (ret != f->want_ret) {
+            printf("    %s: build returned %d, want %d\n", f->name, ret, f->want_ret);
+            failures++;
+            continue;
+        }
+        if (ret != 0) {
+            continue;
+        }
+        uint32_t sectors = 0;
+        for (uint32_t e = 0; e < map.count; e++) {
+            sectors += map.extents[e].sectors;
+        }
+        uint32_t cluster_bytes = vol.cluster_sectors * SECTOR;
+        if (map.count != f->want_extents || sectors != (size + cluster_bytes - 1) / cluster_bytes * vol.cluster_sectors) {
+            printf("    %s: %" PRIu32 " extents of %" PRIu32 " sectors, want %" PRIu32 " extents\n", f->name, map.count,
+                   sectors, f->want_extents);
+            failures++;
+            continue;
+        }
+        /*!< The whole file in one go, then odd sized reads from odd offsets across the fragments */
+        bool same = check_read(img, &map, f->name, 0, size);
+        for (uint32_t pos = 777; same && pos < size; pos += 7001) {
+            same = check_read(img, &map, f->name, pos, 7001);
+        }
+        uint32_t lba;
+        if (same && fat_extent_lookup(&map, (size + SECTOR - 1) / SECTOR, &lba) != 0) {
+            printf("    %s: sectors past the end\n", f->name);
+            same = false;
+        }
+        failures += !same;
+    }
+    fclose(img);
+    return failures;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s dir\n", argv[0]);
+        return 2;
+    }
+    const char *dir = argv[1];
+    mkdir(dir, 0755);
+
+    static const layout_t layouts[] = {
+        { "fat12", 12, 4096, 4, 0 },
+        { "fat16", 16, 65536, 4, 2048 },        // Behind an MBR, like most cards
+        { "fat32", 32, 70000, 1, 0 },
+        { "fat32_4k", 32, 600000, 8, 8192 },    // 4 KB clusters, as formatted by most cameras
+    };
+    static test_file_t files[FILES_MAX];
+    int failed = 0, total = 0;
+    for (size_t i = 0; i < sizeof(layouts) / sizeof(layouts[0]); i++) {
+        const layout_t *l = &layouts[i];
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s.img", dir, l->name);
+        int num_files = plan_files(files, l->cluster_sectors * SECTOR);
+        total++;
+        int failures = make_image(path, l, files, num_files) ? check_image(path, l, files, num_files) : 1;
+        printf("%-10s %s\n", l->name, failures ? "FAIL" : "ok");
+        failed += failures != 0;
+        if (!failures) {
+            remove(path);
+        }
+    }
+    printf("%d of %d images passed\n", total - failed, total);
+    return failed ? 1 : 0;
+}
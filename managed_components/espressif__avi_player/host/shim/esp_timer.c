@@ -0,0 +1,231 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/*
+ * Host shim: esp_timer. Callbacks run one at a time on a dispatch thread, like ESP_TIMER_TASK.
+ *
+ * esp_timer time is the monotonic clock scaled by the speed factor. Changing the factor keeps
+ * the time continuous.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include "esp_timer.h"
+
+struct esp_timer {
+    esp_timer_cb_t callback;
+    void *arg;
+    int64_t alarm;              // esp_timer time of the next call
+    uint64_t period;            // 0 for one shot
+    bool armed;
+    struct esp_timer *next;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    bool started;
+    struct esp_timer *timers;
+    uint32_t speed;
+    int64_t base_real;          // Monotonic time of the last speed change
+    int64_t base_time;          // esp_timer time at that point
+} shim = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .speed = 1,
+};
+
+static int64_t real_time_us(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/* Called with the lock held */
+static int64_t timer_time_locked(void)
+{
+    if (!shim.started) {
+        return 0;
+    }
+    return shim.base_time + (real_time_us() - shim.base_real) * shim.speed;
+}
+
+static void *dispatch_task(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&shim.lock);
+    for (;;) {
+        struct esp_timer *due = NULL;
+        for (struct esp_timer *t = shim.timers; t; t = t->next) {
+            if (t->armed && (!due || t->alarm < due->alarm)) {
+                due = t;
+            }
+        }
+        if (!due) {
+            pthread_cond_wait(&shim.cond, &shim.lock);
+            continue;
+        }
+        int64_t now = timer_time_locked();
+        if (due->alarm > now) {
+            int64_t wait_us = (due->alarm - now + shim.speed - 1) / shim.speed;
+            int64_t until = real_time_us() + wait_us;
+            struct timespec ts = { .tv_sec = until / 1000000, .tv_nsec = (until % 1000000) * 1000 };
+            pthread_cond_timedwait(&shim.cond, &shim.lock, &ts);
+            continue;   // Timers may have changed meanwhile
+        }
+        if (due->period) {
+            // Like skip_unhandled_events, a late periodic timer fires once and realigns
+            due->alarm += due->period;
+            if (due->alarm <= now) {
+                due->alarm = now + due->period;
+            }
+        } else {
+            due->armed = false;
+        }
+        esp_timer_cb_t cb = due->callback;
+        void *cb_arg = due->arg;
+        pthread_mutex_unlock(&shim.lock);
+        cb(cb_arg);
+        pthread_mutex_lock(&shim.lock);
+    }
+    return NULL;
+}
+
+/* Called with the lock held */
+static esp_err_t dispatch_start_locked(void)
+{
+    if (shim.started) {
+        return ESP_OK;
+    }
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&shim.cond, &attr);
+    pthread_condattr_destroy(&attr);
+    shim.base_real = real_time_us();
+    shim.base_time = 0;
+    if (pthread_create(&shim.thread, NULL, dispatch_task, NULL) != 0) {
+        return ESP_ERR_NO_MEM;
+    }
+    pthread_detach(shim.thread);
+    shim.started = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *out_handle)
+{
+    if (!args || !args->callback || !out_handle) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    struct esp_timer *timer = calloc(1, sizeof(*timer));
+    if (!timer) {
+        return ESP_ERR_NO_MEM;
+    }
+    timer->callback = args->callback;
+    timer->arg = args->arg;
+    pthread_mutex_lock(&shim.lock);
+    esp_err_t ret = dispatch_start_locked();
+    if (ret == ESP_OK) {
+        timer->next = shim.timers;
+        shim.timers = timer;
+    }
+    pthread_mutex_unlock(&shim.lock);
+    if (ret != ESP_OK) {
+        free(timer);
+        return ret;
+    }
+    *out_handle = timer;
+    return ESP_OK;
+}
+
+static esp_err_t timer_arm(esp_timer_handle_t timer, uint64_t timeout_us, uint64_t period)
+{
+    if (!timer) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t ret = ESP_OK;
+    pthread_mutex_lock(&shim.lock);
+    if (timer->armed) {
+        ret = ESP_ERR_INVALID_STATE;
+    } else {
+        timer->alarm = timer_time_locked() + (int64_t)timeout_us;
+        timer->period = period;
+        timer->armed = true;
+        pthread_cond_broadcast(&shim.cond);
+    }
+    pthread_mutex_unlock(&shim.lock);
+    return ret;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    return timer_arm(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period)
+{
+    if (period == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return timer_arm(timer, period, period);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    if (!timer) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t ret = ESP_OK;
+    pthread_mutex_lock(&shim.lock);
+    if (!timer->armed) {
+        ret = ESP_ERR_INVALID_STATE;
+    }
+    timer->armed = false;
+    pthread_mutex_unlock(&shim.lock);
+    return ret;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    if (!timer) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&shim.lock);
+    if (timer->armed) {
+        pthread_mutex_unlock(&shim.lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    for (struct esp_timer **p = &shim.timers; *p; p = &(*p)->next) {
+        if (*p == timer) {
+            *p = timer->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&shim.lock);
+    free(timer);
+    return ESP_OK;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    pthread_mutex_lock(&shim.lock);
+    dispatch_start_locked();
+    int64_t now = timer_time_locked();
+    pthread_mutex_unlock(&shim.lock);
+    return now;
+}
+
+void esp_timer_shim_set_speed(uint32_t times)
+{
+    pthread_mutex_lock(&shim.lock);
+    dispatch_start_locked();
+    shim.base_time = timer_time_locked();
+    shim.base_real = real_time_us();
+    shim.speed = times ? times : 1;
+    pthread_cond_broadcast(&shim.cond);
+    pthread_mutex_unlock(&shim.lock);
+}
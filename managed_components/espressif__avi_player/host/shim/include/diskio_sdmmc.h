@@ -0,0 +1,16 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include "ff.h"
+#include "sdmmc_cmd.h"
+
+/* No card is ever registered with FatFs, see sdmmc_cmd.h */
+static inline BYTE ff_diskio_get_pdrv_card(const sdmmc_card_t *card)
+{
+    (void)card;
+    return 0xFF;
+}
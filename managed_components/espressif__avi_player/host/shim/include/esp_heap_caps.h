@@ -0,0 +1,27 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/*
+ * Host shim: every capability is plain malloc
+ */
+#pragma once
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MALLOC_CAP_EXEC             (1 << 0)
+#define MALLOC_CAP_32BIT            (1 << 1)
+#define MALLOC_CAP_8BIT             (1 << 2)
+#define MALLOC_CAP_DMA              (1 << 3)
+#define MALLOC_CAP_SPIRAM           (1 << 10)
+#define MALLOC_CAP_INTERNAL         (1 << 11)
+#define MALLOC_CAP_DEFAULT          (1 << 12)
+
+#define heap_caps_malloc(size, caps)                    malloc(size)
+#define heap_caps_calloc(n, size, caps)                 calloc(n, size)
+#define heap_caps_malloc_prefer(size, num, ...)         malloc(size)
+#define heap_caps_aligned_alloc(align, size, caps)      aligned_alloc(align, ((size) + (align) - 1) / (align) * (align))
+#define heap_caps_free(ptr)                             free(ptr)
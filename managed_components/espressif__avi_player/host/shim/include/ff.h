@@ -0,0 +1,62 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/*
+ * Host shim: the FatFs types the direct read path looks at, f_open() always fails
+ */
+#pragma once
+
+#include <stdint.h>
+
+typedef uint8_t BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef uint32_t FSIZE_t;
+typedef uint32_t LBA_t;
+
+typedef enum {
+    FR_OK = 0,
+    FR_DISK_ERR,
+    FR_INT_ERR,
+    FR_NOT_READY,
+    FR_NO_FILE,
+} FRESULT;
+
+#define FA_READ     0x01
+#define FS_FAT12    1
+#define FS_FAT16    2
+#define FS_FAT32    3
+#define FF_MIN_SS   512
+#define FF_MAX_SS   512
+
+typedef struct {
+    BYTE fs_type;
+    WORD csize;
+    DWORD n_fatent;
+    LBA_t fatbase;
+    LBA_t database;
+} FATFS;
+
+typedef struct {
+    struct {
+        FATFS *fs;
+        DWORD sclust;
+        FSIZE_t objsize;
+    } obj;
+} FIL;
+
+static inline FRESULT f_open(FIL *fp, const char *path, BYTE mode)
+{
+    (void)fp;
+    (void)path;
+    (void)mode;
+    return FR_NO_FILE;
+}
+
+static inline FRESULT f_close(FIL *fp)
+{
+    (void)fp;
+    return FR_OK;
+}
@@ -0,0 +1,24 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Stacks are pthread stacks on the host, the memory caps are ignored */
+#define xTaskCreatePinnedToCoreWithCaps(fn, name, depth, arg, prio, task, core, caps) \
+    ((void)(caps), xTaskCreatePinnedToCore(fn, name, depth, arg, prio, task, core))
+#define vTaskDeleteWithCaps(task) vTaskDelete(task)
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,26 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/*
+ * Host shim: Kconfig defaults of the player, override with -D
+ */
+#pragma once
+
+#ifndef CONFIG_AVI_PLAYER_RING_SIZE_KB
+#define CONFIG_AVI_PLAYER_RING_SIZE_KB 4096
+#endif
+#ifndef CONFIG_AVI_PLAYER_PREFETCH_SIZE_KB
+#define CONFIG_AVI_PLAYER_PREFETCH_SIZE_KB 512
+#endif
+#ifndef CONFIG_AVI_PLAYER_DIRECT_READ_BUF_KB
+#define CONFIG_AVI_PLAYER_DIRECT_READ_BUF_KB 32
+#endif
+#define CONFIG_IDF_TARGET_LINUX 1
+#ifndef CONFIG_AVI_PLAYER_TRACE
+#define CONFIG_AVI_PLAYER_TRACE 1
+#endif
+#ifndef CONFIG_AVI_PLAYER_TRACE_EVENTS
+#define CONFIG_AVI_PLAYER_TRACE_EVENTS 16384
+#endif
@@ -0,0 +1,16 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "sdmmc_cmd.h"
+
+esp_err_t sdmmc_read_sectors(sdmmc_card_t *card, void *dst, size_t start_sector, size_t sector_count)
+{
+    (void)card;
+    (void)dst;
+    (void)start_sector;
+    (void)sector_count;
+    return ESP_ERR_NOT_SUPPORTED;
+}
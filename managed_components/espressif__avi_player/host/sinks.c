@@ -0,0 +1,186 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "sinks.h"
+
+static const char *TAG = "avi_sink";
+
+#define SINK_PATH_MAX   512
+
+typedef struct {
+    char dir[SINK_PATH_MAX];
+    FILE *h264;                 // Opened with the first H264 frame
+    uint32_t frames;
+} frames_ctx_t;
+
+typedef struct {
+    FILE *f;
+    uint32_t rate;
+    uint16_t bits;
+    uint16_t ch;
+    uint32_t data_bytes;
+} wav_ctx_t;
+
+static void null_video(avi_sink_t *sink, const frame_data_t *data)
+{
+}
+
+static void null_audio(avi_sink_t *sink, const frame_data_t *data)
+{
+}
+
+static void frames_video(avi_sink_t *sink, const frame_data_t *data)
+{
+    frames_ctx_t *ctx = sink->ctx;
+    if (data->video_info.frame_format == FORMAT_H264) {
+        if (!ctx->h264) {
+            char path[SINK_PATH_MAX + 16];
+            snprintf(path, sizeof(path), "%s/video.h264", ctx->dir);
+            ctx->h264 = fopen(path, "wb");
+            if (!ctx->h264) {
+                ESP_LOGE(TAG, "Cannot create %s", path);
+                return;
+            }
+        }
+        fwrite(data->data, 1, data->data_bytes, ctx->h264);
+    } else {
+        char path[SINK_PATH_MAX + 24];
+        snprintf(path, sizeof(path), "%s/frame_%06u.jpg", ctx->dir, (unsigned)ctx->frames);
+        FILE *f = fopen(path, "wb");
+        if (!f) {
+            ESP_LOGE(TAG, "Cannot create %s", path);
+            return;
+        }
+        fwrite(data->data, 1, data->data_bytes, f);
+        fclose(f);
+    }
+    ctx->frames++;
+}
+
+static void frames_close(avi_sink_t *sink)
+{
+    frames_ctx_t *ctx = sink->ctx;
+    if (ctx->h264) {
+        fclose(ctx->h264);
+    }
+    ESP_LOGI(TAG, "%u video frames written to %s", (unsigned)ctx->frames, ctx->dir);
+}
+
+static void put_le(uint8_t *p, uint32_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++) {
+        p[i] = value >> (8 * i);
+    }
+}
+
+/* Canonical 44 byte PCM header, rewritten with the final sizes on close */
+static void wav_write_header(wav_ctx_t *ctx)
+{
+    uint8_t h[44];
+    uint32_t block = ctx->ch * ctx->bits / 8;
+    memcpy(h, "RIFF", 4);
+    put_le(h + 4, 36 + ctx->data_bytes, 4);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    put_le(h + 16, 16, 4);
+    put_le(h + 20, 1, 2);
+    put_le(h + 22, ctx->ch, 2);
+    put_le(h + 24, ctx->rate, 4);
+    put_le(h + 28, ctx->rate * block, 4);
+    put_le(h + 32, block, 2);
+    put_le(h + 34, ctx->bits, 2);
+    memcpy(h + 36, "data", 4);
+    put_le(h + 40, ctx->data_bytes, 4);
+    fseek(ctx->f, 0, SEEK_SET);
+    fwrite(h, 1, sizeof(h), ctx->f);
+    fseek(ctx->f, 0, SEEK_END);
+}
+
+static void wav_set_clock(avi_sink_t *sink, uint32_t rate, uint32_t bits, uint32_t ch)
+{
+    wav_ctx_t *ctx = sink->ctx;
+    if (ctx->data_bytes && (rate != ctx->rate || bits != ctx->bits || ch != ctx->ch)) {
+        ESP_LOGW(TAG, "Audio format changed to %u Hz %u bit %u ch, the WAV keeps the first one",
+                 (unsigned)rate, (unsigned)bits, (unsigned)ch);
+        return;
+    }
+    ctx->rate = rate;
+    ctx->bits = bits;
+    ctx->ch = ch;
+    wav_write_header(ctx);
+}
+
+static void wav_audio(avi_sink_t *sink, const frame_data_t *data)
+{
+    wav_ctx_t *ctx = sink->ctx;
+    ctx->data_bytes += fwrite(data->data, 1, data->data_bytes, ctx->f);
+}
+
+static void wav_close(avi_sink_t *sink)
+{
+    wav_ctx_t *ctx = sink->ctx;
+    wav_write_header(ctx);
+    fclose(ctx->f);
+    ESP_LOGI(TAG, "%u bytes of audio written", (unsigned)ctx->data_bytes);
+}
+
+avi_sink_t *avi_sink_create(const char *name, const char *dir)
+{
+    avi_sink_t *sink = calloc(1, sizeof(avi_sink_t));
+    if (!sink) {
+        return NULL;
+    }
+    sink->name = name;
+    sink->video = null_video;
+    sink->audio = null_audio;
+
+    if (strcmp(name, "null") == 0) {
+        return sink;
+    }
+    if (strcmp(name, "frames") == 0) {
+        frames_ctx_t *ctx = calloc(1, sizeof(frames_ctx_t));
+        if (ctx) {
+            snprintf(ctx->dir, sizeof(ctx->dir), "%s", dir);
+            sink->ctx = ctx;
+            sink->video = frames_video;
+            sink->close = frames_close;
+            return sink;
+        }
+    } else if (strcmp(name, "wav") == 0) {
+        wav_ctx_t *ctx = calloc(1, sizeof(wav_ctx_t));
+        char path[SINK_PATH_MAX];
+        snprintf(path, sizeof(path), "%s/audio.wav", dir);
+        if (ctx && (ctx->f = fopen(path, "w+b")) != NULL) {
+            wav_write_header(ctx);
+            sink->ctx = ctx;
+            sink->audio = wav_audio;
+            sink->set_clock = wav_set_clock;
+            sink->close = wav_close;
+            return sink;
+        }
+        ESP_LOGE(TAG, "Cannot create %s", path);
+        free(ctx);
+    } else {
+        ESP_LOGE(TAG, "Unknown sink %s", name);
+    }
+    free(sink);
+    return NULL;
+}
+
+void avi_sink_destroy(avi_sink_t *sink)
+{
+    if (!sink) {
+        return;
+    }
+    if (sink->close) {
+        sink->close(sink);
+    }
+    free(sink->ctx);
+    free(sink);
+}
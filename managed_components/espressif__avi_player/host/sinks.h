@@ -0,0 +1,48 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+/*
+ * Frame sinks of the host build. A sink gets the player callbacks, any number of them can be
+ * attached to one player.
+ */
+#pragma once
+
+#include "avi_player.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct avi_sink avi_sink_t;
+
+struct avi_sink {
+    const char *name;
+    void (*video)(avi_sink_t *sink, const frame_data_t *data);
+    void (*audio)(avi_sink_t *sink, const frame_data_t *data);
+    void (*set_clock)(avi_sink_t *sink, uint32_t rate, uint32_t bits, uint32_t ch);
+    void (*close)(avi_sink_t *sink);
+    void *ctx;
+};
+
+/**
+ * @brief Create a sink.
+ *
+ * @param name: "null" drops everything, "frames" writes every video frame to dir as
+ *              frame_NNNNNN.jpg (MJPEG) or appends it to video.h264, "wav" writes the audio to
+ *              dir/audio.wav
+ * @param dir: Output directory, must exist
+ *
+ * @return Sink, NULL for an unknown name or when the output cannot be created
+ */
+avi_sink_t *avi_sink_create(const char *name, const char *dir);
+
+/**
+ * @brief Finish the output of a sink and free it.
+ */
+void avi_sink_destroy(avi_sink_t *sink);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,83 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "avi_player.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Card behavior to simulate, any combination
+ *
+ * A trace is a text file with one read per line, "<bytes> <us>". avi_io_fault_apply() writes
+ * one with record_path, it is replayed in a loop with the latency scaled to the size of each read.
+ */
+typedef struct {
+    uint32_t rate_kbps;         /*!< Throughput cap in KB/s, 0 for none */
+    uint32_t stall_ms;          /*!< Length of the periodic stalls, like wear levelling pauses */
+    uint32_t stall_every_ms;    /*!< Time from one stall to the next, 0 for none */
+    const char *trace_path;     /*!< Optional, latency trace to replay */
+    const char *record_path;    /*!< Optional, the real reads are written here as a trace */
+    avi_player_clock_t *clock;  /*!< Optional, avi_player_config_t::clock of the player, NULL for esp_timer */
+} avi_io_fault_cfg_t;
+
+/**
+ * @brief What the simulated card did
+ */
+typedef struct {
+    uint32_t reads;
+    uint64_t bytes;
+    uint32_t stalls;            /*!< Periodic stalls that hit a read */
+    uint64_t injected_us;       /*!< Time added to the reads */
+} avi_io_fault_stats_t;
+
+typedef struct avi_io_fault avi_io_fault_t;
+
+/**
+ * @brief Create a simulated card
+ *
+ * @param[in] cfg What to simulate
+ * @param[out] fault Created instance
+ * @return
+ *      - ESP_OK: Success
+ *      - ESP_ERR_INVALID_ARG: NULL arguments, or stalls longer than their period
+ *      - ESP_ERR_NOT_FOUND: Cannot open the trace or the record file
+ *      - ESP_ERR_INVALID_SIZE: Trace without valid lines
+ *      - ESP_ERR_NO_MEM: Out of memory
+ */
+esp_err_t avi_io_fault_create(const avi_io_fault_cfg_t *cfg, avi_io_fault_t **fault);
+
+/**
+ * @brief Make a read take as long as on the simulated card, call it from avi_player_config_t::io_cb.
+ *
+ * Blocks until the read, started elapsed_us ago, would have finished. Stalls are placed on
+ * the time of cfg.clock since the creation, and the wait is a timer of that clock. On a virtual
+ * clock the simulated card so takes virtual time instead of wall time.
+ *
+ * @param[in] fault Simulated card
+ * @param[in] len Bytes read
+ * @param[in] elapsed_us Time the read really took
+ */
+void avi_io_fault_apply(avi_io_fault_t *fault, size_t len, int64_t elapsed_us);
+
+/**
+ * @brief Get what the simulated card did so far
+ */
+void avi_io_fault_get_stats(avi_io_fault_t *fault, avi_io_fault_stats_t *stats);
+
+/**
+ * @brief Delete a simulated card, once no player uses it. NULL is ignored
+ */
+void avi_io_fault_delete(avi_io_fault_t *fault);
+
+#ifdef __cplusplus
+}
+#endif
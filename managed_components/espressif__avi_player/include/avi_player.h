@@ -6,9 +6,11 @@
 #ifndef __VIDOPLAYER_H
 #define __VIDOPLAYER_H
 
+#include <stdbool.h>
 #include "esp_err.h"
 #include "freertos/FreeRTOS.h"
 #include "esp_idf_version.h"
+#include "sdmmc_cmd.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -31,6 +33,7 @@ typedef struct {
     uint32_t width;                  /*!< Width of image in pixels */
     uint32_t height;                 /*!< Height of image in pixels */
     video_frame_format frame_format; /*!< Pixel data format */
+    uint32_t frame_index;            /*!< Index of the frame in the file, restarts at 0 on every loop pass */
 } video_frame_info_t;
 
 /**
@@ -79,23 +82,211 @@ typedef struct {
     };
 } frame_data_t;
 
+/**
+ * @brief Streams that can be enabled or disabled during playback
+ *
+ */
+typedef enum {
+    AVI_PLAYER_STREAM_VIDEO = (1 << 0),  /*!< Video stream */
+    AVI_PLAYER_STREAM_AUDIO = (1 << 1),  /*!< Audio stream */
+    AVI_PLAYER_STREAM_ALL = (AVI_PLAYER_STREAM_VIDEO | AVI_PLAYER_STREAM_AUDIO),
+} avi_player_stream_t;
+
+/**
+ * @brief AVI file information, as found in the file header
+ *
+ */
+typedef struct {
+    video_frame_format video_format; /*!< Video codec */
+    uint16_t width;                  /*!< Video width in pixels */
+    uint16_t height;                 /*!< Video height in pixels */
+    uint16_t fps;                    /*!< Video frame rate, rounded */
+    uint32_t us_per_frame;           /*!< Video frame interval from the main header, 0 if not set */
+    uint32_t frame_period_us;        /*!< Video frame interval from the stream rate and scale, what playback uses */
+    uint32_t total_frames;           /*!< Number of video frames, of all RIFF segments of an OpenDML file */
+    uint32_t duration_ms;            /*!< Playback duration */
+    uint16_t audio_channels;         /*!< Audio channels, 0 if there is no audio stream */
+    uint16_t audio_bits;             /*!< Audio bits per sample */
+    uint32_t audio_sample_rate;      /*!< Audio sample rate */
+    uint32_t movi_start;             /*!< File offset of the first chunk in the movi list */
+    uint32_t movi_size;              /*!< Size of the movi list */
+    uint32_t idx1_offset;            /*!< File offset of the idx1 chunk data, 0 if the file has no index */
+    uint32_t idx1_size;              /*!< Size of the idx1 chunk data */
+} avi_player_file_info_t;
+
+/**
+ * @brief Options for avi_player_play_from_file_ex() and avi_player_play_from_memory_ex()
+ *
+ */
+typedef struct {
+    const avi_player_file_info_t *info; /*!< Header information from avi_player_probe_file(), NULL to parse the file header */
+    bool loop;                          /*!< Play the file over and over until stopped. The reader wraps at the end of the
+                                             movi list and the frame clock keeps running, so there is no gap between passes.
+                                             Only the first RIFF of an OpenDML file is looped */
+    uint32_t start_frame;               /*!< Video frame to start at, located through the idx1 index. Playback starts at the
+                                             last key frame up to it, files without an index start at frame 0 */
+} avi_player_play_cfg_t;
+
 typedef void (*video_write_cb)(frame_data_t *data, void *arg);
 typedef void (*audio_write_cb)(frame_data_t *data, void *arg);
 typedef void (*audio_set_clock_cb)(uint32_t rate, uint32_t bits_cfg, uint32_t ch, void *arg);
 typedef void (*avi_play_end_cb)(void *arg);
+/**
+ * @brief Called when a video frame is due, before its data is read.
+ *
+ * Return true when the application can present this frame itself (for example from a cache of
+ * decoded frames), the frame data is then skipped without being copied and video_cb is not called.
+ */
+typedef bool (*video_skip_cb)(const video_frame_info_t *info, void *arg);
 
 typedef void *avi_player_handle_t;
 
+/**
+ * @brief Commands for avi_player_send_command()
+ *
+ */
+typedef enum {
+    AVI_PLAYER_CMD_PLAY,        /*!< Play play.filename, a playing file is stopped first */
+    AVI_PLAYER_CMD_PAUSE,       /*!< Freeze the frame clock mid frame, the file reader stops once its buffer is full */
+    AVI_PLAYER_CMD_RESUME,      /*!< Continue the frozen clock, without buffering */
+    AVI_PLAYER_CMD_STOP,        /*!< Stop playing */
+    AVI_PLAYER_CMD_SEEK,        /*!< Continue at the last key frame up to seek_frame, needs idx1 */
+    AVI_PLAYER_CMD_STEP,        /*!< While paused, present the next step_frames video frames */
+    AVI_PLAYER_CMD_NEXT,        /*!< Stop and play the file queued with avi_player_set_next() */
+    AVI_PLAYER_CMD_SET_SPEED,   /*!< Frame rate in percent of the file's, audio is skipped away from 100 */
+} avi_player_cmd_type_t;
+
+/**
+ * @brief Command for the player task
+ *
+ */
+typedef struct {
+    avi_player_cmd_type_t type;         /*!< Command */
+    uint32_t id;                        /*!< Any value, returned in the completion event */
+    union {
+        struct {
+            const char *filename;       /*!< File to play, copied */
+            avi_player_play_cfg_t cfg;  /*!< Play options, cfg.info is copied */
+        } play;                         /*!< AVI_PLAYER_CMD_PLAY */
+        uint32_t seek_frame;            /*!< AVI_PLAYER_CMD_SEEK */
+        uint32_t step_frames;           /*!< AVI_PLAYER_CMD_STEP */
+        uint16_t speed_pct;             /*!< AVI_PLAYER_CMD_SET_SPEED, 25 to 400 */
+    };
+} avi_player_cmd_t;
+
+/**
+ * @brief Player events
+ *
+ */
+typedef enum {
+    AVI_PLAYER_EVENT_CMD_DONE,  /*!< A command completed, see cmd, id and err */
+    AVI_PLAYER_EVENT_PLAY_END,  /*!< Playback ended, at the end of the file or stopped */
+} avi_player_event_type_t;
+
+/**
+ * @brief Player event
+ *
+ */
+typedef struct {
+    avi_player_event_type_t type;
+    avi_player_cmd_type_t cmd;  /*!< Completed command, AVI_PLAYER_EVENT_CMD_DONE only */
+    uint32_t id;                /*!< Id of the completed command */
+    esp_err_t err;              /*!< Result of the command */
+} avi_player_event_t;
+
+/**
+ * @brief Called from the player task, keep it short and do not send commands that wait for their result
+ */
+typedef void (*avi_player_event_cb_t)(const avi_player_event_t *event, void *arg);
+
+/**
+ * @brief Time source of the player, see avi_player_config_t::clock
+ *
+ * The frame clock runs on one timer per player, its callback may run in any task. The player
+ * calls the other members from its own task.
+ */
+typedef struct avi_player_clock avi_player_clock_t;
+
+struct avi_player_clock {
+    int64_t (*get_time)(avi_player_clock_t *clock);                             /*!< Current time, us */
+    esp_err_t (*timer_create)(avi_player_clock_t *clock, void (*cb)(void *arg), void *arg, void **timer);
+    esp_err_t (*timer_start)(avi_player_clock_t *clock, void *timer, uint64_t us, bool periodic); /*!< Like esp_timer_start_once() or _periodic() */
+    esp_err_t (*timer_stop)(avi_player_clock_t *clock, void *timer);
+    void (*timer_delete)(avi_player_clock_t *clock, void *timer);               /*!< Stopped first when running */
+    void (*timer_handled)(avi_player_clock_t *clock, void *timer);              /*!< Optional, the player is done with a callback of timer, or with what started it */
+    void (*sleep)(avi_player_clock_t *clock, uint32_t ms);                      /*!< Wait for the reader task */
+};
+
+/**
+ * @brief Work done by the player since avi_player_init(), see avi_player_get_stats()
+ *
+ */
+typedef struct {
+    uint64_t read_bytes;        /*!< Bytes read from files */
+    uint64_t ring_bytes;        /*!< Bytes copied into the read ring */
+    uint32_t ring_copies;       /*!< Copies into the read ring */
+    uint64_t copy_bytes;        /*!< Chunk payload bytes copied out of the ring or the memory source */
+    uint32_t copies;            /*!< Chunk payload copies */
+    uint32_t video_frames;      /*!< Video chunks delivered to video_cb */
+    uint32_t audio_frames;      /*!< Audio chunks delivered to audio_cb */
+    uint32_t skipped_frames;    /*!< Chunks dropped by the stream mask or video_skip_cb, and empty chunks */
+    uint32_t underruns;         /*!< Times playback waited for the reader after the start: a rebuffering or an empty ring */
+    uint32_t missed_ticks;      /*!< Frame clock ticks lost while the player was held up, each delays the video by a frame */
+    uint32_t prefetch_starts;   /*!< Files started from the avi_player_set_next() prefetch */
+    uint32_t ring_fill;         /*!< Bytes waiting in the read ring when the stats were taken, 0 when playing from memory */
+    uint32_t ring_size;         /*!< Size of the read ring */
+} avi_player_stats_t;
+
+/**
+ * @brief Called by the reader task after every read of the playing file with its duration on the
+ * player's clock. Reads take no time on a virtual clock.
+ *
+ * May block, the reader then takes that much longer, which simulates a slower card. See
+ * avi_io_fault.h. Keep blocks well below a second, stopping waits for the read to finish.
+ * Block on a timer of the player's clock, a virtual clock then lets the time run while the
+ * player waits for the reader.
+ */
+typedef void (*avi_player_io_cb_t)(uint32_t pos, size_t len, int64_t elapsed_us, void *arg);
+
+/**
+ * @brief Player buffers, handed to the allocation hooks so the application can place them
+ */
+typedef enum {
+    AVI_PLAYER_BUF_FRAME,       /*!< buffer_size bytes, holds the chunk being delivered. Default: any heap */
+    AVI_PLAYER_BUF_FRAME_HOT,   /*!< hot_buffer_size bytes, chunks that fit are delivered from here. Default: internal RAM */
+    AVI_PLAYER_BUF_RING,        /*!< Read ring, filled by the reader task. Default: PSRAM */
+    AVI_PLAYER_BUF_READ,        /*!< Staging buffer of file reads. Default: PSRAM. Direct reads load whole sectors straight into it when it is DMA capable */
+    AVI_PLAYER_BUF_DIRECT,      /*!< Sector reads of avi_player_set_direct_read() that cannot go to the READ buffer. Default: internal DMA RAM */
+    AVI_PLAYER_BUF_PREFETCH,    /*!< Start of the next track. Default: PSRAM */
+} avi_player_buf_t;
+
+/**
+ * @brief Allocate a player buffer, may return NULL. Called from the player and reader tasks
+ */
+typedef void *(*avi_player_alloc_cb_t)(avi_player_buf_t buf, size_t size, void *arg);
+
+/**
+ * @brief Free a buffer of avi_player_alloc_cb_t
+ */
+typedef void (*avi_player_free_cb_t)(avi_player_buf_t buf, void *ptr, void *arg);
+
 /**
  * @brief avi player config
  *
  */
 typedef struct {
     size_t buffer_size;                      /*!< Internal buffer size */
-    video_write_cb video_cb;                 /*!< Video frame callback */
+    size_t hot_buffer_size;                  /*!< Optional, chunks up to this size are delivered from a second, internal RAM buffer */
+    avi_player_alloc_cb_t buf_alloc_cb;      /*!< Optional, places the player buffers. Set together with buf_free_cb */
+    avi_player_free_cb_t buf_free_cb;        /*!< Optional, frees buffers of buf_alloc_cb */
+    video_write_cb video_cb;                 /*!< Video frame callback, not called for empty chunks, the previous frame stays */
     audio_write_cb audio_cb;                 /*!< Audio frame callback */
     audio_set_clock_cb audio_set_clock_cb;   /*!< Audio set clock callback */
     avi_play_end_cb avi_play_end_cb;         /*!< AVI play end callback */
+    video_skip_cb video_skip_cb;             /*!< Optional, lets the application present a frame without its data */
+    avi_player_event_cb_t event_cb;          /*!< Optional, command completion and play end events */
+    avi_player_clock_t *clock;               /*!< Optional, time source, NULL for esp_timer. See avi_virtual_clock.h */
+    avi_player_io_cb_t io_cb;                /*!< Optional, sees every read of the reader task */
     UBaseType_t priority;                    /*!< FreeRTOS task priority */
     BaseType_t coreID;                       /*!< ESP32 core ID */
     void *user_data;                         /*!< User data */
@@ -117,6 +308,21 @@ typedef struct {
  */
 esp_err_t avi_player_play_from_memory(avi_player_handle_t handle, uint8_t *avi_data, size_t avi_size);
 
+/**
+ * @brief Plays an AVI file from memory with extra options.
+ *
+ * Video frames are not copied, the video callback gets a pointer into avi_data, which can
+ * therefore be flash mapped with esp_partition_mmap(). Audio frames are copied to the internal
+ * buffer so the callback may process them in place. avi_data must stay valid until playback ends.
+ *
+ * @param[in] handle AVI player handle
+ * @param[in] avi_data Pointer to the AVI file data in memory.
+ * @param[in] avi_size Size of the AVI file data in bytes.
+ * @param[in] cfg Play options, NULL behaves like avi_player_play_from_memory()
+ * @return esp_err_t ESP_OK if successful, otherwise an error code.
+ */
+esp_err_t avi_player_play_from_memory_ex(avi_player_handle_t handle, const uint8_t *avi_data, size_t avi_size, const avi_player_play_cfg_t *cfg);
+
 /**
  * @brief Plays an AVI file from the filesystem. The buffer of the AVI will be passed through the set callback function.
  *
@@ -128,6 +334,85 @@ esp_err_t avi_player_play_from_memory(avi_player_handle_t handle, uint8_t *avi_d
  */
 esp_err_t avi_player_play_from_file(avi_player_handle_t handle, const char *filename);
 
+/**
+ * @brief Plays an AVI file from the filesystem with extra options.
+ *
+ * When cfg->info is given the file header is not read again, playback seeks straight to the
+ * movi list. The information must come from the same, unmodified file.
+ *
+ * @param[in] handle AVI player handle
+ * @param[in] filename Path to the AVI file on the filesystem.
+ * @param[in] cfg Play options, NULL behaves like avi_player_play_from_file()
+ * @return esp_err_t ESP_OK if successful, otherwise an error code.
+ */
+esp_err_t avi_player_play_from_file_ex(avi_player_handle_t handle, const char *filename, const avi_player_play_cfg_t *cfg);
+
+/**
+ * @brief Read files on an SD card through their sector map instead of the file system.
+ *
+ * When a file under mount_point starts, its FAT cluster chain is resolved once into runs of
+ * consecutive sectors. The reader then loads them with multi-sector sdmmc_read_sectors() calls
+ * into a DMA capable buffer, see CONFIG_AVI_PLAYER_DIRECT_READ_BUF_KB. Fragmented files, exFAT
+ * volumes and read errors fall back to regular file reads.
+ *
+ * Call it again with card NULL before the card is unmounted, and only while no file plays.
+ * That also drops the file queued by avi_player_set_next(), whose handle is on the card.
+ *
+ * @param[in] handle AVI player handle
+ * @param[in] card Card the file system is mounted from, NULL to disable
+ * @param[in] mount_point VFS mount point of the card, e.g. "/sdcard"
+ * @return
+ *      - ESP_OK: Success
+ *      - ESP_ERR_INVALID_ARG: Invalid handle or mount point
+ *      - ESP_ERR_NO_MEM: Cannot allocate the DMA buffer
+ */
+esp_err_t avi_player_set_direct_read(avi_player_handle_t handle, sdmmc_card_t *card, const char *mount_point);
+
+/**
+ * @brief Queue the file expected to be played next.
+ *
+ * While the current file plays, the reader opens the queued file, parses its header and preloads
+ * its first CONFIG_AVI_PLAYER_PREFETCH_SIZE_KB into a standby buffer. A following
+ * avi_player_play_from_file_ex() with the same filename then starts from that buffer without
+ * reopening the file or waiting for the prebuffer. Playing another file discards the prefetch.
+ *
+ * @param[in] handle AVI player handle
+ * @param[in] filename Path of the next file, NULL to cancel
+ * @param[in] cfg Play options, cfg->info saves parsing the header. Can be NULL
+ * @return
+ *      - ESP_OK: Success
+ *      - ESP_ERR_INVALID_ARG: Invalid handle or filename too long
+ */
+esp_err_t avi_player_set_next(avi_player_handle_t handle, const char *filename, const avi_player_play_cfg_t *cfg);
+
+/**
+ * @brief Get the playback position.
+ *
+ * @param[in] handle AVI player handle
+ * @param[out] frame Index of the next video frame, counted from the start of the current pass
+ * @return
+ *      - ESP_OK: Success
+ *      - ESP_ERR_INVALID_ARG: NULL arguments
+ *      - ESP_ERR_INVALID_STATE: Nothing is playing
+ */
+esp_err_t avi_player_get_position(avi_player_handle_t handle, uint32_t *frame);
+
+/**
+ * @brief Read the header of an AVI file without playing it.
+ *
+ * Only the start of the file and the idx1 chunk header are read.
+ *
+ * @param[in] filename Path to the AVI file on the filesystem.
+ * @param[out] info File information
+ * @return
+ *      - ESP_OK: Success
+ *      - ESP_ERR_INVALID_ARG: NULL arguments
+ *      - ESP_ERR_NOT_FOUND: File cannot be opened
+ *      - ESP_ERR_NO_MEM: Out of memory
+ *      - ESP_ERR_INVALID_RESPONSE: Not a supported AVI file
+ */
+esp_err_t avi_player_probe_file(const char *filename, avi_player_file_info_t *info);
+
 /**
  * @brief Get one video frame from AVI stream
  *
@@ -162,6 +447,43 @@ esp_err_t avi_player_get_video_buffer(avi_player_handle_t handle, void **buffer,
  */
 esp_err_t avi_player_get_audio_buffer(avi_player_handle_t handle, void **buffer, size_t *buffer_size, audio_frame_info_t *info, TickType_t ticks_to_wait);
 
+/**
+ * @brief Get the work counters of the player.
+ *
+ * Counters are updated by the player and reader tasks without locking, a copy taken during
+ * playback may be off by the chunk in flight.
+ *
+ * @param[in] handle AVI player handle
+ * @param[out] stats Counters
+ * @return
+ *      - ESP_OK: Success
+ *      - ESP_ERR_INVALID_ARG: NULL arguments
+ */
+esp_err_t avi_player_get_stats(avi_player_handle_t handle, avi_player_stats_t *stats);
+
+/**
+ * @brief Select which streams are delivered to the callbacks
+ *
+ * Chunks of a disabled stream are skipped in the buffer without being copied and their callback
+ * is not called. A disabled video stream keeps its frame timing, so audio keeps playing at the
+ * normal pace. Takes effect from the next chunk and can be changed at any time.
+ *
+ * @param[in] handle AVI player handle
+ * @param[in] mask   Bitwise OR of avi_player_stream_t, AVI_PLAYER_STREAM_ALL by default
+ * @return
+ *      - ESP_OK: Success
+ *      - ESP_ERR_INVALID_ARG: Invalid handle or mask
+ */
+esp_err_t avi_player_set_stream_mask(avi_player_handle_t handle, uint32_t mask);
+
+/**
+ * @brief Get the streams currently delivered to the callbacks
+ *
+ * @param[in] handle AVI player handle
+ * @return Bitwise OR of avi_player_stream_t
+ */
+uint32_t avi_player_get_stream_mask(avi_player_handle_t handle);
+
 /**
  * @brief Stop AVI player
  *
@@ -172,6 +494,28 @@ esp_err_t avi_player_get_audio_buffer(avi_player_handle_t handle, void **buffer,
  */
 esp_err_t avi_player_play_stop(avi_player_handle_t handle);
 
+/**
+ * @brief Queue a command for the player task.
+ *
+ * Commands are carried out in order by the player task, between frames. Completion is reported
+ * through config.event_cb with AVI_PLAYER_EVENT_CMD_DONE, the result in event.err is:
+ *      - ESP_OK: Done
+ *      - ESP_ERR_INVALID_STATE: Nothing plays, or STEP while not paused
+ *      - ESP_ERR_NOT_SUPPORTED: SEEK in a file without idx1
+ *      - ESP_ERR_NOT_FOUND: NEXT without a queued file
+ *      - Others: PLAY failed, as for avi_player_play_from_file_ex()
+ *
+ * Unlike avi_player_play_stop() a command is safe to send in any state, from any task.
+ *
+ * @param[in] handle AVI player handle
+ * @param[in] cmd Command, copied
+ * @return
+ *      - ESP_OK: Queued
+ *      - ESP_ERR_INVALID_ARG: Invalid handle or command
+ *      - ESP_ERR_TIMEOUT: Queue full
+ */
+esp_err_t avi_player_send_command(avi_player_handle_t handle, const avi_player_cmd_t *cmd);
+
 /**
  * @brief Initialize the AVI player
  *
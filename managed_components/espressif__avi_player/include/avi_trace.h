@@ -0,0 +1,134 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Tracepoints, the player emits the reader, ring and frame ones, the application the rest
+ */
+typedef enum {
+    AVI_TRACE_READ_BEGIN,           /*!< Reader fread or direct read, arg: bytes asked */
+    AVI_TRACE_READ_END,             /*!< arg: bytes read */
+    AVI_TRACE_RING_FILL,            /*!< Ring fill level after the reader or the player moved it, arg: bytes */
+    AVI_TRACE_FRAME_BEGIN,          /*!< read_frame() */
+    AVI_TRACE_FRAME_END,            /*!< arg: payload size */
+    AVI_TRACE_TICK,                 /*!< Frame clock tick handled, arg: next video frame */
+    AVI_TRACE_MISSED_TICKS,         /*!< Ticks lost before this one, arg: how many */
+    AVI_TRACE_UNDERRUN,             /*!< Playback waits for the reader, arg: ring fill */
+    AVI_TRACE_VIDEO_CB_BEGIN,       /*!< arg: frame index */
+    AVI_TRACE_VIDEO_CB_END,
+    AVI_TRACE_AUDIO_CB_BEGIN,       /*!< arg: bytes */
+    AVI_TRACE_AUDIO_CB_END,
+    AVI_TRACE_JPEG_PARSE_BEGIN,
+    AVI_TRACE_JPEG_PARSE_END,
+    AVI_TRACE_JPEG_DECODE_BEGIN,
+    AVI_TRACE_JPEG_DECODE_END,      /*!< arg: decoded bytes */
+    AVI_TRACE_CANVAS_SWAP,          /*!< arg: frame index */
+    AVI_TRACE_FLUSH_BEGIN,          /*!< Display flush callback, arg: lines */
+    AVI_TRACE_FLUSH_END,
+    AVI_TRACE_FLUSH_WAIT_BEGIN,     /*!< Waiting for the flush transfer to complete */
+    AVI_TRACE_FLUSH_WAIT_END,
+    AVI_TRACE_I2S_WRITE_BEGIN,      /*!< arg: bytes */
+    AVI_TRACE_I2S_WRITE_END,        /*!< arg: bytes written */
+    AVI_TRACE_EVENT_MAX,
+} avi_trace_event_t;
+
+typedef enum {
+    AVI_TRACE_KIND_BEGIN,           /*!< Opens a span on its track */
+    AVI_TRACE_KIND_END,             /*!< Closes the innermost span of its track */
+    AVI_TRACE_KIND_COUNTER,
+    AVI_TRACE_KIND_INSTANT,
+} avi_trace_kind_t;
+
+/**
+ * @brief How a tracepoint is shown, the track is the task that emits it
+ */
+typedef struct {
+    const char *name;
+    const char *track;
+    avi_trace_kind_t kind;
+} avi_trace_event_desc_t;
+
+/**
+ * @brief One record, 12 bytes in the dump as well
+ */
+typedef struct {
+    uint32_t time_us;               /*!< Low 32 bits of esp_timer_get_time(), wraps after 71 minutes */
+    uint32_t event;                 /*!< avi_trace_event_t */
+    uint32_t arg;
+} avi_trace_record_t;
+
+/**
+ * @brief Dump header, followed by the records oldest first. Little endian like the targets and hosts
+ */
+typedef struct {
+    char magic[4];                  /*!< "AVTR" */
+    uint16_t version;               /*!< AVI_TRACE_VERSION */
+    uint16_t record_size;           /*!< sizeof(avi_trace_record_t) */
+    uint32_t records;
+    uint32_t lost;                  /*!< Older records overwritten before the dump */
+} avi_trace_file_header_t;
+
+#define AVI_TRACE_VERSION   1
+
+#if CONFIG_AVI_PLAYER_TRACE
+#define AVI_TRACE(event, arg)   avi_trace_emit(event, arg)
+#else
+#define AVI_TRACE(event, arg)   ((void)0)
+#endif
+
+/**
+ * @brief Allocate the trace ring and start recording. AVI_TRACE() does nothing before
+ *
+ * @param[in] events Records kept, rounded up to a power of two, the oldest are overwritten
+ * @return
+ *      - ESP_OK: Success
+ *      - ESP_ERR_INVALID_ARG: No events
+ *      - ESP_ERR_INVALID_STATE: Already initialized
+ *      - ESP_ERR_NO_MEM: Out of memory
+ */
+esp_err_t avi_trace_init(size_t events);
+
+/**
+ * @brief Stop recording and free the ring, after the emits in progress wrote their records
+ */
+void avi_trace_deinit(void);
+
+/**
+ * @brief Record an event, from any task or core. Use AVI_TRACE() so it compiles out
+ */
+void avi_trace_emit(avi_trace_event_t event, uint32_t arg);
+
+/**
+ * @brief Write the recorded events to a file and start over
+ *
+ * Recording pauses while the file is written, events emitted meanwhile are dropped.
+ * host/avi_trace2json turns the file into a Chrome or Perfetto trace.
+ *
+ * @return
+ *      - ESP_OK: Success
+ *      - ESP_ERR_INVALID_STATE: Not initialized
+ *      - ESP_ERR_NOT_FOUND: Cannot create the file
+ *      - ESP_FAIL: Write failed
+ */
+esp_err_t avi_trace_save(const char *path);
+
+/**
+ * @brief How to show an event, NULL for unknown ones
+ */
+const avi_trace_event_desc_t *avi_trace_event_desc(uint32_t event);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,59 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include "avi_player.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Create a virtual clock for avi_player_config_t::clock.
+ *
+ * Virtual time starts at 0 and never passes on its own. Once every timer callback has been
+ * handled it jumps straight to the next timer deadline, so playback runs as fast as the player
+ * delivers frames and every tick comes at exactly its scheduled time. Reading files takes no
+ * virtual time. Runs of the same file with the same commands are therefore repeatable, however
+ * fast the machine is.
+ *
+ * Time runs freely until avi_virtual_clock_run_until() limits it.
+ *
+ * @param[out] clock Created clock
+ * @return
+ *      - ESP_OK: Success
+ *      - ESP_ERR_INVALID_ARG: clock is NULL
+ *      - ESP_ERR_NO_MEM: Out of memory
+ */
+esp_err_t avi_virtual_clock_create(avi_player_clock_t **clock);
+
+/**
+ * @brief Let virtual time run up to time_us and wait until it got there.
+ *
+ * Returns once every tick up to time_us has been handled by the players. Time then holds at
+ * time_us, a command sent now takes effect at exactly that time. INT64_MAX lets the clock run
+ * freely again.
+ *
+ * @param[in] clock Clock of avi_virtual_clock_create()
+ * @param[in] time_us Virtual time to stop at
+ * @param[in] ticks_to_wait Maximum real time to wait
+ * @return
+ *      - ESP_OK: Time is at time_us, or running freely
+ *      - ESP_ERR_INVALID_ARG: clock is NULL
+ *      - ESP_ERR_TIMEOUT: The players did not get there in time
+ */
+esp_err_t avi_virtual_clock_run_until(avi_player_clock_t *clock, int64_t time_us, TickType_t ticks_to_wait);
+
+/**
+ * @brief Delete a virtual clock, after every player using it was deinitialized.
+ *
+ * @param[in] clock Clock of avi_virtual_clock_create(), NULL is ignored
+ */
+void avi_virtual_clock_delete(avi_player_clock_t *clock);
+
+#ifdef __cplusplus
+}
+#endif
@@ -24,6 +24,11 @@
 #define H264_ID     _REV(0x48323634)
 #define VIDS_ID     _REV(0x76696473)
 #define AUDS_ID     _REV(0x61756473)
+#define AVIX_ID     _REV(0x41564958)  /*!< OpenDML RIFF segment after the first */
+#define DMLH_ID     _REV(0x646d6c68)  /*!< OpenDML extended header */
+#define IDX1_ID     _REV(0x69647831)
+#define JUNK_ID     _REV(0x4a554e4b)
+#define IX_ID       _REV(0x69780000)  /*!< OpenDML standard index "ix##" */
 
 /**
 "db"：uncompressed video frame (RGB data stream);
@@ -47,7 +52,11 @@ typedef struct {
     uint32_t movi_start;
     uint32_t movi_size;
 
+    uint32_t us_per_frame;
+    uint32_t total_frames;
+
     uint16_t vids_fps;
+    uint32_t vids_period_us;   /*!< Frame interval from the stream scale / rate */
     uint16_t vids_width;
     uint16_t vids_height;
     video_frame_format vids_format;
@@ -0,0 +1,98 @@
+/*
+ * SPDX-FileCopyrightText: 2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef __FAT_EXTENT_H
+#define __FAT_EXTENT_H
+
+#include <stdint.h>
+
+/*
+ * Resolve the cluster chain of a FAT file into runs of consecutive sectors, so the file can
+ * be read with multi-sector transfers straight from the card. Only plain C and a sector read
+ * callback are used, the walker also runs on the host against a FAT image file.
+ */
+
+#define FAT_EXTENT_SECTOR_SIZE  (512)
+#define FAT_EXTENT_MAX          (32)    /*!< More extents and the file is treated as fragmented */
+
+/**
+ * @brief FAT volume layout, sector numbers are absolute on the device
+ */
+typedef struct {
+    uint8_t fat_bits;           /*!< 12, 16 or 32 */
+    uint32_t cluster_sectors;   /*!< Sectors per cluster */
+    uint32_t fat_lba;           /*!< First sector of the first FAT */
+    uint32_t data_lba;          /*!< First sector of cluster 2 */
+    uint32_t fat_entries;       /*!< Number of FAT entries, data clusters + 2 */
+} fat_extent_volume_t;
+
+/**
+ * @brief Run of consecutive sectors
+ */
+typedef struct {
+    uint32_t lba;
+    uint32_t sectors;
+} fat_extent_t;
+
+/**
+ * @brief Sector map of a file
+ */
+typedef struct {
+    fat_extent_t extents[FAT_EXTENT_MAX];
+    uint32_t count;
+    uint32_t file_size;
+} fat_extent_map_t;
+
+/**
+ * @brief Read count sectors starting at lba into buf, returns 0 on success
+ */
+typedef int (*fat_extent_read_cb)(void *ctx, uint32_t lba, uint32_t count, void *buf);
+
+/**
+ * @brief Parse the boot sector of a FAT volume.
+ *
+ * @param vol Volume layout
+ * @param boot_sector Sector 0 of the volume, FAT_EXTENT_SECTOR_SIZE bytes
+ * @param volume_lba Device sector of the boot sector
+ *
+ * @return
+ *     -  0: Success
+ *     - -1: Not a FAT volume with 512 byte sectors
+ */
+int fat_extent_parse_volume(fat_extent_volume_t *vol, const uint8_t *boot_sector, uint32_t volume_lba);
+
+/**
+ * @brief Walk the cluster chain of a file.
+ *
+ * @param vol Volume layout
+ * @param read Sector read callback
+ * @param ctx Callback context
+ * @param sector_buf Work buffer of FAT_EXTENT_SECTOR_SIZE bytes, passed to read
+ * @param start_cluster First cluster of the file, from its directory entry
+ * @param file_size File size in bytes
+ * @param map Resulting map
+ *
+ * @return
+ *     -  0: Success
+ *     - -1: Sector read failed
+ *     - -2: Broken chain, the file claims more clusters than the chain has
+ *     - -3: Fragmented beyond FAT_EXTENT_MAX extents
+ */
+int fat_extent_build(const fat_extent_volume_t *vol, fat_extent_read_cb read, void *ctx, uint8_t *sector_buf,
+                     uint32_t start_cluster, uint32_t file_size, fat_extent_map_t *map);
+
+/**
+ * @brief Translate a sector of the file into a device sector.
+ *
+ * @param map File map
+ * @param sector Sector index in the file
+ * @param lba Device sector
+ *
+ * @return Consecutive sectors available from there, 0 past the end of the file
+ */
+uint32_t fat_extent_lookup(const fat_extent_map_t *map, uint32_t sector, uint32_t *lba);
+
+#endif
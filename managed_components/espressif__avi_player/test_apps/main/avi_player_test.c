@@ -5,9 +5,12 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <inttypes.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "unity.h"
 #include "esp_heap_caps.h"
 #include "esp_log.h"
@@ -15,6 +18,9 @@
 #include "esp_idf_version.h"
 #include "esp_spiffs.h"
 #include "avi_player.h"
+#include "avi_io_fault.h"
+#include "avi_virtual_clock.h"
+#include "fat_extent.h"
 
 static const char *TAG = "avi_player_test";
 
@@ -23,6 +29,8 @@ static const char *TAG = "avi_player_test";
 
 static bool end_play = false;
 
+static void check_leak(size_t before_free, size_t after_free, const char *type);
+
 void video_write(frame_data_t *data, void *arg)
 {
     TEST_ASSERT_TRUE(data->type == FRAME_TYPE_VIDEO);
@@ -74,6 +82,263 @@ TEST_CASE("avi_player_test", "[avi_player]")
     vTaskDelay(500 / portTICK_PERIOD_MS);
 }
 
+#define TEST_SOAK_SWITCHES 10000
+#define TEST_SOAK_WARMUP   10
+
+static SemaphoreHandle_t soak_cmd_done;
+static esp_err_t soak_cmd_err;
+
+static void soak_frame(frame_data_t *data, void *arg)
+{
+}
+
+static void soak_event(const avi_player_event_t *event, void *arg)
+{
+    if (event->type == AVI_PLAYER_EVENT_CMD_DONE) {
+        soak_cmd_err = event->err;
+        xSemaphoreGive(soak_cmd_done);
+    }
+}
+
+TEST_CASE("avi_player_track_switch_soak", "[avi_player][soak]")
+{
+    soak_cmd_done = xSemaphoreCreateBinary();
+    TEST_ASSERT_NOT_NULL(soak_cmd_done);
+    avi_player_config_t config = {
+        .buffer_size = 60 * 1024,
+        .audio_cb = soak_frame,
+        .video_cb = soak_frame,
+        .event_cb = soak_event,
+        .stack_size = 4096,
+    };
+
+    avi_player_handle_t handle;
+    TEST_ASSERT_EQUAL(ESP_OK, avi_player_init(config, &handle));
+
+    /*!< Every switch stops the playing file and starts the next, the heap must not move */
+    avi_player_cmd_t cmd = {
+        .type = AVI_PLAYER_CMD_PLAY,
+        .play.filename = "/spiffs/p4_introduce.avi",
+    };
+    size_t warm_free = 0, warm_largest = 0;
+    for (int i = 0; i < TEST_SOAK_SWITCHES; i++) {
+        cmd.id = i;
+        TEST_ASSERT_EQUAL(ESP_OK, avi_player_send_command(handle, &cmd));
+        TEST_ASSERT_TRUE(xSemaphoreTake(soak_cmd_done, pdMS_TO_TICKS(2000)));
+        TEST_ASSERT_EQUAL(ESP_OK, soak_cmd_err);
+        if (i == TEST_SOAK_WARMUP) {
+            warm_free = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+            warm_largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+        }
+    }
+    size_t end_free = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    size_t end_largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    printf("After %d track switches: %u bytes free (%u after warm up), largest block %u (%u)\n",
+           TEST_SOAK_SWITCHES, end_free, warm_free, end_largest, warm_largest);
+    check_leak(warm_free, end_free, "8BIT");
+    TEST_ASSERT_MESSAGE(end_largest >= warm_largest, "heap fragmented");
+
+    cmd.type = AVI_PLAYER_CMD_STOP;
+    TEST_ASSERT_EQUAL(ESP_OK, avi_player_send_command(handle, &cmd));
+    TEST_ASSERT_TRUE(xSemaphoreTake(soak_cmd_done, pdMS_TO_TICKS(2000)));
+    TEST_ASSERT_EQUAL(ESP_OK, avi_player_deinit(handle));
+    vSemaphoreDelete(soak_cmd_done);
+}
+
+#define TEST_VCLOCK_US          (60 * 1000 * 1000)
+#define TEST_VCLOCK_TIMEOUT_MS  (120 * 1000)
+
+static struct {
+    avi_player_clock_t *clock;
+    uint32_t period;
+    uint32_t frames;
+    uint32_t mistimed;
+} vclock_test;
+
+static void vclock_video(frame_data_t *data, void *arg)
+{
+    /*!< Frame n is due n periods after the first, loop passes keep the pace */
+    if (vclock_test.clock->get_time(vclock_test.clock) != (int64_t)vclock_test.frames * vclock_test.period) {
+        vclock_test.mistimed++;
+    }
+    vclock_test.frames++;
+}
+
+TEST_CASE("avi_player_virtual_clock", "[avi_player]")
+{
+    end_play = false;
+    avi_player_file_info_t info;
+    TEST_ASSERT_EQUAL(ESP_OK, avi_player_probe_file("/spiffs/p4_introduce.avi", &info));
+    memset(&vclock_test, 0, sizeof(vclock_test));
+    vclock_test.period = info.frame_period_us; // The rate / scale period the player ticks on, fps is rounded
+    TEST_ASSERT_EQUAL(ESP_OK, avi_virtual_clock_create(&vclock_test.clock));
+
+    avi_player_config_t config = {
+        .buffer_size = 60 * 1024,
+        .audio_cb = soak_frame,
+        .video_cb = vclock_video,
+        .avi_play_end_cb = avi_play_end,
+        .clock = vclock_test.clock,
+        .stack_size = 4096,
+    };
+    avi_player_handle_t handle;
+    TEST_ASSERT_EQUAL(ESP_OK, avi_player_init(config, &handle));
+    avi_player_play_cfg_t cfg = {
+        .info = &info,
+        .loop = true,
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, avi_player_play_from_file_ex(handle, "/spiffs/p4_introduce.avi", &cfg));
+
+    /*!< A minute of looped playback, as fast as the file can be read */
+    int64_t start = esp_timer_get_time();
+    TEST_ASSERT_EQUAL(ESP_OK, avi_virtual_clock_run_until(vclock_test.clock, TEST_VCLOCK_US, pdMS_TO_TICKS(TEST_VCLOCK_TIMEOUT_MS)));
+    printf("%"PRIu32" frames of %"PRIu32" us in %"PRIu32" ms\n", vclock_test.frames, vclock_test.period,
+           (uint32_t)((esp_timer_get_time() - start) / 1000));
+    TEST_ASSERT_EQUAL(TEST_VCLOCK_US / vclock_test.period + 1, vclock_test.frames);
+    TEST_ASSERT_EQUAL(0, vclock_test.mistimed);
+
+    TEST_ASSERT_EQUAL(ESP_OK, avi_player_play_stop(handle));
+    TEST_ASSERT_EQUAL(ESP_OK, avi_virtual_clock_run_until(vclock_test.clock, INT64_MAX, 0));
+    while (!end_play) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    TEST_ASSERT_EQUAL(ESP_OK, avi_player_deinit(handle));
+    avi_virtual_clock_delete(vclock_test.clock);
+}
+
+#define TEST_SLOW_CARD_KBPS     32
+#define TEST_SLOW_CARD_MS       (10 * 1000)
+
+static void slow_card_read(uint32_t pos, size_t len, int64_t elapsed_us, void *arg)
+{
+    avi_io_fault_apply((avi_io_fault_t *)arg, len, elapsed_us);
+}
+
+TEST_CASE("avi_player_slow_card", "[avi_player]")
+{
+    end_play = false;
+    avi_io_fault_t *fault;
+    avi_io_fault_cfg_t fault_cfg = {
+        .rate_kbps = TEST_SLOW_CARD_KBPS,
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, avi_io_fault_create(&fault_cfg, &fault));
+
+    avi_player_config_t config = {
+        .buffer_size = 60 * 1024,
+        .audio_cb = soak_frame,
+        .video_cb = soak_frame,
+        .avi_play_end_cb = avi_play_end,
+        .io_cb = slow_card_read,
+        .user_data = fault,
+        .stack_size = 4096,
+    };
+    avi_player_handle_t handle;
+    TEST_ASSERT_EQUAL(ESP_OK, avi_player_init(config, &handle));
+    avi_player_play_cfg_t cfg = {
+        .loop = true,
+    };
+    TEST_ASSERT_EQUAL(ESP_OK, avi_player_play_from_file_ex(handle, "/spiffs/p4_introduce.avi", &cfg));
+
+    /*!< The card is slower than the stream, playback has to wait for it and lose ticks */
+    vTaskDelay(pdMS_TO_TICKS(TEST_SLOW_CARD_MS));
+    TEST_ASSERT_EQUAL(ESP_OK, avi_player_play_stop(handle));
+    while (!end_play) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    avi_player_stats_t stats;
+    avi_io_fault_stats_t fault_stats;
+    TEST_ASSERT_EQUAL(ESP_OK, avi_player_get_stats(handle, &stats));
+    avi_io_fault_get_stats(fault, &fault_stats);
+    printf("%"PRIu32" underruns, %"PRIu32" ticks missed, %"PRIu32" frames, %"PRIu32" ms added\n", stats.underruns,
+           stats.missed_ticks, stats.video_frames, (uint32_t)(fault_stats.injected_us / 1000));
+    TEST_ASSERT_GREATER_THAN(0, stats.underruns);
+    TEST_ASSERT_GREATER_THAN(0, stats.missed_ticks);
+    TEST_ASSERT_TRUE(stats.read_bytes == fault_stats.bytes); // Every reader read went through the card
+
+    TEST_ASSERT_EQUAL(ESP_OK, avi_player_deinit(handle));
+    avi_io_fault_delete(fault);
+}
+
+#define TEST_FAT_SECTORS 40
+
+static uint16_t *test_fat;
+
+/* Only the FAT of the test volume exists, the walker never reads data sectors */
+static int test_fat_read(void *ctx, uint32_t lba, uint32_t count, void *buf)
+{
+    const fat_extent_volume_t *vol = ctx;
+    if (lba < vol->fat_lba || lba + count > vol->fat_lba + TEST_FAT_SECTORS) {
+        return -1;
+    }
+    memcpy(buf, (uint8_t *)test_fat + (lba - vol->fat_lba) * FAT_EXTENT_SECTOR_SIZE, count * FAT_EXTENT_SECTOR_SIZE);
+    return 0;
+}
+
+static void test_fat_chain(uint32_t first, uint32_t last)
+{
+    for (uint32_t c = first; c < last; c++) {
+        test_fat[c] = c + 1;
+    }
+    test_fat[last] = 0xFFFF;
+}
+
+TEST_CASE("fat_extent_test", "[avi_player]")
+{
+    /*!< FAT16, 4 sectors per cluster, one reserved sector, two FATs and 512 root entries */
+    uint8_t boot[FAT_EXTENT_SECTOR_SIZE] = { 0xEB, 0x3C, 0x90 };
+    boot[11] = 0x00; boot[12] = 0x02;
+    boot[13] = 4;
+    boot[14] = 1;
+    boot[16] = 2;
+    boot[17] = 0x00; boot[18] = 0x02;
+    boot[22] = TEST_FAT_SECTORS;
+    boot[32] = 0x40; boot[33] = 0x9C;  // 40000 sectors
+    boot[510] = 0x55; boot[511] = 0xAA;
+
+    fat_extent_volume_t vol;
+    TEST_ASSERT_EQUAL(0, fat_extent_parse_volume(&vol, boot, 0));
+    TEST_ASSERT_EQUAL(16, vol.fat_bits);
+    TEST_ASSERT_EQUAL(1, vol.fat_lba);
+    TEST_ASSERT_EQUAL(1 + 2 * TEST_FAT_SECTORS + 32, vol.data_lba);
+
+    test_fat = calloc(TEST_FAT_SECTORS, FAT_EXTENT_SECTOR_SIZE);
+    TEST_ASSERT_NOT_NULL(test_fat);
+    uint8_t sector[FAT_EXTENT_SECTOR_SIZE];
+    fat_extent_map_t map;
+    uint32_t lba;
+
+    /*!< Contiguous file, the last cluster is partly used */
+    test_fat_chain(10, 19);
+    TEST_ASSERT_EQUAL(0, fat_extent_build(&vol, test_fat_read, &vol, sector, 10, 10 * 2048 - 100, &map));
+    TEST_ASSERT_EQUAL(1, map.count);
+    TEST_ASSERT_EQUAL(vol.data_lba + 8 * 4, map.extents[0].lba);
+    TEST_ASSERT_EQUAL(40, fat_extent_lookup(&map, 0, &lba));
+    TEST_ASSERT_EQUAL(1, fat_extent_lookup(&map, 39, &lba));
+    TEST_ASSERT_EQUAL(0, fat_extent_lookup(&map, 40, &lba));
+
+    /*!< Two fragments */
+    test_fat_chain(30, 31);
+    test_fat[31] = 50;
+    test_fat_chain(50, 52);
+    TEST_ASSERT_EQUAL(0, fat_extent_build(&vol, test_fat_read, &vol, sector, 30, 5 * 2048, &map));
+    TEST_ASSERT_EQUAL(2, map.count);
+    TEST_ASSERT_EQUAL(12, fat_extent_lookup(&map, 8, &lba));
+    TEST_ASSERT_EQUAL(vol.data_lba + 48 * 4, lba);
+
+    /*!< Chain shorter than the file size */
+    test_fat_chain(60, 61);
+    TEST_ASSERT_EQUAL(-2, fat_extent_build(&vol, test_fat_read, &vol, sector, 60, 3 * 2048, &map));
+
+    /*!< Every cluster in its own extent */
+    for (uint32_t c = 100; c < 100 + 2 * FAT_EXTENT_MAX; c += 2) {
+        test_fat[c] = c + 2;
+    }
+    test_fat[100 + 2 * FAT_EXTENT_MAX] = 0xFFFF;
+    TEST_ASSERT_EQUAL(-3, fat_extent_build(&vol, test_fat_read, &vol, sector, 100, (FAT_EXTENT_MAX + 1) * 2048, &map));
+
+    free(test_fat);
+}
+
 static size_t before_free_8bit;
 static size_t before_free_32bit;
 
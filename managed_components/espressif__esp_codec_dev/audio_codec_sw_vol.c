@@ -6,21 +6,137 @@
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "audio_codec_sw_vol.h"
+#include "esp_codec_dev_os.h"
 
-#define GAIN_0DB_SHIFT (15)
+#define GAIN_0DB_SHIFT  (15)
+#define GAIN_MAX        (0xFFFF)
+#define RAMP_FRAC_SHIFT (12)
 
 typedef struct {
     audio_codec_vol_if_t        base;
     esp_codec_dev_sample_info_t fs;
-    uint16_t                    gain;
+    volatile int32_t            gain;      /*!< Target gain in Q15, written by set_vol */
     bool                        is_open;
-    int                         cur;
-    int                         step;
+    int32_t                     cur;       /*!< Current gain in Q15 << RAMP_FRAC_SHIFT, owned by process */
+    int32_t                     step;      /*!< Per frame ramp increment, same format as cur */
+    int32_t                     ramp_to;   /*!< Target the running ramp heads for */
     int                         block_size;
     int                         duration;
+    portMUX_TYPE                mix_lock;  /*!< Guards the mix fields below, set by mix, advanced by process */
+    const int16_t              *mix_data;  /*!< Pending mix input (UI sounds) */
+    int                         mix_left;  /*!< Samples of mix input left */
+    int32_t                     mix_gain;  /*!< Mix input gain in Q15 */
+    bool                        mix_busy;  /*!< Process is reading mix_data outside the lock */
 } audio_vol_t;
 
+static inline int16_t _sat16(int32_t v)
+{
+    if (v > INT16_MAX) {
+        return INT16_MAX;
+    }
+    if (v < INT16_MIN) {
+        return INT16_MIN;
+    }
+    return (int16_t) v;
+}
+
+static int32_t _db_to_gain(float db_value)
+{
+    if (db_value <= -96.0) {
+        return 0;
+    }
+    int32_t gain = (int32_t) (exp(db_value / 20 * log(10)) * (1 << GAIN_0DB_SHIFT));
+    return gain > GAIN_MAX ? GAIN_MAX : gain;
+}
+
+/*
+ * Constant gain kernel, 4 samples per iteration so that loads, multiplies and stores
+ * of independent samples can be pipelined. Gain is limited to GAIN_MAX so the
+ * 16x16 product always fits in 32 bits.
+ */
+static void _scale_const(const int16_t *in, int16_t *out, int n, int32_t gain)
+{
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        int32_t a = (in[i] * gain) >> GAIN_0DB_SHIFT;
+        int32_t b = (in[i + 1] * gain) >> GAIN_0DB_SHIFT;
+        int32_t c = (in[i + 2] * gain) >> GAIN_0DB_SHIFT;
+        int32_t d = (in[i + 3] * gain) >> GAIN_0DB_SHIFT;
+        out[i] = _sat16(a);
+        out[i + 1] = _sat16(b);
+        out[i + 2] = _sat16(c);
+        out[i + 3] = _sat16(d);
+    }
+    for (; i < n; i++) {
+        out[i] = _sat16((in[i] * gain) >> GAIN_0DB_SHIFT);
+    }
+}
+
+/*
+ * Linear ramp kernel, gain is updated once per frame so all channels of one frame share it.
+ * Returns frames processed, stops early when the ramp reaches its target.
+ */
+static int _scale_ramp(audio_vol_t *vol, const int16_t *in, int16_t *out, int frames)
+{
+    int ch = vol->fs.channel;
+    int done = 0;
+    while (done < frames && vol->step) {
+        int32_t g = vol->cur >> RAMP_FRAC_SHIFT;
+        for (int j = 0; j < ch; j++) {
+            *out++ = _sat16((*in++ * g) >> GAIN_0DB_SHIFT);
+        }
+        done++;
+        vol->cur += vol->step;
+        if ((vol->step > 0 && vol->cur >= vol->ramp_to) || (vol->step < 0 && vol->cur <= vol->ramp_to)) {
+            vol->cur = vol->ramp_to;
+            vol->step = 0;
+        }
+    }
+    return done;
+}
+
+static void _start_ramp(audio_vol_t *vol, int32_t target)
+{
+    int32_t to = target << RAMP_FRAC_SHIFT;
+    int frames = (int) ((int64_t) vol->duration * vol->fs.sample_rate / 1000);
+    vol->ramp_to = to;
+    if (frames <= 1 || to == vol->cur) {
+        vol->cur = to;
+        vol->step = 0;
+        return;
+    }
+    vol->step = (to - vol->cur) / frames;
+    if (vol->step == 0) {
+        vol->step = (to > vol->cur) ? 1 : -1;
+    }
+}
+
+static void _mix(audio_vol_t *vol, int16_t *out, int n)
+{
+    // Samples are mixed outside the lock, mix_busy keeps a mix call from replacing the input meanwhile
+    taskENTER_CRITICAL(&vol->mix_lock);
+    int left = vol->mix_left;
+    const int16_t *src = vol->mix_data;
+    int32_t g = vol->mix_gain;
+    vol->mix_busy = left > 0 && src != NULL;
+    taskEXIT_CRITICAL(&vol->mix_lock);
+    if (left <= 0 || src == NULL) {
+        return;
+    }
+    int cnt = left < n ? left : n;
+    for (int i = 0; i < cnt; i++) {
+        out[i] = _sat16(out[i] + ((src[i] * g) >> GAIN_0DB_SHIFT));
+    }
+    taskENTER_CRITICAL(&vol->mix_lock);
+    vol->mix_data = src + cnt;
+    vol->mix_left = left - cnt;
+    vol->mix_busy = false;
+    taskEXIT_CRITICAL(&vol->mix_lock);
+}
+
 static int _sw_vol_close(const audio_codec_vol_if_t *h)
 {
     audio_vol_t *vol = (audio_vol_t *)h;
@@ -57,43 +173,39 @@ static int _sw_vol_process(const audio_codec_vol_if_t *h, uint8_t *in, int len,
     if (vol->is_open == false) {
         return ESP_CODEC_DEV_WRONG_STATE;
     }
-    int sample = len / vol->block_size;
-    if (vol->fs.bits_per_sample == 16) {
-        int16_t *v_in = (int16_t *) in;
-        int16_t *v_out = (int16_t *) out;
-        if (vol->cur == vol->gain) {
-            if (vol->gain == 0) {
-                memset(out, 0, len);
-                return 0;
-            } else {
-                for (int i = 0; i < sample; i++) {
-                    for (int j = 0; j < vol->fs.channel; j++) {
-                        *(v_out++) = ((*v_in++) * vol->cur) >> GAIN_0DB_SHIFT;
-                    }
-                }
-                return 0;
-            }
-        }
-        for (int i = 0; i < sample; i++) {
-            for (int j = 0; j < vol->fs.channel; j++) {
-                *(v_out++) = ((*v_in++) * vol->cur) >> GAIN_0DB_SHIFT;
-            }
-            if (vol->step) {
-                vol->cur += vol->step;
-                if (vol->step > 0) {
-                    if (vol->cur > vol->gain) {
-                        vol->cur = vol->gain;
-                        vol->step = 0;
-                    }
-                } else {
-                    if (vol->cur < vol->gain) {
-                        vol->cur = vol->gain;
-                        vol->step = 0;
-                    }
-                }
+    if (vol->fs.bits_per_sample != 16) {
+        return 0;
+    }
+    int frames = len / vol->block_size;
+    int samples = frames * vol->fs.channel;
+    int16_t *v_in = (int16_t *) in;
+    int16_t *v_out = (int16_t *) out;
+
+    // Pick up the latest target set by set_vol, only this function touches the ramp state
+    int32_t target = vol->gain;
+    if ((target << RAMP_FRAC_SHIFT) != vol->ramp_to) {
+        _start_ramp(vol, target);
+    }
+    if (vol->step) {
+        int done = _scale_ramp(vol, v_in, v_out, frames);
+        int skip = done * vol->fs.channel;
+        v_in += skip;
+        v_out += skip;
+        samples -= skip;
+    }
+    int32_t g = vol->cur >> RAMP_FRAC_SHIFT;
+    if (samples > 0) {
+        if (g == 0) {
+            memset(v_out, 0, samples * sizeof(int16_t));
+        } else if (g == (1 << GAIN_0DB_SHIFT)) {
+            if (v_out != v_in) {
+                memcpy(v_out, v_in, samples * sizeof(int16_t));
             }
+        } else {
+            _scale_const(v_in, v_out, samples, g);
         }
     }
+    _mix(vol, (int16_t *) out, frames * vol->fs.channel);
     return 0;
 }
 
@@ -104,26 +216,50 @@ static int _sw_vol_set(const audio_codec_vol_if_t *h, float db_value)
         return ESP_CODEC_DEV_INVALID_ARG;
     }
     // Support set volume when not opened
-    int gain;
-    if (db_value <= -96.0) {
-        gain = 0;
-    } else {
-        gain = (int) (exp(db_value / 20 * log(10)) * (1 << GAIN_0DB_SHIFT));
-    }
+    int32_t gain = _db_to_gain(db_value);
     vol->gain = gain;
-    if (vol->is_open) {
-        float step = (float) (vol->gain - vol->cur) * 1000 / vol->duration / vol->fs.sample_rate;
-        vol->step = (int) step;
-        if (step == 0) {
-            vol->cur = vol->gain;
-        }
-    } else {
+    if (vol->is_open == false) {
         vol->step = 0;
-        vol->cur = vol->gain;
+        vol->cur = vol->ramp_to = gain << RAMP_FRAC_SHIFT;
     }
     return ESP_CODEC_DEV_OK;
 }
 
+int audio_codec_sw_vol_mix(const audio_codec_vol_if_t *h, const int16_t *data, int samples, float db_value)
+{
+    audio_vol_t *vol = (audio_vol_t *) h;
+    if (vol == NULL || (data == NULL && samples > 0)) {
+        return ESP_CODEC_DEV_INVALID_ARG;
+    }
+    int32_t gain = _db_to_gain(db_value);
+    // Wait out a mix in progress, once this returns the old input is not read any more
+    while (true) {
+        taskENTER_CRITICAL(&vol->mix_lock);
+        if (!vol->mix_busy) {
+            break;
+        }
+        taskEXIT_CRITICAL(&vol->mix_lock);
+        esp_codec_dev_sleep(1);
+    }
+    vol->mix_data = data;
+    vol->mix_left = samples;
+    vol->mix_gain = gain;
+    taskEXIT_CRITICAL(&vol->mix_lock);
+    return ESP_CODEC_DEV_OK;
+}
+
+int audio_codec_sw_vol_mix_remain(const audio_codec_vol_if_t *h)
+{
+    audio_vol_t *vol = (audio_vol_t *) h;
+    if (vol == NULL) {
+        return 0;
+    }
+    taskENTER_CRITICAL(&vol->mix_lock);
+    int left = vol->mix_left;
+    taskEXIT_CRITICAL(&vol->mix_lock);
+    return left;
+}
+
 const audio_codec_vol_if_t *audio_codec_new_sw_vol(void)
 {
     audio_vol_t *vol = calloc(1, sizeof(audio_vol_t));
@@ -134,7 +270,8 @@ const audio_codec_vol_if_t *audio_codec_new_sw_vol(void)
     vol->base.set_vol = _sw_vol_set;
     vol->base.process = _sw_vol_process;
     vol->base.close = _sw_vol_close;
+    portMUX_INITIALIZE(&vol->mix_lock);
     // Default no audio output
-    vol->cur = vol->gain = 0;
+    vol->cur = vol->gain = vol->ramp_to = 0;
     return &vol->base;
 }
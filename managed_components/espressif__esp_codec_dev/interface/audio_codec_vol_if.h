@@ -34,6 +34,39 @@ struct audio_codec_vol_if_t {
  */
 int audio_codec_delete_vol_if(const audio_codec_vol_if_t *vol_if);
 
+/**
+ * @brief         New software volume processor interface
+ *                Notes: currently only support 16bits input
+ *                       Volume changes are ramped linearly over the fade time given to `open`
+ *                       and output is saturated, so gain changes and mute do not click
+ * @return        NULL: Memory not enough
+ *                -Others: Software volume interface handle
+ */
+const audio_codec_vol_if_t *audio_codec_new_sw_vol(void);
+
+/**
+ * @brief         Queue PCM data to be mixed into the output of a software volume processor
+ *                Notes: data must have the same format as the processed stream (16 bits, same channels)
+ *                       and stay valid until `audio_codec_sw_vol_mix_remain` returns 0
+ *                       Mixing happens after volume so the mix input is not affected by volume ramps
+ *                       A new call replaces any mix input still pending, it waits for a mix in progress
+ *                       so the replaced data can be freed once it returns
+ * @param         h: Software volume interface created by `audio_codec_new_sw_vol`
+ * @param         data: Interleaved 16 bits PCM data
+ * @param         samples: Sample count (frames * channels)
+ * @param         db_value: Gain applied to the mix input in decibel unit
+ * @return        ESP_CODEC_DEV_OK: Mix input queued
+ *                ESP_CODEC_DEV_INVALID_ARG: Invalid input
+ */
+int audio_codec_sw_vol_mix(const audio_codec_vol_if_t *h, const int16_t *data, int samples, float db_value);
+
+/**
+ * @brief         Get samples of mix input not yet mixed
+ * @param         h: Software volume interface created by `audio_codec_new_sw_vol`
+ * @return        Samples left
+ */
+int audio_codec_sw_vol_mix_remain(const audio_codec_vol_if_t *h);
+
 #ifdef __cplusplus
 }
 #endif
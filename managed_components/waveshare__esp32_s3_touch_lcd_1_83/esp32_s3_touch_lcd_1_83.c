@@ -233,6 +233,18 @@ err:
     return ret;
 }
 
+esp_err_t bsp_audio_register_tx_callbacks(const i2s_event_callbacks_t *callbacks, void *user_data)
+{
+    esp_err_t ret = ESP_OK;
+    ESP_RETURN_ON_FALSE(i2s_tx_chan, ESP_ERR_INVALID_STATE, TAG, "Audio not initialized");
+
+    // Callbacks can only be registered while the channel is disabled
+    ESP_RETURN_ON_ERROR(i2s_channel_disable(i2s_tx_chan), TAG, "I2S disabling failed");
+    ret = i2s_channel_register_event_callback(i2s_tx_chan, callbacks, user_data);
+    ESP_RETURN_ON_ERROR(i2s_channel_enable(i2s_tx_chan), TAG, "I2S enabling failed");
+    return ret;
+}
+
 esp_codec_dev_handle_t bsp_audio_codec_speaker_init(void)
 {
     if (i2s_data_if == NULL)
@@ -140,6 +140,21 @@ i2c_master_bus_handle_t bsp_i2c_get_handle(void);
  */
 esp_err_t bsp_audio_init(const i2s_std_config_t *i2s_config);
 
+/**
+ * @brief Register I2S TX event callbacks
+ *
+ * The TX channel is briefly disabled to register the callbacks, so call it before playback starts.
+ * Callbacks run in ISR context.
+ *
+ * @param[in] callbacks  I2S event callbacks, only the TX related ones are used
+ * @param[in] user_data  User data passed to the callbacks
+ * @return
+ *      - ESP_OK                On success
+ *      - ESP_ERR_INVALID_STATE Audio not initialized yet
+ *      - Others                Registration failed
+ */
+esp_err_t bsp_audio_register_tx_callbacks(const i2s_event_callbacks_t *callbacks, void *user_data);
+
 /**
  * @brief Initialize speaker codec device
  *
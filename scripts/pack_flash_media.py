@@ -0,0 +1,55 @@
+import os
+import struct
+import sys
+
+# Packs AVI clips into an image for the flash "storage" partition (see partitions.csv).
+# The player maps the partition and plays the clips without an SD card, e.g. as fallback clips.
+#
+# Flash the image with:
+#   parttool.py --port PORT write_partition --partition-name storage --input flash_media.bin
+
+script_dir = os.path.dirname(os.path.abspath(__file__))
+input_dir = os.path.join(script_dir, 'flash_media')
+output_path = os.path.join(script_dir, 'flash_media.bin')
+
+MAGIC = b'CLIP'
+VERSION = 1
+NAME_MAX = 40                 # Including the terminator, FLASH_MEDIA_NAME_MAX
+ALIGN = 4096                  # Clips start on a flash sector
+PARTITION_SIZE = 7 * 1024 * 1024
+
+files = sorted(f for f in os.listdir(input_dir) if f.lower().endswith('.avi')) if os.path.isdir(input_dir) else []
+
+if not files:
+    print(f"No AVI files found in {input_dir}")
+    sys.exit(0)
+
+for f in files:
+    if len(f.encode()) >= NAME_MAX:
+        print(f"Name too long: {f}")
+        sys.exit(1)
+
+toc_size = 8 + len(files) * (NAME_MAX + 8)
+offset = (toc_size + ALIGN - 1) // ALIGN * ALIGN
+entries = []
+for f in files:
+    size = os.path.getsize(os.path.join(input_dir, f))
+    entries.append((f, offset, size))
+    offset = (offset + size + ALIGN - 1) // ALIGN * ALIGN
+
+if offset > PARTITION_SIZE:
+    print(f"Clips need {offset // 1024} KB, the partition has {PARTITION_SIZE // 1024} KB")
+    sys.exit(1)
+
+with open(output_path, 'wb') as out:
+    out.write(MAGIC + struct.pack('<HH', VERSION, len(entries)))
+    for name, off, size in entries:
+        out.write(struct.pack(f'<{NAME_MAX}sII', name.encode(), off, size))
+    for name, off, size in entries:
+        # Erased flash reads 0xFF, pad with it so unused bytes need no programming
+        out.write(b'\xff' * (off - out.tell()))
+        with open(os.path.join(input_dir, name), 'rb') as f:
+            out.write(f.read())
+        print(f"{name}: {size // 1024} KB at 0x{off:x}")
+
+print(f"Wrote {output_path}, {offset // 1024} KB of {PARTITION_SIZE // 1024} KB")